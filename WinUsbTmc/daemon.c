@@ -0,0 +1,746 @@
+/*
+ * Daemon mode of the command line tool.
+ * A usb interface can only be claimed by one process, so parallel test processes can not share an
+ * instrument directly. The daemon owns all devices, keeps them opened and serves its clients over
+ * a unix domain socket.
+ *
+ * Protocol, a client sends one line per request in the script syntax of "winusbtmc /S":
+ *   @<device>             select the device of this connection (number or string, "quoted" if it contains spaces)
+ *   @<device> <command>   send a command to another device
+ *   <command>             send a command to the selected device, commands containing '?' are queries
+ * every line is answered with
+ *   <result> <length>\n<length bytes of response data>
+ * result is 0 or an error code of winusbtmc.h, the data is the raw response of a query.
+ *
+ * Every device has its own queue and worker thread, so slow transfers of one device do not delay
+ * other devices. A client can only have one request in progress, so the FIFO queue of a device
+ * serves its clients round robin. Requests naming a device go through a lookup thread first, which
+ * passes them on to the queue of the device, so the main loop never waits for the library. The
+ * workers do not send the responses, they pass them to the main loop, which sends them without
+ * blocking. A client which does not read its responses only stalls itself.
+ */
+#ifndef _WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "winusbtmc.h"
+#include "daemon.h"
+
+#define DAEMON_MAX_CLIENTS  (64)
+#define DAEMON_LINE_MAX     (4096)
+#define DAEMON_READ_CHUNK   (1024 * 1024)      /* max. size of one read, calibrated devices use large transfers */
+#define DAEMON_SOCKET_CHUNK (64 * 1024)        /* receive buffer of the clients, larger responses are passed without copy */
+
+typedef struct daemon_client_s
+{
+    int      fd;                          /* -1 if unused */
+    char     buf[DAEMON_LINE_MAX];        /* received data not processed yet */
+    size_t   buflen;
+    int32_t  devnum;                      /* handle of the selected device */
+    bool     busy;                        /* a request is queued or in progress */
+    bool     closing;                     /* connection closed by the client */
+
+    /* response which is not sent completely */
+    bool     sending;
+    char     hdr[32];                     /* "<result> <length>\n" */
+    size_t   hdrlen;
+    char    *reply;                       /* response data, allocated */
+    size_t   replylen;
+    size_t   sent;                        /* sent bytes of hdr and reply */
+
+    /* request while busy */
+    char     command[DAEMON_LINE_MAX];
+    int32_t  reqdev;                      /* handle of the device */
+    struct daemon_client_s *next;         /* next request in the device queue */
+} daemon_client_t;
+
+typedef struct
+{
+    pthread_t        thread;
+    bool             started;
+    bool             warm;                /* last transfer succeeded, handle is opened */
+    int32_t          handle;              /* handle of the last transfer */
+    unsigned long    generation;          /* s_lib_generation after the last transfer */
+    daemon_client_t *head;                /* request queue */
+    daemon_client_t *tail;
+    pthread_cond_t   cond;
+} daemon_device_t;
+
+static daemon_client_t  s_clients[DAEMON_MAX_CLIENTS];
+static daemon_device_t **s_devices   = (void *)0; /* indexed by device number, grows when needed, s_queue_lock */
+static int32_t          s_device_count = 0;
+static daemon_device_t  s_lookup;         /* queue of the requests naming a device */
+static pthread_mutex_t  s_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+/* winusbtmc is not thread safe, transfers to warm devices may run in parallel (read lock),
+   everything which can update the device table (finding devices, stale handles) is exclusive.
+   The lock prefers writers, so parallel transfers do not starve a lookup. */
+static pthread_rwlock_t s_lib_lock;
+static unsigned long    s_lib_generation = 0; /* count of exclusive sections, the table may have changed */
+static int              s_wakeup[2];      /* workers write the index of a finished client */
+
+
+void daemon_default_path(char *path, size_t pathln)
+{
+    if (getenv("XDG_RUNTIME_DIR"))
+        snprintf(path, pathln, "%s/winusbtmc.sock", getenv("XDG_RUNTIME_DIR"));
+    else
+        snprintf(path, pathln, "/tmp/winusbtmc-%d.sock", (int)getuid());
+}
+
+static bool s_send_all(int fd, const char *dat, size_t len)
+{
+    ssize_t ret;
+
+    while (len > 0)
+    {
+        ret = send(fd, dat, len, 0);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        dat += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+/*
+ * send as much of the pending response as the socket takes without blocking.
+ * returns true if nothing is left, the connection is closed after an error
+ */
+static bool s_flush(daemon_client_t *pclient)
+{
+    const char *dat;
+    size_t      len;
+    ssize_t     ret;
+
+    while (pclient->sending)
+    {
+        if (pclient->sent < pclient->hdrlen)
+        {
+            dat = &pclient->hdr[pclient->sent];
+            len = pclient->hdrlen - pclient->sent;
+        }
+        else
+        {
+            dat = &pclient->reply[pclient->sent - pclient->hdrlen];
+            len = pclient->hdrlen + pclient->replylen - pclient->sent;
+        }
+        ret = (len > 0) ? send(pclient->fd, dat, len, 0) : 0;
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) )
+                return false;
+            pclient->closing = true; /* the client is gone, the rest is dropped */
+            ret = pclient->hdrlen + pclient->replylen - pclient->sent;
+        }
+        pclient->sent += ret;
+        if (pclient->sent == pclient->hdrlen + pclient->replylen)
+        {
+            free(pclient->reply);
+            pclient->reply   = (void *)0;
+            pclient->sending = false;
+        }
+    }
+    return true;
+}
+
+/*
+ * set the response of a client, reply is allocated and freed when it was sent
+ */
+static void s_set_reply(daemon_client_t *pclient, int32_t result, char *reply, size_t len)
+{
+    snprintf(pclient->hdr, sizeof(pclient->hdr), "%d %lu\n", (int)result, (unsigned long)len);
+    pclient->hdrlen   = strlen(pclient->hdr);
+    pclient->reply    = reply;
+    pclient->replylen = len;
+    pclient->sent     = 0;
+    pclient->sending  = true;
+}
+
+/* response without data from the main loop */
+static void s_reply(daemon_client_t *pclient, int32_t result)
+{
+    s_set_reply(pclient, result, (void *)0, 0);
+    s_flush(pclient);
+}
+
+/*
+ * split "@<device> <command>" into device and command, returns false if the line is malformed
+ */
+static bool s_parse_device(char **pcmd, char *devname)
+{
+    char *cmd = *pcmd + 1;
+    char *end;
+
+    if (*cmd == '"')
+    {
+        cmd++;
+        end = strchr(cmd, '"');
+        if (!end)
+            return false;
+    }
+    else
+    {
+        end = cmd + strcspn(cmd, " \t");
+    }
+    memcpy(devname, cmd, end - cmd);
+    devname[end - cmd] = '\0';
+    for (cmd = (*end == '"') ? end + 1 : end; (*cmd == ' ') || (*cmd == '\t'); cmd++)
+        ;
+    *pcmd = cmd;
+    return true;
+}
+
+static int32_t s_find_device(const char *device)
+{
+    const char *p;
+
+    for (p = device; (*p >= '0') && (*p <= '9'); p++)
+        ;
+    if ( (*device) && (*p == '\0') )
+    { /* device specified by device number */
+        return atoi(device);
+    }
+    return winusbtmc_find_devnum_by_string(device);
+}
+
+/* take the library lock for everything which may update the device table */
+static void s_lock_exclusive(void)
+{
+    pthread_rwlock_wrlock(&s_lib_lock);
+    s_lib_generation++;
+}
+
+/*
+ * take the library lock for one transfer. It is shared only if the last transfer of the device
+ * used the same handle successfully and no exclusive section ran since, otherwise the library
+ * may look for devices again (stale handle, device not opened yet).
+ */
+static void s_lock_transfer(daemon_device_t *pdev, int32_t handle)
+{
+    pthread_rwlock_rdlock(&s_lib_lock);
+    if ( (pdev->warm) && (pdev->handle == handle) && (pdev->generation == s_lib_generation) )
+        return;
+    pthread_rwlock_unlock(&s_lib_lock);
+    s_lock_exclusive();
+}
+
+/* release the lock of s_lock_transfer, an error makes the device cold again (it may be unplugged) */
+static void s_unlock_transfer(daemon_device_t *pdev, int32_t handle, int32_t ret)
+{
+    pdev->warm       = (ret >= 0);
+    pdev->handle     = handle;
+    pdev->generation = s_lib_generation;
+    pthread_rwlock_unlock(&s_lib_lock);
+}
+
+/* next request of a queue, waits until there is one */
+static daemon_client_t *s_dequeue(daemon_device_t *pdev)
+{
+    daemon_client_t *pclient;
+
+    pthread_mutex_lock(&s_queue_lock);
+    while (!pdev->head)
+        pthread_cond_wait(&pdev->cond, &s_queue_lock);
+    pclient    = pdev->head;
+    pdev->head = pclient->next;
+    if (!pdev->head)
+        pdev->tail = (void *)0;
+    pthread_mutex_unlock(&s_queue_lock);
+    return pclient;
+}
+
+/* pass a finished request to the main loop, which sends the response */
+static void s_done(daemon_client_t *pclient)
+{
+    int index = pclient - s_clients;
+
+    if (write(s_wakeup[1], &index, sizeof(index)) < 0)
+        perror("daemon");
+}
+
+/*
+ * device worker, executes the requests of one device in the order they were queued.
+ * The lock is taken per transfer, a long response does not block lookups in between.
+ */
+static void *s_worker(void *arg)
+{
+    daemon_device_t *pdev = arg;
+    daemon_client_t *pclient;
+    char            *dat, *reply, *tmp;
+    size_t           len, size;
+    int32_t          ret;
+    bool             eom;
+
+    size = DAEMON_READ_CHUNK;
+    dat  = malloc(size);
+
+    while (1)
+    {
+        pclient = s_dequeue(pdev);
+
+        s_lock_transfer(pdev, pclient->reqdev);
+        ret = winusbtmc_send_string(pclient->reqdev, pclient->command);
+        s_unlock_transfer(pdev, pclient->reqdev, ret);
+
+        len = 0;
+        if ( (ret >= 0) && (strchr(pclient->command, '?')) )
+        {
+            do
+            {
+                if ( (dat) && (size - len < DAEMON_READ_CHUNK) )
+                {
+                    tmp = realloc(dat, 2 * size);
+                    if (!tmp)
+                    {
+                        ret = WINUSBTMC_ERR_MALLOC_FAILED;
+                        break;
+                    }
+                    dat   = tmp;
+                    size *= 2;
+                }
+                if (!dat)
+                {
+                    ret = WINUSBTMC_ERR_MALLOC_FAILED;
+                    break;
+                }
+                s_lock_transfer(pdev, pclient->reqdev);
+                ret = winusbtmc_recv_data(pclient->reqdev, &dat[len], DAEMON_READ_CHUNK, &eom);
+                s_unlock_transfer(pdev, pclient->reqdev, ret);
+                if (ret < 0)
+                    break;
+                len += ret;
+            } while (!eom);
+        }
+
+        /* the main loop sends the response, large ones take the buffer along */
+        if (ret < 0)
+        {
+            s_set_reply(pclient, ret, (void *)0, 0);
+        }
+        else if (len > DAEMON_SOCKET_CHUNK)
+        {
+            s_set_reply(pclient, 0, dat, len);
+            dat = (void *)0;
+        }
+        else
+        {
+            reply = (len > 0) ? malloc(len) : (void *)0;
+            if (reply)
+                memcpy(reply, dat, len);
+            if ( (len > 0) && (!reply) )
+                s_set_reply(pclient, WINUSBTMC_ERR_MALLOC_FAILED, (void *)0, 0);
+            else
+                s_set_reply(pclient, 0, reply, len);
+        }
+        s_done(pclient);
+
+        if ( (!dat) || (size > 4 * DAEMON_READ_CHUNK) )
+        { /* do not keep huge buffers of single screenshots */
+            free(dat);
+            size = DAEMON_READ_CHUNK;
+            dat  = malloc(size);
+        }
+    }
+    return (void *)0;
+}
+
+/*
+ * returns the queue of a device number, it is created the first time. 0 if out of memory.
+ * The same device number shares its queue even after it was taken by another device.
+ * Called with s_queue_lock, the main loop and the lookup thread queue requests.
+ */
+static daemon_device_t *s_get_device(int32_t devnum)
+{
+    daemon_device_t **pdevices;
+    int32_t           count;
+
+    if (devnum >= s_device_count)
+    {
+        count    = (devnum < 2 * s_device_count) ? 2 * s_device_count : devnum + 16;
+        pdevices = realloc(s_devices, count * sizeof(daemon_device_t *));
+        if (!pdevices)
+            return (void *)0;
+        memset(&pdevices[s_device_count], 0, (count - s_device_count) * sizeof(daemon_device_t *));
+        s_devices      = pdevices;
+        s_device_count = count;
+    }
+    if (!s_devices[devnum])
+        s_devices[devnum] = calloc(1, sizeof(daemon_device_t));
+    return s_devices[devnum];
+}
+
+/*
+ * append a request to a queue, the worker of the queue is started the first time.
+ * pdev is 0 for the queue of the device number devnum.
+ */
+static int32_t s_enqueue(daemon_device_t *pdev, int32_t devnum, daemon_client_t *pclient, void *(*worker)(void *))
+{
+    pclient->next = (void *)0;
+
+    pthread_mutex_lock(&s_queue_lock);
+    if (!pdev)
+        pdev = s_get_device(WINUSBTMC_DEVNUM(devnum));
+    if (!pdev)
+    {
+        pthread_mutex_unlock(&s_queue_lock);
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+    if (!pdev->started)
+    {
+        pthread_cond_init(&pdev->cond, (void *)0);
+        if (pthread_create(&pdev->thread, (void *)0, worker, pdev) != 0)
+        {
+            pthread_mutex_unlock(&s_queue_lock);
+            return WINUSBTMC_ERR_MALLOC_FAILED;
+        }
+        pdev->started = true;
+    }
+    if (pdev->tail)
+        pdev->tail->next = pclient;
+    else
+        pdev->head = pclient;
+    pdev->tail = pclient;
+    pthread_cond_signal(&pdev->cond);
+    pthread_mutex_unlock(&s_queue_lock);
+    return WINUSBTMC_ERR_NONE;
+}
+
+/*
+ * lookup thread, finds the device of "@<device> [command]" requests and passes the command to the
+ * queue of the device. Finding a device may update the device table, so it is exclusive.
+ */
+static void *s_lookup_worker(void *arg)
+{
+    daemon_client_t *pclient;
+    char             devname[DAEMON_LINE_MAX];
+    char            *cmd;
+    int32_t          devnum, ret;
+
+    while (1)
+    {
+        pclient = s_dequeue(&s_lookup);
+
+        cmd = pclient->command;
+        if (!s_parse_device(&cmd, devname))
+        {
+            s_set_reply(pclient, WINUSBTMC_ERR_INVALID_PARAMETER, (void *)0, 0);
+            s_done(pclient);
+            continue;
+        }
+        s_lock_exclusive();
+        devnum = s_find_device(devname);
+        pthread_rwlock_unlock(&s_lib_lock);
+
+        if (*cmd == '\0')
+        { /* only selects the device */
+            pclient->devnum = devnum;
+            ret = (devnum < 0) ? devnum : 0;
+        }
+        else if ( (*cmd == '#') || (devnum < 0) )
+        {
+            ret = (devnum < 0) ? devnum : 0;
+        }
+        else
+        {
+            memmove(pclient->command, cmd, strlen(cmd) + 1);
+            pclient->reqdev = devnum;
+            ret = s_enqueue((void *)0, devnum, pclient, s_worker);
+            if (ret >= 0)
+                continue; /* the device worker answers */
+        }
+        s_set_reply(pclient, ret, (void *)0, 0);
+        s_done(pclient);
+    }
+    return (void *)0;
+}
+
+/*
+ * handle one request line, returns true if the request was queued to a device or the lookup thread
+ */
+static bool s_request(daemon_client_t *pclient, char *line)
+{
+    char   *cmd;
+    int32_t ret;
+
+    for (cmd = line; (*cmd == ' ') || (*cmd == '\t'); cmd++)
+        ;
+
+    if (*cmd == '@')
+    { /* the lookup thread finds the device */
+        strcpy(pclient->command, cmd);
+        pclient->busy = true;
+        ret = s_enqueue(&s_lookup, 0, pclient, s_lookup_worker);
+    }
+    else if ( (*cmd == '\0') || (*cmd == '#') )
+    {
+        ret = 0;
+    }
+    else if (pclient->devnum < 0)
+    {
+        ret = pclient->devnum;
+    }
+    else
+    {
+        strcpy(pclient->command, cmd);
+        pclient->reqdev = pclient->devnum;
+        pclient->busy   = true;
+        ret = s_enqueue((void *)0, pclient->devnum, pclient, s_worker);
+    }
+
+    if ( (ret >= 0) && (pclient->busy) )
+        return true;
+    pclient->busy = false;
+    s_reply(pclient, ret);
+    return false;
+}
+
+static void s_close_client(daemon_client_t *pclient)
+{
+    close(pclient->fd);
+    pclient->fd = -1;
+    free(pclient->reply);
+    pclient->reply   = (void *)0;
+    pclient->sending = false;
+}
+
+/*
+ * process the complete lines received from a client until a request is queued
+ */
+static void s_process(daemon_client_t *pclient)
+{
+    char   line[DAEMON_LINE_MAX];
+    char  *end;
+    size_t len;
+
+    while ( (!pclient->busy) && (!pclient->sending) && ((end = memchr(pclient->buf, '\n', pclient->buflen)) != (void *)0) )
+    {
+        len = end - pclient->buf;
+        memcpy(line, pclient->buf, len);
+        line[len] = '\0';
+        if ( (len > 0) && (line[len - 1] == '\r') )
+            line[len - 1] = '\0';
+        pclient->buflen -= len + 1;
+        memmove(pclient->buf, end + 1, pclient->buflen);
+
+        s_request(pclient, line);
+    }
+
+    if ( (!pclient->busy) && (!pclient->sending) && (pclient->buflen == sizeof(pclient->buf)) )
+    { /* line too long */
+        s_reply(pclient, WINUSBTMC_ERR_INVALID_PARAMETER);
+        pclient->closing = true;
+    }
+    if ( (!pclient->busy) && (!pclient->sending) && (pclient->closing) )
+    {
+        s_close_client(pclient);
+    }
+}
+
+int daemon_run(const char *path)
+{
+    struct sockaddr_un addr;
+    struct pollfd      fds[DAEMON_MAX_CLIENTS + 2];
+    daemon_client_t   *map[DAEMON_MAX_CLIENTS + 2];
+    pthread_rwlockattr_t attr;
+    int                listener, fd, i, nfds, index;
+    ssize_t            ret;
+
+    signal(SIGPIPE, SIG_IGN); /* clients may disconnect before they get their response */
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "socket path too long\n");
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+    unlink(path); /* socket of a previous daemon */
+    if ( (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(listener, 16) < 0) )
+    {
+        perror(path);
+        close(listener);
+        return 1;
+    }
+    if (pipe(s_wakeup) < 0)
+    {
+        perror("pipe");
+        close(listener);
+        return 1;
+    }
+    pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&s_lib_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    for (i = 0; i < DAEMON_MAX_CLIENTS; i++)
+        s_clients[i].fd = -1;
+
+    /* enumerate once, so the first client does not pay for it */
+    winusbtmc_get_device_count();
+    fprintf(stderr, "winusbtmc daemon listening on %s\n", path);
+
+    while (1)
+    {
+        nfds = 0;
+        fds[nfds].fd = listener;    fds[nfds].events = POLLIN; map[nfds++] = (void *)0;
+        fds[nfds].fd = s_wakeup[0]; fds[nfds].events = POLLIN; map[nfds++] = (void *)0;
+        for (i = 0; i < DAEMON_MAX_CLIENTS; i++)
+        {
+            if ( (s_clients[i].fd >= 0) && (!s_clients[i].busy) )
+            { /* a pending response is sent before the next request is read */
+                fds[nfds].fd = s_clients[i].fd;
+                fds[nfds].events = (s_clients[i].sending) ? POLLOUT : POLLIN;
+                map[nfds++] = &s_clients[i];
+            }
+        }
+
+        if (poll(fds, nfds, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            fd = accept(listener, (void *)0, (void *)0);
+            for (i = 0; (fd >= 0) && (i < DAEMON_MAX_CLIENTS) && (s_clients[i].fd >= 0); i++)
+                ;
+            if ( (fd >= 0) && (i < DAEMON_MAX_CLIENTS) )
+            {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                memset(&s_clients[i], 0, sizeof(daemon_client_t));
+                s_clients[i].fd     = fd;
+                s_clients[i].devnum = WINUSBTMC_ERR_DEVICE_NOT_PRESENT;
+            }
+            else if (fd >= 0)
+            { /* too many clients */
+                close(fd);
+            }
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            if (read(s_wakeup[0], &index, sizeof(index)) == sizeof(index))
+            {
+                pthread_mutex_lock(&s_queue_lock);
+                s_clients[index].busy = false;
+                pthread_mutex_unlock(&s_queue_lock);
+                if (s_flush(&s_clients[index]))
+                    s_process(&s_clients[index]); /* further requests already received */
+            }
+        }
+
+        for (i = 2; i < nfds; i++)
+        {
+            if ( (!fds[i].revents) || (map[i]->fd < 0) || (map[i]->busy) )
+                continue;
+            if (map[i]->sending)
+            {
+                if (s_flush(map[i]))
+                    s_process(map[i]);
+                continue;
+            }
+            ret = recv(map[i]->fd, &map[i]->buf[map[i]->buflen], sizeof(map[i]->buf) - map[i]->buflen, 0);
+            if ( (ret < 0) && ( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) ) )
+                continue;
+            if (ret <= 0)
+            {
+                map[i]->closing = true;
+            }
+            else
+            {
+                map[i]->buflen += ret;
+            }
+            s_process(map[i]);
+        }
+    }
+
+    close(listener);
+    unlink(path);
+    return 1;
+}
+
+int daemon_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    int                sock;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0)
+        return -1;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int32_t daemon_request(int sock, const char *line, FILE *out)
+{
+    char          hdr[32];
+    char          dat[DAEMON_SOCKET_CHUNK];
+    size_t        i;
+    int           result;
+    unsigned long len;
+    ssize_t       ret;
+
+    if ( (!s_send_all(sock, line, strlen(line))) || (!s_send_all(sock, "\n", 1)) )
+        return WINUSBTMC_ERR_BULKOUT_FAILED;
+
+    /* "<result> <length>\n" */
+    for (i = 0; i < sizeof(hdr) - 1; i++)
+    {
+        if ( (recv(sock, &hdr[i], 1, 0) != 1) || (hdr[i] == '\n') )
+            break;
+    }
+    hdr[i] = '\0';
+    if (sscanf(hdr, "%d %lu", &result, &len) != 2)
+        return WINUSBTMC_ERR_BULKIN_FAILED;
+
+    while (len > 0)
+    {
+        ret = recv(sock, dat, (len < sizeof(dat)) ? len : sizeof(dat), 0);
+        if (ret <= 0)
+            return WINUSBTMC_ERR_BULKIN_FAILED;
+        if (out)
+            fwrite(dat, ret, 1, out);
+        len -= ret;
+    }
+    return result;
+}
+
+#endif // _WIN32
@@ -0,0 +1,28 @@
+#ifndef DAEMON_H_INCLUDED
+#define DAEMON_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * daemon mode of the command line tool, not available for windows builds.
+ * The daemon owns the devices and keeps them open, any count of clients send their commands
+ * through a unix domain socket. See daemon.c for the protocol.
+ */
+
+/* default socket: $XDG_RUNTIME_DIR/winusbtmc.sock or /tmp/winusbtmc-<uid>.sock */
+void    daemon_default_path(char *path, size_t pathln);
+
+/* run the daemon until it is terminated, returns the exit code */
+int     daemon_run(const char *path);
+
+/* connect to a running daemon, returns the socket or -1 */
+int     daemon_connect(const char *path);
+
+/* execute one script line (see run_script in main.c, without "> file") at the daemon.
+ * The response is written to out (may be 0 to discard it).
+ * returns the result of the command (< 0 is an error code of winusbtmc.h) */
+int32_t daemon_request(int sock, const char *line, FILE *out);
+
+#endif // DAEMON_H_INCLUDED
@@ -3,7 +3,125 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <unistd.h>
+#endif
 #include "winusbtmc.h"
+#include "daemon.h"
+
+#define READ_BUFFER  (1024 * 1024)  /* size of the reads of responses */
+
+static bool   s_timing   = false; /* /T: print startup and total time to stderr */
+static bool   s_profile  = false; /* /F: print the per mnemonic latencies of the used devices to stderr */
+static double s_resolved = -1;    /* time when the device was found, -1 if not reached */
+
+/* the enumeration cache file, can be changed or disabled (empty) with the environment variable WINUSBTMC_CACHE */
+static void enable_cache(void)
+{
+    char        filename[512];
+    const char *dir;
+
+    if (getenv("WINUSBTMC_CACHE"))
+    {
+        if (*getenv("WINUSBTMC_CACHE"))
+            winusbtmc_set_cache_file(getenv("WINUSBTMC_CACHE"));
+        return;
+    }
+#ifdef _WIN32
+    dir = getenv("TEMP");
+#else
+    dir = getenv("XDG_RUNTIME_DIR"); /* per user, cleared on logout */
+#endif
+    if (!dir)
+        return;
+    snprintf(filename, sizeof(filename), "%s/winusbtmc.cache", dir);
+    winusbtmc_set_cache_file(filename);
+}
+
+/* quirks of usb devices from the environment variable WINUSBTMC_QUIRKS,
+   "<vid>:<pid>=<flags>[,<max_transfer>];..." with hexadecimal vid, pid and flags, pid * for all products */
+static void enable_quirks(void)
+{
+    const char   *p;
+    char         *end;
+    unsigned long vid, pid, flags, max_transfer;
+
+    for (p = getenv("WINUSBTMC_QUIRKS"); (p) && (*p); p = (*end == ';') ? end + 1 : end)
+    {
+        vid = strtoul(p, &end, 16);
+        if (*end != ':')
+            break;
+        if (end[1] == '*')
+        {
+            pid = WINUSBTMC_QUIRK_ANY_PID;
+            end += 2;
+        }
+        else
+        {
+            pid = strtoul(end + 1, &end, 16);
+        }
+        if (*end != '=')
+            break;
+        flags = strtoul(end + 1, &end, 16);
+        max_transfer = (*end == ',') ? strtoul(end + 1, &end, 10) : 0;
+        if ( (*end != ';') && (*end != '\0') )
+            break;
+        winusbtmc_set_quirks(vid, pid, flags, max_transfer);
+    }
+    if ( (p) && (*p) )
+        fprintf(stderr, "WINUSBTMC_QUIRKS: cannot parse \"%s\"\n", p);
+}
+
+/* response cache of all devices, enabled by the environment variable WINUSBTMC_RESPONSE_CACHE. Its value is "1"
+   or a list of additional rules "<pattern>;!<pattern>;...", patterns with ! drop the cache */
+static void enable_response_cache(void)
+{
+    char  rules[512];
+    char *p, *end;
+
+    if ( (!getenv("WINUSBTMC_RESPONSE_CACHE")) || (!*getenv("WINUSBTMC_RESPONSE_CACHE")) )
+        return;
+    snprintf(rules, sizeof(rules), "%s", getenv("WINUSBTMC_RESPONSE_CACHE"));
+    for (p = rules; *p; p = end)
+    {
+        end = p + strcspn(p, ";");
+        if (*end)
+            *end++ = '\0';
+        if ( (*p) && (strcmp(p, "1") != 0) )
+            winusbtmc_response_cache_rule((*p == '!') ? p + 1 : p, (*p == '!') ? WINUSBTMC_RCACHE_INVALIDATE : WINUSBTMC_RCACHE_QUERY);
+    }
+    winusbtmc_response_cache(-1, true);
+}
+
+/* per mnemonic latencies of the devices which were used, the slowest first */
+static void print_profile(void)
+{
+    winusbtmc_profile_entry_t entries[64];
+    char                      name[256];
+    int32_t                   devnum, count, i;
+
+    for (devnum = 0; devnum < winusbtmc_get_device_count(); devnum++)
+    {
+        count = winusbtmc_profile_report(devnum, entries, sizeof(entries) / sizeof(entries[0]));
+        if (count <= 0)
+            continue;
+        winusbtmc_get_device_string(devnum, name, sizeof(name));
+        fprintf(stderr, "profile of %d: %s\n", devnum, name);
+        fprintf(stderr, "%10s %8s %12s %10s %10s %10s %12s %12s  %s\n",
+                "count", "errors", "total ms", "p50 ms", "p99 ms", "max ms", "sent", "received", "mnemonic");
+        for (i = 0; (i < count) && (i < (int32_t)(sizeof(entries) / sizeof(entries[0]))); i++)
+        {
+            fprintf(stderr, "%10u %8u %12.3f %10.3f %10.3f %10.3f %12llu %12llu  %s\n",
+                    entries[i].count, entries[i].errors, entries[i].total_ms, entries[i].p50_ms, entries[i].p99_ms,
+                    entries[i].max_ms, (unsigned long long)entries[i].bytes_sent,
+                    (unsigned long long)entries[i].bytes_received, entries[i].mnemonic);
+        }
+        if (count > i)
+            fprintf(stderr, "%d more mnemonics\n", count - i);
+    }
+}
 
 /* small helper function to check if a string contains a numeric value*/
 static bool isnumeric(const char *str)
@@ -24,6 +142,7 @@ static void list_devices(void)
     char    str[256];
 
     devicecount = winusbtmc_get_device_count();
+    s_resolved = winusbtmc_time_ms();
     printf("%d winusbtmc device(s) present.\n", devicecount);
 
     for (i = 0; i < devicecount; i++)
@@ -34,21 +153,75 @@ static void list_devices(void)
     printf("\n");
 }
 
+static int32_t find_device(const char *device)
+{
+    if ( isnumeric(device) )
+    { /* device specified by device number */
+        return atoi(device);
+    }
+    /* device specified by string */
+    return winusbtmc_find_devnum_by_string(device);
+}
+
+/* read a complete response and write it to out, returns < 0 in case of an error.
+ * raw writes the response unchanged, including the terminator.
+ * The buffer is large enough for the calibrated transfer size of any device, it is only held during the read,
+ * pages the response does not reach are never touched */
+static int32_t read_response(int32_t devnum, FILE *out, bool raw)
+{
+    char *str;
+    int   ret;
+    bool  eom;
+
+    str = malloc(READ_BUFFER);
+    if (!str)
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+
+    do
+    {
+        if (raw)
+            ret = winusbtmc_recv_data(devnum, str, READ_BUFFER, &eom);
+        else
+            ret = winusbtmc_recv_string(devnum, str, READ_BUFFER-1, &eom);
+        if (ret < 0)
+            break;
+        fwrite(str, ret, 1, out);
+    } while (!eom);
+
+    free(str);
+    return (ret < 0) ? ret : 0;
+}
+
 static void send_command(char *device, char *commandstr, bool getResponse)
 {
     int devnum;
-    char str[8192];
     int ret;
-    bool eom;
+#ifndef _WIN32
+    char line[8192];
+    int  sock;
 
-    if ( isnumeric(device) )
-    { /* device specified by device number */
-        devnum = atoi(device);
-    }
-    else
-    { /* device specified by string */
-        devnum = winusbtmc_find_devnum_by_string(device);
+    if (getenv("WINUSBTMC_DAEMON"))
+    { /* the daemon owns the devices */
+        sock = daemon_connect(getenv("WINUSBTMC_DAEMON"));
+        if (sock < 0)
+        {
+            printf("ERROR: daemon not running\n");
+            return;
+        }
+        snprintf(line, sizeof(line), "@\"%s\" %s", device, commandstr);
+        ret = daemon_request(sock, line, getResponse ? stdout : (void *)0);
+        s_resolved = winusbtmc_time_ms();
+        close(sock);
+        if (ret < 0)
+        {
+            printf("ERROR: %d\n", ret);
+        }
+        return;
     }
+#endif
+
+    devnum = find_device(device);
+    s_resolved = winusbtmc_time_ms();
 
     ret = winusbtmc_send_string(devnum, commandstr);
     if (ret < 0)
@@ -58,18 +231,857 @@ static void send_command(char *device, char *commandstr, bool getResponse)
     }
     if (getResponse)
     {
-        do
+        ret = read_response(devnum, stdout, false);
+        if (ret < 0)
+        {
+            printf("ERROR: %d\n", ret);
+            return;
+        }
+    }
+}
+
+/*
+ * script mode, executes one command per line over a single session.
+ *   # comment
+ *   @<device>             following lines go to this device (number or string, quote strings with spaces)
+ *   @<device> <command>   this line only goes to the device
+ *   <command>             commands containing '?' are queries, the response is written to stdout
+ *   <command> > <file>    the response is written to a file instead, e.g. a screenshot
+ * With pipeline, consecutive commands without response to the same device are combined into
+ * a single message ("CMD1;:CMD2"), a query or a device change sends them.
+ * If sock is >= 0 the lines are executed by the daemon (pipeline is not used then).
+ * returns 0 if all lines were executed, 1 at the first error
+ */
+#define SCRIPT_LINE_MAX  (4096)
+
+typedef struct
+{
+    int32_t devnum;                       /* device of the pending commands */
+    char    pending[SCRIPT_LINE_MAX];     /* combined commands not yet sent */
+    int     pendinglines;
+} script_pipe_t;
+
+static int32_t script_flush(script_pipe_t *pipe)
+{
+    int32_t ret = 0;
+
+    if (pipe->pendinglines > 0)
+    {
+        ret = winusbtmc_send_string(pipe->devnum, pipe->pending);
+    }
+    pipe->pending[0]   = '\0';
+    pipe->pendinglines = 0;
+    return ret;
+}
+
+/* returns false if the line could not be queued, it is sent on its own then */
+static bool script_queue(script_pipe_t *pipe, int32_t devnum, const char *cmd)
+{
+    size_t len, cmdlen;
+
+    len    = strlen(pipe->pending);
+    cmdlen = strlen(cmd);
+    if ( (pipe->pendinglines > 0) && ( (pipe->devnum != devnum) || (len + cmdlen + 3 > sizeof(pipe->pending)) ) )
+    {
+        return false;
+    }
+    if (pipe->pendinglines > 0)
+    { /* ':' starts the next command at the root of the command tree, common commands do not need it */
+        strcat(pipe->pending, ((cmd[0] == ':') || (cmd[0] == '*')) ? ";" : ";:");
+    }
+    else if (cmdlen + 1 > sizeof(pipe->pending))
+    {
+        return false;
+    }
+    strcat(pipe->pending, cmd);
+    pipe->devnum = devnum;
+    pipe->pendinglines++;
+    return true;
+}
+
+/* split "@<device> [command]" into device and command, returns false if the closing " is missing */
+static bool script_device(char **pcmd, char *devname)
+{
+    char *cmd = *pcmd + 1;
+    char *end;
+
+    if (*cmd == '"')
+    {
+        cmd++;
+        end = strchr(cmd, '"');
+        if (!end)
+            return false;
+    }
+    else
+    {
+        end = cmd + strcspn(cmd, " \t");
+    }
+    memcpy(devname, cmd, end - cmd);
+    devname[end - cmd] = '\0';
+    for (cmd = (*end == '"') ? end + 1 : end; (*cmd == ' ') || (*cmd == '\t'); cmd++)
+        ;
+    *pcmd = cmd;
+    return true;
+}
+
+static int run_script(FILE *in, bool pipeline, int sock)
+{
+    char          line[SCRIPT_LINE_MAX];
+    char          devname[SCRIPT_LINE_MAX];
+    char         *cmd, *file, *rest;
+    int32_t       devnum, linedev, ret;
+    int           lineno, commands;
+    double        t, start;
+    bool          selected;
+    FILE         *out;
+    script_pipe_t pipe;
+
+    devnum   = WINUSBTMC_ERR_DEVICE_NOT_PRESENT;
+    selected = false;
+    lineno   = 0;
+    commands = 0;
+    pipe.pending[0]   = '\0';
+    pipe.pendinglines = 0;
+    start = winusbtmc_time_ms();
+
+    while (fgets(line, sizeof(line), in))
+    {
+        lineno++;
+        line[strcspn(line, "\r\n")] = '\0';
+        for (cmd = line; (*cmd == ' ') || (*cmd == '\t'); cmd++)
+            ;
+        if ( (*cmd == '\0') || (*cmd == '#') )
+            continue;
+
+        t = winusbtmc_time_ms();
+
+        /* a command needs a device, "@<device>" on a line of its own selects it for the following lines */
+        rest = cmd;
+        if ( (*cmd == '@') && (!script_device(&rest, devname)) )
+        {
+            fprintf(stderr, "line %d: missing \"\n", lineno);
+            return 1;
+        }
+        if ( (*cmd != '@') && (!selected) )
+        {
+            fprintf(stderr, "line %d: no device selected, start the script with @<device>\n", lineno);
+            return 1;
+        }
+
+#ifndef _WIN32
+        if (sock >= 0)
+        {
+            out  = stdout;
+            file = strstr(cmd, " > ");
+            if (file)
+            {
+                *file = '\0';
+                for (file += 3; *file == ' '; file++)
+                    ;
+                out = fopen(file, "wb");
+                if (!out)
+                {
+                    fprintf(stderr, "line %d: cannot create \"%s\"\n", lineno, file);
+                    return 1;
+                }
+            }
+            ret = daemon_request(sock, cmd, out);
+            if (file)
+                fclose(out);
+            else
+                fflush(stdout);
+            if (ret < 0)
+            {
+                fprintf(stderr, "line %d: ERROR: %d\n", lineno, ret);
+                return 1;
+            }
+            if (*cmd != '@')
+                commands++;
+            else if (*rest == '\0')
+                selected = true;
+            if (s_timing)
+                fprintf(stderr, "line %d: %.3f ms\n", lineno, winusbtmc_time_ms() - t);
+            continue;
+        }
+#endif
+
+        linedev = devnum;
+        if (*cmd == '@')
+        { /* device addressing */
+            cmd = rest;
+            linedev = find_device(devname);
+            if (linedev < 0)
+            {
+                fprintf(stderr, "line %d: device \"%s\" not found\n", lineno, devname);
+                return 1;
+            }
+            if (*cmd == '\0')
+            { /* only selects the device */
+                devnum   = linedev;
+                selected = true;
+                continue;
+            }
+        }
+
+        out  = stdout;
+        file = strstr(cmd, " > ");
+        if (file)
+        {
+            *file = '\0';
+            file += 3;
+            while (*file == ' ')
+                file++;
+        }
+
+        ret = 0;
+        if ( (pipeline) && (!file) && (!strchr(cmd, '?')) && (script_queue(&pipe, linedev, cmd)) )
+        { /* sent together with the next commands */
+        }
+        else
+        {
+            ret = script_flush(&pipe);
+            if ( (ret >= 0) && (pipeline) && (!file) && (!strchr(cmd, '?')) )
+            {
+                script_queue(&pipe, linedev, cmd); /* did not fit to the pending commands */
+            }
+            else if (ret >= 0)
+            {
+                ret = winusbtmc_send_string(linedev, cmd);
+                if ( (ret >= 0) && ( (file) || (strchr(cmd, '?')) ) )
+                {
+                    if (file)
+                    {
+                        out = fopen(file, "wb");
+                        if (!out)
+                        {
+                            fprintf(stderr, "line %d: cannot create \"%s\"\n", lineno, file);
+                            return 1;
+                        }
+                    }
+                    ret = read_response(linedev, out, true); /* one response per line on stdout */
+                    if (file)
+                        fclose(out);
+                    else
+                        fflush(stdout);
+                }
+            }
+        }
+        if (ret < 0)
+        {
+            fprintf(stderr, "line %d: ERROR: %d\n", lineno, ret);
+            return 1;
+        }
+        commands++;
+
+        if (s_timing)
+        {
+            fprintf(stderr, "line %d: %.3f ms%s\n", lineno, winusbtmc_time_ms() - t, pipe.pendinglines ? " (queued)" : "");
+        }
+    }
+
+    ret = script_flush(&pipe);
+    if (ret < 0)
+    {
+        fprintf(stderr, "line %d: ERROR: %d\n", lineno, ret);
+        return 1;
+    }
+    if (s_timing)
+    {
+        fprintf(stderr, "%d commands in %.3f ms\n", commands, winusbtmc_time_ms() - start);
+    }
+    return 0;
+}
+
+/*
+ * transfer size calibration, probes the device with query (a query with a large response) and prints the fastest
+ * transfer size. It is kept in the enumeration cache until the device is replugged.
+ * returns 0 if a transfer size was found
+ */
+static int calibrate(char *device, char *query)
+{
+    int32_t devnum, ret;
+
+    devnum = find_device(device);
+    ret = (devnum < 0) ? devnum : winusbtmc_calibrate(devnum, query);
+    if (ret < 0)
+    {
+        printf("ERROR: %d\n", ret);
+        return 1;
+    }
+    printf("transfer size: %d bytes\n", (int)ret);
+    return 0;
+}
+
+/* qsort order of latencies */
+static int cmp_double(const void *a, const void *b)
+{
+    double d = *(const double *)a - *(const double *)b;
+    return (d < 0) ? -1 : (d > 0);
+}
+
+/*
+ * latency benchmark, repeats a command count times or for a duration and reports the round trip times.
+ * Options: n=<count>, t=<seconds>, warmup=<count>, size=<expected response length in bytes>,
+ * io=<cpu> (transfers by the I/O thread of the device)
+ * returns 0 if all commands succeeded and all responses had the expected size
+ */
+static int benchmark(char *device, char *commandstr, int optc, char *optv[])
+{
+    winusbtmc_io_request_t req;
+    int32_t  devnum, ret, cpu;
+    long     count, warmup, expected, i, n, mismatch, size, len;
+    double   duration, t, start, elapsed, bytes;
+    double  *lat, *p;
+    bool     query, eom, io;
+    char    *dat;
+
+    count    = 0;
+    duration = 0;
+    warmup   = 1;
+    expected = -1;
+    io       = false;
+    cpu      = -1;
+    for (i = 0; i < optc; i++)
+    {
+        if (strncasecmp(optv[i], "n=", 2) == 0)
+            count = atol(&optv[i][2]);
+        else if (strncasecmp(optv[i], "t=", 2) == 0)
+            duration = atof(&optv[i][2]) * 1000.0;
+        else if (strncasecmp(optv[i], "warmup=", 7) == 0)
+            warmup = atol(&optv[i][7]);
+        else if (strncasecmp(optv[i], "size=", 5) == 0)
+            expected = atol(&optv[i][5]);
+        else if (strncasecmp(optv[i], "io=", 3) == 0)
+        {
+            io  = true;
+            cpu = atoi(&optv[i][3]);
+        }
+        else
+        {
+            fprintf(stderr, "unknown option \"%s\"\n", optv[i]);
+            return 1;
+        }
+    }
+    if ( (count <= 0) && (duration <= 0) )
+        count = 1000;
+
+    devnum = find_device(device);
+    if (devnum < 0)
+    {
+        printf("ERROR: %d\n", devnum);
+        return 1;
+    }
+
+    query = (strchr(commandstr, '?') != (void *)0);
+    dat   = malloc(1024 * 1024);
+    size  = (count > 0) ? count : 100000;
+    lat   = malloc(size * sizeof(double));
+    if ( (!dat) || (!lat) )
+    {
+        printf("ERROR: %d\n", WINUSBTMC_ERR_MALLOC_FAILED);
+        return 1;
+    }
+    if (io)
+    { /* the transfers are done by the I/O thread of the device, this thread only submits and waits */
+        ret = winusbtmc_io_start(devnum, cpu);
+        if (ret < 0)
+        {
+            printf("ERROR: %d\n", ret);
+            free(dat);
+            free(lat);
+            return 1;
+        }
+        memset(&req, 0, sizeof(req));
+        req.command  = commandstr;
+        req.response = (query) ? dat : (void *)0;
+        req.maxlen   = 1024 * 1024;
+    }
+
+    mismatch = 0;
+    bytes    = 0;
+    n        = 0;
+    start    = 0;
+    for (i = 0; ; i++)
+    {
+        if (i == warmup)
+            start = winusbtmc_time_ms(); /* warm-up transfers open the device and are not measured */
+        if (i >= warmup)
+        {
+            if ( (count > 0) && (n >= count) )
+                break;
+            if ( (count <= 0) && (winusbtmc_time_ms() - start >= duration) )
+                break;
+        }
+
+        t   = winusbtmc_time_ms();
+        len = 0;
+        if (io)
+        {
+            ret = winusbtmc_io_submit(devnum, &req);
+            if (ret >= 0)
+                ret = winusbtmc_io_wait(devnum, &req, -1);
+            len = (ret > 0) ? ret : 0;
+        }
+        else
+        {
+            ret = winusbtmc_send_string(devnum, commandstr);
+        }
+        while ( (ret >= 0) && (query) && (!io) )
+        {
+            ret = winusbtmc_recv_data(devnum, dat, 1024 * 1024, &eom);
+            if (ret >= 0)
+                len += ret;
+            if ( (ret < 0) || (eom) )
+                break;
+        }
+        if (ret < 0)
+        {
+            printf("ERROR: %d\n", ret);
+            if (io)
+                winusbtmc_io_stop(devnum);
+            free(dat);
+            free(lat);
+            return 1;
+        }
+        if (i < warmup)
+            continue;
+
+        if ( (expected >= 0) && (len != expected) )
+            mismatch++;
+        bytes += len;
+
+        if (n >= size)
+        {
+            size *= 2;
+            p = realloc(lat, size * sizeof(double));
+            if (!p)
+                break;
+            lat = p;
+        }
+        lat[n++] = winusbtmc_time_ms() - t;
+    }
+    elapsed = winusbtmc_time_ms() - start;
+    if (io)
+        winusbtmc_io_stop(devnum);
+
+    if (n > 0)
+    {
+        qsort(lat, n, sizeof(double), cmp_double);
+        printf("%s \"%s\": %ld %s in %.3f s", query ? "query" : "command", commandstr, n, query ? "queries" : "commands", elapsed / 1000.0);
+        if (query)
+            printf(", %.0f bytes per response", bytes / n);
+        printf("\n");
+        printf("latency [us]: min %.1f  p50 %.1f  p99 %.1f  max %.1f\n",
+               lat[0] * 1000.0, lat[n / 2] * 1000.0, lat[(long)(n * 0.99)] * 1000.0, lat[n - 1] * 1000.0);
+        printf("throughput:   %.1f %s/s  %.3f MB/s\n", n * 1000.0 / elapsed, query ? "queries" : "commands", bytes / 1000.0 / elapsed);
+        if (mismatch)
+            printf("size check:   %ld of %ld responses were not %ld bytes\n", mismatch, n, expected);
+    }
+
+    free(dat);
+    free(lat);
+    return (mismatch > 0) ? 1 : 0;
+}
+
+/*
+ * continuous acquisition, the query is repeated by the library as fast as the device answers and every
+ * response is printed with its time. Options: n=<count>, t=<seconds>, buffers=<count>, size=<max. response length>,
+ * store=<file> appends the responses to a capture store instead of printing them
+ */
+static int acquire(char *device, char *query, int optc, char *optv[])
+{
+    winusbtmc_acquire_buffer_t buf;
+    winusbtmc_store_t *pstore = (void *)0;
+    int32_t  devnum, ret;
+    long     count, buffers, size, i, n;
+    double   duration, start, first;
+    uint64_t overruns;
+    uint32_t len;
+
+    count    = 0;
+    duration = 0;
+    buffers  = 8;
+    size     = 65536;
+    for (i = 0; i < optc; i++)
+    {
+        if (strncasecmp(optv[i], "n=", 2) == 0)
+            count = atol(&optv[i][2]);
+        else if (strncasecmp(optv[i], "t=", 2) == 0)
+            duration = atof(&optv[i][2]) * 1000.0;
+        else if (strncasecmp(optv[i], "buffers=", 8) == 0)
+            buffers = atol(&optv[i][8]);
+        else if (strncasecmp(optv[i], "size=", 5) == 0)
+            size = atol(&optv[i][5]);
+        else if ( (strncasecmp(optv[i], "store=", 6) == 0) && (!pstore) )
         {
-            ret = winusbtmc_recv_string(devnum, str, sizeof(str)-1, &eom);
+            ret = winusbtmc_store_create(&pstore, &optv[i][6]);
+            if (ret < 0)
+            {
+                printf("ERROR: cannot open \"%s\" (%d)\n", &optv[i][6], ret);
+                return 1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "unknown option \"%s\"\n", optv[i]);
+            winusbtmc_store_close(pstore);
+            return 1;
+        }
+    }
+
+    devnum = find_device(device);
+    ret    = (devnum < 0) ? devnum : winusbtmc_acquire_start(devnum, query, buffers, size);
+    if (ret < 0)
+    {
+        printf("ERROR: %d\n", ret);
+        winusbtmc_store_close(pstore);
+        return 1;
+    }
+
+    n        = 0;
+    overruns = 0;
+    first    = 0;
+    start    = winusbtmc_time_ms();
+    while ( ((count <= 0) || (n < count)) && ((duration <= 0) || (winusbtmc_time_ms() - start < duration)) )
+    {
+        ret = winusbtmc_acquire_get(devnum, &buf, 100);
+        if (ret < 0)
+        {
+            printf("ERROR: %d\n", ret);
+            break;
+        }
+        if (ret == 0)
+            continue;
+
+        if (n == 0)
+            first = buf.start_ms;
+        if (pstore)
+        { /* tagged with the device, the store can be read while it is written (/G) */
+            ret = winusbtmc_store_add(pstore, devnum, 0, buf.dat, buf.len);
             if (ret < 0)
             {
                 printf("ERROR: %d\n", ret);
-                return;
+                winusbtmc_acquire_release(devnum);
+                break;
+            }
+        }
+        else
+        {
+            len = buf.len;
+            if ( (len > 0) && (buf.dat[len - 1] == '\n') )
+                len--;
+            printf("%.6f\t", (buf.end_ms - first) / 1000.0);
+            fwrite(buf.dat, 1, len, stdout);
+            printf("%s\n", buf.truncated ? "..." : "");
+        }
+        overruns = buf.overruns;
+        n++;
+        winusbtmc_acquire_release(devnum);
+    }
+    winusbtmc_acquire_stop(devnum);
+    winusbtmc_store_close(pstore);
+
+    fprintf(stderr, "%ld responses, %llu dropped, %.1f responses/s\n", n, (unsigned long long)overruns,
+            n * 1000.0 / (winusbtmc_time_ms() - start));
+    return (ret < 0) ? 1 : 0;
+}
+
+/* names of the WINUSBTMC_SAMPLE_* formats for /W and /X */
+static const char * const s_formats[] = { "", "int8", "uint8", "int16", "int16be", "uint16", "uint16be" };
+
+/*
+ * waveform archive, the query is repeated and every response is stored as a capture of the archive file.
+ * Options: n=<count>, t=<seconds>, format=<sample format, default uint8>, preamble=<query stored with each capture>
+ */
+static int archive(char *device, char *filename, char *query, int optc, char *optv[])
+{
+    winusbtmc_archive_t *parc;
+    static char          preamble[4096];
+    char                 rest[256];
+    const char          *prequery;
+    int32_t              devnum, ret, format, plen;
+    long                 count, i, n;
+    double               duration, start, bytes;
+    bool                 eom;
+
+    count    = 0;
+    duration = 0;
+    format   = WINUSBTMC_SAMPLE_UINT8;
+    prequery = (void *)0;
+    for (i = 0; i < optc; i++)
+    {
+        if (strncasecmp(optv[i], "n=", 2) == 0)
+            count = atol(&optv[i][2]);
+        else if (strncasecmp(optv[i], "t=", 2) == 0)
+            duration = atof(&optv[i][2]) * 1000.0;
+        else if (strncasecmp(optv[i], "preamble=", 9) == 0)
+            prequery = &optv[i][9];
+        else if (strncasecmp(optv[i], "format=", 7) == 0)
+        {
+            for (format = WINUSBTMC_SAMPLE_UINT16_BE; format > 0; format--)
+                if (strcasecmp(&optv[i][7], s_formats[format]) == 0)
+                    break;
+            if (format == 0)
+            {
+                fprintf(stderr, "unknown format \"%s\"\n", &optv[i][7]);
+                return 1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "unknown option \"%s\"\n", optv[i]);
+            return 1;
+        }
+    }
+    if ( (count <= 0) && (duration <= 0) )
+        count = 1;
+
+    devnum = find_device(device);
+    ret    = (devnum < 0) ? devnum : winusbtmc_archive_create(&parc, filename);
+    if (ret < 0)
+    {
+        printf("ERROR: %d\n", ret);
+        return 1;
+    }
+
+    n     = 0;
+    bytes = 0;
+    start = winusbtmc_time_ms();
+    while ( ((count <= 0) || (n < count)) && ((duration <= 0) || (winusbtmc_time_ms() - start < duration)) )
+    {
+        plen = 0;
+        if (prequery)
+        {
+            ret = winusbtmc_send_string(devnum, prequery);
+            if (ret >= 0)
+                ret = plen = winusbtmc_recv_string(devnum, preamble, sizeof(preamble) - 1, &eom);
+            while ( (ret >= 0) && (!eom) ) /* longer than the buffer, the rest is dropped */
+                ret = winusbtmc_recv_data(devnum, rest, sizeof(rest), &eom);
+            if (ret < 0)
+                break;
+            if ( (plen > 0) && (preamble[plen - 1] == '\n') )
+                plen--;
+        }
+        ret = winusbtmc_send_string(devnum, query);
+        if (ret >= 0)
+            ret = winusbtmc_recv_archive(devnum, parc, format, 0, preamble, plen);
+        if (ret < 0)
+            break;
+        bytes += ret;
+        n++;
+    }
+    if (ret < 0)
+        printf("ERROR: %d\n", ret);
+    if (winusbtmc_archive_close(parc) < 0)
+    {
+        printf("ERROR: cannot write \"%s\"\n", filename);
+        ret = WINUSBTMC_ERR_FILE;
+    }
+
+    fprintf(stderr, "%ld captures, %.0f bytes, %.2f MB/s\n", n, bytes, bytes / 1000.0 / (winusbtmc_time_ms() - start));
+    return (ret < 0) ? 1 : 0;
+}
+
+/*
+ * list the captures of an archive file, or write the samples of one capture to a file (raw, in its format)
+ */
+static int extract(char *filename, int index, char *outname)
+{
+    winusbtmc_archive_t     *parc;
+    winusbtmc_archive_info_t info;
+    FILE                    *out;
+    void                    *dat;
+    int32_t                  ret, i, count;
+
+    ret = winusbtmc_archive_open(&parc, filename);
+    if (ret < 0)
+    {
+        printf("ERROR: %d\n", ret);
+        return 1;
+    }
+
+    count = winusbtmc_archive_count(parc);
+    if (!outname)
+    {
+        for (i = 0; i < count; i++)
+        {
+            winusbtmc_archive_info(parc, i, &info);
+            printf("%d\t%.6f\t%s\t%llu samples\t%llu bytes\n", i, info.timestamp,
+                   ( (info.format > 0) && (info.format <= WINUSBTMC_SAMPLE_UINT16_BE) ) ? s_formats[info.format] : "?",
+                   (unsigned long long)info.samples, (unsigned long long)info.stored);
+        }
+        winusbtmc_archive_close(parc);
+        return 0;
+    }
+
+    ret = winusbtmc_archive_info(parc, index, &info);
+    dat = (void *)0;
+    if (ret >= 0)
+    {
+        dat = malloc(info.samples * (info.format <= WINUSBTMC_SAMPLE_UINT8 ? 1 : 2) + 1);
+        ret = (dat) ? winusbtmc_archive_read(parc, index, (void *)0, 0, dat, info.samples) : WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+    if (ret >= 0)
+    {
+        out = fopen(outname, "wb");
+        if ( (!out) || (fwrite(dat, info.format <= WINUSBTMC_SAMPLE_UINT8 ? 1 : 2, info.samples, out) != info.samples) )
+            ret = WINUSBTMC_ERR_FILE;
+        if ( (out) && (fclose(out) != 0) )
+            ret = WINUSBTMC_ERR_FILE;
+    }
+    free(dat);
+    winusbtmc_archive_close(parc);
+    if (ret < 0)
+    {
+        printf("ERROR: %d\n", ret);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * read a capture store: the count of captures, one capture (written unchanged to stdout) or, with follow,
+ * every capture with its time and tag as soon as it was added
+ */
+static int read_store(char *filename, char *what)
+{
+    winusbtmc_store_t      *pstore;
+    winusbtmc_store_entry_t entry;
+    int32_t                 ret, count, i;
+    bool                    follow;
+
+    ret = winusbtmc_store_open(&pstore, filename);
+    if (ret < 0)
+    {
+        printf("ERROR: %d\n", ret);
+        return 1;
+    }
+
+    count  = winusbtmc_store_count(pstore);
+    follow = (what) && (strcasecmp(what, "follow") == 0);
+    if (!what)
+    {
+        printf("%d captures\n", count);
+    }
+    else if (!follow)
+    {
+        ret = winusbtmc_store_get(pstore, atoi(what), &entry);
+        if (ret < 0)
+            printf("ERROR: no capture %s\n", what);
+        else
+            fwrite(entry.dat, 1, entry.len, stdout);
+    }
+    else
+    {
+        for (i = 0; ret >= 0; )
+        {
+            for ( ; i < count; i++)
+            {
+                winusbtmc_store_get(pstore, i, &entry);
+                printf("%d\t%.6f\t%u\t", i, entry.timestamp, entry.tag);
+                fwrite(entry.dat, 1, ( (entry.len > 0) && (entry.dat[entry.len - 1] == '\n') ) ? entry.len - 1 : entry.len, stdout);
+                printf("\n");
             }
-            fwrite(str, ret, 1, stdout);
-            //printf(str);
-        } while (!eom);
+            fflush(stdout);
+#ifdef _WIN32
+            Sleep(100);
+#else
+            usleep(100000);
+#endif
+            ret = count = winusbtmc_store_refresh(pstore);
+        }
+        printf("ERROR: %d\n", ret);
+    }
+    winusbtmc_store_close(pstore);
+    return (ret < 0) ? 1 : 0;
+}
+
+/*
+ * shared memory producer, the query is repeated and every response is received into the named ring for another
+ * process (/N). Options: n=<count>, t=<seconds>, slots=<count>, size=<bytes per slot>
+ */
+static int shm_producer(char *device, char *name, char *query, int optc, char *optv[])
+{
+    winusbtmc_shm_t *pshm;
+    int32_t          devnum, ret;
+    long             count, slots, size, i, n;
+    double           duration, start, bytes;
+
+    count    = 0;
+    duration = 0;
+    slots    = 8;
+    size     = 1024 * 1024;
+    for (i = 0; i < optc; i++)
+    {
+        if (strncasecmp(optv[i], "n=", 2) == 0)
+            count = atol(&optv[i][2]);
+        else if (strncasecmp(optv[i], "t=", 2) == 0)
+            duration = atof(&optv[i][2]) * 1000.0;
+        else if (strncasecmp(optv[i], "slots=", 6) == 0)
+            slots = atol(&optv[i][6]);
+        else if (strncasecmp(optv[i], "size=", 5) == 0)
+            size = atol(&optv[i][5]);
+        else
+        {
+            fprintf(stderr, "unknown option \"%s\"\n", optv[i]);
+            return 1;
+        }
+    }
+
+    devnum = find_device(device);
+    ret    = (devnum < 0) ? devnum : winusbtmc_shm_create(&pshm, name, slots, size);
+    if (ret < 0)
+    {
+        printf("ERROR: %d\n", ret);
+        return 1;
+    }
+
+    n     = 0;
+    bytes = 0;
+    start = winusbtmc_time_ms();
+    while ( ((count <= 0) || (n < count)) && ((duration <= 0) || (winusbtmc_time_ms() - start < duration)) )
+    {
+        ret = winusbtmc_send_string(devnum, query);
+        if (ret >= 0)
+            ret = winusbtmc_recv_shm(devnum, pshm, -1); /* waits for the consumer */
+        if (ret < 0)
+        {
+            printf("ERROR: %d\n", ret);
+            break;
+        }
+        bytes += ret;
+        n++;
+    }
+    winusbtmc_shm_close(pshm);
+
+    fprintf(stderr, "%ld responses, %.2f MB/s\n", n, bytes / 1000.0 / (winusbtmc_time_ms() - start));
+    return (ret < 0) ? 1 : 0;
+}
+
+/*
+ * shared memory consumer, prints sequence number, time and length of every response of the ring until the
+ * producer closes it
+ */
+static int shm_consumer(char *name)
+{
+    winusbtmc_shm_t      *pshm;
+    winusbtmc_shm_entry_t entry;
+    int32_t               ret;
+
+    ret = winusbtmc_shm_open(&pshm, name);
+    if (ret < 0)
+    {
+        printf("ERROR: %d\n", ret);
+        return 1;
+    }
+    while ((ret = winusbtmc_shm_get(pshm, &entry, -1)) == 1)
+    {
+        printf("%llu\t%.6f\t%u%s\n", (unsigned long long)entry.sequence, entry.timestamp, entry.len,
+               entry.truncated ? "..." : "");
+        winusbtmc_shm_release(pshm);
     }
+    winusbtmc_shm_close(pshm);
+    return (ret == WINUSBTMC_ERR_SHM_CLOSED) ? 0 : 1;
 }
 
 static void interpret_command(char *cmd)
@@ -93,13 +1105,167 @@ static void print_help(void)
     printf("                         This will not read automatically the response of the device\n");
     printf("winusbtmc /R \"Rigol\" \"*IDN?\"   send a command to device beginning with the string \"Rigol\"\n");
     printf("                         The response is read and written to stdout. It can be redirected to a file\n");
+    printf("winusbtmc /S [/P] [file]   executes the commands of a script file (or stdin) over one session, per line:\n");
+    printf("                         @<device>  select the device for the following lines (number or string)\n");
+    printf("                         @<device> <command>  send a single line to another device\n");
+    printf("                         <command>  responses of queries (commands containing '?') go to stdout\n");
+    printf("                         <command> > <file>  the response is written to a file\n");
+    printf("                         /P combines consecutive commands without response into one message\n");
+    printf("winusbtmc /D [socket]  runs as daemon which keeps the devices opened for many clients (not on windows)\n");
+    printf("                         The other commands use the daemon if WINUSBTMC_DAEMON is set to its socket\n");
+    printf("winusbtmc /B \"Rigol\" \"*IDN?\" [n=1000] [t=<s>] [warmup=1] [size=<bytes>] [io=<cpu>]\n");
+    printf("                         latency benchmark, repeats the command n times or for t seconds and prints min/p50/p99/max latency\n");
+    printf("                         and the throughput. size checks the length of every response (including 0x0a)\n");
+    printf("                         io=<cpu> does the transfers in an I/O thread pinned to the cpu (-1 for any cpu)\n");
+    printf("winusbtmc /C \"Rigol\" \":DISP:DATA?\"   finds the fastest transfer size for large responses of the query,\n");
+    printf("                         it is kept in the enumeration cache and used until the device is replugged\n");
+    printf("winusbtmc /A \"Keysight\" \"READ?\" [n=<count>] [t=<s>] [buffers=8] [size=65536] [store=<file>]\n");
+    printf("                         continuous acquisition, the query is repeated as fast as the device answers,\n");
+    printf("                         each response is printed with its time in seconds. Responses which are not\n");
+    printf("                         printed in time are dropped\n");
+    printf("                         store=<file> appends the responses to a capture store instead of printing them\n");
+    printf("winusbtmc /G log.st [<index> | follow]   reads a capture store: the count of captures, capture <index>\n");
+    printf("                         or every capture as soon as it is added (while /A is still writing)\n");
+    printf("winusbtmc /M \"Rigol\" wave \":WAV:DATA?\" [n=<count>] [t=<s>] [slots=8] [size=1048576]   receives\n");
+    printf("                         the responses into the shared memory ring \"wave\" for another process\n");
+    printf("winusbtmc /N wave     takes the responses of the shared memory ring \"wave\" and prints their length\n");
+    printf("winusbtmc /W \"Rigol\" wave.wtmc \":WAV:DATA?\" [n=1] [t=<s>] [format=uint8] [preamble=\":WAV:PRE?\"]\n");
+    printf("                         stores n or t seconds of waveform records in an archive file (delta coded),\n");
+    printf("                         formats: int8 uint8 int16 int16be uint16 uint16be\n");
+    printf("winusbtmc /X wave.wtmc [<index> <file>]   lists the captures of an archive or writes the samples of one\n");
+    printf("                         to a file\n");
+    printf("winusbtmc /T ...      any of the above, prints the startup time (until the device was found)\n");
+    printf("                         and the total time to stderr\n");
+    printf("winusbtmc /F ...      any of the above, prints count, total, p50 and p99 latency and the bytes per\n");
+    printf("                         command mnemonic (e.g. MEAS:FREQ?, CHAN<n>:SCAL) of every used device to stderr\n");
+    printf("\n");
+    printf("Device strings are cached in winusbtmc.cache in the temp directory (%%TEMP%% or $XDG_RUNTIME_DIR),\n");
+    printf("set WINUSBTMC_CACHE to use a different file or to an empty string to disable the cache\n");
+    printf("WINUSBTMC_QUIRKS overrides the quirks of usb devices, e.g. \"1ab1:04b0=a,4096;0957:*=4\"\n");
+    printf("(hex vid:pid=flags[,max. transfer size], flags: 1 GET_CAPABILITIES, 2 vendor request 0xa0,\n");
+    printf("4 INITIATE_CLEAR after failed transfers, 8 device splits transfers, 10 reads end at 0x0a (Linux kernel\n");
+    printf("driver), 20 INITIATE_CLEAR when opened)\n");
+    printf("WINUSBTMC_RESPONSE_CACHE=1 answers repeated *IDN?, *OPT? and SYST:OPT? queries from a cache until *RST,\n");
+    printf("more queries and commands which drop the cache can be added, e.g. \"SENS:VOLT:RANG?;!CONF*\"\n");
 }
 
 
 
 int main(int argc,char *argv[])
 {
-    if (argc == 1)
+    double start;
+    int    ret = 0;
+    bool   pipeline;
+    FILE  *in;
+    int    sock = -1;
+#ifndef _WIN32
+    char   path[256];
+#endif
+
+    start = winusbtmc_time_ms();
+    while ( (argc > 1) && ( (strcasecmp(argv[1], "/T") == 0) || (strcasecmp(argv[1], "/F") == 0) ) )
+    {
+        if (strcasecmp(argv[1], "/T") == 0)
+            s_timing = true;
+        else
+            s_profile = true;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    enable_cache();
+    enable_quirks();
+    enable_response_cache();
+    if (s_profile)
+        winusbtmc_profile(-1, true);
+
+    if ( (argc > 1) && (strcasecmp(argv[1], "/S") == 0) )
+    { /* script mode */
+        pipeline = (argc > 2) && (strcasecmp(argv[2], "/P") == 0);
+        if (pipeline)
+        {
+            argv++;
+            argc--;
+        }
+        in = stdin;
+        if ( (argc > 2) && (strcmp(argv[2], "-") != 0) )
+        {
+            in = fopen(argv[2], "r");
+        }
+        if (!in)
+        {
+            fprintf(stderr, "cannot open \"%s\"\n", argv[2]);
+            ret = 1;
+        }
+        else
+        {
+#ifndef _WIN32
+            if (getenv("WINUSBTMC_DAEMON"))
+            {
+                sock = daemon_connect(getenv("WINUSBTMC_DAEMON"));
+                if (sock < 0)
+                    fprintf(stderr, "daemon not running\n");
+            }
+            if ( (sock >= 0) || (!getenv("WINUSBTMC_DAEMON")) )
+                ret = run_script(in, pipeline, sock);
+            else
+                ret = 1;
+            if (sock >= 0)
+                close(sock);
+#else
+            ret = run_script(in, pipeline, sock);
+#endif
+            if (in != stdin)
+                fclose(in);
+        }
+        s_resolved = -1; /* per line timing is printed instead */
+    }
+    else if ( (argc == 4) && (strcasecmp(argv[1], "/C") == 0) )
+    { /* transfer size calibration */
+        ret = calibrate(argv[2], argv[3]);
+    }
+    else if ( (argc > 3) && (strcasecmp(argv[1], "/B") == 0) )
+    { /* latency benchmark */
+        ret = benchmark(argv[2], argv[3], argc - 4, &argv[4]);
+    }
+    else if ( (argc > 3) && (strcasecmp(argv[1], "/A") == 0) )
+    { /* continuous acquisition */
+        ret = acquire(argv[2], argv[3], argc - 4, &argv[4]);
+    }
+    else if ( (argc > 4) && (strcasecmp(argv[1], "/W") == 0) )
+    { /* waveform archive */
+        ret = archive(argv[2], argv[3], argv[4], argc - 5, &argv[5]);
+    }
+    else if ( ((argc == 3) || (argc == 5)) && (strcasecmp(argv[1], "/X") == 0) )
+    { /* list or extract the captures of an archive */
+        ret = extract(argv[2], (argc == 5) ? atoi(argv[3]) : 0, (argc == 5) ? argv[4] : (void *)0);
+    }
+    else if ( (argc > 4) && (strcasecmp(argv[1], "/M") == 0) )
+    { /* shared memory producer */
+        ret = shm_producer(argv[2], argv[3], argv[4], argc - 5, &argv[5]);
+    }
+    else if ( (argc == 3) && (strcasecmp(argv[1], "/N") == 0) )
+    { /* shared memory consumer */
+        ret = shm_consumer(argv[2]);
+    }
+    else if ( ((argc == 3) || (argc == 4)) && (strcasecmp(argv[1], "/G") == 0) )
+    { /* read a capture store */
+        ret = read_store(argv[2], (argc == 4) ? argv[3] : (void *)0);
+    }
+    else if ( (argc > 1) && (strcasecmp(argv[1], "/D") == 0) )
+    { /* daemon mode */
+#ifndef _WIN32
+        if (argc > 2)
+            snprintf(path, sizeof(path), "%s", argv[2]);
+        else
+            daemon_default_path(path, sizeof(path));
+        ret = daemon_run(path);
+#else
+        fprintf(stderr, "daemon mode is not available on windows\n");
+        ret = 1;
+#endif
+    }
+    else if (argc == 1)
     { /* no parameters given, return device list */
         print_help();
     }
@@ -119,8 +1285,17 @@ int main(int argc,char *argv[])
         }
     }
 
+    if (s_profile)
+        print_profile();
     winusbtmc_deinit();
 
-    return 0; /* \TODO: return a nonzero value in case an error occured */
+    if (s_timing)
+    {
+        if (s_resolved >= 0)
+            fprintf(stderr, "startup: %.3f ms\n", s_resolved - start);
+        fprintf(stderr, "total:   %.3f ms\n", winusbtmc_time_ms() - start);
+    }
+
+    return ret; /* \TODO: return a nonzero value in case an error occured in the single command modes */
 }
 
@@ -1,53 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "lusb0_usb.h"
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <sched.h>
+    #include <time.h>
+#endif
 #include "winusbtmc.h"
+#include "winusbtmc_private.h"
 
-#define WINUSBTMC_USTR_MAX (256) /* maximum length of the unique identifier string */
-#define WINUSBTMC_MAX_DEVNUM (128) /* max. count of supported devices */
-
-#define WINUSBTMC_CLASS    (0xfe)
-#define WINUSBTMC_SUBCLASS (0x03)
-
-#define WINUSBTMC_DEV_DEP_MSG_OUT (0x01)
-#define WINUSBTMC_DEV_DEP_MSG_IN  (0x02)
-
-#define WINUSBTMC_TIMEOUT (1000)              /* timeout, unit milliseconds */
-
-
-typedef struct
-{
-    struct usb_device *dev;                /* usb device structure */
-    usb_dev_handle    *usb_handle;         /* handle to usb device (0 if not opened) */
-    int8_t             usb_config;         /* configuration number */
-    int8_t             usb_interface;      /* interface number */
-    int8_t             usb_alt_setting;    /* alternative setting (-1 if none) */
-    char               usb_uniquestring[WINUSBTMC_USTR_MAX];
-
-    uint8_t            usb_ep_bulkin;
-    uint8_t            usb_ep_bulkout;
-    uint8_t            usb_ep_interrupt;
-
-    /* status information for usbtmc protocol handling */
-    uint8_t            winusbtmc_bTag;        /* current bTag number (incremented each transfer) */
-    uint8_t            winusbtmc_status;      /* latest status code from usbtmc device */
-} winusbtmc_device_t;
-
-typedef winusbtmc_device_t *winusbtmc_device_ptr_t;
-
-typedef struct
-{
-    uint8_t MsgID;
-    uint8_t bTag;
-    uint8_t bTagInverse;
-    uint8_t Rsvd1;
-    uint32_t TransferSize;
-    uint8_t bmTransferAttributes;
-    uint8_t Rsvd2;
-    uint8_t Rsvd3;
-    uint8_t Rsvd4;
-} winusbtmc_bulkout_header_t;
 
 /**************************************************************************************************
  * Global variables
@@ -55,8 +18,31 @@ typedef struct
 
 
 
+/* entry of the device table, the index is the device number */
+typedef struct
+{
+    winusbtmc_device_ptr_t pdev;                                   /* 0 if the entry is free */
+    uint16_t               generation;                             /* incremented when the device is removed */
+} winusbtmc_slot_t;
+
 bool s_winusbtmc_initialized = false;                              /* used to detect if this module was initialized */
-winusbtmc_device_ptr_t g_winusbtmc_deviceinfo_ptr[WINUSBTMC_MAX_DEVNUM]; /* this stores information about opened devices*/
+static winusbtmc_slot_t *s_winusbtmc_slots = (void *)0;            /* device table, grows when needed */
+static int32_t s_winusbtmc_slots_alloc = 0;                        /* allocated entries of the device table */
+static int32_t s_winusbtmc_slots_used  = 0;                        /* highest used entry + 1 */
+static int32_t s_winusbtmc_slots_free  = 0;                        /* no free entry below this one */
+static bool s_winusbtmc_slots_lock = false;                        /* see s_winusbtmc_lock_slots */
+static char s_winusbtmc_cache_filename[512] = "";                  /* enumeration cache file, empty if disabled */
+
+/* all transports, new devices are added to the device table in this order */
+static const winusbtmc_transport_t * const s_winusbtmc_transports[] =
+{
+    &winusbtmc_transport_usb,
+#ifdef __linux__
+    &winusbtmc_transport_linux,
+#endif
+    &winusbtmc_transport_tcp,
+    (void *)0
+};
 
 
 
@@ -76,7 +62,7 @@ winusbtmc_device_ptr_t g_winusbtmc_deviceinfo_ptr[WINUSBTMC_MAX_DEVNUM]; /* this
  * Returns strlen(src) + MIN(siz, strlen(initial dst)).
  * If retval >= siz, truncation occurred.
  */
-static size_t strlcat(char *dst, const char *src, size_t siz)
+static size_t s_strlcat(char *dst, const char *src, size_t siz)
 {
 	char *d = dst;
 	const char *s = src;
@@ -104,7 +90,7 @@ static size_t strlcat(char *dst, const char *src, size_t siz)
 	return(dlen + (s - src));	/* count does not include NUL */
 }
 
-size_t strlcpy(char * dst, const char * src, size_t siz)
+static size_t s_strlcpy(char * dst, const char * src, size_t siz)
 {
     char *d = dst;
     const char *s = src;
@@ -134,7 +120,7 @@ static void strtrim(char * s) {
     char * p = s;
     int l = strlen(p);
 
-    while(p[l - 1] == ' ')
+    while((l > 0) && (p[l - 1] == ' '))
         p[--l] = 0;
     while(* p && (*p == ' '))
         ++p, --l;
@@ -142,341 +128,532 @@ static void strtrim(char * s) {
     memmove(s, p, l + 1);
 }
 
+/*
+ * build the unique identifier string "manufacturer:product:serial" of a device.
+ * The passed strings are trimmed in place. dst must have a size of WINUSBTMC_USTR_MAX.
+ */
+void winusbtmc_uniquestring(char *dst, char *manufacturer, char *product, char *serial)
+{
+    strtrim(manufacturer);
+    strtrim(product);
+    strtrim(serial);
+    *dst = '\0';
+    s_strlcat(dst, manufacturer, WINUSBTMC_USTR_MAX);
+    s_strlcat(dst, ":", WINUSBTMC_USTR_MAX);
+    s_strlcat(dst, product, WINUSBTMC_USTR_MAX);
+    s_strlcat(dst, ":", WINUSBTMC_USTR_MAX);
+    s_strlcat(dst, serial, WINUSBTMC_USTR_MAX);
+}
+
 
 
 /*
- * walk through all present usbtmc devices.
- * returns count of present usbtmc devices and returns some device information if requested
- * returns -1 in case an error occured
+ * monotonic time in milliseconds
  */
-static int32_t s_winusbtmc_deviceindex(int32_t devicenum, winusbtmc_device_t *pdeviceinfo)
+DLL_EXPORT double winusbtmc_time_ms(void)
 {
-    struct usb_bus *bus;
-    int c, i, a, e;
-    uint32_t devicecount;
-    bool     error = false;
-    struct usb_endpoint_descriptor *endpoint;
-    usb_dev_handle *udev;
-    char     str[WINUSBTMC_USTR_MAX];
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart * 1000.0 / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#endif
+}
 
+/*
+ * wall clock time in seconds since 1970
+ */
+double winusbtmc_time_now(void)
+{
+#ifdef _WIN32
+    FILETIME ft;
+    uint64_t t;
+
+    GetSystemTimeAsFileTime(&ft);
+    t = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return (double)(t - 116444736000000000ULL) / 10000000.0;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+#endif
+}
 
-    devicecount = 0;
+/*
+ * clear a device returned by the deviceindex function of a transport, the identification strings are kept allocated
+ */
+void winusbtmc_device_clear(winusbtmc_device_t *pdev)
+{
+    winusbtmc_device_id_t *pid = pdev->id;
 
-    /* Walk through all devices associated with libusb driver
-     * YES, this is real spaghetti code :-) */
-    for (bus = usb_get_busses(); bus; bus = bus->next)
-    {
-        struct usb_device *dev;
+    memset(pdev, 0, sizeof(winusbtmc_device_t));
+    if (pid)
+        memset(pid, 0, sizeof(winusbtmc_device_id_t));
+    pdev->id = pid;
+}
 
-        /* Loop through all devices */
-        for (dev = bus->devices; dev; dev = dev->next)
-        {
-            /* Loop through all of the configurations */
-            for (c = 0; c < dev->descriptor.bNumConfigurations; c++)
-            {
-                /* Loop through all of the interfaces */
-                for (i = 0; i < dev->config[c].bNumInterfaces; i++)
-                {
-                    /* Loop through all of the alternate settings */
-                    for (a = 0; a < dev->config[c].interface[i].num_altsetting; a++)
-                    {
-                        /* Check if this interface is a usbtmc if */
-                        if ( (dev->config[c].interface[i].altsetting[a].bInterfaceClass == 0xfe) &&
-                             (dev->config[c].interface[i].altsetting[a].bInterfaceSubClass == 0x03) &&
-                             ( (dev->config[c].interface[i].altsetting[a].bInterfaceProtocol == 0x00) ||
-                               (dev->config[c].interface[i].altsetting[a].bInterfaceProtocol == 0x01))   )
-                        {
-                            if ((devicenum == devicecount) && (pdeviceinfo) )
-                            {
-                                memset(pdeviceinfo, 0, sizeof(winusbtmc_device_t));
-                                pdeviceinfo->dev              = dev;
-                                pdeviceinfo->usb_handle       = (void *)0;
-                                pdeviceinfo->usb_config       = dev->config[c].bConfigurationValue;
-                                pdeviceinfo->usb_interface    = i;
-                                pdeviceinfo->usb_alt_setting  = a;
-                                pdeviceinfo->usb_ep_bulkin    = -1;
-                                pdeviceinfo->usb_ep_bulkout   = -1;
-                                pdeviceinfo->usb_ep_interrupt = -1;
-
-                                /* identify endpoints (bulk in, bulk out, interrupt in) */
-                                for (e = 0; e < dev->config[c].interface[i].altsetting[a].bNumEndpoints; e++)
-                                {
-                                    endpoint = &dev->config[c].interface[i].altsetting[a].endpoint[e];
-                                    switch (endpoint->bmAttributes)
-                                    {
-                                        case USB_ENDPOINT_TYPE_BULK: /* bulk in or out => identify direction */
-                                            if (endpoint->bEndpointAddress & (USB_ENDPOINT_DIR_MASK))
-                                            { /* bit 7 is set => IN endpoint*/
-                                                pdeviceinfo->usb_ep_bulkin = endpoint->bEndpointAddress;
-                                            }
-                                            else
-                                            {
-                                                pdeviceinfo->usb_ep_bulkout = endpoint->bEndpointAddress;
-                                            }
-                                            break;
-                                        case USB_ENDPOINT_TYPE_INTERRUPT:
-                                            if (endpoint->bEndpointAddress & (USB_ENDPOINT_DIR_MASK))
-                                            { /* bit 7 is set => IN endpoint*/
-                                                pdeviceinfo->usb_ep_interrupt = endpoint->bEndpointAddress;
-                                            }
-                                            break;
-                                        default:
-                                            break;
-                                    }
-                                }
-
-                                /* retrieve USB string descriptors */
-                                udev = usb_open(dev);
-                                if (udev)
-                                {
-                                    if (dev->descriptor.iManufacturer)
-                                    {
-                                        if (usb_get_string_simple(udev, dev->descriptor.iManufacturer, str, WINUSBTMC_USTR_MAX - 1) > 0)
-                                        {
-                                            strtrim(str);
-                                            strlcat(pdeviceinfo->usb_uniquestring, str, WINUSBTMC_USTR_MAX);
-                                        }
-                                    }
-                                    strlcat(pdeviceinfo->usb_uniquestring, ":", WINUSBTMC_USTR_MAX);
-                                    if (dev->descriptor.iProduct)
-                                    {
-                                        if (usb_get_string_simple(udev, dev->descriptor.iProduct, str, WINUSBTMC_USTR_MAX - 1) > 0)
-                                        {
-                                            strtrim(str);
-                                            strlcat(pdeviceinfo->usb_uniquestring, str, WINUSBTMC_USTR_MAX);
-                                        }
-
-                                    }
-                                    strlcat(pdeviceinfo->usb_uniquestring, ":", WINUSBTMC_USTR_MAX);
-                                    if (dev->descriptor.iSerialNumber)
-                                    {
-                                        if (usb_get_string_simple(udev, dev->descriptor.iSerialNumber, str, WINUSBTMC_USTR_MAX - 1) > 0)
-                                        {
-                                            strtrim(str);
-                                            strlcat(pdeviceinfo->usb_uniquestring, str, WINUSBTMC_USTR_MAX);
-                                        }
-                                    }
-                                    usb_close(udev);
-                                }
-                                else
-                                {
-                                    error = true; /* device can not be opened */
-                                }
-
-                            }
-                            devicecount++;
-                        }
-                    }
-                }
-            }
-        }
-    }
-    if ( (devicenum >= 0) && (pdeviceinfo) && (devicenum >= devicecount) )
-        error = true;
+/*
+ * returns the handle of device number devnum, it contains the generation of the table entry
+ */
+static int32_t s_winusbtmc_handle(int32_t devnum)
+{
+    return devnum | ((int32_t)(s_winusbtmc_slots[devnum].generation & WINUSBTMC_HANDLE_GEN_MASK) << WINUSBTMC_HANDLE_SLOT_BITS);
+}
 
-    if (error)
-        return -1;
-    else
-        return devicecount;
+/*
+ * The device table is changed by one thread at a time (enumeration, hotplug, init / deinit), but winusbtmc_io_submit
+ * and winusbtmc_io_wait look up devices from any thread. This lock is held while the table is reallocated or a device
+ * is put into or taken out of it, and by these two functions while they look up a device. Both sides hold it only
+ * for a few instructions, so a spin lock is enough.
+ */
+static void s_winusbtmc_lock_slots(void)
+{
+    while (__atomic_test_and_set(&s_winusbtmc_slots_lock, __ATOMIC_ACQUIRE))
+    {
+#ifdef _WIN32
+        SwitchToThread();
+#else
+        sched_yield();
+#endif
+    }
 }
 
+static void s_winusbtmc_unlock_slots(void)
+{
+    __atomic_clear(&s_winusbtmc_slots_lock, __ATOMIC_RELEASE);
+}
 
 /*
- * Do initialization when device is opened the first time within this module
+ * returns the device of a handle or plain device number. If there is none, 0 is returned and *perr
+ * is set to the error code, handles of removed devices are detected by their generation.
  */
-static int32_t s_winusbtmc_first_open_init(int32_t devnum)
+static winusbtmc_device_ptr_t s_winusbtmc_device(int32_t handle, int32_t *perr)
 {
-    char  dat[200];
-    int     ret;
-
+    int32_t  devnum     = handle & WINUSBTMC_HANDLE_SLOT_MASK;
+    uint16_t generation = (handle >> WINUSBTMC_HANDLE_SLOT_BITS) & WINUSBTMC_HANDLE_GEN_MASK;
 
-    if (usb_claim_interface(g_winusbtmc_deviceinfo_ptr[devnum]->usb_handle, g_winusbtmc_deviceinfo_ptr[devnum]->usb_interface) < 0)
+    if (handle < 0)
     {
-        return WINUSBTMC_ERR_FIRST_INIT_FAILED;
+        *perr = WINUSBTMC_ERR_INVALID_PARAMETER;
+        return (void *)0;
     }
-
-    if (usb_set_configuration(g_winusbtmc_deviceinfo_ptr[devnum]->usb_handle, g_winusbtmc_deviceinfo_ptr[devnum]->usb_config) < 0)
+    if ( (generation != 0) && (devnum < s_winusbtmc_slots_alloc) &&
+         (generation != (s_winusbtmc_slots[devnum].generation & WINUSBTMC_HANDLE_GEN_MASK)) )
     {
-        return WINUSBTMC_ERR_FIRST_INIT_FAILED;
+        *perr = WINUSBTMC_ERR_DEVICE_CHANGED;
+        return (void *)0;
     }
-
- /*   if (usb_set_altinterface(g_winusbtmc_deviceinfo_ptr[devnum]->usb_handle, g_winusbtmc_deviceinfo_ptr[devnum]->usb_alt_setting) < 0)
+    if ( (devnum >= s_winusbtmc_slots_used) || (!s_winusbtmc_slots[devnum].pdev) )
     {
-        return WINUSBTMC_ERR_FIRST_INIT_FAILED;
-    }*/
+        *perr = WINUSBTMC_ERR_DEVICE_NOT_PRESENT;
+        return (void *)0;
+    }
+    return s_winusbtmc_slots[devnum].pdev;
+}
 
+/*
+ * returns the lowest free device number, the table is grown if it is full. -1 if out of memory
+ */
+static int32_t s_winusbtmc_alloc_slot(void)
+{
+    winusbtmc_slot_t *pslots;
+    int32_t           devnum, count;
 
+    for (devnum = s_winusbtmc_slots_free; (devnum < s_winusbtmc_slots_alloc) && (s_winusbtmc_slots[devnum].pdev); devnum++)
+        ;
+    s_winusbtmc_slots_free = devnum;
+    if (devnum < s_winusbtmc_slots_alloc)
+        return devnum;
+
+    if (s_winusbtmc_slots_alloc > WINUSBTMC_HANDLE_SLOT_MASK / 2)
+        return -1; /* no more device numbers which fit into a handle */
+    count  = (s_winusbtmc_slots_alloc) ? s_winusbtmc_slots_alloc * 2 : 32;
+    s_winusbtmc_lock_slots(); /* the table moves */
+    pslots = realloc(s_winusbtmc_slots, count * sizeof(winusbtmc_slot_t));
+    if (!pslots)
+    {
+        s_winusbtmc_unlock_slots();
+        return -1;
+    }
+    for (devnum = s_winusbtmc_slots_alloc; devnum < count; devnum++)
+    {
+        pslots[devnum].pdev       = (void *)0;
+        pslots[devnum].generation = 1; /* generation 0 is reserved for plain device numbers */
+    }
+    s_winusbtmc_slots       = pslots;
+    devnum                  = s_winusbtmc_slots_alloc;
+    s_winusbtmc_slots_alloc = count;
+    s_winusbtmc_unlock_slots();
+    return devnum;
+}
 
-    /* get capabilities */
-    ret = usb_control_msg(g_winusbtmc_deviceinfo_ptr[devnum]->usb_handle, USB_TYPE_CLASS | USB_RECIP_INTERFACE | USB_ENDPOINT_IN,
-                      7, /*  */
-                      0,  /* value */
-                      g_winusbtmc_deviceinfo_ptr[devnum]->usb_interface,  /* interface id */
-                      dat, 0x18, WINUSBTMC_TIMEOUT);
+/*
+ * returns the device number of the device of transport ptransport at location, -1 if not in the table
+ */
+static int32_t s_winusbtmc_find_location(const winusbtmc_transport_t *ptransport, const char *location)
+{
+    int32_t i;
 
+    for (i = 0; i < s_winusbtmc_slots_used; i++)
+    {
+        if ( (s_winusbtmc_slots[i].pdev) &&
+             (s_winusbtmc_slots[i].pdev->transport == ptransport) &&
+             (strcmp(s_winusbtmc_slots[i].pdev->id->location, location) == 0) )
+        {
+            return i;
+        }
+    }
+    return -1;
+}
 
+/*
+ * remove a device from the table, closes it if it was opened.
+ * The generation of the entry changes, so handles of the device are not valid anymore.
+ */
+static void s_winusbtmc_remove(int32_t devnum)
+{
+    winusbtmc_slot_t      *pslot;
+    winusbtmc_device_ptr_t pdev;
+
+    /* taken out of the table first, so winusbtmc_io_submit of another thread does not find it any more */
+    s_winusbtmc_lock_slots();
+    pslot       = &s_winusbtmc_slots[devnum];
+    pdev        = pslot->pdev;
+    pslot->pdev = (void *)0;
+    pslot->generation++;
+    if ((pslot->generation & WINUSBTMC_HANDLE_GEN_MASK) == 0)
+        pslot->generation++;
+
+    if (devnum < s_winusbtmc_slots_free)
+        s_winusbtmc_slots_free = devnum;
+    while ( (s_winusbtmc_slots_used > 0) && (!s_winusbtmc_slots[s_winusbtmc_slots_used - 1].pdev) )
+        s_winusbtmc_slots_used--;
+    s_winusbtmc_unlock_slots();
+
+    winusbtmc_io_end(pdev);
+    winusbtmc_acquire_end(pdev);
+    if (pdev->opened)
+    {
+        pdev->transport->close(pdev);
+    }
+    winusbtmc_rcache_enable(pdev, false);
+    winusbtmc_profiler_enable(pdev, false);
+    free(pdev->send_buf);
+    free(pdev->id);
+    free(pdev);
+}
 
-    /* unkown request */
-    ret = usb_control_msg(g_winusbtmc_deviceinfo_ptr[devnum]->usb_handle, USB_TYPE_CLASS | USB_RECIP_INTERFACE | USB_ENDPOINT_IN,
-                      0xa0, /*  */
-                      1,  /* value */
-                      g_winusbtmc_deviceinfo_ptr[devnum]->usb_interface,  /* interface id */
-                      dat, 0x1, WINUSBTMC_TIMEOUT);
+/*
+ * bring the device table up to date with the devices currently present at one transport.
+ * Devices which are still present keep their device number and their open handle,
+ * removed devices are closed and free their device number, new devices get the lowest free
+ * device number. The descriptor strings of new devices are fetched later by s_winusbtmc_fetch_strings,
+ * so counting devices does not need any usb transfers.
+ */
+static void s_winusbtmc_update(const winusbtmc_transport_t *ptransport)
+{
+    winusbtmc_device_t     devinfo;
+    winusbtmc_device_id_t  id;
+    winusbtmc_device_ptr_t pdevinfo;
+    bool                  *seen;
+    int32_t                count, i, devnum;
 
+    count = ptransport->deviceindex(-1, (void *)0);
 
+    /* new devices get numbers up to the current end of the table + count */
+    seen = calloc(s_winusbtmc_slots_used + count + 1, sizeof(bool));
+    if (!seen)
+        return;
 
+    devinfo.id = &id;
+    for (i = 0; i < count; i++)
+    {
+        if (ptransport->deviceindex(i, &devinfo) < 0)
+            continue;
+
+        devnum = s_winusbtmc_find_location(ptransport, id.location);
+        if (devnum >= 0)
+        { /* known device, the usb device structure may have been reallocated by the rescan */
+            s_winusbtmc_slots[devnum].pdev->dev = devinfo.dev;
+            seen[devnum] = true;
+            continue;
+        }
 
-    #if 0
-    /* commented out, because these class commands are not implemented in some usbtmc class devices,
-       allthough they are mandatory according to the USBTMC standard.
-       One example for such devices is the Rigol DS2000 series (DS1000 supports them well!) */
-    /* send INITIATE_CLEAR class command */
-    ret = usb_control_msg(g_winusbtmc_deviceinfo_ptr[devnum]->usb_handle,
-                          USB_TYPE_CLASS | USB_RECIP_INTERFACE | USB_ENDPOINT_IN,
-                          6, /* check_clear_status */
-                          0,  /* value */
-                          g_winusbtmc_deviceinfo_ptr[devnum]->usb_interface,  /* interface id */
-                          dat,
-                          2,
-                          WINUSBTMC_TIMEOUT);
+        devnum = s_winusbtmc_alloc_slot();
+        if (devnum < 0)
+            break;
 
-    if (ret < 0)
-    {
-        return WINUSBTMC_ERR_FIRST_INIT_FAILED;
+        pdevinfo = malloc(sizeof(winusbtmc_device_t));
+        if (!pdevinfo)
+            break;
+        memcpy(pdevinfo, &devinfo, sizeof(winusbtmc_device_t));
+        pdevinfo->id = malloc(sizeof(winusbtmc_device_id_t));
+        if (!pdevinfo->id)
+        {
+            free(pdevinfo);
+            break;
+        }
+        memcpy(pdevinfo->id, &id, sizeof(winusbtmc_device_id_t));
+        pdevinfo->id->strings_valid  = (s_winusbtmc_cache_filename[0]) && (winusbtmc_cache_lookup(pdevinfo));
+        pdevinfo->id->strings_cached = pdevinfo->id->strings_valid;
+        s_winusbtmc_lock_slots();
+        s_winusbtmc_slots[devnum].pdev = pdevinfo;
+        if (devnum >= s_winusbtmc_slots_used)
+            s_winusbtmc_slots_used = devnum + 1;
+        s_winusbtmc_unlock_slots();
+        seen[devnum] = true;
     }
 
-    /* send CHECK_CLEAR_STATUS class command*/
-    ret = usb_control_msg(g_winusbtmc_deviceinfo_ptr[devnum]->usb_handle,
-                          USB_TYPE_CLASS | USB_RECIP_INTERFACE | USB_ENDPOINT_IN,
-                          6, /* check_clear_status */
-                          0,  /* value */
-                          g_winusbtmc_deviceinfo_ptr[devnum]->usb_interface,  /* interface id */
-                          dat,
-                          2,
-                          WINUSBTMC_TIMEOUT);
-    if (ret < 0)
+    for (devnum = s_winusbtmc_slots_used - 1; devnum >= 0; devnum--)
     {
-        return WINUSBTMC_ERR_FIRST_INIT_FAILED;
+        if ( (s_winusbtmc_slots[devnum].pdev) &&
+             (s_winusbtmc_slots[devnum].pdev->transport == ptransport) &&
+             (!seen[devnum]) &&
+             (!s_winusbtmc_slots[devnum].pdev->io) ) /* kept until winusbtmc_io_stop, its requests fail */
+        {
+            s_winusbtmc_remove(devnum);
+        }
     }
-    usb_resetep(g_winusbtmc_deviceinfo_ptr[devnum]->usb_handle, 0x01);
-    #endif
+    free(seen);
+}
 
-    return WINUSBTMC_ERR_NONE;
+/*
+ * write all devices of the table to the enumeration cache file, if the cache is enabled
+ */
+static void s_winusbtmc_cache_update(void)
+{
+    winusbtmc_device_ptr_t *devices;
+    int32_t                 i, count;
+
+    if (!s_winusbtmc_cache_filename[0])
+        return;
+
+    devices = malloc((s_winusbtmc_slots_used + 1) * sizeof(winusbtmc_device_ptr_t));
+    if (!devices)
+        return;
+    count = 0;
+    for (i = 0; i < s_winusbtmc_slots_used; i++)
+    {
+        if (s_winusbtmc_slots[i].pdev)
+            devices[count++] = s_winusbtmc_slots[i].pdev;
+    }
+    winusbtmc_cache_save(s_winusbtmc_cache_filename, devices, count);
+    free(devices);
 }
 
-static int32_t s_winusbtmc_device_open(int32_t devnum)
+/*
+ * worker pool for fetching descriptor strings. Each worker takes the next device from the job list
+ * until it is empty, so the time needed is bounded by the slowest device instead of the sum of all.
+ */
+typedef struct
 {
-    int32_t ret;
-    bool    firstopen;
-    winusbtmc_device_ptr_t pdevinfo;
+    winusbtmc_device_ptr_t *devices;
+    int32_t                 count;
+    volatile int32_t        next;        /* next job to take, incremented atomically */
+} winusbtmc_fetch_jobs_t;
+
+#ifdef _WIN32
+static DWORD WINAPI s_winusbtmc_fetch_worker(LPVOID arg)
+#else
+static void *s_winusbtmc_fetch_worker(void *arg)
+#endif
+{
+    winusbtmc_fetch_jobs_t *pjobs = arg;
+    int32_t                 i;
 
-    firstopen = false;
+    while ((i = __sync_fetch_and_add(&pjobs->next, 1)) < pjobs->count)
+    {
+        /* devices which can not be opened keep an empty string and are retried next time */
+        pjobs->devices[i]->id->strings_valid = ( (!pjobs->devices[i]->transport->uniquestring) ||
+                                                 (pjobs->devices[i]->transport->uniquestring(pjobs->devices[i]) >= 0) );
+    }
+    return 0;
+}
 
-    /* allocate memory for deviceinfo structure and do initial prefill */
-    if (!g_winusbtmc_deviceinfo_ptr[devnum])
-    { /* we come here if the devices was opened the very first time */
-        firstopen = true;
-        pdevinfo = malloc(sizeof(winusbtmc_device_t));
-        if (!pdevinfo)
+/*
+ * fetch the descriptor strings of all devices in the table which do not have them yet.
+ * Only needed when device strings are accessed, not for counting or transfers.
+ */
+static void s_winusbtmc_fetch_strings(void)
+{
+    winusbtmc_fetch_jobs_t jobs;
+    int32_t                i, threads, started;
+#ifdef _WIN32
+    HANDLE                 thread[WINUSBTMC_FETCH_THREADS];
+#else
+    pthread_t              thread[WINUSBTMC_FETCH_THREADS];
+#endif
+
+    jobs.count = 0;
+    jobs.next  = 0;
+    for (i = 0; i < s_winusbtmc_slots_used; i++)
+    {
+        if ( (s_winusbtmc_slots[i].pdev) && (!s_winusbtmc_slots[i].pdev->id->strings_valid) )
         {
-            return WINUSBTMC_ERR_MALLOC_FAILED;
+            jobs.count++;
         }
+    }
+    if (jobs.count == 0)
+        return;
 
-        g_winusbtmc_deviceinfo_ptr[devnum] = pdevinfo;
-        ret = s_winusbtmc_deviceindex(devnum, pdevinfo);
-        if (ret < 0 )
+    jobs.devices = malloc(s_winusbtmc_slots_used * sizeof(winusbtmc_device_ptr_t));
+    if (!jobs.devices)
+        return;
+    jobs.count = 0;
+    for (i = 0; i < s_winusbtmc_slots_used; i++)
+    {
+        if ( (s_winusbtmc_slots[i].pdev) && (!s_winusbtmc_slots[i].pdev->id->strings_valid) )
         {
-            free(g_winusbtmc_deviceinfo_ptr[devnum]);
-            g_winusbtmc_deviceinfo_ptr[devnum] = (void *)0;
-            return WINUSBTMC_ERR_CANNOT_OPEN_DEVICE;
+            jobs.devices[jobs.count++] = s_winusbtmc_slots[i].pdev;
         }
     }
 
-    /* check if device is already open */
-    if (!g_winusbtmc_deviceinfo_ptr[devnum]->usb_handle)
+    threads = (jobs.count < WINUSBTMC_FETCH_THREADS) ? jobs.count : WINUSBTMC_FETCH_THREADS;
+
+    /* the calling thread is a worker as well, so a single device does not start any thread */
+    started = 0;
+    for (i = 0; i < threads - 1; i++)
+    {
+#ifdef _WIN32
+        thread[started] = CreateThread(NULL, 0, s_winusbtmc_fetch_worker, &jobs, 0, NULL);
+        if (thread[started] == NULL)
+            break;
+#else
+        if (pthread_create(&thread[started], NULL, s_winusbtmc_fetch_worker, &jobs) != 0)
+            break;
+#endif
+        started++;
+    }
+    s_winusbtmc_fetch_worker(&jobs);
+
+#ifdef _WIN32
+    if (started > 0)
+        WaitForMultipleObjects(started, thread, TRUE, INFINITE);
+    for (i = 0; i < started; i++)
+        CloseHandle(thread[i]);
+#else
+    for (i = 0; i < started; i++)
+        pthread_join(thread[i], NULL);
+#endif
+
+    free(jobs.devices);
+    s_winusbtmc_cache_update();
+}
+
+/*
+ * returns the handle of the first device whose string begins with pstr (case insensitive)
+ */
+static int32_t s_winusbtmc_find_string(const char *pstr)
+{
+    int32_t i;
+    size_t  len;
+
+    len = strlen(pstr);
+    for (i = 0; i < s_winusbtmc_slots_used; i++)
     {
-        g_winusbtmc_deviceinfo_ptr[devnum]->usb_handle = usb_open(g_winusbtmc_deviceinfo_ptr[devnum]->dev);
+        if ( (s_winusbtmc_slots[i].pdev) &&
+             (strncasecmp(s_winusbtmc_slots[i].pdev->id->usb_uniquestring, pstr, len) == 0) )
+        {
+            return s_winusbtmc_handle(i);
+        }
+    }
+    return WINUSBTMC_ERR_DEVICE_NOT_PRESENT;
+}
+
+/*
+ * process hotplug notifications of all transports, only transports which report a change are updated
+ */
+static void s_winusbtmc_hotplug(void)
+{
+    int t;
 
-        if (!g_winusbtmc_deviceinfo_ptr[devnum]->usb_handle)
+    for (t = 0; s_winusbtmc_transports[t]; t++)
+    {
+        if (s_winusbtmc_transports[t]->changed())
         {
-            return WINUSBTMC_ERR_CANNOT_OPEN_DEVICE;
+            s_winusbtmc_update(s_winusbtmc_transports[t]);
         }
     }
+}
+
+static int32_t s_winusbtmc_device_open(winusbtmc_device_ptr_t pdev)
+{
+    int32_t ret;
 
-    /* device is opened */
-    if (firstopen)
-    { /* device is opened the first time... do some initialization */
-        ret = s_winusbtmc_first_open_init(devnum);
+    /* check if device is already open, the transport does the first time initialization */
+    if (!pdev->opened)
+    {
+        ret = pdev->transport->open(pdev);
         if (ret < 0)
+        {
             return ret;
+        }
+        pdev->opened = true;
+        winusbtmc_rcache_opened(pdev);
+        winusbtmc_profiler_opened(pdev);
     }
 
-
     return WINUSBTMC_ERR_NONE;
 }
 
 /*
- * eom gets true, if the complete message was received
- * maxlen = max. amount of data to receive
- * returns the count of received bytes
+ * send a message or receive a part of a response through the response cache and the profiler if enabled
  */
-static int32_t s_winusbtmc_receive_data(int32_t devnum, char *str, uint32_t maxlen, bool *eom)
+int32_t winusbtmc_device_write(winusbtmc_device_ptr_t pdev, const char *dat, uint32_t len)
 {
-    char *dat;
-    winusbtmc_bulkout_header_t hdr;
-    int ret;
-    uint32_t reclen;
+    int32_t ret;
 
-    dat = malloc(maxlen + sizeof(winusbtmc_bulkout_header_t) + 4);
-    if (!dat)
+    if (pdev->profiler)
     {
-        return WINUSBTMC_ERR_MALLOC_FAILED;
+        winusbtmc_profiler_send(pdev, dat, len);
     }
-
-    hdr.MsgID        = WINUSBTMC_DEV_DEP_MSG_IN;
-    hdr.bTag         = g_winusbtmc_deviceinfo_ptr[devnum]->winusbtmc_bTag++;
-    hdr.bTagInverse  = hdr.bTag ^ 0xff;
-    hdr.Rsvd1        = 0;
-    hdr.TransferSize = maxlen;
-    hdr.bmTransferAttributes = 0x00;
-    hdr.Rsvd2        = 0;
-    hdr.Rsvd3        = 0;
-    hdr.Rsvd4        = 0;
-    ret = usb_bulk_write( g_winusbtmc_deviceinfo_ptr[devnum]->usb_handle,
-                          g_winusbtmc_deviceinfo_ptr[devnum]->usb_ep_bulkout,
-                          (char *)&hdr, sizeof(hdr), WINUSBTMC_TIMEOUT);
-
-    if (ret < 0)
+    if (pdev->rcache)
     {
-        free(dat);
-        return WINUSBTMC_ERR_BULKOUT_FAILED;
+        ret = winusbtmc_rcache_write(pdev, dat, len);
     }
-    ret = usb_bulk_read( g_winusbtmc_deviceinfo_ptr[devnum]->usb_handle,
-                         g_winusbtmc_deviceinfo_ptr[devnum]->usb_ep_bulkin,
-                         dat, maxlen + sizeof(winusbtmc_bulkout_header_t) + 4, WINUSBTMC_TIMEOUT);
-
-    if (ret < 0)
+    else
+    {
+        ret = pdev->transport->write(pdev, dat, len);
+    }
+    if (pdev->profiler)
     {
-        free(dat);
-        return WINUSBTMC_ERR_BULKIN_FAILED;
+        winusbtmc_profiler_sent(pdev, ret);
     }
+    return ret;
+}
 
-    reclen = ((winusbtmc_bulkout_header_t*)dat)->TransferSize;
-    memcpy(str, &dat[sizeof(winusbtmc_bulkout_header_t)], reclen);
+int32_t winusbtmc_device_read(winusbtmc_device_ptr_t pdev, char *dat, uint32_t maxlen, bool *eom)
+{
+    int32_t ret;
 
-    if (eom)
+    if (pdev->rcache)
     {
-        *eom = ( ((winusbtmc_bulkout_header_t*)dat)->bmTransferAttributes == 0x01 );
+        ret = winusbtmc_rcache_read(pdev, dat, maxlen, eom);
     }
-
-    free(dat);
-    return reclen;
+    else
+    {
+        ret = pdev->transport->read(pdev, dat, maxlen, eom);
+    }
+    if (pdev->profiler)
+    {
+        winusbtmc_profiler_received(pdev, ret, (ret >= 0) && (*eom));
+    }
+    return ret;
 }
 
-/* Initializes the module automatically if needed and opens device if devnum >= 0*/
-int32_t s_winusbtmc_preinitcheck(int32_t devnum)
+/* Initializes the module automatically if needed and opens the device of handle if it is >= 0.
+ * *ppdev is set to the device */
+int32_t s_winusbtmc_preinitcheck(int32_t handle, winusbtmc_device_ptr_t *ppdev)
 {
-    if ((devnum < -1) | (devnum >= WINUSBTMC_MAX_DEVNUM))
+    winusbtmc_device_ptr_t pdev;
+    int32_t                ret;
+
+    if (handle < -1)
     {
         return WINUSBTMC_ERR_INVALID_PARAMETER;
     }
@@ -485,11 +662,25 @@ int32_t s_winusbtmc_preinitcheck(int32_t devnum)
     {
         winusbtmc_init();
     }
+    else if (handle < 0)
+    {
+        s_winusbtmc_hotplug();
+    }
+    else
+    { /* transfers to opened devices do not need to know about other devices */
+        pdev = s_winusbtmc_device(handle, &ret);
+        if ( (!pdev) || (!pdev->opened) )
+            s_winusbtmc_hotplug();
+    }
 
-    if (devnum >= 0)
-        return s_winusbtmc_device_open(devnum);
+    if (handle < 0)
+        return WINUSBTMC_ERR_NONE;
 
-    return WINUSBTMC_ERR_NONE;
+    pdev = s_winusbtmc_device(handle, &ret);
+    if (!pdev)
+        return ret;
+    *ppdev = pdev;
+    return s_winusbtmc_device_open(pdev);
 }
 
 
@@ -501,31 +692,33 @@ int32_t s_winusbtmc_preinitcheck(int32_t devnum)
 
 DLL_EXPORT void winusbtmc_init(void)
 {
+    int t;
+
     s_winusbtmc_initialized = true;
-    memset(g_winusbtmc_deviceinfo_ptr, 0, sizeof(g_winusbtmc_deviceinfo_ptr));
 
-    usb_init();                            /* initialize the library */
-    usb_find_busses();                     /* find all busses */
-    usb_find_devices();                    /* find all connected devices */
+    winusbtmc_usbport_init();              /* initialize the usb library and find all connected devices */
+
+    for (t = 0; s_winusbtmc_transports[t]; t++)
+    {
+        s_winusbtmc_transports[t]->changed(); /* a full update follows, drop pending notifications */
+        s_winusbtmc_update(s_winusbtmc_transports[t]);
+    }
 }
 
 DLL_EXPORT void winusbtmc_deinit(void)
 {
-    int i;
+    int32_t i;
 
-    for (i=0; i < WINUSBTMC_MAX_DEVNUM; i++)
+    /* the table itself is kept, so the generations still detect handles from before */
+    for (i = s_winusbtmc_slots_used - 1; i >= 0; i--)
     {
-        if (g_winusbtmc_deviceinfo_ptr[i])
+        if (s_winusbtmc_slots[i].pdev)
         {
-            if (g_winusbtmc_deviceinfo_ptr[i]->usb_handle)
-            {
-                usb_release_interface(g_winusbtmc_deviceinfo_ptr[i]->usb_handle, g_winusbtmc_deviceinfo_ptr[i]->usb_interface);
-                usb_close(g_winusbtmc_deviceinfo_ptr[i]->usb_handle);
-            }
-            free(g_winusbtmc_deviceinfo_ptr[i]);
-            g_winusbtmc_deviceinfo_ptr[i] = (void *)0;
+            s_winusbtmc_remove(i);
         }
     }
+    winusbtmc_usbport_deinit();
+    s_winusbtmc_initialized = false;
 }
 
 
@@ -533,29 +726,27 @@ DLL_EXPORT int32_t winusbtmc_get_device_count(void)
 {
     int32_t ret;
 
-    ret = s_winusbtmc_preinitcheck(-1);
+    ret = s_winusbtmc_preinitcheck(-1, (void *)0);
     if (ret < 0)
     {
         return ret;
     }
-    return s_winusbtmc_deviceindex(-1, 0);
+
+    /* device numbers are stable, so removed devices can leave gaps */
+    return s_winusbtmc_slots_used;
 }
 
 
 DLL_EXPORT void winusbtmc_get_device_string(int32_t devnum, char *str, int strln)
 {
-    winusbtmc_device_t devinfo;
-    int32_t ret;
+    winusbtmc_device_ptr_t pdev;
+    int32_t                ret;
 
-    ret = s_winusbtmc_preinitcheck(-1);
-    if (ret < 0)
-    {
-        return;
-    }
-
-    if (s_winusbtmc_deviceindex(devnum, &devinfo))
+    ret = s_winusbtmc_preinitcheck(-1, (void *)0);
+    if ( (ret >= 0) && ((pdev = s_winusbtmc_device(devnum, &ret)) != (void *)0) )
     {
-        strlcpy(str, devinfo.usb_uniquestring, strln);
+        s_winusbtmc_fetch_strings(); /* all missing strings at once, the caller usually iterates over all devices */
+        s_strlcpy(str, pdev->id->usb_uniquestring, strln);
     }
     else if (strln > 0)
     {
@@ -566,130 +757,480 @@ DLL_EXPORT void winusbtmc_get_device_string(int32_t devnum, char *str, int strln
 
 DLL_EXPORT int32_t winusbtmc_find_devnum_by_string(const char *pstr)
 {
-    winusbtmc_device_t devinfo;
-    int32_t         devcnt, i, err;
-    bool            found;
+    int32_t         i;
+    bool            cached;
     int32_t         ret;
+    char            address[WINUSBTMC_USTR_MAX];
 
-    ret = s_winusbtmc_preinitcheck(-1);
+    ret = s_winusbtmc_preinitcheck(-1, (void *)0);
     if (ret < 0)
     {
         return ret;
     }
 
-    devcnt = winusbtmc_get_device_count();
-    if (devcnt < 0)
+    /* LAN instruments can not be enumerated, they are added when they are addressed the first time */
+    if (winusbtmc_tcp_register(pstr, address) >= 0)
+    {
+        pstr = address;
+        s_winusbtmc_hotplug();
+    }
+    s_winusbtmc_fetch_strings();
+
+    ret = s_winusbtmc_find_string(pstr);
+    if (ret >= 0)
     {
-        return WINUSBTMC_ERR_DEVICE_NOT_PRESENT;
+        return ret;
     }
 
-    i = 0;
-    do
+    /* not found, do not trust the enumeration cache and read the strings from the devices */
+    cached = false;
+    for (i = 0; i < s_winusbtmc_slots_used; i++)
     {
-        err = s_winusbtmc_deviceindex(i, &devinfo);
-        if ( strlen(devinfo.usb_uniquestring) > strlen(pstr) )
+        if ( (s_winusbtmc_slots[i].pdev) && (s_winusbtmc_slots[i].pdev->id->strings_cached) )
         {
-            devinfo.usb_uniquestring[strlen(pstr)] = '\0';
+            s_winusbtmc_slots[i].pdev->id->strings_valid  = false;
+            s_winusbtmc_slots[i].pdev->id->strings_cached = false;
+            cached = true;
         }
-        found  = ( 0 == strcasecmp(devinfo.usb_uniquestring, pstr) );
-        i++;
     }
-    while ( (i < devcnt) && (err >= 0) && (!found) );
+    if (cached)
+    {
+        s_winusbtmc_fetch_strings();
+        ret = s_winusbtmc_find_string(pstr);
+    }
+
+    return ret;
+}
+
 
-    if (found)
+DLL_EXPORT void winusbtmc_set_cache_file(const char *filename)
+{
+    if ( (!filename) || (strlen(filename) >= sizeof(s_winusbtmc_cache_filename)) )
     {
-        return --i;
+        s_winusbtmc_cache_filename[0] = '\0';
+        return;
     }
-    else
+    strcpy(s_winusbtmc_cache_filename, filename);
+    winusbtmc_cache_load(s_winusbtmc_cache_filename);
+}
+
+
+DLL_EXPORT int32_t winusbtmc_response_cache(int32_t devnum, bool enable)
+{
+    winusbtmc_device_ptr_t pdev;
+    int32_t                ret, i;
+
+    if (devnum == -1)
+    { /* opened devices are changed now, the others when they are opened */
+        winusbtmc_rcache_all(enable);
+        for (i = 0; i < s_winusbtmc_slots_used; i++)
+        {
+            pdev = s_winusbtmc_slots[i].pdev;
+            if ( (pdev) && (pdev->opened) && (!pdev->io) )
+            {
+                ret = winusbtmc_rcache_enable(pdev, enable);
+                if (ret < 0)
+                {
+                    return ret;
+                }
+            }
+        }
+        return WINUSBTMC_ERR_NONE;
+    }
+
+    ret = s_winusbtmc_preinitcheck(devnum, &pdev);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    if (pdev->io)
     {
-        return WINUSBTMC_ERR_DEVICE_NOT_PRESENT;
+        return WINUSBTMC_ERR_DEVICE_BUSY;
     }
+    return winusbtmc_rcache_enable(pdev, enable);
 }
 
 
-DLL_EXPORT int32_t winusbtmc_send_string(int32_t devnum, const char *str)
+DLL_EXPORT int32_t winusbtmc_profile(int32_t devnum, bool enable)
+{
+    winusbtmc_device_ptr_t pdev;
+    int32_t                ret, i;
+
+    if (devnum == -1)
+    { /* opened devices are changed now, the others when they are opened */
+        winusbtmc_profiler_all(enable);
+        for (i = 0; i < s_winusbtmc_slots_used; i++)
+        {
+            pdev = s_winusbtmc_slots[i].pdev;
+            if ( (pdev) && (pdev->opened) && (!pdev->io) )
+            {
+                ret = winusbtmc_profiler_enable(pdev, enable);
+                if (ret < 0)
+                {
+                    return ret;
+                }
+            }
+        }
+        return WINUSBTMC_ERR_NONE;
+    }
+
+    ret = s_winusbtmc_preinitcheck(devnum, &pdev);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    if (pdev->io)
+    {
+        return WINUSBTMC_ERR_DEVICE_BUSY;
+    }
+    return winusbtmc_profiler_enable(pdev, enable);
+}
+
+DLL_EXPORT int32_t winusbtmc_profile_report(int32_t devnum, winusbtmc_profile_entry_t *entries, uint32_t maxcount)
+{
+    winusbtmc_device_ptr_t pdev;
+    int32_t                ret;
+
+    if ( (!entries) && (maxcount > 0) )
+    {
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    }
+    pdev = s_winusbtmc_device(devnum, &ret); /* devices which were not opened have no profile */
+    if (!pdev)
+    {
+        return ret;
+    }
+    if (pdev->io)
+    { /* the I/O thread adds to the profile without a lock */
+        return WINUSBTMC_ERR_DEVICE_BUSY;
+    }
+    return winusbtmc_profiler_report(pdev, entries, maxcount);
+}
+
+
+DLL_EXPORT int32_t winusbtmc_acquire_start(int32_t devnum, const char *query, uint32_t buffers, uint32_t size)
+{
+    winusbtmc_device_ptr_t pdev;
+    int32_t                ret;
+
+    ret = s_winusbtmc_preinitcheck(devnum, &pdev);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    return winusbtmc_acquire_begin(pdev, query, buffers, size);
+}
+
+DLL_EXPORT int32_t winusbtmc_acquire_get(int32_t devnum, winusbtmc_acquire_buffer_t *pbuf, int32_t timeout_ms)
+{
+    winusbtmc_device_ptr_t pdev;
+    int32_t                ret;
+
+    /* only the running acquisition is accessed, the device table is not updated */
+    pdev = s_winusbtmc_device(devnum, &ret);
+    if (!pdev)
+    {
+        return ret;
+    }
+    return winusbtmc_acquire_next(pdev, pbuf, timeout_ms);
+}
+
+DLL_EXPORT int32_t winusbtmc_acquire_release(int32_t devnum)
+{
+    winusbtmc_device_ptr_t pdev;
+    int32_t                ret;
+
+    pdev = s_winusbtmc_device(devnum, &ret);
+    if (!pdev)
+    {
+        return ret;
+    }
+    return winusbtmc_acquire_done(pdev);
+}
+
+DLL_EXPORT int32_t winusbtmc_acquire_stop(int32_t devnum)
 {
-    char     *dat;
-    uint32_t  len;
-    int       ret;
+    winusbtmc_device_ptr_t pdev;
+    int32_t                ret;
 
-    ret = s_winusbtmc_preinitcheck(devnum);
+    pdev = s_winusbtmc_device(devnum, &ret);
+    if (!pdev)
+    {
+        return ret;
+    }
+    return winusbtmc_acquire_end(pdev);
+}
+
+
+DLL_EXPORT int32_t winusbtmc_io_start(int32_t devnum, int32_t cpu)
+{
+    winusbtmc_device_ptr_t pdev;
+    int32_t                ret;
+
+    ret = s_winusbtmc_preinitcheck(devnum, &pdev);
     if (ret < 0)
     {
         return ret;
     }
+    return winusbtmc_io_begin(pdev, cpu);
+}
+
+DLL_EXPORT int32_t winusbtmc_io_submit(int32_t devnum, winusbtmc_io_request_t *request)
+{
+    winusbtmc_device_ptr_t pdev;
+    int32_t                ret;
+
+    /* no hotplug check, the device is opened while its thread runs. The lock keeps the device in the table until
+     * the request is queued, queueing never waits */
+    s_winusbtmc_lock_slots();
+    pdev = s_winusbtmc_device(devnum, &ret);
+    if (pdev)
+    {
+        ret = winusbtmc_io_queue(pdev, request);
+    }
+    s_winusbtmc_unlock_slots();
+    return ret;
+}
+
+DLL_EXPORT int32_t winusbtmc_io_wait(int32_t devnum, winusbtmc_io_request_t *request, int32_t timeout_ms)
+{
+    winusbtmc_device_ptr_t pdev;
+    int32_t                ret;
+
+    /* a device with a running I/O thread stays in the table, so it can be used after the lock is released */
+    s_winusbtmc_lock_slots();
+    pdev = s_winusbtmc_device(devnum, &ret);
+    if ( (pdev) && (!pdev->io) )
+    { /* no thread, returns the state of the request at once */
+        ret  = winusbtmc_io_result(pdev, request, timeout_ms);
+        pdev = (void *)0;
+    }
+    s_winusbtmc_unlock_slots();
+    if (!pdev)
+    {
+        return ret;
+    }
+    return winusbtmc_io_result(pdev, request, timeout_ms);
+}
 
-    len = strlen(str);
-    dat = malloc(len + sizeof(winusbtmc_bulkout_header_t) + 5);
+DLL_EXPORT int32_t winusbtmc_io_stop(int32_t devnum)
+{
+    const winusbtmc_transport_t *ptransport;
+    winusbtmc_device_ptr_t       pdev;
+    int32_t                      ret;
 
-    if (!dat)
+    pdev = s_winusbtmc_device(devnum, &ret);
+    if (!pdev)
+    {
+        return ret;
+    }
+    ptransport = pdev->transport;
+    ret        = winusbtmc_io_end(pdev);
+    s_winusbtmc_update(ptransport); /* removes the device if it was unplugged while its thread ran */
+    return ret;
+}
+
+
+DLL_EXPORT int32_t winusbtmc_calibrate(int32_t devnum, const char *query)
+{
+    winusbtmc_device_ptr_t pdev;
+    char                  *buf;
+    uint32_t               size, aligned, packet, best;
+    double                 start, ms, bytes, rate, bestrate;
+    int32_t                ret, i;
+    bool                   eom, pending;
+
+    ret = s_winusbtmc_preinitcheck(devnum, &pdev);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    if ( (pdev->acquire) || (pdev->io) )
+    {
+        return WINUSBTMC_ERR_DEVICE_BUSY;
+    }
+    if (pdev->transport != &winusbtmc_transport_usb)
+    { /* the other transports do not build usbtmc transfers themselves */
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    }
+
+    buf = malloc(WINUSBTMC_CALIBRATE_MAX);
+    if (!buf)
     {
         return WINUSBTMC_ERR_MALLOC_FAILED;
     }
 
-    ((winusbtmc_bulkout_header_t*)dat)->MsgID = WINUSBTMC_DEV_DEP_MSG_OUT;
-    ((winusbtmc_bulkout_header_t*)dat)->bTag  = g_winusbtmc_deviceinfo_ptr[devnum]->winusbtmc_bTag++;
-    ((winusbtmc_bulkout_header_t*)dat)->bTagInverse = ((winusbtmc_bulkout_header_t*)dat)->bTag ^ 0xff;
-    ((winusbtmc_bulkout_header_t*)dat)->Rsvd1 = 0;
-    ((winusbtmc_bulkout_header_t*)dat)->TransferSize = len;
-    ((winusbtmc_bulkout_header_t*)dat)->bmTransferAttributes = 0x01; // EOM set
-    ((winusbtmc_bulkout_header_t*)dat)->Rsvd2 = 0;
-    ((winusbtmc_bulkout_header_t*)dat)->Rsvd3 = 0;
-    ((winusbtmc_bulkout_header_t*)dat)->Rsvd4 = 0;
+    packet   = (pdev->usb_ep_bulkin_size) ? pdev->usb_ep_bulkin_size : 64;
+    best     = 0;
+    bestrate = 0;
+    pending  = false;
+    for (size = WINUSBTMC_CALIBRATE_MIN; size <= WINUSBTMC_CALIBRATE_MAX; size *= 4)
+    {
+        /* header and data fill complete packets, so a transfer only ends with a short packet at the end of the message */
+        aligned = (size / packet) * packet - sizeof(winusbtmc_bulkout_header_t);
+        if ( (pdev->max_transfer) && (aligned > pdev->max_transfer) )
+            break;
+        pdev->transfer_size = aligned;
+
+        bytes = 0;
+        start = winusbtmc_time_ms();
+        for (i = 0; (i < WINUSBTMC_CALIBRATE_ROUNDS) && (ret >= 0); i++)
+        {
+            ret = pdev->transport->write(pdev, query, strlen(query));
+            pending = (ret >= 0);
+            eom = false;
+            while ( (ret >= 0) && (!eom) )
+            {
+                ret = pdev->transport->read(pdev, buf, WINUSBTMC_CALIBRATE_MAX, &eom);
+                if (ret > 0)
+                    bytes += ret;
+            }
+            if (eom)
+                pending = false;
+        }
+        ms = winusbtmc_time_ms() - start;
+        if (ret < 0)
+            break; /* the device does not handle this size, keep the best one so far */
 
-    memcpy(&dat[sizeof(winusbtmc_bulkout_header_t)], str, len);
+        /* larger sizes are only used if they are clearly faster */
+        rate = bytes / ((ms > 0.001) ? ms : 0.001);
+        if (rate > bestrate * 1.05)
+        {
+            bestrate = rate;
+            best     = aligned;
+        }
+        if (bytes <= (double)aligned * WINUSBTMC_CALIBRATE_ROUNDS)
+            break; /* the response fits into one transfer, larger sizes make no difference */
+    }
 
-    /* add terminator 0x0a if not present */
-    if (dat[sizeof(winusbtmc_bulkout_header_t)+len-1] != 0x0a)
+    /* a failed probe leaves the rest of its response in the device, it is read with the size which worked before
+     * so the next query of the application does not get it */
+    pdev->transfer_size = best;
+    for (i = 0; (pending) && (i < WINUSBTMC_CALIBRATE_DRAIN); i++)
     {
-        dat[sizeof(winusbtmc_bulkout_header_t)+len] = 0x0a;
-        len++;
-        ((winusbtmc_bulkout_header_t*)dat)->TransferSize++;
+        if (pdev->transport->read(pdev, buf, WINUSBTMC_CALIBRATE_MAX, &eom) < 0)
+            break;
+        pending = !eom;
+    }
+    free(buf);
+
+    if (best == 0)
+    { /* no size worked, or the query has no response */
+        return (ret < 0) ? ret : WINUSBTMC_ERR_INVALID_PARAMETER;
     }
+    s_winusbtmc_cache_update(); /* the next program run uses the same size */
+    return best;
+}
+
 
-    len += sizeof(winusbtmc_bulkout_header_t);
+DLL_EXPORT int32_t winusbtmc_send_string(int32_t devnum, const char *str)
+{
+    winusbtmc_device_ptr_t pdev;
+    int                    ret;
 
-    /* 32 Bit zero padding */
-    while ((len & 0x03) != 0)
+    ret = s_winusbtmc_preinitcheck(devnum, &pdev);
+    if (ret < 0)
     {
-        dat[len++] = 0x00;
+        return ret;
+    }
+    if ( (pdev->acquire) || (pdev->io) )
+    {
+        return WINUSBTMC_ERR_DEVICE_BUSY;
     }
 
-    ret = usb_bulk_write( g_winusbtmc_deviceinfo_ptr[devnum]->usb_handle,
-                          g_winusbtmc_deviceinfo_ptr[devnum]->usb_ep_bulkout, dat, len, WINUSBTMC_TIMEOUT);
+    return winusbtmc_device_write(pdev, str, strlen(str));
+}
 
-    free(dat);
+DLL_EXPORT int32_t winusbtmc_send_buffer(int32_t devnum, uint32_t len, char **pbuf)
+{
+    winusbtmc_device_ptr_t pdev;
+    char                  *p;
+    int32_t                ret;
 
+    if ( (!pbuf) || (len > INT32_MAX) )
+    {
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    }
+    ret = s_winusbtmc_preinitcheck(devnum, &pdev);
     if (ret < 0)
     {
-        return WINUSBTMC_ERR_BULKOUT_FAILED;
+        return ret;
+    }
+    if ( (pdev->acquire) || (pdev->io) )
+    {
+        return WINUSBTMC_ERR_DEVICE_BUSY;
     }
 
+    /* the transfer buffer of the transport if possible, so the message is sent without copying it */
+    p = (pdev->transport->buffer) ? pdev->transport->buffer(pdev, len) : (void *)0;
+    if ( (!p) && (len + 1 > pdev->send_size) )
+    {
+        p = realloc(pdev->send_buf, len + 1);
+        if (!p)
+        {
+            return WINUSBTMC_ERR_MALLOC_FAILED;
+        }
+        pdev->send_buf  = p;
+        pdev->send_size = len + 1;
+    }
+    *pbuf = (p) ? p : pdev->send_buf;
     return WINUSBTMC_ERR_NONE;
 }
 
+DLL_EXPORT int32_t winusbtmc_send_data(int32_t devnum, const char *dat, uint32_t len)
+{
+    winusbtmc_device_ptr_t pdev;
+    int32_t                ret;
+
+    if ( (!dat) && (len > 0) )
+    {
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    }
+    ret = s_winusbtmc_preinitcheck(devnum, &pdev);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    if ( (pdev->acquire) || (pdev->io) )
+    {
+        return WINUSBTMC_ERR_DEVICE_BUSY;
+    }
+
+    return winusbtmc_device_write(pdev, dat, len);
+}
+
 DLL_EXPORT int32_t winusbtmc_recv_data(int32_t devnum, char *dat, uint32_t maxlen, bool *eom)
 {
+    winusbtmc_device_ptr_t pdev;
     int32_t ret;
-    ret = s_winusbtmc_preinitcheck(devnum);
+    ret = s_winusbtmc_preinitcheck(devnum, &pdev);
     if (ret < 0)
     {
         return ret;
     }
-    return s_winusbtmc_receive_data(devnum, dat, maxlen, eom);
+    if ( (pdev->acquire) || (pdev->io) )
+    {
+        return WINUSBTMC_ERR_DEVICE_BUSY;
+    }
+    return winusbtmc_device_read(pdev, dat, maxlen, eom);
 }
 
 DLL_EXPORT int32_t winusbtmc_recv_string(int32_t devnum, char *str, uint32_t maxlen, bool *eom)
 {
-    int32_t ret;
+    winusbtmc_device_ptr_t pdev;
+    int32_t                ret;
 
-    ret = s_winusbtmc_preinitcheck(devnum);
+    ret = s_winusbtmc_preinitcheck(devnum, &pdev);
     if (ret < 0)
     {
         return ret;
     }
+    if ( (pdev->acquire) || (pdev->io) )
+    {
+        return WINUSBTMC_ERR_DEVICE_BUSY;
+    }
 
-    ret = s_winusbtmc_receive_data(devnum, str, maxlen-1, eom);
+    ret = winusbtmc_device_read(pdev, str, maxlen-1, eom);
     if ( (ret > 0) && (*eom) )
     {
         if (str[ret-1] = '\n')
@@ -39,6 +39,212 @@
 #define WINUSBTMC_ERR_BULKOUT_FAILED     -5
 #define WINUSBTMC_ERR_BULKIN_FAILED      -6
 #define WINUSBTMC_ERR_INVALID_PARAMETER  -7
+#define WINUSBTMC_ERR_DEVICE_CHANGED     -8 /* the device of this handle was removed, find it again */
+#define WINUSBTMC_ERR_DEVICE_BUSY        -9 /* a continuous acquisition is running on the device */
+#define WINUSBTMC_ERR_FILE               -10 /* a waveform archive or capture store could not be written or is damaged */
+#define WINUSBTMC_ERR_SHM_FULL           -11 /* no free slot in a shared memory ring, the response was not received */
+#define WINUSBTMC_ERR_SHM_CLOSED         -12 /* the producer of a shared memory ring closed it */
+#define WINUSBTMC_ERR_PENDING            -13 /* the request of an I/O thread is not done yet */
+
+/*
+ * winusbtmc_find_devnum_by_string returns a handle, the device number in the lower 20 bits and a
+ * generation count above. When a device is removed, its handles are detected as stale even if the
+ * device number is taken by another device. Plain device numbers (0 .. winusbtmc_get_device_count()-1)
+ * are accepted by all functions as well, they are not checked.
+ */
+#define WINUSBTMC_DEVNUM(handle)         ((handle) & 0xfffff)
+
+/*
+ * Quirks of usb devices, see winusbtmc_set_quirks
+ */
+#define WINUSBTMC_QUIRK_GET_CAPABILITIES 0x01 /* send GET_CAPABILITIES when the device is opened */
+#define WINUSBTMC_QUIRK_VENDOR_INIT      0x02 /* send the vendor request 0xa0 when the device is opened (Rigol) */
+#define WINUSBTMC_QUIRK_CLEAR            0x04 /* INITIATE_CLEAR works, used to recover after failed transfers */
+#define WINUSBTMC_QUIRK_SPLIT_TRANSFERS  0x08 /* the device sends one transfer in several bulk-in packets */
+#define WINUSBTMC_QUIRK_TERMCHAR         0x10 /* reads end at 0x0a (Linux kernel driver), only for devices without binary responses */
+#define WINUSBTMC_QUIRK_CLEAR_ON_OPEN    0x20 /* INITIATE_CLEAR when opened, for devices which keep stale data of a previous program */
+#define WINUSBTMC_QUIRK_DEFAULT          (WINUSBTMC_QUIRK_GET_CAPABILITIES | WINUSBTMC_QUIRK_VENDOR_INIT)
+#define WINUSBTMC_QUIRK_ANY_PID          0xffff /* quirks for all products of a vendor */
+
+/*
+ * Actions of response cache rules, see winusbtmc_response_cache_rule
+ */
+#define WINUSBTMC_RCACHE_QUERY           1 /* the response of a matching query is cached */
+#define WINUSBTMC_RCACHE_INVALIDATE      2 /* a matching command drops all cached responses of the device */
+
+#define WINUSBTMC_PROFILE_MNEMONIC_MAX   64 /* size of the mnemonic of winusbtmc_profile_entry_t */
+
+/*
+ * Sample formats of waveform data, see winusbtmc_convert_float
+ */
+#define WINUSBTMC_SAMPLE_INT8            1
+#define WINUSBTMC_SAMPLE_UINT8           2 /* e.g. Rigol :WAV:FORM BYTE */
+#define WINUSBTMC_SAMPLE_INT16_LE        3 /* e.g. Keysight :WAV:FORM WORD with :WAV:BYT LSBF */
+#define WINUSBTMC_SAMPLE_INT16_BE        4
+#define WINUSBTMC_SAMPLE_UINT16_LE       5
+#define WINUSBTMC_SAMPLE_UINT16_BE       6
+
+#define WINUSBTMC_SIMD_NONE              0 /* instruction sets of the conversion, see winusbtmc_convert_simd */
+#define WINUSBTMC_SIMD_SSE2              1
+#define WINUSBTMC_SIMD_AVX2              2
+
+/*
+ * State of winusbtmc_parse_numbers, set all fields to 0 before the first chunk of a response
+ */
+#define WINUSBTMC_NUMBERS_TOKEN_MAX      63 /* longer tokens are no numbers */
+
+typedef struct
+{
+    char     token[WINUSBTMC_NUMBERS_TOKEN_MAX]; /* part of a number at the end of the previous chunk */
+    uint32_t tokenlen;
+    int32_t  header;                             /* remaining bytes of the block header, -1 after the '#' */
+    bool     started;                            /* the first chunk of the response was parsed */
+    uint32_t errors;                             /* count of tokens which were no numbers (stored as NAN) */
+} winusbtmc_numbers_t;
+
+/*
+ * Response of a continuous acquisition, see winusbtmc_acquire_get
+ */
+typedef struct winusbtmc_acquire_buffer_s
+{
+    const char *dat;                             /* response, valid until winusbtmc_acquire_release */
+    uint32_t    len;
+    bool        truncated;                       /* the response was longer than the buffer, the rest was dropped */
+    uint64_t    sequence;                        /* number of the query since the start, gaps are overruns */
+    uint64_t    overruns;                        /* count of responses dropped so far because all buffers were full */
+    double      start_ms;                        /* monotonic time when the query was sent */
+    double      end_ms;                          /* monotonic time when the response was complete */
+} winusbtmc_acquire_buffer_t;
+
+/*
+ * Request to the I/O thread of a device, see winusbtmc_io_submit. The caller owns it, it must stay valid and
+ * unchanged until the result is not WINUSBTMC_ERR_PENDING anymore.
+ */
+typedef struct winusbtmc_io_request_s
+{
+    const char *command;                         /* message sent to the device */
+    uint32_t    len;                             /* length of command, 0 if it is a 0 terminated string */
+    char       *response;                        /* buffer for the response, 0 for commands without response */
+    uint32_t    maxlen;                          /* size of response */
+    int32_t     result;                          /* completion: WINUSBTMC_ERR_PENDING, the response length or an error code */
+    bool        truncated;                       /* the response was longer than maxlen, the rest was dropped */
+    double      queued_ms;                       /* monotonic times when the request was submitted, */
+    double      start_ms;                        /* taken by the I/O thread */
+    double      end_ms;                          /* and done */
+    struct winusbtmc_io_request_s *next;         /* used by the queue */
+} winusbtmc_io_request_t;
+
+/*
+ * Waveform archive, see winusbtmc_archive_create
+ */
+typedef struct winusbtmc_archive_s winusbtmc_archive_t;
+
+typedef struct
+{
+    double   timestamp;                          /* seconds since 1970 */
+    int32_t  format;                             /* WINUSBTMC_SAMPLE_* */
+    uint64_t samples;
+    uint32_t preamble_len;
+    uint64_t stored;                             /* bytes of the capture in the archive, compare with samples * sample size */
+} winusbtmc_archive_info_t;
+
+/*
+ * Capture store, see winusbtmc_store_create
+ */
+typedef struct winusbtmc_store_s winusbtmc_store_t;
+
+typedef struct
+{
+    const char *dat;                             /* the response in the mapped file, valid until the next refresh or close */
+    uint32_t    len;
+    uint32_t    tag;                             /* given by the writer, e.g. the device number */
+    double      timestamp;                       /* seconds since 1970 */
+} winusbtmc_store_entry_t;
+
+/*
+ * Shared memory ring, see winusbtmc_shm_create
+ */
+typedef struct winusbtmc_shm_s winusbtmc_shm_t;
+
+typedef struct
+{
+    const char *dat;                             /* response in the shared memory, valid until winusbtmc_shm_release */
+    uint32_t    len;
+    bool        truncated;                       /* the response was longer than a slot, the rest was dropped */
+    uint64_t    sequence;                        /* number of the response since the ring was created */
+    double      timestamp;                       /* seconds since 1970 when the response was complete */
+} winusbtmc_shm_entry_t;
+
+/*
+ * Latencies and transferred bytes of the commands with one mnemonic, see winusbtmc_profile_report
+ */
+typedef struct winusbtmc_profile_entry_s
+{
+    char        mnemonic[WINUSBTMC_PROFILE_MNEMONIC_MAX]; /* e.g. "MEAS:FREQ?" or "SOUR<n>:VOLT" */
+    uint32_t    count;                           /* commands sent */
+    uint32_t    errors;                          /* failed sends or receives */
+    uint32_t    samples;                         /* measured latencies, commands without a complete response are missing */
+    uint64_t    bytes_sent;
+    uint64_t    bytes_received;
+    double      total_ms;                        /* sum of the latencies */
+    double      p50_ms;                          /* median and 99th percentile of the latencies (resolution about 4 %) */
+    double      p99_ms;
+    double      max_ms;
+} winusbtmc_profile_entry_t;
+
+/*
+ * Position in a binary waveform record received in chunks, part of the states below
+ */
+typedef struct winusbtmc_record_s
+{
+    uint64_t total;                              /* samples of the record, 0 until known from the block header */
+    uint64_t pos;                                /* count of samples already used */
+    bool     unbounded;                          /* data without block header and total 0 is used completely */
+    bool     started;
+    int32_t  header;                             /* remaining digits of the block header, -1 after the '#' */
+    uint64_t length;                             /* length of the block header */
+    uint8_t  partial;                            /* first byte of a 16 bit sample split between two chunks */
+    uint32_t partial_len;
+} winusbtmc_record_t;
+
+/*
+ * State of winusbtmc_decimate, set by winusbtmc_decimate_init
+ */
+typedef struct
+{
+    winusbtmc_record_t record;
+    int32_t  format;                             /* WINUSBTMC_SAMPLE_* */
+    uint32_t width;                              /* count of output points */
+    float    scale, offset;
+    float   *min, *max, *mean;                   /* output points, each may be 0 */
+    uint64_t pos;                                /* count of samples in completed points and the current one */
+    uint32_t points;                             /* count of completed output points */
+    int32_t  cur_min, cur_max;                   /* codes of the current point */
+    int64_t  cur_sum;
+} winusbtmc_decimate_t;
+
+/*
+ * State and results of winusbtmc_stats_add, set by winusbtmc_stats_init. The results are valid
+ * after winusbtmc_stats_finish or winusbtmc_recv_stats.
+ */
+typedef struct
+{
+    winusbtmc_record_t record;
+    int32_t   format;                            /* WINUSBTMC_SAMPLE_* */
+    double    scale, offset;
+    uint32_t *histogram;                         /* count of samples per range of codes, may be 0 */
+    uint32_t  bins;                              /* count of histogram bins, a power of 2 */
+    int32_t   shift;                             /* codes of a bin = 1 << shift */
+    int32_t   code_min, code_max;                /* range and exact integer sums of the codes */
+    int64_t   sum;
+    uint64_t  sumsq;
+
+    uint64_t  count;                             /* results, converted with scale and offset */
+    double    mean;
+    double    rms;
+    double    min, max;
+    double    peak_to_peak;
+} winusbtmc_stats_t;
 
 
 #ifdef __cplusplus
@@ -57,7 +263,9 @@ extern "C"
  * Initialize the usbtmc module.
  * This function does not need to be called. It will be internally called when needed.
  * In case you plugged in a new usbtmc after the module was used you can call this function
- * to make usbtmc detect the new device.
+ * to make usbtmc detect the new device. Devices which are already known keep their device number
+ * and stay opened, only added or removed devices are updated.
+ * With libusb-1.0 and the Linux kernel driver plugged devices are also detected automatically.
  */
 DLL_EXPORT void          winusbtmc_init (void);
 
@@ -78,6 +286,9 @@ DLL_EXPORT void          winusbtmc_deinit (void);
 /* [winusbtmc_get_device_count]
  *
  * Get the count of available usbtmc devices in the system
+ * Device numbers are stable while the module is initialized. When a device is unplugged
+ * its number stays unused (the device string is empty) until a new device takes it,
+ * so this is the highest device number + 1. There is no limit for the count of devices.
  */
 DLL_EXPORT int32_t       winusbtmc_get_device_count (void);
 
@@ -90,13 +301,74 @@ DLL_EXPORT void          winusbtmc_get_device_string (int32_t devnum, char *str,
 
 /* [winusbtmc_find_devnum_by_string]
  *
- * get the devicenumber of a device based on its string, this can be e.g.:
+ * get the handle of a device based on its string, this can be e.g.:
  * "Rigol Technologies:DS1000 SERIES:DS1EB1501xxxxx"
  * You can pass also a shorter version of this string, e.g.
  * "Rigol Technologies:DS1000" would also find the same device
+ *
+ * LAN instruments (raw socket SCPI) are addressed with "TCPIP::<host>::<port>", e.g.
+ * "TCPIP::192.168.1.10::5025", IPv6 addresses in brackets ("TCPIP::[fe80::1]::5025"). They get a
+ * device number the first time they are addressed and are handled by the same functions as usb devices afterwards.
+ * The handle can be passed as devnum to all other functions, they return WINUSBTMC_ERR_DEVICE_CHANGED
+ * if the device was removed in the meantime.
  */
 DLL_EXPORT int32_t       winusbtmc_find_devnum_by_string(const char *pstr);
 
+/* [winusbtmc_set_cache_file]
+ *
+ * Enable the enumeration cache. The device strings are stored in this file and reused by the next
+ * program run for all devices which were not replugged in the meantime, so finding a device by its
+ * string does not need to open all devices. If no device matches, the strings are read from the
+ * devices again. Call this before any other function of this module, pass 0 to disable the cache.
+ */
+DLL_EXPORT void          winusbtmc_set_cache_file(const char *filename);
+
+/* [winusbtmc_set_quirks]
+ *
+ * Set the quirks of usb devices with vendor id vid and product id pid (WINUSBTMC_QUIRK_ANY_PID for all
+ * products of the vendor), this overrides the table compiled into the module (winusbtmc_quirks.c).
+ * flags is a combination of WINUSBTMC_QUIRK_*, max_transfer limits the size of a single bulk transfer
+ * (0 = no limit). The quirks are used the next time a device is opened.
+ */
+DLL_EXPORT int32_t       winusbtmc_set_quirks(uint16_t vid, uint16_t pid, uint32_t flags, uint32_t max_transfer);
+
+/* [winusbtmc_response_cache]
+ *
+ * Enable or disable the response cache of a device, devnum -1 for all devices including the ones found later.
+ * The response of a cacheable query (e.g. "*IDN?") is then received from the device only once, later
+ * winusbtmc_send_string calls with the same query send nothing and the response is returned by
+ * winusbtmc_recv_data or winusbtmc_recv_string from the cache. The cache is dropped by commands like "*RST",
+ * failed transfers and when the device is removed. Disabled by default.
+ */
+DLL_EXPORT int32_t       winusbtmc_response_cache(int32_t devnum, bool enable);
+
+/* [winusbtmc_response_cache_rule]
+ *
+ * Add a rule which commands are cached (action WINUSBTMC_RCACHE_QUERY) or drop the cache
+ * (WINUSBTMC_RCACHE_INVALIDATE). pattern is compared case insensitive, a '*' at the end matches any rest of the
+ * command, e.g. "SENS:VOLT:RANG?" or "CONF*". Rules added later take precedence. pattern 0 removes all rules
+ * including the default ones ("*IDN?", "*OPT?", "SYST:OPT?" cached, "*RST", "*RCL", "SYST:PRES" invalidate).
+ */
+DLL_EXPORT int32_t       winusbtmc_response_cache_rule(const char *pattern, int32_t action);
+
+/* [winusbtmc_profile]
+ *
+ * Enable or disable the command profiler of a device, devnum -1 for all devices including the ones found later.
+ * Each message sent is reduced to its mnemonic (header without parameters, upper case, numeric suffixes as <n>)
+ * and its latency is added to the mnemonic: for queries from sending until the response was received completely,
+ * for other commands the time to send them. Disabling drops the collected data. Disabled by default.
+ */
+DLL_EXPORT int32_t       winusbtmc_profile(int32_t devnum, bool enable);
+
+/* [winusbtmc_profile_report]
+ *
+ * Copy up to maxcount mnemonics of the profiler of a device to entries, sorted by total latency (largest first).
+ * The device is not opened by this function.
+ * returns the count of mnemonics (may be more than maxcount) or an error code, WINUSBTMC_ERR_DEVICE_BUSY while the
+ * device has an I/O thread (winusbtmc_io_start)
+ */
+DLL_EXPORT int32_t       winusbtmc_profile_report(int32_t devnum, winusbtmc_profile_entry_t *entries, uint32_t maxcount);
+
 
 
 
@@ -104,6 +376,295 @@ DLL_EXPORT int32_t       winusbtmc_find_devnum_by_string(const char *pstr);
  * functions to exchange data with the device
  **************************************************************************************************/
 
+/* [winusbtmc_calibrate]
+ *
+ * Find the fastest transfer size for large reads of a usb device. query must be a query with a large
+ * response, e.g. a screenshot or waveform query. It is sent several times while the TransferSize requested
+ * from the device is increased from 4 KB to 1 MB (aligned to the usb packet size). Sizes which fail end the
+ * probing. The fastest size is stored for the device and used by winusbtmc_recv_data and winusbtmc_recv_string
+ * for all reads larger than it, until the device is removed. The rest of a response whose probe failed is read
+ * and discarded with the last working size.
+ * returns the selected transfer size or an error code, WINUSBTMC_ERR_INVALID_PARAMETER if query has no response
+ */
+DLL_EXPORT int32_t       winusbtmc_calibrate(int32_t devnum, const char *query);
+
+/* [winusbtmc_acquire_start]
+ *
+ * Start a continuous acquisition: a thread of the module sends query to the device again and again and receives
+ * the responses into a ring of buffers of size bytes each, as fast as the device answers. The responses are taken
+ * with winusbtmc_acquire_get and winusbtmc_acquire_release, e.g. by a processing thread, without any lock.
+ * If all buffers are still in use when a response arrives, it is dropped and counted as overrun.
+ * Until winusbtmc_acquire_stop, other transfers to the device return WINUSBTMC_ERR_DEVICE_BUSY.
+ * returns an error code
+ */
+DLL_EXPORT int32_t       winusbtmc_acquire_start(int32_t devnum, const char *query, uint32_t buffers, uint32_t size);
+
+/* [winusbtmc_acquire_get]
+ *
+ * Get the oldest response of the acquisition, waiting up to timeout_ms (-1 = no limit) for it. The buffer stays
+ * valid until winusbtmc_acquire_release, further calls before return the same response. Only one thread may
+ * get and release responses of a device.
+ * returns 1 for a response, 0 after the timeout or the error code of the transfer which ended the acquisition
+ */
+DLL_EXPORT int32_t       winusbtmc_acquire_get(int32_t devnum, winusbtmc_acquire_buffer_t *pbuf, int32_t timeout_ms);
+DLL_EXPORT int32_t       winusbtmc_acquire_release(int32_t devnum);
+
+/* [winusbtmc_acquire_stop]
+ *
+ * End the acquisition after the running query and free its buffers, the device can be used normally again.
+ * returns the error code which ended the acquisition before, otherwise WINUSBTMC_ERR_NONE
+ */
+DLL_EXPORT int32_t       winusbtmc_acquire_stop(int32_t devnum);
+
+/* [winusbtmc_io_start]
+ *
+ * Start a dedicated I/O thread for a device, pinned to cpu number cpu (-1 for any cpu). From now on only this thread
+ * talks to the device, so application threads never block on a transfer and do not contend for it. Requests are
+ * queued with winusbtmc_io_submit by any count of threads; the other transfer functions return
+ * WINUSBTMC_ERR_DEVICE_BUSY for the device until winusbtmc_io_stop. The response cache and the profiler of the
+ * device keep working, but they can not be enabled or disabled (nor the profile reported) while the thread runs.
+ * A device with an I/O thread stays in the device table when it is unplugged, its requests fail until
+ * winusbtmc_io_stop.
+ * returns an error code, WINUSBTMC_ERR_INVALID_PARAMETER if the thread could not be pinned to the cpu
+ */
+DLL_EXPORT int32_t       winusbtmc_io_start(int32_t devnum, int32_t cpu);
+
+/* [winusbtmc_io_submit]
+ *
+ * Queue a request to the I/O thread of a device, this never waits for the device (the queue is lock free).
+ * The command of the request is sent and, if response is not 0, the complete response is received. Afterwards
+ * result is set to the response length (0 for commands) or an error code; requests are done in submission order.
+ * Thread safe against other winusbtmc_io_submit and winusbtmc_io_wait calls and against enumeration or hotplug
+ * updates of the device table by another thread (e.g. winusbtmc_find_devnum_by_string). winusbtmc_deinit and
+ * winusbtmc_io_stop of the device must not run at the same time.
+ * returns an error code
+ */
+DLL_EXPORT int32_t       winusbtmc_io_submit(int32_t devnum, winusbtmc_io_request_t *request);
+
+/* [winusbtmc_io_wait]
+ *
+ * Wait up to timeout_ms (-1 forever, 0 not at all) until a submitted request is done.
+ * returns the result of the request, WINUSBTMC_ERR_PENDING if it is not done yet
+ */
+DLL_EXPORT int32_t       winusbtmc_io_wait(int32_t devnum, winusbtmc_io_request_t *request, int32_t timeout_ms);
+
+/* [winusbtmc_io_stop]
+ *
+ * End the I/O thread after all submitted requests are done, the device can be used normally again.
+ * No other thread may submit requests or wait for them at this time.
+ * returns an error code
+ */
+DLL_EXPORT int32_t       winusbtmc_io_stop(int32_t devnum);
+
+/* [winusbtmc_time_ms]
+ *
+ * Monotonic time in milliseconds, the clock of the *_ms times in the request and acquisition structures.
+ */
+DLL_EXPORT double        winusbtmc_time_ms(void);
+
+/* [winusbtmc_convert_float]
+ *
+ * Convert count waveform samples of format WINUSBTMC_SAMPLE_* in src to dst[i] = code * scale + offset.
+ * With the preamble of the waveform scale is the y-increment and offset = y-origin - y-reference * y-increment.
+ * Can be called for every received chunk, 16 bit formats need complete samples.
+ * winusbtmc_convert_double does the same with double precision.
+ * returns count or an error code
+ */
+DLL_EXPORT int32_t       winusbtmc_convert_float(float *dst, const void *src, uint32_t count, int32_t format, float scale, float offset);
+DLL_EXPORT int32_t       winusbtmc_convert_double(double *dst, const void *src, uint32_t count, int32_t format, double scale, double offset);
+
+/* [winusbtmc_convert_simd]
+ *
+ * Limit the instruction set of the conversion and decimation to level (WINUSBTMC_SIMD_*), -1 for the best one
+ * of the cpu.
+ * The best instruction set is used by default.
+ * returns the instruction set used from now on
+ */
+DLL_EXPORT int32_t       winusbtmc_convert_simd(int32_t level);
+
+/* [winusbtmc_decimate_init]
+ *
+ * Prepare the decimation of a record of total samples of format WINUSBTMC_SAMPLE_* to width points, e.g. for
+ * a display. Each point gets the min, max and mean of its samples, converted with scale and offset like
+ * winusbtmc_convert_float, into the arrays min, max and mean of width floats (each may be 0).
+ * Pass total 0 to take the record length from the block header ("#9000001000") of the data.
+ * returns the count of points, below width if the record is shorter, or an error code
+ */
+DLL_EXPORT int32_t       winusbtmc_decimate_init(winusbtmc_decimate_t *state, int32_t format, uint64_t total, uint32_t width,
+                                                 float scale, float offset, float *min, float *max, float *mean);
+
+/* [winusbtmc_decimate]
+ *
+ * Add a chunk of the record, e.g. as received with winusbtmc_recv_data. The block header at the start of the
+ * record and anything after the record is skipped, chunks may end anywhere. winusbtmc_decimate_finish
+ * completes the last point if the record was shorter than expected.
+ * returns the count of completed points or an error code
+ */
+DLL_EXPORT int32_t       winusbtmc_decimate(winusbtmc_decimate_t *state, const void *dat, uint32_t len);
+DLL_EXPORT int32_t       winusbtmc_decimate_finish(winusbtmc_decimate_t *state);
+
+/* [winusbtmc_stats_init]
+ *
+ * Prepare the statistics of a record of format WINUSBTMC_SAMPLE_*: count, mean, rms, min, max and peak to peak,
+ * converted with scale and offset like winusbtmc_convert_double. If histogram is not 0, it gets the count of
+ * samples in bins ranges of codes (bins is a power of 2 up to 256 for 8 bit and 65536 for 16 bit samples), bin 0
+ * starts at the lowest code of the format (-128, 0, -32768 or 0).
+ * returns an error code
+ */
+DLL_EXPORT int32_t       winusbtmc_stats_init(winusbtmc_stats_t *state, int32_t format, double scale, double offset,
+                                              uint32_t *histogram, uint32_t bins);
+
+/* [winusbtmc_stats_add]
+ *
+ * Add a chunk of the record like winusbtmc_decimate, a record without block header is used completely.
+ * winusbtmc_stats_finish calculates the results.
+ * returns an error code
+ */
+DLL_EXPORT int32_t       winusbtmc_stats_add(winusbtmc_stats_t *state, const void *dat, uint32_t len);
+DLL_EXPORT int32_t       winusbtmc_stats_finish(winusbtmc_stats_t *state);
+
+/* [winusbtmc_recv_stats]
+ *
+ * Receive the response of a waveform query sent before (e.g. ":WAV:DATA?") and calculate its statistics
+ * without keeping the record. Each chunk is processed by a second thread while the next one is received,
+ * so the results are ready right after the last transfer.
+ * returns the count of received bytes or an error code
+ */
+DLL_EXPORT int32_t       winusbtmc_recv_stats(int32_t devnum, winusbtmc_stats_t *state);
+
+/* [winusbtmc_archive_create]
+ *
+ * Create a waveform archive file, an existing file is overwritten. The archive keeps any count of captures,
+ * each is a waveform record with its preamble and a timestamp. The samples are stored lossless with delta
+ * coding, which takes usually half or less of the raw size for 8 bit data, and fast enough to archive the
+ * records of back to back waveform queries. winusbtmc_archive_close writes the index of the captures.
+ * returns an error code
+ */
+DLL_EXPORT int32_t       winusbtmc_archive_create(winusbtmc_archive_t **pparchive, const char *filename);
+
+/* [winusbtmc_archive_begin]
+ *
+ * Start a capture of format WINUSBTMC_SAMPLE_* with its preamble (e.g. the response of ":WAV:PRE?", may be 0)
+ * and timestamp (seconds since 1970, 0 for the current time). winusbtmc_archive_add takes the waveform data
+ * in chunks like winusbtmc_decimate, the block header is skipped, data without block header is stored
+ * completely. winusbtmc_archive_end completes the capture.
+ * returns an error code
+ */
+DLL_EXPORT int32_t       winusbtmc_archive_begin(winusbtmc_archive_t *parchive, int32_t format, double timestamp,
+                                                 const char *preamble, uint32_t preamble_len);
+DLL_EXPORT int32_t       winusbtmc_archive_add(winusbtmc_archive_t *parchive, const void *dat, uint32_t len);
+DLL_EXPORT int32_t       winusbtmc_archive_end(winusbtmc_archive_t *parchive);
+
+/* [winusbtmc_recv_archive]
+ *
+ * Receive the response of a waveform query sent before (e.g. ":WAV:DATA?") into a new capture of the archive,
+ * the parameters are the ones of winusbtmc_archive_begin.
+ * returns the count of received bytes or an error code
+ */
+DLL_EXPORT int32_t       winusbtmc_recv_archive(int32_t devnum, winusbtmc_archive_t *parchive, int32_t format, double timestamp,
+                                                const char *preamble, uint32_t preamble_len);
+
+/* [winusbtmc_archive_open]
+ *
+ * Open an archive for reading. The captures of an archive which was not closed are found without the index.
+ * winusbtmc_archive_count returns the count of captures, winusbtmc_archive_info the properties of one.
+ * winusbtmc_archive_read returns up to maxpreamble bytes of its preamble and up to maxsamples samples in
+ * the original format (both may be 0).
+ * returns an error code, winusbtmc_archive_count the count of captures
+ */
+DLL_EXPORT int32_t       winusbtmc_archive_open(winusbtmc_archive_t **pparchive, const char *filename);
+DLL_EXPORT int32_t       winusbtmc_archive_count(winusbtmc_archive_t *parchive);
+DLL_EXPORT int32_t       winusbtmc_archive_info(winusbtmc_archive_t *parchive, uint32_t index, winusbtmc_archive_info_t *pinfo);
+DLL_EXPORT int32_t       winusbtmc_archive_read(winusbtmc_archive_t *parchive, uint32_t index, char *preamble, uint32_t maxpreamble,
+                                                void *dst, uint64_t maxsamples);
+
+/* [winusbtmc_archive_close]
+ *
+ * Close an archive, the index is written if it was created.
+ * returns an error code, e.g. if the disk was full
+ */
+DLL_EXPORT int32_t       winusbtmc_archive_close(winusbtmc_archive_t *parchive);
+
+/* [winusbtmc_store_create]
+ *
+ * Open a capture store for appending, it is created if it does not exist. A store keeps any count of
+ * responses (captures) with a tag and a timestamp in two files: the responses are appended to filename and
+ * an index of fixed size records to filename.idx, so any capture is found without reading the ones before.
+ * winusbtmc_store_add appends a capture (timestamp 0 for the current time), winusbtmc_recv_store
+ * receives the response of a query sent before directly into the store and returns the count of bytes.
+ * Each capture is visible to readers as soon as it was added. Only one writer per store.
+ * returns an error code
+ */
+DLL_EXPORT int32_t       winusbtmc_store_create(winusbtmc_store_t **ppstore, const char *filename);
+DLL_EXPORT int32_t       winusbtmc_store_add(winusbtmc_store_t *pstore, uint32_t tag, double timestamp,
+                                             const void *dat, uint32_t len);
+DLL_EXPORT int32_t       winusbtmc_recv_store(int32_t devnum, winusbtmc_store_t *pstore, uint32_t tag);
+
+/* [winusbtmc_store_open]
+ *
+ * Open a capture store for reading. Both files are memory mapped, winusbtmc_store_get returns a capture
+ * in constant time without copying it. winusbtmc_store_refresh maps the captures which were added by a
+ * writer since (to follow a store while it is written), the pointers of the captures taken before are
+ * invalid then. A 32 bit process can map stores of about 1 GB.
+ * returns an error code, winusbtmc_store_count and winusbtmc_store_refresh the count of captures
+ */
+DLL_EXPORT int32_t       winusbtmc_store_open(winusbtmc_store_t **ppstore, const char *filename);
+DLL_EXPORT int32_t       winusbtmc_store_count(winusbtmc_store_t *pstore);
+DLL_EXPORT int32_t       winusbtmc_store_refresh(winusbtmc_store_t *pstore);
+DLL_EXPORT int32_t       winusbtmc_store_get(winusbtmc_store_t *pstore, uint32_t index, winusbtmc_store_entry_t *pentry);
+
+/* [winusbtmc_store_close]
+ *
+ * Close a capture store opened by winusbtmc_store_create or winusbtmc_store_open.
+ * returns an error code, e.g. if a capture could not be written
+ */
+DLL_EXPORT int32_t       winusbtmc_store_close(winusbtmc_store_t *pstore);
+
+/* [winusbtmc_shm_create]
+ *
+ * Create a named ring of slots buffers of size bytes in shared memory (POSIX shared memory, a named file
+ * mapping on windows). Fails with WINUSBTMC_ERR_CANNOT_OPEN_DEVICE while another producer (or on windows a
+ * consumer of a previous producer) has a ring of the same name, a ring left by a crashed producer is replaced.
+ * winusbtmc_recv_shm receives the response of a query sent before directly into the next free slot and
+ * passes it to the process which opened the ring with winusbtmc_shm_open; the response is not copied on
+ * either side. If the consumer did not release a slot within timeout_ms (0 no wait, -1 infinite)
+ * WINUSBTMC_ERR_SHM_FULL is returned and the response is left in the device.
+ * returns an error code, winusbtmc_recv_shm the count of received bytes
+ */
+DLL_EXPORT int32_t       winusbtmc_shm_create(winusbtmc_shm_t **ppshm, const char *name, uint32_t slots, uint32_t size);
+DLL_EXPORT int32_t       winusbtmc_recv_shm(int32_t devnum, winusbtmc_shm_t *pshm, int32_t timeout_ms);
+
+/* [winusbtmc_shm_open]
+ *
+ * Open the shared memory ring of another process (the consumer side). winusbtmc_shm_get waits up to
+ * timeout_ms (0 no wait, -1 infinite) for the next response, it points into the shared memory until
+ * winusbtmc_shm_release passes the slot back to the producer. The responses are taken in order.
+ * returns an error code, winusbtmc_shm_get 1 for a response, 0 on timeout or WINUSBTMC_ERR_SHM_CLOSED
+ * when the producer closed the ring and all responses were taken
+ */
+DLL_EXPORT int32_t       winusbtmc_shm_open(winusbtmc_shm_t **ppshm, const char *name);
+DLL_EXPORT int32_t       winusbtmc_shm_get(winusbtmc_shm_t *pshm, winusbtmc_shm_entry_t *pentry, int32_t timeout_ms);
+DLL_EXPORT int32_t       winusbtmc_shm_release(winusbtmc_shm_t *pshm);
+
+/* [winusbtmc_shm_close]
+ *
+ * Close a shared memory ring on either side. The name of the ring is removed when the producer closes it,
+ * a consumer can still take the responses which were passed before.
+ * returns an error code
+ */
+DLL_EXPORT int32_t       winusbtmc_shm_close(winusbtmc_shm_t *pshm);
+
+/* [winusbtmc_parse_numbers]
+ *
+ * Convert a comma or newline separated list of numbers, e.g. a chunk received with winusbtmc_recv_data,
+ * to dst. Call it for every chunk with the same state and pass eom of the chunk, a number split between
+ * two chunks is converted with the next one. 9.9E37 and 9.91E37 become +-INFINITY and NAN. dst must have
+ * room for maxcount >= len / 2 + 2 numbers.
+ * returns the count of numbers stored in dst or an error code, WINUSBTMC_ERR_INVALID_PARAMETER also if the
+ * response ends within its block header (the state is ready for the next response then)
+ */
+DLL_EXPORT int32_t       winusbtmc_parse_numbers(winusbtmc_numbers_t *state, const char *dat, uint32_t len, bool eom, double *dst, uint32_t maxcount);
+
 /* [winusbtmc_send_string]
  *
  * Send a command to the usbtmc device, e.g. "*IDN?".
@@ -111,6 +672,17 @@ DLL_EXPORT int32_t       winusbtmc_find_devnum_by_string(const char *pstr);
  */
 DLL_EXPORT int32_t       winusbtmc_send_string(int32_t devnum, const char *str);
 
+/* [winusbtmc_send_buffer]
+ *
+ * Get room for a command of up to len bytes, usually within the transfer buffer of the device, so
+ * winusbtmc_send_data sends a command formatted there (e.g. by winusbtmc_scpi.hpp) without copying it.
+ * The buffer is valid until the next call for the device. winusbtmc_send_data sends len bytes of any
+ * buffer like winusbtmc_send_string, the command does not need a terminating 0.
+ * returns an error code
+ */
+DLL_EXPORT int32_t       winusbtmc_send_buffer(int32_t devnum, uint32_t len, char **pbuf);
+DLL_EXPORT int32_t       winusbtmc_send_data(int32_t devnum, const char *dat, uint32_t len);
+
 /* [winusbtmc_recv_string]
  *
  * receive a response string from the usbtmc device.
@@ -0,0 +1,349 @@
+/*
+ * Continuous acquisition.
+ * A thread per device sends the same query again and again and receives the responses into a ring of
+ * preallocated buffers, so the query rate is only limited by the instrument and not by the processing of
+ * the responses. The application takes the responses with winusbtmc_acquire_get/winusbtmc_acquire_release.
+ *
+ * The ring has a single producer (the acquisition thread) and a single consumer (the application), head and
+ * tail are each written by one side only, so no lock is needed to pass a buffer. A consumer which waits for
+ * the next response sleeps on a condition variable (an event on windows), the producer only signals it while
+ * it waits. If the consumer did not release a buffer in time, the response is received into a spare buffer
+ * and dropped; its sequence number is skipped and counted as overrun.
+ */
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <time.h>
+#endif
+#include "winusbtmc.h"
+#include "winusbtmc_private.h"
+
+/* fields shared by both threads. The store of head or tail publishes everything written before, and as the
+ * accesses are sequentially consistent, the waiting flag and a new head are never missed by both sides. */
+#define WINUSBTMC_ACQUIRE_LOAD(field)         __atomic_load_n(&(field), __ATOMIC_SEQ_CST)
+#define WINUSBTMC_ACQUIRE_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_SEQ_CST)
+
+typedef struct
+{
+    uint32_t len;
+    bool     truncated;
+    uint64_t sequence;
+    uint64_t overruns;
+    double   start_ms;
+    double   end_ms;
+} winusbtmc_acquire_slot_t;
+
+struct winusbtmc_acquire_s
+{
+    winusbtmc_device_t       *pdev;
+    char                     *query;
+    uint32_t                  querylen;
+    uint32_t                  count;        /* buffers of the ring */
+    uint32_t                  size;         /* bytes per buffer */
+    char                     *data;         /* count + 1 buffers, the last one is the spare buffer */
+    winusbtmc_acquire_slot_t *slots;        /* count + 1 */
+    uint32_t                  head;         /* next buffer published, written by the thread only */
+    uint32_t                  tail;         /* next buffer released, written by the consumer only */
+    bool                      stop;
+    bool                      running;      /* false after the thread ended */
+    bool                      waiting;      /* the consumer waits for the next response */
+    int32_t                   error;        /* transfer error which ended the thread, set before running */
+    uint64_t                  sequence;
+    uint64_t                  overruns;
+#ifdef _WIN32
+    HANDLE                    thread;
+    HANDLE                    event;
+#else
+    pthread_t                 thread;
+    pthread_mutex_t           mutex;
+    pthread_cond_t            cond;
+#endif
+};
+
+
+/*
+ * head and tail count from 0 to 2 * count - 1, so a full ring differs from an empty one and the buffer
+ * index is the counter modulo count
+ */
+static uint32_t s_winusbtmc_acquire_inc(const struct winusbtmc_acquire_s *pa, uint32_t pos)
+{
+    return (pos + 1 == 2 * pa->count) ? 0 : pos + 1;
+}
+
+static uint32_t s_winusbtmc_acquire_used(const struct winusbtmc_acquire_s *pa)
+{
+    return (WINUSBTMC_ACQUIRE_LOAD(pa->head) + 2 * pa->count - WINUSBTMC_ACQUIRE_LOAD(pa->tail)) % (2 * pa->count);
+}
+
+/* no response to take and the thread still runs */
+static bool s_winusbtmc_acquire_idle(struct winusbtmc_acquire_s *pa)
+{
+    return (WINUSBTMC_ACQUIRE_LOAD(pa->head) == pa->tail) && (WINUSBTMC_ACQUIRE_LOAD(pa->running));
+}
+
+/*
+ * wake the consumer if it waits, called by the thread after head or running changed
+ */
+static void s_winusbtmc_acquire_wake(struct winusbtmc_acquire_s *pa)
+{
+    if (!WINUSBTMC_ACQUIRE_LOAD(pa->waiting))
+        return;
+#ifdef _WIN32
+    SetEvent(pa->event);
+#else
+    pthread_mutex_lock(&pa->mutex);
+    pthread_cond_signal(&pa->cond);
+    pthread_mutex_unlock(&pa->mutex);
+#endif
+}
+
+/*
+ * wait up to ms for the thread unless a response is available already
+ */
+static void s_winusbtmc_acquire_sleep(struct winusbtmc_acquire_s *pa, double ms)
+{
+#ifdef _WIN32
+    WINUSBTMC_ACQUIRE_STORE(pa->waiting, true);
+    if (s_winusbtmc_acquire_idle(pa))
+        WaitForSingleObject(pa->event, (ms < 0) ? INFINITE : (DWORD)ms + 1);
+    WINUSBTMC_ACQUIRE_STORE(pa->waiting, false);
+#else
+    struct timespec ts;
+    time_t          sec;
+    long            ns;
+
+    pthread_mutex_lock(&pa->mutex);
+    WINUSBTMC_ACQUIRE_STORE(pa->waiting, true);
+    if (s_winusbtmc_acquire_idle(pa))
+    {
+        if (ms < 0)
+        {
+            pthread_cond_wait(&pa->cond, &pa->mutex);
+        }
+        else
+        {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            sec         = (time_t)(ms / 1000);
+            ns          = ts.tv_nsec + (long)((ms - sec * 1000.0) * 1000000.0);
+            ts.tv_sec  += sec + ns / 1000000000;
+            ts.tv_nsec  = ns % 1000000000;
+            pthread_cond_timedwait(&pa->cond, &pa->mutex, &ts);
+        }
+    }
+    WINUSBTMC_ACQUIRE_STORE(pa->waiting, false);
+    pthread_mutex_unlock(&pa->mutex);
+#endif
+}
+
+/*
+ * one query, the response is received into buf. The part which does not fit is received into spare.
+ */
+static int32_t s_winusbtmc_acquire_query(struct winusbtmc_acquire_s *pa, char *buf, char *spare, winusbtmc_acquire_slot_t *pslot)
+{
+    winusbtmc_device_t *pdev = pa->pdev;
+    int32_t             ret;
+    bool                eom = false;
+
+    pslot->len       = 0;
+    pslot->truncated = false;
+    pslot->start_ms  = winusbtmc_time_ms();
+    ret = pdev->transport->write(pdev, pa->query, pa->querylen);
+    while ( (ret >= 0) && (!eom) )
+    {
+        if (pslot->len < pa->size)
+        {
+            ret = pdev->transport->read(pdev, buf + pslot->len, pa->size - pslot->len, &eom);
+            if (ret > 0)
+                pslot->len += ret;
+        }
+        else
+        { /* the rest is read anyway, the next query would get it otherwise */
+            pslot->truncated = true;
+            ret = pdev->transport->read(pdev, spare, pa->size, &eom);
+        }
+    }
+    pslot->end_ms = winusbtmc_time_ms();
+    return ret;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI s_winusbtmc_acquire_thread(LPVOID arg)
+#else
+static void *s_winusbtmc_acquire_thread(void *arg)
+#endif
+{
+    struct winusbtmc_acquire_s *pa = arg;
+    winusbtmc_acquire_slot_t   *pslot;
+    char                       *spare;
+    uint32_t                    i;
+    int32_t                     ret;
+    bool                        full;
+
+    spare = pa->data + (size_t)pa->count * pa->size;
+    while (!WINUSBTMC_ACQUIRE_LOAD(pa->stop))
+    {
+        /* the consumer only increments tail, so a free buffer stays free until head is incremented */
+        full  = (s_winusbtmc_acquire_used(pa) == pa->count);
+        i     = (full) ? pa->count : pa->head % pa->count;
+        pslot = &pa->slots[i];
+
+        ret = s_winusbtmc_acquire_query(pa, pa->data + (size_t)i * pa->size, spare, pslot);
+        pslot->sequence = pa->sequence++;
+        if (ret < 0)
+        {
+            pa->error = ret;
+            break;
+        }
+        if (full)
+        {
+            pa->overruns++;
+            continue;
+        }
+
+        pslot->overruns = pa->overruns;
+        WINUSBTMC_ACQUIRE_STORE(pa->head, s_winusbtmc_acquire_inc(pa, pa->head));
+        s_winusbtmc_acquire_wake(pa);
+    }
+
+    WINUSBTMC_ACQUIRE_STORE(pa->running, false);
+    s_winusbtmc_acquire_wake(pa);
+    return 0;
+}
+
+static void s_winusbtmc_acquire_free(struct winusbtmc_acquire_s *pa)
+{
+#ifdef _WIN32
+    if (pa->event)
+        CloseHandle(pa->event);
+#else
+    pthread_cond_destroy(&pa->cond);
+    pthread_mutex_destroy(&pa->mutex);
+#endif
+    free(pa->query);
+    free(pa->data);
+    free(pa->slots);
+    free(pa);
+}
+
+int32_t winusbtmc_acquire_begin(winusbtmc_device_t *pdev, const char *query, uint32_t buffers, uint32_t size)
+{
+    struct winusbtmc_acquire_s *pa;
+
+    if ( (pdev->acquire) || (pdev->io) )
+        return WINUSBTMC_ERR_DEVICE_BUSY;
+    if ( (!query) || (!*query) || (buffers == 0) || (buffers > INT32_MAX / 2) || (size == 0) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    pa = calloc(1, sizeof(struct winusbtmc_acquire_s));
+    if (!pa)
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    pa->pdev     = pdev;
+    pa->count    = buffers;
+    pa->size     = size;
+    pa->querylen = strlen(query);
+    pa->query    = malloc(pa->querylen + 1);
+    pa->data     = malloc(((size_t)buffers + 1) * size);
+    pa->slots    = calloc((size_t)buffers + 1, sizeof(winusbtmc_acquire_slot_t));
+#ifdef _WIN32
+    pa->event    = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if ( (!pa->query) || (!pa->data) || (!pa->slots) || (!pa->event) )
+#else
+    pthread_mutex_init(&pa->mutex, NULL);
+    pthread_cond_init(&pa->cond, NULL);
+    if ( (!pa->query) || (!pa->data) || (!pa->slots) )
+#endif
+    {
+        s_winusbtmc_acquire_free(pa);
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+    memcpy(pa->query, query, pa->querylen + 1);
+
+    pa->running = true;
+#ifdef _WIN32
+    pa->thread = CreateThread(NULL, 0, s_winusbtmc_acquire_thread, pa, 0, NULL);
+    if (pa->thread == NULL)
+#else
+    if (pthread_create(&pa->thread, NULL, s_winusbtmc_acquire_thread, pa) != 0)
+#endif
+    {
+        s_winusbtmc_acquire_free(pa);
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+    pdev->acquire = pa;
+    return WINUSBTMC_ERR_NONE;
+}
+
+int32_t winusbtmc_acquire_next(winusbtmc_device_t *pdev, struct winusbtmc_acquire_buffer_s *pbuf, int32_t timeout_ms)
+{
+    struct winusbtmc_acquire_s *pa = pdev->acquire;
+    winusbtmc_acquire_slot_t   *pslot;
+    double                      start = 0, left = -1;
+    uint32_t                    i;
+
+    if ( (!pa) || (!pbuf) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    if (timeout_ms > 0)
+        start = winusbtmc_time_ms();
+    while (WINUSBTMC_ACQUIRE_LOAD(pa->head) == pa->tail)
+    {
+        if (!WINUSBTMC_ACQUIRE_LOAD(pa->running))
+        {
+            if (WINUSBTMC_ACQUIRE_LOAD(pa->head) == pa->tail)
+                return pa->error;
+            break; /* responses received before the thread ended */
+        }
+        if (timeout_ms >= 0)
+        {
+            left = (timeout_ms > 0) ? timeout_ms - (winusbtmc_time_ms() - start) : 0;
+            if (left <= 0)
+                return 0;
+        }
+        s_winusbtmc_acquire_sleep(pa, left);
+    }
+
+    i     = pa->tail % pa->count;
+    pslot = &pa->slots[i];
+    pbuf->dat       = pa->data + (size_t)i * pa->size;
+    pbuf->len       = pslot->len;
+    pbuf->truncated = pslot->truncated;
+    pbuf->sequence  = pslot->sequence;
+    pbuf->overruns  = pslot->overruns;
+    pbuf->start_ms  = pslot->start_ms;
+    pbuf->end_ms    = pslot->end_ms;
+    return 1;
+}
+
+int32_t winusbtmc_acquire_done(winusbtmc_device_t *pdev)
+{
+    struct winusbtmc_acquire_s *pa = pdev->acquire;
+
+    if ( (!pa) || (WINUSBTMC_ACQUIRE_LOAD(pa->head) == pa->tail) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    WINUSBTMC_ACQUIRE_STORE(pa->tail, s_winusbtmc_acquire_inc(pa, pa->tail));
+    return WINUSBTMC_ERR_NONE;
+}
+
+int32_t winusbtmc_acquire_end(winusbtmc_device_t *pdev)
+{
+    struct winusbtmc_acquire_s *pa = pdev->acquire;
+    int32_t                     ret;
+
+    if (!pa)
+        return WINUSBTMC_ERR_NONE;
+
+    WINUSBTMC_ACQUIRE_STORE(pa->stop, true);
+#ifdef _WIN32
+    WaitForSingleObject(pa->thread, INFINITE);
+    CloseHandle(pa->thread);
+#else
+    pthread_join(pa->thread, NULL);
+#endif
+    ret = pa->error;
+    s_winusbtmc_acquire_free(pa);
+    pdev->acquire = (void *)0;
+    return ret;
+}
@@ -0,0 +1,717 @@
+/*
+ * Waveform archive.
+ * A file with any count of captures, each is a waveform record with its preamble (e.g. the response of
+ * ":WAV:PRE?") and a timestamp. The samples are stored in chunks of WINUSBTMC_ARCHIVE_CHUNK samples, every
+ * chunk can be decoded on its own. Within a chunk each sample is stored as the difference to the previous
+ * one, and each block of WINUSBTMC_ARCHIVE_BLOCK differences is packed with the bits needed by the largest
+ * one. Waveforms of a scope rarely change by more than a few codes between two samples, so an 8 bit record
+ * needs about 3 to 5 bits per sample. The coding is lossless and takes no external library.
+ *
+ * File layout, all numbers little endian:
+ *   "WTMCARC1"
+ *   per capture:  u32 'WCAP', u32 format (WINUSBTMC_SAMPLE_*), f64 timestamp, u32 preamble length, preamble
+ *     per chunk:  u32 samples, u32 bytes, u32 first sample, bytes of packed blocks (u8 bits, differences)
+ *     end:        u32 0
+ *   index:        per capture u64 file offset, f64 timestamp, u32 format, u32 preamble length, u64 samples,
+ *                 u64 stored bytes
+ *   trailer:      u64 file offset of the index, u32 count of captures, "WTMCIDX1"
+ * The index is written when the archive is closed. An archive without it (the program was stopped before)
+ * is still read completely, its captures are found by walking through the chunks.
+ */
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "winusbtmc.h"
+#include "winusbtmc_private.h"
+
+#define WINUSBTMC_ARCHIVE_CHUNK    (65536)       /* samples per chunk */
+#define WINUSBTMC_ARCHIVE_BLOCK    (128)         /* differences packed with the same count of bits */
+#define WINUSBTMC_ARCHIVE_MAGIC    "WTMCARC1"
+#define WINUSBTMC_ARCHIVE_END      "WTMCIDX1"
+#define WINUSBTMC_ARCHIVE_CAPTURE  (0x50414357)  /* "WCAP" */
+#define WINUSBTMC_ARCHIVE_ENTRY    (40)          /* bytes of an index entry */
+#define WINUSBTMC_ARCHIVE_TRAILER  (20)
+#define WINUSBTMC_ARCHIVE_BUFFER   (1024 * 1024) /* stdio buffer of the file */
+
+/* max. bytes of an encoded chunk */
+#define WINUSBTMC_ARCHIVE_PACKED   (WINUSBTMC_ARCHIVE_CHUNK * 2 + WINUSBTMC_ARCHIVE_CHUNK / WINUSBTMC_ARCHIVE_BLOCK + 16)
+
+typedef struct
+{
+    uint64_t offset;
+    double   timestamp;
+    int32_t  format;
+    uint32_t preamble_len;
+    uint64_t samples;
+    uint64_t stored;
+} winusbtmc_archive_entry_t;
+
+struct winusbtmc_archive_s
+{
+    FILE                      *f;
+    bool                       write;
+    uint64_t                   pos;          /* file position while writing */
+    winusbtmc_archive_entry_t *entries;
+    uint32_t                   count;
+    uint32_t                   alloc;
+    bool                       capturing;    /* between winusbtmc_archive_begin and winusbtmc_archive_end */
+    winusbtmc_record_t         record;
+    uint8_t                   *chunk;        /* samples of the current chunk */
+    uint32_t                   chunk_len;
+    uint8_t                   *packed;       /* encoded chunk */
+    int32_t                    error;        /* first write error, the archive is not written anymore */
+};
+
+
+/**************************************************************************************************
+ * coding
+ **************************************************************************************************/
+
+static void s_winusbtmc_put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void s_winusbtmc_put64(uint8_t *p, uint64_t v)
+{
+    s_winusbtmc_put32(p, (uint32_t)v);
+    s_winusbtmc_put32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t s_winusbtmc_get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t s_winusbtmc_get64(const uint8_t *p)
+{
+    return s_winusbtmc_get32(p) | ((uint64_t)s_winusbtmc_get32(p + 4) << 32);
+}
+
+static void s_winusbtmc_putdouble(uint8_t *p, double d)
+{
+    uint64_t v;
+
+    memcpy(&v, &d, sizeof(v));
+    s_winusbtmc_put64(p, v);
+}
+
+static double s_winusbtmc_getdouble(const uint8_t *p)
+{
+    uint64_t v = s_winusbtmc_get64(p);
+    double   d;
+
+    memcpy(&d, &v, sizeof(d));
+    return d;
+}
+
+/* sample i as unsigned value of the format's byte order, the difference of two samples does not depend on the sign */
+static uint32_t s_winusbtmc_archive_value(const uint8_t *src, uint32_t i, int32_t format)
+{
+    switch (format)
+    {
+        case WINUSBTMC_SAMPLE_INT8:
+        case WINUSBTMC_SAMPLE_UINT8:     return src[i];
+        case WINUSBTMC_SAMPLE_INT16_BE:
+        case WINUSBTMC_SAMPLE_UINT16_BE: return (src[2*i] << 8) | src[2*i+1];
+        default:                         return src[2*i] | (src[2*i+1] << 8);
+    }
+}
+
+static void s_winusbtmc_archive_store(uint8_t *dst, uint32_t i, int32_t format, uint32_t value)
+{
+    switch (format)
+    {
+        case WINUSBTMC_SAMPLE_INT8:
+        case WINUSBTMC_SAMPLE_UINT8:     dst[i] = (uint8_t)value; break;
+        case WINUSBTMC_SAMPLE_INT16_BE:
+        case WINUSBTMC_SAMPLE_UINT16_BE: dst[2*i] = (uint8_t)(value >> 8); dst[2*i+1] = (uint8_t)value; break;
+        default:                         dst[2*i] = (uint8_t)value; dst[2*i+1] = (uint8_t)(value >> 8); break;
+    }
+}
+
+/*
+ * encode count samples, the first one is stored in the chunk header. Returns the count of bytes in dst,
+ * at most count * sample size + count / WINUSBTMC_ARCHIVE_BLOCK + 1.
+ */
+static uint32_t s_winusbtmc_archive_encode(const uint8_t *src, uint32_t count, int32_t format, uint8_t *dst)
+{
+    uint32_t diff[WINUSBTMC_ARCHIVE_BLOCK];
+    uint32_t bits, i, n, b, value, prev, any, width;
+    int32_t  d;
+    uint64_t acc;
+    int32_t  accbits;
+    uint8_t *out = dst;
+
+    bits = winusbtmc_sample_size(format) * 8;
+    prev = s_winusbtmc_archive_value(src, 0, format);
+    for (b = 0; b < count; b += WINUSBTMC_ARCHIVE_BLOCK)
+    {
+        /* differences modulo 2^bits as signed numbers, zigzag coded: 0, -1, 1, -2, ... => 0, 1, 2, 3, ... */
+        n   = (count - b < WINUSBTMC_ARCHIVE_BLOCK) ? count - b : WINUSBTMC_ARCHIVE_BLOCK;
+        any = 0;
+        for (i = 0; i < n; i++)
+        {
+            value   = s_winusbtmc_archive_value(src, b + i, format);
+            d       = (int32_t)((value - prev) << (32 - bits)) >> (32 - bits);
+            diff[i] = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+            any    |= diff[i];
+            prev    = value;
+        }
+        width  = (any) ? 32 - __builtin_clz(any) : 0;
+        *out++ = (uint8_t)width;
+
+        acc     = 0;
+        accbits = 0;
+        for (i = 0; (i < n) && (width > 0); i++)
+        {
+            acc     |= (uint64_t)diff[i] << accbits;
+            accbits += width;
+            if (accbits >= 32)
+            {
+                s_winusbtmc_put32(out, (uint32_t)acc);
+                out     += 4;
+                acc    >>= 32;
+                accbits -= 32;
+            }
+        }
+        for (; accbits > 0; accbits -= 8)
+        {
+            *out++ = (uint8_t)acc;
+            acc  >>= 8;
+        }
+    }
+    return out - dst;
+}
+
+/* decode a chunk, returns false if the data is inconsistent */
+static bool s_winusbtmc_archive_decode(const uint8_t *src, uint32_t len, uint32_t count, int32_t format, uint32_t first, uint8_t *dst)
+{
+    const uint8_t *in = src, *end = src + len;
+    uint32_t       bits, mask, i, n, b, width, z, prev;
+    uint64_t       acc;
+    int32_t        accbits;
+
+    bits = winusbtmc_sample_size(format) * 8;
+    mask = (1U << bits) - 1;
+    prev = first;
+    for (b = 0; b < count; b += WINUSBTMC_ARCHIVE_BLOCK)
+    {
+        n = (count - b < WINUSBTMC_ARCHIVE_BLOCK) ? count - b : WINUSBTMC_ARCHIVE_BLOCK;
+        if (in >= end)
+            return false;
+        width = *in++;
+        if ( (width > bits) || ((uint64_t)(end - in) * 8 < (uint64_t)n * width) )
+            return false;
+
+        acc     = 0;
+        accbits = 0;
+        for (i = 0; i < n; i++)
+        {
+            while (accbits < (int32_t)width)
+            {
+                acc     |= (uint64_t)*in++ << accbits;
+                accbits += 8;
+            }
+            z        = (uint32_t)acc & ((1U << width) - 1);
+            acc    >>= width;
+            accbits -= width;
+            prev     = (prev + ((z >> 1) ^ (0U - (z & 1)))) & mask;
+            s_winusbtmc_archive_store(dst, b + i, format, prev);
+        }
+    }
+    return true;
+}
+
+
+/**************************************************************************************************
+ * file access
+ **************************************************************************************************/
+
+static int s_winusbtmc_archive_seek(FILE *f, uint64_t pos)
+{
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)pos, SEEK_SET);
+#else
+    return fseeko(f, (off_t)pos, SEEK_SET);
+#endif
+}
+
+static uint64_t s_winusbtmc_archive_size(FILE *f)
+{
+#ifdef _WIN32
+    _fseeki64(f, 0, SEEK_END);
+    return (uint64_t)_ftelli64(f);
+#else
+    fseeko(f, 0, SEEK_END);
+    return (uint64_t)ftello(f);
+#endif
+}
+
+static void s_winusbtmc_archive_write(winusbtmc_archive_t *parc, const void *dat, uint32_t len)
+{
+    if ( (parc->error < 0) || (len == 0) )
+        return;
+    if (fwrite(dat, 1, len, parc->f) != len)
+        parc->error = WINUSBTMC_ERR_FILE;
+    parc->pos += len;
+}
+
+static bool s_winusbtmc_archive_read(winusbtmc_archive_t *parc, void *dat, uint32_t len)
+{
+    return (len == 0) || (fread(dat, 1, len, parc->f) == len);
+}
+
+static int32_t s_winusbtmc_archive_add_entry(winusbtmc_archive_t *parc, const winusbtmc_archive_entry_t *pentry)
+{
+    winusbtmc_archive_entry_t *p;
+    uint32_t                   alloc;
+
+    if (parc->count == parc->alloc)
+    {
+        alloc = (parc->alloc) ? parc->alloc * 2 : 64;
+        p     = realloc(parc->entries, alloc * sizeof(winusbtmc_archive_entry_t));
+        if (!p)
+            return WINUSBTMC_ERR_MALLOC_FAILED;
+        parc->entries = p;
+        parc->alloc   = alloc;
+    }
+    parc->entries[parc->count++] = *pentry;
+    return WINUSBTMC_ERR_NONE;
+}
+
+static void s_winusbtmc_archive_free(winusbtmc_archive_t *parc)
+{
+    if (parc->f)
+        fclose(parc->f);
+    free(parc->entries);
+    free(parc->chunk);
+    free(parc->packed);
+    free(parc);
+}
+
+
+/**************************************************************************************************
+ * writing
+ **************************************************************************************************/
+
+/* encode and write the samples collected in parc->chunk */
+static void s_winusbtmc_archive_flush(winusbtmc_archive_t *parc)
+{
+    winusbtmc_archive_entry_t *pentry = &parc->entries[parc->count - 1];
+    uint8_t                    hdr[12];
+    uint32_t                   len;
+
+    if (parc->chunk_len == 0)
+        return;
+    len = s_winusbtmc_archive_encode(parc->chunk, parc->chunk_len, pentry->format, parc->packed);
+    s_winusbtmc_put32(&hdr[0], parc->chunk_len);
+    s_winusbtmc_put32(&hdr[4], len);
+    s_winusbtmc_put32(&hdr[8], s_winusbtmc_archive_value(parc->chunk, 0, pentry->format));
+    s_winusbtmc_archive_write(parc, hdr, sizeof(hdr));
+    s_winusbtmc_archive_write(parc, parc->packed, len);
+    pentry->samples  += parc->chunk_len;
+    pentry->stored   += sizeof(hdr) + len;
+    parc->chunk_len   = 0;
+}
+
+/* complete samples of the record, called by winusbtmc_record_add */
+static void s_winusbtmc_archive_samples(void *ctx, const uint8_t *src, uint32_t count)
+{
+    winusbtmc_archive_t *parc = ctx;
+    uint32_t             size, n;
+
+    size = winusbtmc_sample_size(parc->entries[parc->count - 1].format);
+    while (count > 0)
+    {
+        n = WINUSBTMC_ARCHIVE_CHUNK - parc->chunk_len;
+        if (n > count)
+            n = count;
+        memcpy(parc->chunk + parc->chunk_len * size, src, n * size);
+        parc->chunk_len += n;
+        src             += n * size;
+        count           -= n;
+        if (parc->chunk_len == WINUSBTMC_ARCHIVE_CHUNK)
+            s_winusbtmc_archive_flush(parc);
+    }
+}
+
+DLL_EXPORT int32_t winusbtmc_archive_create(winusbtmc_archive_t **pparc, const char *filename)
+{
+    winusbtmc_archive_t *parc;
+
+    if ( (!pparc) || (!filename) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    *pparc = (void *)0;
+
+    parc = calloc(1, sizeof(winusbtmc_archive_t));
+    if (!parc)
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    parc->write  = true;
+    parc->chunk  = malloc(WINUSBTMC_ARCHIVE_CHUNK * 2);
+    parc->packed = malloc(WINUSBTMC_ARCHIVE_PACKED);
+    if ( (!parc->chunk) || (!parc->packed) )
+    {
+        s_winusbtmc_archive_free(parc);
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+    parc->f = fopen(filename, "wb");
+    if (!parc->f)
+    {
+        s_winusbtmc_archive_free(parc);
+        return WINUSBTMC_ERR_FILE;
+    }
+    setvbuf(parc->f, (void *)0, _IOFBF, WINUSBTMC_ARCHIVE_BUFFER);
+
+    s_winusbtmc_archive_write(parc, WINUSBTMC_ARCHIVE_MAGIC, 8);
+    *pparc = parc;
+    return parc->error;
+}
+
+DLL_EXPORT int32_t winusbtmc_archive_begin(winusbtmc_archive_t *parc, int32_t format, double timestamp,
+                                           const char *preamble, uint32_t preamble_len)
+{
+    winusbtmc_archive_entry_t entry;
+    uint8_t                   hdr[20];
+    int32_t                   ret;
+
+    if ( (!parc) || (!parc->write) || (parc->capturing) || (winusbtmc_sample_size(format) == 0) ||
+         ((!preamble) && (preamble_len > 0)) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    if (parc->error < 0)
+        return parc->error;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.offset       = parc->pos;
+    entry.timestamp    = (timestamp != 0) ? timestamp : winusbtmc_time_now();
+    entry.format       = format;
+    entry.preamble_len = preamble_len;
+    ret = s_winusbtmc_archive_add_entry(parc, &entry);
+    if (ret < 0)
+        return ret;
+
+    s_winusbtmc_put32(&hdr[0], WINUSBTMC_ARCHIVE_CAPTURE);
+    s_winusbtmc_put32(&hdr[4], (uint32_t)format);
+    s_winusbtmc_putdouble(&hdr[8], entry.timestamp);
+    s_winusbtmc_put32(&hdr[16], preamble_len);
+    s_winusbtmc_archive_write(parc, hdr, sizeof(hdr));
+    s_winusbtmc_archive_write(parc, preamble, preamble_len);
+
+    memset(&parc->record, 0, sizeof(parc->record));
+    parc->record.unbounded = true;
+    parc->chunk_len        = 0;
+    parc->capturing        = true;
+    return parc->error;
+}
+
+DLL_EXPORT int32_t winusbtmc_archive_add(winusbtmc_archive_t *parc, const void *dat, uint32_t len)
+{
+    int32_t ret;
+
+    if ( (!parc) || (!parc->capturing) || ((!dat) && (len > 0)) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    if (parc->error < 0)
+        return parc->error;
+
+    ret = winusbtmc_record_add(&parc->record, parc->entries[parc->count - 1].format, dat, len,
+                               s_winusbtmc_archive_samples, parc);
+    return (ret < 0) ? ret : parc->error;
+}
+
+DLL_EXPORT int32_t winusbtmc_archive_end(winusbtmc_archive_t *parc)
+{
+    uint8_t end[4];
+
+    if ( (!parc) || (!parc->capturing) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    s_winusbtmc_archive_flush(parc);
+    s_winusbtmc_put32(end, 0);
+    s_winusbtmc_archive_write(parc, end, sizeof(end));
+    parc->entries[parc->count - 1].stored += sizeof(end);
+    parc->capturing = false;
+    return parc->error;
+}
+
+DLL_EXPORT int32_t winusbtmc_recv_archive(int32_t devnum, winusbtmc_archive_t *parc, int32_t format, double timestamp,
+                                          const char *preamble, uint32_t preamble_len)
+{
+    char   *buf;
+    int32_t ret, total;
+    bool    eom = false;
+
+    ret = winusbtmc_archive_begin(parc, format, timestamp, preamble, preamble_len);
+    if (ret < 0)
+        return ret;
+    buf = malloc(WINUSBTMC_ARCHIVE_BUFFER);
+    if (!buf)
+    {
+        winusbtmc_archive_end(parc);
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+
+    total = 0;
+    while ( (ret >= 0) && (!eom) )
+    {
+        ret = winusbtmc_recv_data(devnum, buf, WINUSBTMC_ARCHIVE_BUFFER, &eom);
+        if (ret >= 0)
+        {
+            total += ret;
+            ret    = winusbtmc_archive_add(parc, buf, ret);
+        }
+    }
+    free(buf);
+
+    if (ret < 0)
+    {
+        winusbtmc_archive_end(parc);
+        return ret;
+    }
+    ret = winusbtmc_archive_end(parc);
+    return (ret < 0) ? ret : total;
+}
+
+
+/**************************************************************************************************
+ * reading
+ **************************************************************************************************/
+
+/* read the index at the end of the file, returns false if there is none */
+static bool s_winusbtmc_archive_index(winusbtmc_archive_t *parc, uint64_t size)
+{
+    winusbtmc_archive_entry_t entry;
+    uint8_t                   trailer[WINUSBTMC_ARCHIVE_TRAILER], e[WINUSBTMC_ARCHIVE_ENTRY];
+    uint64_t                  offset;
+    uint32_t                  count, i;
+
+    if (size < 8 + WINUSBTMC_ARCHIVE_TRAILER)
+        return false;
+    if ( (s_winusbtmc_archive_seek(parc->f, size - WINUSBTMC_ARCHIVE_TRAILER) != 0) ||
+         (!s_winusbtmc_archive_read(parc, trailer, sizeof(trailer))) ||
+         (memcmp(&trailer[12], WINUSBTMC_ARCHIVE_END, 8) != 0) )
+        return false;
+    offset = s_winusbtmc_get64(&trailer[0]);
+    count  = s_winusbtmc_get32(&trailer[8]);
+    if ( (offset < 8) || (offset + (uint64_t)count * WINUSBTMC_ARCHIVE_ENTRY + WINUSBTMC_ARCHIVE_TRAILER != size) ||
+         (s_winusbtmc_archive_seek(parc->f, offset) != 0) )
+        return false;
+
+    for (i = 0; i < count; i++)
+    {
+        if (!s_winusbtmc_archive_read(parc, e, sizeof(e)))
+            return false;
+        entry.offset       = s_winusbtmc_get64(&e[0]);
+        entry.timestamp    = s_winusbtmc_getdouble(&e[8]);
+        entry.format       = (int32_t)s_winusbtmc_get32(&e[16]);
+        entry.preamble_len = s_winusbtmc_get32(&e[20]);
+        entry.samples      = s_winusbtmc_get64(&e[24]);
+        entry.stored       = s_winusbtmc_get64(&e[32]);
+        if (s_winusbtmc_archive_add_entry(parc, &entry) < 0)
+            return false;
+    }
+    return true;
+}
+
+/* find the captures of an archive without index, an incomplete capture at the end is ignored */
+static void s_winusbtmc_archive_scan(winusbtmc_archive_t *parc, uint64_t size)
+{
+    winusbtmc_archive_entry_t entry;
+    uint8_t                   hdr[20];
+    uint64_t                  pos;
+    uint32_t                  samples, len;
+
+    pos = 8;
+    while (s_winusbtmc_archive_seek(parc->f, pos) == 0)
+    {
+        if ( (!s_winusbtmc_archive_read(parc, hdr, sizeof(hdr))) ||
+             (s_winusbtmc_get32(&hdr[0]) != WINUSBTMC_ARCHIVE_CAPTURE) )
+            return;
+        memset(&entry, 0, sizeof(entry));
+        entry.offset       = pos;
+        entry.format       = (int32_t)s_winusbtmc_get32(&hdr[4]);
+        entry.timestamp    = s_winusbtmc_getdouble(&hdr[8]);
+        entry.preamble_len = s_winusbtmc_get32(&hdr[16]);
+        pos += sizeof(hdr) + entry.preamble_len;
+
+        for (;;)
+        {
+            if ( (s_winusbtmc_archive_seek(parc->f, pos) != 0) || (!s_winusbtmc_archive_read(parc, hdr, 4)) )
+                return;
+            samples = s_winusbtmc_get32(&hdr[0]);
+            if (samples == 0)
+                break;
+            if (!s_winusbtmc_archive_read(parc, &hdr[4], 8))
+                return;
+            len = s_winusbtmc_get32(&hdr[4]);
+            if (pos + 12 + len > size)
+                return;
+            entry.samples += samples;
+            entry.stored  += 12 + len;
+            pos           += 12 + len;
+        }
+        pos          += 4;
+        entry.stored += 4;
+        if (s_winusbtmc_archive_add_entry(parc, &entry) < 0)
+            return;
+    }
+}
+
+DLL_EXPORT int32_t winusbtmc_archive_open(winusbtmc_archive_t **pparc, const char *filename)
+{
+    winusbtmc_archive_t *parc;
+    char                 magic[8];
+    uint64_t             size;
+
+    if ( (!pparc) || (!filename) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    *pparc = (void *)0;
+
+    parc = calloc(1, sizeof(winusbtmc_archive_t));
+    if (!parc)
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    parc->f = fopen(filename, "rb");
+    if ( (!parc->f) || (!s_winusbtmc_archive_read(parc, magic, 8)) || (memcmp(magic, WINUSBTMC_ARCHIVE_MAGIC, 8) != 0) )
+    {
+        s_winusbtmc_archive_free(parc);
+        return WINUSBTMC_ERR_FILE;
+    }
+
+    size = s_winusbtmc_archive_size(parc->f);
+    if (!s_winusbtmc_archive_index(parc, size))
+    {
+        parc->count = 0;
+        s_winusbtmc_archive_scan(parc, size);
+    }
+    *pparc = parc;
+    return WINUSBTMC_ERR_NONE;
+}
+
+DLL_EXPORT int32_t winusbtmc_archive_count(winusbtmc_archive_t *parc)
+{
+    if (!parc)
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    return parc->count;
+}
+
+DLL_EXPORT int32_t winusbtmc_archive_info(winusbtmc_archive_t *parc, uint32_t index, winusbtmc_archive_info_t *pinfo)
+{
+    const winusbtmc_archive_entry_t *pentry;
+
+    if ( (!parc) || (index >= parc->count) || (!pinfo) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    pentry = &parc->entries[index];
+    pinfo->timestamp    = pentry->timestamp;
+    pinfo->format       = pentry->format;
+    pinfo->samples      = pentry->samples;
+    pinfo->preamble_len = pentry->preamble_len;
+    pinfo->stored       = pentry->stored;
+    return WINUSBTMC_ERR_NONE;
+}
+
+DLL_EXPORT int32_t winusbtmc_archive_read(winusbtmc_archive_t *parc, uint32_t index, char *preamble, uint32_t maxpreamble,
+                                          void *dst, uint64_t maxsamples)
+{
+    const winusbtmc_archive_entry_t *pentry;
+    uint8_t                          hdr[12], *packed, *out = dst;
+    uint64_t                         done;
+    uint32_t                         size, samples, len, first, n;
+    int32_t                          ret = WINUSBTMC_ERR_NONE;
+
+    if ( (!parc) || (parc->write) || (index >= parc->count) || ((!preamble) && (maxpreamble > 0)) ||
+         ((!dst) && (maxsamples > 0)) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    pentry = &parc->entries[index];
+    size   = winusbtmc_sample_size(pentry->format);
+    if ( (size == 0) || (s_winusbtmc_archive_seek(parc->f, pentry->offset + 20) != 0) )
+        return WINUSBTMC_ERR_FILE;
+
+    n = (pentry->preamble_len < maxpreamble) ? pentry->preamble_len : maxpreamble;
+    if ( (!s_winusbtmc_archive_read(parc, preamble, n)) ||
+         (s_winusbtmc_archive_seek(parc->f, pentry->offset + 20 + pentry->preamble_len) != 0) )
+        return WINUSBTMC_ERR_FILE;
+
+    /* a chunk which is only partly wanted is decoded behind the packed data */
+    packed = malloc(WINUSBTMC_ARCHIVE_PACKED + WINUSBTMC_ARCHIVE_CHUNK * 2);
+    if (!packed)
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    for (done = 0; (done < maxsamples) && (done < pentry->samples); done += samples)
+    {
+        if (!s_winusbtmc_archive_read(parc, hdr, sizeof(hdr)))
+        {
+            ret = WINUSBTMC_ERR_FILE;
+            break;
+        }
+        samples = s_winusbtmc_get32(&hdr[0]);
+        len     = s_winusbtmc_get32(&hdr[4]);
+        first   = s_winusbtmc_get32(&hdr[8]);
+        if ( (samples == 0) || (samples > WINUSBTMC_ARCHIVE_CHUNK) ||
+             (len > WINUSBTMC_ARCHIVE_PACKED) ||
+             (!s_winusbtmc_archive_read(parc, packed, len)) )
+        {
+            ret = WINUSBTMC_ERR_FILE;
+            break;
+        }
+        if (maxsamples - done >= samples)
+        {
+            if (!s_winusbtmc_archive_decode(packed, len, samples, pentry->format, first, out + done * size))
+                ret = WINUSBTMC_ERR_FILE;
+        }
+        else
+        {
+            if (!s_winusbtmc_archive_decode(packed, len, samples, pentry->format, first, packed + WINUSBTMC_ARCHIVE_PACKED))
+                ret = WINUSBTMC_ERR_FILE;
+            else
+                memcpy(out + done * size, packed + WINUSBTMC_ARCHIVE_PACKED, (size_t)(maxsamples - done) * size);
+        }
+        if (ret < 0)
+            break;
+    }
+    free(packed);
+    return ret;
+}
+
+DLL_EXPORT int32_t winusbtmc_archive_close(winusbtmc_archive_t *parc)
+{
+    const winusbtmc_archive_entry_t *pentry;
+    uint8_t                          e[WINUSBTMC_ARCHIVE_ENTRY], trailer[WINUSBTMC_ARCHIVE_TRAILER];
+    uint64_t                         offset;
+    uint32_t                         i;
+    int32_t                          ret = WINUSBTMC_ERR_NONE;
+
+    if (!parc)
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    if (parc->write)
+    {
+        if (parc->capturing)
+            winusbtmc_archive_end(parc);
+        offset = parc->pos;
+        for (i = 0; i < parc->count; i++)
+        {
+            pentry = &parc->entries[i];
+            s_winusbtmc_put64(&e[0], pentry->offset);
+            s_winusbtmc_putdouble(&e[8], pentry->timestamp);
+            s_winusbtmc_put32(&e[16], (uint32_t)pentry->format);
+            s_winusbtmc_put32(&e[20], pentry->preamble_len);
+            s_winusbtmc_put64(&e[24], pentry->samples);
+            s_winusbtmc_put64(&e[32], pentry->stored);
+            s_winusbtmc_archive_write(parc, e, sizeof(e));
+        }
+        s_winusbtmc_put64(&trailer[0], offset);
+        s_winusbtmc_put32(&trailer[8], parc->count);
+        memcpy(&trailer[12], WINUSBTMC_ARCHIVE_END, 8);
+        s_winusbtmc_archive_write(parc, trailer, sizeof(trailer));
+        ret = parc->error;
+        if ( (fclose(parc->f) != 0) && (ret == WINUSBTMC_ERR_NONE) )
+            ret = WINUSBTMC_ERR_FILE;
+        parc->f = (void *)0;
+    }
+    s_winusbtmc_archive_free(parc);
+    return ret;
+}
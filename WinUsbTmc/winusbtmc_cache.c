@@ -0,0 +1,216 @@
+/*
+ * Enumeration cache.
+ * Reading the string descriptors is the slowest part of finding a device by its string, every
+ * device has to be opened and asked for three strings. The cache file remembers the strings of
+ * each device together with its location and a descriptor fingerprint (vid:pid:bcdDevice:address),
+ * and the transfer size found by winusbtmc_calibrate.
+ * The usb address changes with every replug, so an entry is only reused while the device stays
+ * plugged in at the same port. Everything else is read from the device again.
+ *
+ * The file is a text file, one device per line, fields separated by tabs:
+ *   <transport>\t<location>\t<fingerprint>\t<transfer size>\t<manufacturer:product:serial>
+ * Malformed lines are ignored, a missing or damaged file just means a cold start.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+    #include <process.h>
+    #define getpid _getpid
+#else
+    #include <unistd.h>
+#endif
+#include "winusbtmc.h"
+#include "winusbtmc_private.h"
+
+#define WINUSBTMC_CACHE_HEADER "winusbtmc-cache 2"
+
+typedef struct
+{
+    char transport[16];
+    char location[WINUSBTMC_LOCATION_MAX];
+    char fingerprint[WINUSBTMC_FINGERPRINT_MAX];
+    char uniquestring[WINUSBTMC_USTR_MAX];
+    uint32_t transfer_size;              /* 0 if not calibrated */
+} winusbtmc_cache_entry_t;
+
+static winusbtmc_cache_entry_t *s_winusbtmc_cache = (void *)0;  /* grows when needed */
+static int32_t                  s_winusbtmc_cache_count = 0;
+static int32_t                  s_winusbtmc_cache_alloc = 0;
+
+
+/*
+ * make room for count entries, returns false if out of memory
+ */
+static bool s_winusbtmc_cache_reserve(int32_t count)
+{
+    winusbtmc_cache_entry_t *p;
+
+    if (count <= s_winusbtmc_cache_alloc)
+        return true;
+    count = (count < 2 * s_winusbtmc_cache_alloc) ? 2 * s_winusbtmc_cache_alloc : count;
+    p = realloc(s_winusbtmc_cache, count * sizeof(winusbtmc_cache_entry_t));
+    if (!p)
+        return false;
+    s_winusbtmc_cache       = p;
+    s_winusbtmc_cache_alloc = count;
+    return true;
+}
+
+/*
+ * copy the next tab separated field of *pline to dst, returns false if the field does not fit
+ */
+static bool s_winusbtmc_cache_field(char **pline, char *dst, size_t dstln)
+{
+    size_t len;
+
+    len = strcspn(*pline, "\t\r\n");
+    if ( (len == 0) || (len >= dstln) )
+        return false;
+    memcpy(dst, *pline, len);
+    dst[len] = '\0';
+    *pline += len;
+    if (**pline == '\t')
+        (*pline)++;
+    return true;
+}
+
+void winusbtmc_cache_load(const char *filename)
+{
+    FILE *f;
+    char  line[WINUSBTMC_USTR_MAX + WINUSBTMC_LOCATION_MAX + WINUSBTMC_FINGERPRINT_MAX + 48];
+    char  size[16];
+    char *p;
+    winusbtmc_cache_entry_t *pentry;
+
+    s_winusbtmc_cache_count = 0;
+
+    f = fopen(filename, "r");
+    if (!f)
+        return;
+
+    if ( (!fgets(line, sizeof(line), f)) || (strncmp(line, WINUSBTMC_CACHE_HEADER, strlen(WINUSBTMC_CACHE_HEADER)) != 0) )
+    { /* unknown format */
+        fclose(f);
+        return;
+    }
+
+    while ( (s_winusbtmc_cache_reserve(s_winusbtmc_cache_count + 1)) && (fgets(line, sizeof(line), f)) )
+    {
+        p      = line;
+        pentry = &s_winusbtmc_cache[s_winusbtmc_cache_count];
+        if ( (s_winusbtmc_cache_field(&p, pentry->transport, sizeof(pentry->transport))) &&
+             (s_winusbtmc_cache_field(&p, pentry->location, sizeof(pentry->location))) &&
+             (s_winusbtmc_cache_field(&p, pentry->fingerprint, sizeof(pentry->fingerprint))) &&
+             (s_winusbtmc_cache_field(&p, size, sizeof(size))) &&
+             (s_winusbtmc_cache_field(&p, pentry->uniquestring, sizeof(pentry->uniquestring))) )
+        {
+            pentry->transfer_size = strtoul(size, (void *)0, 10);
+            s_winusbtmc_cache_count++;
+        }
+    }
+    fclose(f);
+}
+
+bool winusbtmc_cache_lookup(winusbtmc_device_t *pdev)
+{
+    int32_t i;
+
+    if (pdev->id->fingerprint[0] == '\0')
+        return false;
+
+    for (i = 0; i < s_winusbtmc_cache_count; i++)
+    {
+        if ( (strcmp(s_winusbtmc_cache[i].transport, pdev->transport->name) == 0) &&
+             (strcmp(s_winusbtmc_cache[i].location, pdev->id->location) == 0) &&
+             (strcmp(s_winusbtmc_cache[i].fingerprint, pdev->id->fingerprint) == 0) )
+        {
+            strcpy(pdev->id->usb_uniquestring, s_winusbtmc_cache[i].uniquestring);
+            pdev->transfer_size = s_winusbtmc_cache[i].transfer_size;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * returns the entry of the interface at location, it is added if there is none. 0 if out of memory.
+ * One location holds one interface, a device plugged in there later replaces the entry
+ */
+static winusbtmc_cache_entry_t *s_winusbtmc_cache_entry(const char *transport, const char *location)
+{
+    winusbtmc_cache_entry_t *pentry;
+    int32_t i;
+
+    for (i = 0; i < s_winusbtmc_cache_count; i++)
+    {
+        if ( (strcmp(s_winusbtmc_cache[i].transport, transport) == 0) &&
+             (strcmp(s_winusbtmc_cache[i].location, location) == 0) )
+            return &s_winusbtmc_cache[i];
+    }
+    if (!s_winusbtmc_cache_reserve(s_winusbtmc_cache_count + 1))
+        return (void *)0;
+    pentry = &s_winusbtmc_cache[s_winusbtmc_cache_count++];
+    snprintf(pentry->transport, sizeof(pentry->transport), "%s", transport);
+    strcpy(pentry->location, location);
+    return pentry;
+}
+
+/*
+ * merge all devices with valid strings into the cache file. The entries of the file are read again
+ * first, so devices which are unplugged now keep their entries, and entries written by another program
+ * since the start are kept as well. The file is written to a temporary file first and renamed, so a
+ * concurrently started program never reads a half written file.
+ * The temporary file has the process id in its name, programs which save at the same time do not
+ * write into the same file, the last rename wins.
+ */
+void winusbtmc_cache_save(const char *filename, const winusbtmc_device_ptr_t *devices, int32_t count)
+{
+    FILE   *f;
+    char    tmpname[512];
+    int32_t i;
+    winusbtmc_device_id_t   *pid;
+    winusbtmc_cache_entry_t *pentry;
+
+    /* the loaded copy is updated as well, devices which are found later in this run use it */
+    winusbtmc_cache_load(filename);
+    for (i = 0; i < count; i++)
+    {
+        pid = devices[i]->id;
+        if ( (pid->strings_valid) && (pid->fingerprint[0]) &&
+             (pid->usb_uniquestring[strcspn(pid->usb_uniquestring, "\t\r\n")] == '\0') )
+        {
+            pentry = s_winusbtmc_cache_entry(devices[i]->transport->name, pid->location);
+            if (pentry)
+            {
+                strcpy(pentry->fingerprint, pid->fingerprint);
+                strcpy(pentry->uniquestring, pid->usb_uniquestring);
+                pentry->transfer_size = devices[i]->transfer_size;
+            }
+        }
+    }
+
+    snprintf(tmpname, sizeof(tmpname), "%s.%lu.tmp", filename, (unsigned long)getpid());
+    f = fopen(tmpname, "w");
+    if (!f)
+        return;
+
+    fprintf(f, WINUSBTMC_CACHE_HEADER "\n");
+    for (i = 0; i < s_winusbtmc_cache_count; i++)
+    {
+        pentry = &s_winusbtmc_cache[i];
+        fprintf(f, "%s\t%s\t%s\t%lu\t%s\n", pentry->transport, pentry->location,
+                pentry->fingerprint, (unsigned long)pentry->transfer_size, pentry->uniquestring);
+    }
+
+    if (fclose(f) != 0)
+    {
+        remove(tmpname);
+        return;
+    }
+#ifdef _WIN32
+    remove(filename); /* rename does not replace existing files on windows */
+#endif
+    if (rename(tmpname, filename) != 0)
+        remove(tmpname);
+}
@@ -0,0 +1,418 @@
+/*
+ * Dedicated I/O threads.
+ * With many instruments, blocking transfers in the application threads cause jitter and contention. When the I/O
+ * thread of a device is started, only this thread talks to the device (optionally pinned to a cpu). Application
+ * threads queue requests with winusbtmc_io_submit, which never waits for the device, and find the result in the
+ * request itself (the completion slot) when winusbtmc_io_wait returns.
+ *
+ * The queue is an intrusive lock-free MPSC queue (Vyukov): a producer links its request with one atomic exchange of
+ * the head, the I/O thread takes requests from the tail. Between the exchange and the link of the previous request
+ * the queue looks inconsistent to the consumer, it yields until the producer finished the link. The I/O thread
+ * sleeps on a condition variable (an event on windows) when the queue is empty, producers only signal it while it
+ * sleeps. Waiting application threads are counted the same way and woken after every completion.
+ */
+#ifdef __linux__
+    #define _GNU_SOURCE /* pthread_setaffinity_np */
+#endif
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <sched.h>
+    #include <time.h>
+#endif
+#include "winusbtmc.h"
+#include "winusbtmc_private.h"
+
+#define WINUSBTMC_IO_SPARE (64 * 1024)          /* rest of a response which does not fit to the request */
+
+/* fields shared by the threads, sequentially consistent like the acquisition ring (winusbtmc_acquire.c) */
+#define WINUSBTMC_IO_LOAD(field)              __atomic_load_n(&(field), __ATOMIC_SEQ_CST)
+#define WINUSBTMC_IO_STORE(field, value)      __atomic_store_n(&(field), (value), __ATOMIC_SEQ_CST)
+#define WINUSBTMC_IO_EXCHANGE(field, value)   __atomic_exchange_n(&(field), (value), __ATOMIC_SEQ_CST)
+#define WINUSBTMC_IO_ADD(field, value)        __atomic_add_fetch(&(field), (value), __ATOMIC_SEQ_CST)
+
+struct winusbtmc_io_s
+{
+    winusbtmc_device_t      *pdev;
+    winusbtmc_io_request_t  *head;              /* last queued request, exchanged by the producers */
+    winusbtmc_io_request_t  *tail;              /* next request taken, used by the I/O thread only */
+    winusbtmc_io_request_t   stub;              /* keeps the queue linked when it is empty */
+    char                    *spare;             /* WINUSBTMC_IO_SPARE */
+    bool                     stop;
+    bool                     sleeping;          /* the I/O thread waits for requests */
+    int32_t                  waiters;           /* application threads in winusbtmc_io_wait */
+#ifdef _WIN32
+    HANDLE                   thread;
+    HANDLE                   event;             /* wakes the I/O thread */
+    HANDLE                   done;              /* semaphore, wakes the waiters after a completion */
+#else
+    pthread_t                thread;
+    pthread_mutex_t          mutex;
+    pthread_cond_t           cond;              /* wakes the I/O thread */
+    pthread_cond_t           done;              /* wakes the waiters after a completion */
+#endif
+};
+
+
+static void s_winusbtmc_io_push(struct winusbtmc_io_s *pio, winusbtmc_io_request_t *preq)
+{
+    winusbtmc_io_request_t *prev;
+
+    WINUSBTMC_IO_STORE(preq->next, (winusbtmc_io_request_t *)0);
+    prev = WINUSBTMC_IO_EXCHANGE(pio->head, preq);
+    WINUSBTMC_IO_STORE(prev->next, preq);
+}
+
+/*
+ * takes the oldest request, 0 if the queue is empty or a producer did not finish its link yet
+ */
+static winusbtmc_io_request_t *s_winusbtmc_io_pop(struct winusbtmc_io_s *pio)
+{
+    winusbtmc_io_request_t *tail = pio->tail;
+    winusbtmc_io_request_t *next = WINUSBTMC_IO_LOAD(tail->next);
+
+    if (tail == &pio->stub)
+    {
+        if (!next)
+            return (void *)0;
+        pio->tail = next;
+        tail      = next;
+        next      = WINUSBTMC_IO_LOAD(next->next);
+    }
+    if (next)
+    {
+        pio->tail = next;
+        return tail;
+    }
+    if (tail != WINUSBTMC_IO_LOAD(pio->head))
+        return (void *)0;
+    s_winusbtmc_io_push(pio, &pio->stub); /* tail is the last request, the stub takes its place */
+    next = WINUSBTMC_IO_LOAD(tail->next);
+    if (next)
+    {
+        pio->tail = next;
+        return tail;
+    }
+    return (void *)0;
+}
+
+/* nothing queued, not even a request which is linked right now */
+static bool s_winusbtmc_io_empty(struct winusbtmc_io_s *pio)
+{
+    return (pio->tail == &pio->stub) && (WINUSBTMC_IO_LOAD(pio->head) == &pio->stub);
+}
+
+static void s_winusbtmc_io_yield(void)
+{
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+/*
+ * wake the I/O thread if it sleeps, called after a request was queued or stop was set
+ */
+static void s_winusbtmc_io_wake(struct winusbtmc_io_s *pio)
+{
+    if (!WINUSBTMC_IO_LOAD(pio->sleeping))
+        return;
+#ifdef _WIN32
+    SetEvent(pio->event);
+#else
+    pthread_mutex_lock(&pio->mutex);
+    pthread_cond_signal(&pio->cond);
+    pthread_mutex_unlock(&pio->mutex);
+#endif
+}
+
+/*
+ * the I/O thread waits for the next request unless one was queued already
+ */
+static void s_winusbtmc_io_sleep(struct winusbtmc_io_s *pio)
+{
+#ifdef _WIN32
+    WINUSBTMC_IO_STORE(pio->sleeping, true);
+    if ( (s_winusbtmc_io_empty(pio)) && (!WINUSBTMC_IO_LOAD(pio->stop)) )
+        WaitForSingleObject(pio->event, INFINITE);
+    WINUSBTMC_IO_STORE(pio->sleeping, false);
+#else
+    pthread_mutex_lock(&pio->mutex);
+    WINUSBTMC_IO_STORE(pio->sleeping, true);
+    if ( (s_winusbtmc_io_empty(pio)) && (!WINUSBTMC_IO_LOAD(pio->stop)) )
+        pthread_cond_wait(&pio->cond, &pio->mutex);
+    WINUSBTMC_IO_STORE(pio->sleeping, false);
+    pthread_mutex_unlock(&pio->mutex);
+#endif
+}
+
+/*
+ * publish the result of a request and wake the waiting application threads
+ */
+static void s_winusbtmc_io_complete(struct winusbtmc_io_s *pio, winusbtmc_io_request_t *preq, int32_t result)
+{
+    int32_t waiters;
+
+    preq->end_ms = winusbtmc_time_ms();
+    WINUSBTMC_IO_STORE(preq->result, result);
+    waiters = WINUSBTMC_IO_LOAD(pio->waiters);
+    if (waiters == 0)
+        return;
+#ifdef _WIN32
+    ReleaseSemaphore(pio->done, waiters, NULL); /* each waiter checks its own request */
+#else
+    pthread_mutex_lock(&pio->mutex);
+    pthread_cond_broadcast(&pio->done);
+    pthread_mutex_unlock(&pio->mutex);
+#endif
+}
+
+/*
+ * send the command of a request and receive its response, returns the response length or an error code
+ */
+static int32_t s_winusbtmc_io_execute(struct winusbtmc_io_s *pio, winusbtmc_io_request_t *preq)
+{
+    winusbtmc_device_t *pdev = pio->pdev;
+    uint32_t            len  = 0;
+    int32_t             ret;
+    bool                eom  = false;
+
+    preq->start_ms  = winusbtmc_time_ms();
+    preq->truncated = false;
+    ret = winusbtmc_device_write(pdev, preq->command, (preq->len) ? preq->len : (uint32_t)strlen(preq->command));
+    while ( (ret >= 0) && (preq->response) && (!eom) )
+    {
+        if (len < preq->maxlen)
+        {
+            ret = winusbtmc_device_read(pdev, preq->response + len, preq->maxlen - len, &eom);
+            if (ret > 0)
+                len += ret;
+        }
+        else
+        { /* the rest is read anyway, the next request would get it otherwise */
+            preq->truncated = true;
+            ret = winusbtmc_device_read(pdev, pio->spare, WINUSBTMC_IO_SPARE, &eom);
+        }
+    }
+    return (ret < 0) ? ret : (int32_t)len;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI s_winusbtmc_io_thread(LPVOID arg)
+#else
+static void *s_winusbtmc_io_thread(void *arg)
+#endif
+{
+    struct winusbtmc_io_s  *pio = arg;
+    winusbtmc_io_request_t *preq;
+
+    for (;;)
+    {
+        preq = s_winusbtmc_io_pop(pio);
+        if (preq)
+        {
+            s_winusbtmc_io_complete(pio, preq, s_winusbtmc_io_execute(pio, preq));
+        }
+        else if (!s_winusbtmc_io_empty(pio))
+        {
+            s_winusbtmc_io_yield(); /* a producer is between exchange and link */
+        }
+        else if (WINUSBTMC_IO_LOAD(pio->stop))
+        {
+            break; /* requests queued before the stop are done */
+        }
+        else
+        {
+            s_winusbtmc_io_sleep(pio);
+        }
+    }
+    return 0;
+}
+
+static void s_winusbtmc_io_free(struct winusbtmc_io_s *pio)
+{
+#ifdef _WIN32
+    if (pio->event)
+        CloseHandle(pio->event);
+    if (pio->done)
+        CloseHandle(pio->done);
+#else
+    pthread_cond_destroy(&pio->done);
+    pthread_cond_destroy(&pio->cond);
+    pthread_mutex_destroy(&pio->mutex);
+#endif
+    free(pio->spare);
+    free(pio);
+}
+
+/*
+ * pin the I/O thread to a cpu, returns false if the cpu does not exist
+ */
+static bool s_winusbtmc_io_affinity(struct winusbtmc_io_s *pio, int32_t cpu)
+{
+#ifdef _WIN32
+    if (cpu >= (int32_t)(8 * sizeof(DWORD_PTR)))
+        return false;
+    return SetThreadAffinityMask(pio->thread, (DWORD_PTR)1 << cpu) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+
+    if (cpu >= CPU_SETSIZE)
+        return false;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pio->thread, sizeof(set), &set) == 0;
+#else
+    (void)pio;
+    (void)cpu;
+    return false;
+#endif
+}
+
+int32_t winusbtmc_io_begin(winusbtmc_device_t *pdev, int32_t cpu)
+{
+    struct winusbtmc_io_s *pio;
+
+    if ( (pdev->io) || (pdev->acquire) )
+        return WINUSBTMC_ERR_DEVICE_BUSY;
+
+    pio = calloc(1, sizeof(struct winusbtmc_io_s));
+    if (!pio)
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    pio->pdev  = pdev;
+    pio->head  = &pio->stub;
+    pio->tail  = &pio->stub;
+    pio->spare = malloc(WINUSBTMC_IO_SPARE);
+#ifdef _WIN32
+    pio->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    pio->done  = CreateSemaphore(NULL, 0, INT32_MAX, NULL);
+    if ( (!pio->spare) || (!pio->event) || (!pio->done) )
+#else
+    pthread_mutex_init(&pio->mutex, NULL);
+    pthread_cond_init(&pio->cond, NULL);
+    pthread_cond_init(&pio->done, NULL);
+    if (!pio->spare)
+#endif
+    {
+        s_winusbtmc_io_free(pio);
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+
+#ifdef _WIN32
+    pio->thread = CreateThread(NULL, 0, s_winusbtmc_io_thread, pio, 0, NULL);
+    if (pio->thread == NULL)
+#else
+    if (pthread_create(&pio->thread, NULL, s_winusbtmc_io_thread, pio) != 0)
+#endif
+    {
+        s_winusbtmc_io_free(pio);
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+    pdev->io = pio;
+    if ( (cpu >= 0) && (!s_winusbtmc_io_affinity(pio, cpu)) )
+    {
+        winusbtmc_io_end(pdev);
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    }
+    return WINUSBTMC_ERR_NONE;
+}
+
+int32_t winusbtmc_io_queue(winusbtmc_device_t *pdev, winusbtmc_io_request_t *preq)
+{
+    struct winusbtmc_io_s *pio = pdev->io;
+
+    if ( (!pio) || (!preq) || (!preq->command) || ( (preq->response) && (preq->maxlen == 0) ) || (preq->len > INT32_MAX) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    preq->queued_ms = winusbtmc_time_ms();
+    preq->start_ms  = 0;
+    preq->end_ms    = 0;
+    preq->truncated = false;
+    WINUSBTMC_IO_STORE(preq->result, WINUSBTMC_ERR_PENDING);
+    s_winusbtmc_io_push(pio, preq);
+    s_winusbtmc_io_wake(pio);
+    return WINUSBTMC_ERR_NONE;
+}
+
+int32_t winusbtmc_io_result(winusbtmc_device_t *pdev, winusbtmc_io_request_t *preq, int32_t timeout_ms)
+{
+    struct winusbtmc_io_s *pio = pdev->io;
+    int32_t                result;
+#ifndef _WIN32
+    struct timespec        ts;
+    time_t                 sec;
+    long                   ns;
+#else
+    double                 start, left = 0;
+#endif
+
+    if (!preq)
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    result = WINUSBTMC_IO_LOAD(preq->result);
+    if ( (result != WINUSBTMC_ERR_PENDING) || (timeout_ms == 0) || (!pio) )
+        return result;
+
+#ifdef _WIN32
+    start = winusbtmc_time_ms();
+    WINUSBTMC_IO_ADD(pio->waiters, 1);
+    while ( ((result = WINUSBTMC_IO_LOAD(preq->result)) == WINUSBTMC_ERR_PENDING) )
+    {
+        if (timeout_ms > 0)
+        {
+            left = timeout_ms - (winusbtmc_time_ms() - start);
+            if (left <= 0)
+                break;
+        }
+        WaitForSingleObject(pio->done, (timeout_ms < 0) ? INFINITE : (DWORD)left + 1);
+    }
+    WINUSBTMC_IO_ADD(pio->waiters, -1);
+#else
+    if (timeout_ms > 0)
+    {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        sec         = timeout_ms / 1000;
+        ns          = ts.tv_nsec + (long)(timeout_ms % 1000) * 1000000L;
+        ts.tv_sec  += sec + ns / 1000000000;
+        ts.tv_nsec  = ns % 1000000000;
+    }
+    pthread_mutex_lock(&pio->mutex);
+    WINUSBTMC_IO_ADD(pio->waiters, 1);
+    while ( ((result = WINUSBTMC_IO_LOAD(preq->result)) == WINUSBTMC_ERR_PENDING) )
+    {
+        if (timeout_ms < 0)
+            pthread_cond_wait(&pio->done, &pio->mutex);
+        else if (pthread_cond_timedwait(&pio->done, &pio->mutex, &ts) != 0)
+            break;
+    }
+    WINUSBTMC_IO_ADD(pio->waiters, -1);
+    pthread_mutex_unlock(&pio->mutex);
+#endif
+    return result;
+}
+
+int32_t winusbtmc_io_end(winusbtmc_device_t *pdev)
+{
+    struct winusbtmc_io_s *pio = pdev->io;
+
+    if (!pio)
+        return WINUSBTMC_ERR_NONE;
+
+    WINUSBTMC_IO_STORE(pio->stop, true);
+#ifdef _WIN32
+    SetEvent(pio->event);
+    WaitForSingleObject(pio->thread, INFINITE);
+    CloseHandle(pio->thread);
+#else
+    pthread_mutex_lock(&pio->mutex);
+    pthread_cond_signal(&pio->cond);
+    pthread_mutex_unlock(&pio->mutex);
+    pthread_join(pio->thread, NULL);
+#endif
+    s_winusbtmc_io_free(pio);
+    pdev->io = (void *)0;
+    return WINUSBTMC_ERR_NONE;
+}
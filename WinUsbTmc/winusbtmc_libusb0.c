@@ -0,0 +1,213 @@
+/*
+ * usb port layer for the libusb-win32 0.1 API (static libusb.a).
+ * This is the default usb port, it is not used when WINUSBTMC_LIBUSB1 or WINUSBTMC_SIMPORT is defined.
+ */
+#if !defined(WINUSBTMC_LIBUSB1) && !defined(WINUSBTMC_SIMPORT)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lusb0_usb.h"
+#include "winusbtmc_private.h"
+
+
+void winusbtmc_usbport_init(void)
+{
+    usb_init();                            /* initialize the library */
+    usb_find_busses();                     /* find all busses */
+    usb_find_devices();                    /* find all connected devices */
+}
+
+void winusbtmc_usbport_deinit(void)
+{
+    /* libusb-win32 has nothing to release, usb_init is called again by the next winusbtmc_init */
+}
+
+bool winusbtmc_usbport_changed(void)
+{
+    return false; /* libusb-win32 has no hotplug notifications, winusbtmc_init rescans the busses */
+}
+
+int32_t winusbtmc_usbport_deviceindex(int32_t devicenum, winusbtmc_device_t *pdeviceinfo)
+{
+    struct usb_bus *bus;
+    int c, i, a, e;
+    int32_t devicecount;
+    struct usb_endpoint_descriptor *endpoint;
+
+    devicecount = 0;
+
+    /* Walk through all devices associated with libusb driver
+     * YES, this is real spaghetti code :-) */
+    for (bus = usb_get_busses(); bus; bus = bus->next)
+    {
+        struct usb_device *dev;
+
+        /* Loop through all devices */
+        for (dev = bus->devices; dev; dev = dev->next)
+        {
+            /* Loop through all of the configurations */
+            for (c = 0; c < dev->descriptor.bNumConfigurations; c++)
+            {
+                /* Loop through all of the interfaces */
+                for (i = 0; i < dev->config[c].bNumInterfaces; i++)
+                {
+                    /* Loop through all of the alternate settings */
+                    for (a = 0; a < dev->config[c].interface[i].num_altsetting; a++)
+                    {
+                        /* Check if this interface is a usbtmc if */
+                        if ( (dev->config[c].interface[i].altsetting[a].bInterfaceClass == WINUSBTMC_CLASS) &&
+                             (dev->config[c].interface[i].altsetting[a].bInterfaceSubClass == WINUSBTMC_SUBCLASS) &&
+                             ( (dev->config[c].interface[i].altsetting[a].bInterfaceProtocol == 0x00) ||
+                               (dev->config[c].interface[i].altsetting[a].bInterfaceProtocol == 0x01))   )
+                        {
+                            if ((devicenum == devicecount) && (pdeviceinfo) )
+                            {
+                                winusbtmc_device_clear(pdeviceinfo);
+                                pdeviceinfo->dev              = dev;
+                                pdeviceinfo->usb_handle       = (void *)0;
+                                pdeviceinfo->usb_config       = dev->config[c].bConfigurationValue;
+                                pdeviceinfo->usb_interface    = i;
+                                pdeviceinfo->usb_alt_setting  = a;
+                                pdeviceinfo->usb_vid          = dev->descriptor.idVendor;
+                                pdeviceinfo->usb_pid          = dev->descriptor.idProduct;
+                                pdeviceinfo->usb_ep_bulkin    = -1;
+                                pdeviceinfo->usb_ep_bulkout   = -1;
+                                pdeviceinfo->usb_ep_interrupt = -1;
+                                snprintf(pdeviceinfo->id->location, WINUSBTMC_LOCATION_MAX, "%.24s/%.24s:%d", bus->dirname, dev->filename, i);
+                                snprintf(pdeviceinfo->id->fingerprint, WINUSBTMC_FINGERPRINT_MAX, "%04x:%04x:%04x:%d",
+                                         dev->descriptor.idVendor, dev->descriptor.idProduct, dev->descriptor.bcdDevice, dev->devnum);
+
+                                /* identify endpoints (bulk in, bulk out, interrupt in) */
+                                for (e = 0; e < dev->config[c].interface[i].altsetting[a].bNumEndpoints; e++)
+                                {
+                                    endpoint = &dev->config[c].interface[i].altsetting[a].endpoint[e];
+                                    switch (endpoint->bmAttributes)
+                                    {
+                                        case USB_ENDPOINT_TYPE_BULK: /* bulk in or out => identify direction */
+                                            if (endpoint->bEndpointAddress & (USB_ENDPOINT_DIR_MASK))
+                                            { /* bit 7 is set => IN endpoint*/
+                                                pdeviceinfo->usb_ep_bulkin      = endpoint->bEndpointAddress;
+                                                pdeviceinfo->usb_ep_bulkin_size = endpoint->wMaxPacketSize;
+                                            }
+                                            else
+                                            {
+                                                pdeviceinfo->usb_ep_bulkout = endpoint->bEndpointAddress;
+                                            }
+                                            break;
+                                        case USB_ENDPOINT_TYPE_INTERRUPT:
+                                            if (endpoint->bEndpointAddress & (USB_ENDPOINT_DIR_MASK))
+                                            { /* bit 7 is set => IN endpoint*/
+                                                pdeviceinfo->usb_ep_interrupt = endpoint->bEndpointAddress;
+                                            }
+                                            break;
+                                        default:
+                                            break;
+                                    }
+                                }
+                            }
+                            devicecount++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return devicecount;
+}
+
+int32_t winusbtmc_usbport_get_strings(winusbtmc_device_t *pdev, char *manufacturer, char *product, char *serial, int strln)
+{
+    struct usb_device *dev = pdev->dev;
+    usb_dev_handle    *udev;
+
+    *manufacturer = '\0';
+    *product      = '\0';
+    *serial       = '\0';
+
+    udev = usb_open(dev);
+    if (!udev)
+    {
+        return -1; /* device can not be opened */
+    }
+
+    if (dev->descriptor.iManufacturer)
+    {
+        if (usb_get_string_simple(udev, dev->descriptor.iManufacturer, manufacturer, strln) <= 0)
+            *manufacturer = '\0';
+    }
+    if (dev->descriptor.iProduct)
+    {
+        if (usb_get_string_simple(udev, dev->descriptor.iProduct, product, strln) <= 0)
+            *product = '\0';
+    }
+    if (dev->descriptor.iSerialNumber)
+    {
+        if (usb_get_string_simple(udev, dev->descriptor.iSerialNumber, serial, strln) <= 0)
+            *serial = '\0';
+    }
+    usb_close(udev);
+
+    return 0;
+}
+
+int32_t winusbtmc_usbport_open(winusbtmc_device_t *pdev)
+{
+    pdev->usb_handle = usb_open(pdev->dev);
+    return pdev->usb_handle ? 0 : -1;
+}
+
+void winusbtmc_usbport_close(winusbtmc_device_t *pdev)
+{
+    usb_release_interface(pdev->usb_handle, pdev->usb_interface);
+    usb_close(pdev->usb_handle);
+    pdev->usb_handle = (void *)0;
+}
+
+int32_t winusbtmc_usbport_claim(winusbtmc_device_t *pdev)
+{
+    if (usb_claim_interface(pdev->usb_handle, pdev->usb_interface) < 0)
+    {
+        return -1;
+    }
+
+    if (usb_set_configuration(pdev->usb_handle, pdev->usb_config) < 0)
+    {
+        return -1;
+    }
+
+ /*   if (usb_set_altinterface(pdev->usb_handle, pdev->usb_alt_setting) < 0)
+    {
+        return -1;
+    }*/
+
+    return 0;
+}
+
+int32_t winusbtmc_usbport_control_in(winusbtmc_device_t *pdev, uint8_t request, uint16_t value, char *dat, uint16_t len)
+{
+    return usb_control_msg(pdev->usb_handle, USB_TYPE_CLASS | USB_RECIP_INTERFACE | USB_ENDPOINT_IN,
+                           request,
+                           value,
+                           pdev->usb_interface,  /* interface id */
+                           dat, len, WINUSBTMC_TIMEOUT);
+}
+
+int32_t winusbtmc_usbport_clear_halt(winusbtmc_device_t *pdev, uint8_t endpoint)
+{
+    return usb_clear_halt(pdev->usb_handle, endpoint);
+}
+
+int32_t winusbtmc_usbport_bulk_write(winusbtmc_device_t *pdev, const char *dat, uint32_t len)
+{
+    return usb_bulk_write(pdev->usb_handle, pdev->usb_ep_bulkout, (char *)dat, len, WINUSBTMC_TIMEOUT);
+}
+
+int32_t winusbtmc_usbport_bulk_read(winusbtmc_device_t *pdev, char *dat, uint32_t len)
+{
+    /* libusb-win32 splits large requests internally, so a single synchronous read is used */
+    return usb_bulk_read(pdev->usb_handle, pdev->usb_ep_bulkin, dat, len, WINUSBTMC_TIMEOUT);
+}
+
+#endif // !WINUSBTMC_LIBUSB1 && !WINUSBTMC_SIMPORT
@@ -0,0 +1,526 @@
+/*
+ * usb port layer for the libusb-1.0 API.
+ * Used when WINUSBTMC_LIBUSB1 is defined, e.g. for Linux builds (link with -lusb-1.0).
+ *
+ * Large bulk-in reads are split into chunks which are submitted as asynchronous transfers.
+ * Several chunks are kept queued on the bulk-in endpoint, so the host controller always has a
+ * buffer to fill and the device does not need to wait for the completion of the previous one.
+ */
+#ifdef WINUSBTMC_LIBUSB1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libusb-1.0/libusb.h>
+#include "winusbtmc_private.h"
+
+#define WINUSBTMC_LIBUSB1_CHUNK  (64 * 1024) /* size of one queued bulk-in transfer, multiple of any wMaxPacketSize */
+#define WINUSBTMC_LIBUSB1_QUEUED (4)         /* count of bulk-in transfers kept queued during large reads */
+
+typedef struct
+{
+    struct libusb_transfer *xfer[WINUSBTMC_LIBUSB1_QUEUED];
+    unsigned char          *buf;              /* destination buffer */
+    uint32_t                len;              /* size of destination buffer */
+    uint32_t                submitted;        /* offset up to which transfers were submitted */
+    uint32_t                received;         /* count of bytes received in sequence */
+    uint32_t                expected;         /* total length announced by usbtmc header, 0 if unknown */
+    int                     pending;          /* count of transfers owned by libusb, atomic */
+    int                     completed;        /* every transfer is back, set atomic by the last callback */
+    bool                    done;             /* short packet, expected length or error seen */
+    bool                    error;
+} winusbtmc_libusb1_stream_t;
+
+static libusb_context *s_winusbtmc_libusb1_ctx     = (void *)0;
+static libusb_device **s_winusbtmc_libusb1_devlist = (void *)0;
+static bool            s_winusbtmc_libusb1_hotplug = false;   /* hotplug callback is registered */
+static libusb_hotplug_callback_handle s_winusbtmc_libusb1_hotplug_handle; /* valid if s_winusbtmc_libusb1_hotplug */
+static volatile bool   s_winusbtmc_libusb1_changed = false;   /* set by the hotplug callback */
+
+
+/*
+ * returns the usbtmc interface descriptor of interface / altsetting if it is one, otherwise 0
+ */
+static const struct libusb_interface_descriptor *s_winusbtmc_libusb1_tmcif(const struct libusb_config_descriptor *config, int i, int a)
+{
+    const struct libusb_interface_descriptor *ifdesc = &config->interface[i].altsetting[a];
+
+    if ( (ifdesc->bInterfaceClass == WINUSBTMC_CLASS) &&
+         (ifdesc->bInterfaceSubClass == WINUSBTMC_SUBCLASS) &&
+         ( (ifdesc->bInterfaceProtocol == 0x00) || (ifdesc->bInterfaceProtocol == 0x01) ) )
+    {
+        return ifdesc;
+    }
+    return (void *)0;
+}
+
+/*
+ * hotplug callback, only takes note of the change. The device list is refreshed by
+ * winusbtmc_usbport_changed, because libusb does not allow blocking calls from here
+ */
+static int LIBUSB_CALL s_winusbtmc_libusb1_hotplug_callback(libusb_context *ctx, libusb_device *device, libusb_hotplug_event event, void *user_data)
+{
+    s_winusbtmc_libusb1_changed = true;
+    return 0; /* keep the callback registered */
+}
+
+void winusbtmc_usbport_init(void)
+{
+    if (!s_winusbtmc_libusb1_ctx)
+    {
+        if (libusb_init(&s_winusbtmc_libusb1_ctx) < 0)
+        {
+            s_winusbtmc_libusb1_ctx = (void *)0;
+            return;
+        }
+
+        if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+        {
+            s_winusbtmc_libusb1_hotplug = ( libusb_hotplug_register_callback(s_winusbtmc_libusb1_ctx,
+                                                LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+                                                LIBUSB_HOTPLUG_NO_FLAGS,
+                                                LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+                                                s_winusbtmc_libusb1_hotplug_callback, (void *)0,
+                                                &s_winusbtmc_libusb1_hotplug_handle) == LIBUSB_SUCCESS );
+        }
+    }
+    s_winusbtmc_libusb1_changed = false;
+
+    if (s_winusbtmc_libusb1_devlist)
+    {
+        libusb_free_device_list(s_winusbtmc_libusb1_devlist, 1);
+        s_winusbtmc_libusb1_devlist = (void *)0;
+    }
+
+    if (libusb_get_device_list(s_winusbtmc_libusb1_ctx, &s_winusbtmc_libusb1_devlist) < 0)
+    {
+        s_winusbtmc_libusb1_devlist = (void *)0;
+    }
+}
+
+void winusbtmc_usbport_deinit(void)
+{
+    if (!s_winusbtmc_libusb1_ctx)
+    {
+        return;
+    }
+    if (s_winusbtmc_libusb1_hotplug)
+    {
+        libusb_hotplug_deregister_callback(s_winusbtmc_libusb1_ctx, s_winusbtmc_libusb1_hotplug_handle);
+        s_winusbtmc_libusb1_hotplug = false;
+    }
+    if (s_winusbtmc_libusb1_devlist)
+    {
+        libusb_free_device_list(s_winusbtmc_libusb1_devlist, 1);
+        s_winusbtmc_libusb1_devlist = (void *)0;
+    }
+    libusb_exit(s_winusbtmc_libusb1_ctx);
+    s_winusbtmc_libusb1_ctx = (void *)0;
+}
+
+bool winusbtmc_usbport_changed(void)
+{
+    struct timeval tv;
+
+    if (!s_winusbtmc_libusb1_hotplug)
+    {
+        return false;
+    }
+
+    /* deliver pending hotplug events without blocking */
+    tv.tv_sec  = 0;
+    tv.tv_usec = 0;
+    libusb_handle_events_timeout_completed(s_winusbtmc_libusb1_ctx, &tv, (void *)0);
+    if (!s_winusbtmc_libusb1_changed)
+    {
+        return false;
+    }
+    s_winusbtmc_libusb1_changed = false;
+
+    /* libusb keeps its device list up to date from the hotplug events, so this does not rescan the busses */
+    if (s_winusbtmc_libusb1_devlist)
+    {
+        libusb_free_device_list(s_winusbtmc_libusb1_devlist, 1);
+        s_winusbtmc_libusb1_devlist = (void *)0;
+    }
+    if (libusb_get_device_list(s_winusbtmc_libusb1_ctx, &s_winusbtmc_libusb1_devlist) < 0)
+    {
+        s_winusbtmc_libusb1_devlist = (void *)0;
+    }
+    return true;
+}
+
+/*
+ * location of an interface in the form used by sysfs: "<bus>-<port>.<port>...:<config>.<interface>"
+ */
+static void s_winusbtmc_libusb1_location(libusb_device *dev, uint8_t config, uint8_t interface, char *location)
+{
+    uint8_t ports[8];
+    int     nports, len, i;
+
+    nports = libusb_get_port_numbers(dev, ports, sizeof(ports));
+    len = snprintf(location, WINUSBTMC_LOCATION_MAX, "%d-", libusb_get_bus_number(dev));
+    for (i = 0; (i < nports) && (len < WINUSBTMC_LOCATION_MAX); i++)
+    {
+        len += snprintf(&location[len], WINUSBTMC_LOCATION_MAX - len, (i == 0) ? "%d" : ".%d", ports[i]);
+    }
+    if (len < WINUSBTMC_LOCATION_MAX)
+    {
+        snprintf(&location[len], WINUSBTMC_LOCATION_MAX - len, ":%d.%d", config, interface);
+    }
+}
+
+int32_t winusbtmc_usbport_deviceindex(int32_t devicenum, winusbtmc_device_t *pdeviceinfo)
+{
+    libusb_device **pdev;
+    struct libusb_device_descriptor desc;
+    struct libusb_config_descriptor *config;
+    const struct libusb_interface_descriptor *ifdesc;
+    const struct libusb_endpoint_descriptor *endpoint;
+    int c, i, a, e;
+    int32_t devicecount;
+#ifdef __linux__
+    uint8_t ports[8];
+    int     nports;
+#endif
+
+    devicecount = 0;
+    if (!s_winusbtmc_libusb1_devlist)
+    {
+        return 0;
+    }
+
+    for (pdev = s_winusbtmc_libusb1_devlist; *pdev; pdev++)
+    {
+        if (libusb_get_device_descriptor(*pdev, &desc) < 0)
+            continue;
+#ifdef __linux__
+        nports = libusb_get_port_numbers(*pdev, ports, sizeof(ports));
+#endif
+
+        for (c = 0; c < desc.bNumConfigurations; c++)
+        {
+            if (libusb_get_config_descriptor(*pdev, c, &config) < 0)
+                continue;
+
+            for (i = 0; i < config->bNumInterfaces; i++)
+            {
+                for (a = 0; a < config->interface[i].num_altsetting; a++)
+                {
+                    ifdesc = s_winusbtmc_libusb1_tmcif(config, i, a);
+                    if (!ifdesc)
+                        continue;
+#ifdef __linux__
+                    if ( (nports > 0) &&
+                         (winusbtmc_linux_driver_bound(libusb_get_bus_number(*pdev), ports, nports, config->bConfigurationValue, ifdesc->bInterfaceNumber)) )
+                        continue; /* owned by the kernel usbtmc driver => handled by winusbtmc_transport_linux */
+#endif
+
+                    if ((devicenum == devicecount) && (pdeviceinfo) )
+                    {
+                        winusbtmc_device_clear(pdeviceinfo);
+                        pdeviceinfo->dev              = *pdev;
+                        pdeviceinfo->usb_handle       = (void *)0;
+                        pdeviceinfo->usb_config       = config->bConfigurationValue;
+                        pdeviceinfo->usb_interface    = ifdesc->bInterfaceNumber;
+                        pdeviceinfo->usb_alt_setting  = ifdesc->bAlternateSetting;
+                        pdeviceinfo->usb_vid          = desc.idVendor;
+                        pdeviceinfo->usb_pid          = desc.idProduct;
+                        pdeviceinfo->usb_ep_bulkin    = -1;
+                        pdeviceinfo->usb_ep_bulkout   = -1;
+                        pdeviceinfo->usb_ep_interrupt = -1;
+                        s_winusbtmc_libusb1_location(*pdev, config->bConfigurationValue, ifdesc->bInterfaceNumber, pdeviceinfo->id->location);
+                        /* the device address changes with every replug, so a different device at the same port is detected */
+                        snprintf(pdeviceinfo->id->fingerprint, WINUSBTMC_FINGERPRINT_MAX, "%04x:%04x:%04x:%d",
+                                 desc.idVendor, desc.idProduct, desc.bcdDevice, libusb_get_device_address(*pdev));
+
+                        /* identify endpoints (bulk in, bulk out, interrupt in) */
+                        for (e = 0; e < ifdesc->bNumEndpoints; e++)
+                        {
+                            endpoint = &ifdesc->endpoint[e];
+                            switch (endpoint->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK)
+                            {
+                                case LIBUSB_TRANSFER_TYPE_BULK:
+                                    if (endpoint->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
+                                    {
+                                        pdeviceinfo->usb_ep_bulkin      = endpoint->bEndpointAddress;
+                                        pdeviceinfo->usb_ep_bulkin_size = endpoint->wMaxPacketSize;
+                                    }
+                                    else
+                                        pdeviceinfo->usb_ep_bulkout = endpoint->bEndpointAddress;
+                                    break;
+                                case LIBUSB_TRANSFER_TYPE_INTERRUPT:
+                                    if (endpoint->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
+                                        pdeviceinfo->usb_ep_interrupt = endpoint->bEndpointAddress;
+                                    break;
+                                default:
+                                    break;
+                            }
+                        }
+                    }
+                    devicecount++;
+                }
+            }
+            libusb_free_config_descriptor(config);
+        }
+    }
+
+    return devicecount;
+}
+
+int32_t winusbtmc_usbport_get_strings(winusbtmc_device_t *pdev, char *manufacturer, char *product, char *serial, int strln)
+{
+    struct libusb_device_descriptor desc;
+    libusb_device_handle *udev;
+
+    *manufacturer = '\0';
+    *product      = '\0';
+    *serial       = '\0';
+
+    if (libusb_get_device_descriptor(pdev->dev, &desc) < 0)
+    {
+        return -1;
+    }
+    if (libusb_open(pdev->dev, &udev) < 0)
+    {
+        return -1; /* device can not be opened */
+    }
+
+    if (desc.iManufacturer)
+    {
+        if (libusb_get_string_descriptor_ascii(udev, desc.iManufacturer, (unsigned char *)manufacturer, strln) <= 0)
+            *manufacturer = '\0';
+    }
+    if (desc.iProduct)
+    {
+        if (libusb_get_string_descriptor_ascii(udev, desc.iProduct, (unsigned char *)product, strln) <= 0)
+            *product = '\0';
+    }
+    if (desc.iSerialNumber)
+    {
+        if (libusb_get_string_descriptor_ascii(udev, desc.iSerialNumber, (unsigned char *)serial, strln) <= 0)
+            *serial = '\0';
+    }
+    libusb_close(udev);
+
+    return 0;
+}
+
+int32_t winusbtmc_usbport_open(winusbtmc_device_t *pdev)
+{
+    libusb_device_handle *udev;
+
+    if (libusb_open(pdev->dev, &udev) < 0)
+    {
+        pdev->usb_handle = (void *)0;
+        return -1;
+    }
+    libusb_set_auto_detach_kernel_driver(udev, 1);
+    pdev->usb_handle = udev;
+    return 0;
+}
+
+void winusbtmc_usbport_close(winusbtmc_device_t *pdev)
+{
+    libusb_release_interface(pdev->usb_handle, pdev->usb_interface);
+    libusb_close(pdev->usb_handle);
+    pdev->usb_handle = (void *)0;
+}
+
+int32_t winusbtmc_usbport_claim(winusbtmc_device_t *pdev)
+{
+    int config;
+
+    /* the configuration can only be changed before an interface is claimed. It is only set if another one is
+       active, setting the active configuration again would do a lightweight reset of the device */
+    if ( (libusb_get_configuration(pdev->usb_handle, &config) < 0) || (config != pdev->usb_config) )
+    {
+        if (libusb_set_configuration(pdev->usb_handle, pdev->usb_config) < 0)
+        {
+            return -1;
+        }
+    }
+
+    if (libusb_claim_interface(pdev->usb_handle, pdev->usb_interface) < 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+int32_t winusbtmc_usbport_control_in(winusbtmc_device_t *pdev, uint8_t request, uint16_t value, char *dat, uint16_t len)
+{
+    return libusb_control_transfer(pdev->usb_handle,
+                                   LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE | LIBUSB_ENDPOINT_IN,
+                                   request,
+                                   value,
+                                   pdev->usb_interface,  /* interface id */
+                                   (unsigned char *)dat, len, WINUSBTMC_TIMEOUT);
+}
+
+int32_t winusbtmc_usbport_clear_halt(winusbtmc_device_t *pdev, uint8_t endpoint)
+{
+    return libusb_clear_halt(pdev->usb_handle, endpoint);
+}
+
+int32_t winusbtmc_usbport_bulk_write(winusbtmc_device_t *pdev, const char *dat, uint32_t len)
+{
+    int transferred;
+
+    if (libusb_bulk_transfer(pdev->usb_handle, pdev->usb_ep_bulkout, (unsigned char *)dat, len, &transferred, WINUSBTMC_TIMEOUT) < 0)
+    {
+        return -1;
+    }
+    return transferred;
+}
+
+
+/*
+ * submit the next chunk of a streamed bulk-in read, returns false if nothing was left to submit
+ */
+static bool s_winusbtmc_libusb1_submit(winusbtmc_libusb1_stream_t *pstream, struct libusb_transfer *xfer)
+{
+    uint32_t chunk;
+
+    if ( (pstream->done) || (pstream->submitted >= pstream->len) )
+        return false;
+
+    chunk = pstream->len - pstream->submitted;
+    if (chunk > WINUSBTMC_LIBUSB1_CHUNK)
+        chunk = WINUSBTMC_LIBUSB1_CHUNK;
+
+    xfer->buffer = &pstream->buf[pstream->submitted];
+    xfer->length = chunk;
+    __atomic_add_fetch(&pstream->pending, 1, __ATOMIC_ACQ_REL);
+    if (libusb_submit_transfer(xfer) < 0)
+    {
+        __atomic_sub_fetch(&pstream->pending, 1, __ATOMIC_ACQ_REL);
+        pstream->error = true;
+        pstream->done  = true;
+        return false;
+    }
+    pstream->submitted += chunk;
+    return true;
+}
+
+/* cancel the queued chunks behind the end of the message, fails harmlessly for transfers which are back */
+static void s_winusbtmc_libusb1_cancel(winusbtmc_libusb1_stream_t *pstream)
+{
+    int i;
+
+    for (i = 0; i < WINUSBTMC_LIBUSB1_QUEUED; i++)
+    {
+        if (pstream->xfer[i])
+            libusb_cancel_transfer(pstream->xfer[i]);
+    }
+}
+
+/*
+ * completion callback of a streamed bulk-in chunk. It runs in whichever thread handles the libusb
+ * events, one callback at a time, the reading thread waits for completed.
+ * Transfers on one endpoint complete in submission order, so received data is always contiguous.
+ */
+static void LIBUSB_CALL s_winusbtmc_libusb1_callback(struct libusb_transfer *xfer)
+{
+    winusbtmc_libusb1_stream_t *pstream = xfer->user_data;
+
+    if (!pstream->done)
+    {
+        if (xfer->status != LIBUSB_TRANSFER_COMPLETED)
+        {
+            pstream->error = true;
+            pstream->done  = true;
+        }
+        else
+        {
+            pstream->received += xfer->actual_length;
+
+            /* the first chunk carries the usbtmc header which announces the length of the message */
+            if ( (pstream->expected == 0) && (pstream->received >= sizeof(winusbtmc_bulkout_header_t)) )
+            {
+                pstream->expected = sizeof(winusbtmc_bulkout_header_t) + ((winusbtmc_bulkout_header_t *)pstream->buf)->TransferSize;
+            }
+
+            if ( (xfer->actual_length < xfer->length) ||
+                 ( (pstream->expected) && (pstream->received >= pstream->expected) ) )
+            {
+                pstream->done = true; /* short packet or all announced data received */
+            }
+            else if (!s_winusbtmc_libusb1_submit(pstream, xfer))
+            {
+                if (__atomic_load_n(&pstream->pending, __ATOMIC_ACQUIRE) == 1)
+                    pstream->done = true; /* buffer is full */
+            }
+        }
+        if (pstream->done)
+            s_winusbtmc_libusb1_cancel(pstream);
+    }
+
+    /* the last access to the stream, it is on the stack of the reading thread */
+    if (__atomic_sub_fetch(&pstream->pending, 1, __ATOMIC_ACQ_REL) == 0)
+        __atomic_store_n(&pstream->completed, 1, __ATOMIC_RELEASE);
+}
+
+int32_t winusbtmc_usbport_bulk_read(winusbtmc_device_t *pdev, char *dat, uint32_t len)
+{
+    winusbtmc_libusb1_stream_t stream;
+    struct timeval tv;
+    int  transferred;
+    int  i;
+
+    if (len <= WINUSBTMC_LIBUSB1_CHUNK)
+    { /* small read, the synchronous transfer has less overhead */
+        if (libusb_bulk_transfer(pdev->usb_handle, pdev->usb_ep_bulkin, (unsigned char *)dat, len, &transferred, WINUSBTMC_TIMEOUT) < 0)
+        {
+            return -1;
+        }
+        return transferred;
+    }
+
+    memset(&stream, 0, sizeof(stream));
+    stream.buf = (unsigned char *)dat;
+    stream.len = len;
+
+    /* another thread handling events must not complete a chunk while the stream is set up */
+    libusb_lock_events(s_winusbtmc_libusb1_ctx);
+    for (i = 0; i < WINUSBTMC_LIBUSB1_QUEUED; i++)
+    {
+        stream.xfer[i] = libusb_alloc_transfer(0);
+        if (!stream.xfer[i])
+        {
+            stream.error = true;
+            stream.done  = true;
+            break;
+        }
+        libusb_fill_bulk_transfer(stream.xfer[i], pdev->usb_handle, pdev->usb_ep_bulkin,
+                                  (void *)0, 0, s_winusbtmc_libusb1_callback, &stream, WINUSBTMC_TIMEOUT);
+        s_winusbtmc_libusb1_submit(&stream, stream.xfer[i]);
+    }
+    if (stream.done)
+        s_winusbtmc_libusb1_cancel(&stream);
+    if (stream.pending == 0)
+        stream.completed = 1;
+    libusb_unlock_events(s_winusbtmc_libusb1_ctx);
+
+    /* process completions until every transfer is back, libusb returns early when completed is set */
+    while (!__atomic_load_n(&stream.completed, __ATOMIC_ACQUIRE))
+    {
+        tv.tv_sec  = 0;
+        tv.tv_usec = 100000;
+        libusb_handle_events_timeout_completed(s_winusbtmc_libusb1_ctx, &tv, &stream.completed);
+    }
+
+    for (i = 0; i < WINUSBTMC_LIBUSB1_QUEUED; i++)
+    {
+        if (stream.xfer[i])
+            libusb_free_transfer(stream.xfer[i]);
+    }
+
+    if (stream.error)
+        return -1;
+
+    return stream.received;
+}
+
+#endif // WINUSBTMC_LIBUSB1
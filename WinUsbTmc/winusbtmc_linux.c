@@ -0,0 +1,308 @@
+/*
+ * Transport for the Linux kernel usbtmc driver.
+ * When the kernel driver owns an instrument, the device is enumerated via sysfs
+ * (/sys/class/usbmisc/usbtmcN) and accessed through /dev/usbtmcN. The kernel builds and parses
+ * the usbtmc headers, so this transport only passes the message payload with read() / write().
+ */
+#ifdef __linux__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <linux/usb/tmc.h>
+#include "winusbtmc.h"
+#include "winusbtmc_private.h"
+
+#define WINUSBTMC_LINUX_SYSFS_CLASS  "/sys/class/usbmisc"
+#define WINUSBTMC_LINUX_SYSFS_USB    "/sys/bus/usb/devices"
+#define WINUSBTMC_LINUX_WRITEBUF     (256)    /* messages up to this size are terminated on the stack */
+#define WINUSBTMC_LINUX_MAX_MINORS   (256)    /* minors of all usb class devices together */
+
+static int s_winusbtmc_linux_inotify = -2;    /* watches /dev for usbtmc nodes, -1 if not available, -2 before first use */
+
+
+static int s_winusbtmc_linux_cmpint(const void *a, const void *b)
+{
+    return *(const int32_t *)a - *(const int32_t *)b;
+}
+
+/*
+ * read a single line sysfs attribute of the usb device a usbtmc minor belongs to
+ */
+static void s_winusbtmc_linux_attr(int32_t minor, const char *attr, char *str, int strln)
+{
+    char  path[128];
+    FILE *f;
+
+    *str = '\0';
+    snprintf(path, sizeof(path), WINUSBTMC_LINUX_SYSFS_CLASS "/usbtmc%d/device/../%s", minor, attr);
+    f = fopen(path, "r");
+    if (!f)
+        return;
+    if (!fgets(str, strln, f))
+        *str = '\0';
+    fclose(f);
+    str[strcspn(str, "\r\n")] = '\0';
+}
+
+/*
+ * collect the minor numbers of all usbtmc devices, sorted ascending so device numbers are stable
+ */
+static int32_t s_winusbtmc_linux_minors(int32_t *minors, int32_t maxcount)
+{
+    DIR           *dir;
+    struct dirent *entry;
+    int32_t        count;
+
+    count = 0;
+    dir = opendir(WINUSBTMC_LINUX_SYSFS_CLASS);
+    if (!dir)
+        return 0; /* usbtmc driver not loaded */
+
+    while ( ((entry = readdir(dir)) != (void *)0) && (count < maxcount) )
+    {
+        if (strncmp(entry->d_name, "usbtmc", 6) == 0)
+        {
+            minors[count++] = atoi(&entry->d_name[6]);
+        }
+    }
+    closedir(dir);
+
+    qsort(minors, count, sizeof(int32_t), s_winusbtmc_linux_cmpint);
+    return count;
+}
+
+static int32_t s_winusbtmc_linux_deviceindex(int32_t devicenum, winusbtmc_device_t *pdeviceinfo)
+{
+    int32_t minors[WINUSBTMC_LINUX_MAX_MINORS];
+    int32_t devicecount;
+    char    path[64];
+    char    link[256];
+    char    vid[8], pid[8], bcd[8], devnum[8];
+    ssize_t ret;
+
+    devicecount = s_winusbtmc_linux_minors(minors, WINUSBTMC_LINUX_MAX_MINORS);
+
+    if ( (devicenum >= 0) && (devicenum < devicecount) && (pdeviceinfo) )
+    {
+        winusbtmc_device_clear(pdeviceinfo);
+        pdeviceinfo->transport    = &winusbtmc_transport_linux;
+        pdeviceinfo->fd           = -1;
+        pdeviceinfo->usbtmc_minor = minors[devicenum];
+
+        /* the interface the node belongs to, e.g. "1-2.3:1.0", the minor may change when replugged */
+        snprintf(path, sizeof(path), WINUSBTMC_LINUX_SYSFS_CLASS "/usbtmc%d/device", pdeviceinfo->usbtmc_minor);
+        ret = readlink(path, link, sizeof(link) - 1);
+        if (ret > 0)
+        {
+            link[ret] = '\0';
+            snprintf(pdeviceinfo->id->location, WINUSBTMC_LOCATION_MAX, "%.63s", strrchr(link, '/') ? strrchr(link, '/') + 1 : link);
+        }
+        else
+        {
+            snprintf(pdeviceinfo->id->location, WINUSBTMC_LOCATION_MAX, "usbtmc%d", pdeviceinfo->usbtmc_minor);
+        }
+
+        /* vid:pid:bcdDevice:address, the address changes with every replug */
+        s_winusbtmc_linux_attr(pdeviceinfo->usbtmc_minor, "idVendor", vid, sizeof(vid));
+        s_winusbtmc_linux_attr(pdeviceinfo->usbtmc_minor, "idProduct", pid, sizeof(pid));
+        s_winusbtmc_linux_attr(pdeviceinfo->usbtmc_minor, "bcdDevice", bcd, sizeof(bcd));
+        s_winusbtmc_linux_attr(pdeviceinfo->usbtmc_minor, "devnum", devnum, sizeof(devnum));
+        snprintf(pdeviceinfo->id->fingerprint, WINUSBTMC_FINGERPRINT_MAX, "%.4s:%.4s:%.4s:%.5s", vid, pid, bcd, devnum);
+        pdeviceinfo->usb_vid = (uint16_t)strtoul(vid, (void *)0, 16);
+        pdeviceinfo->usb_pid = (uint16_t)strtoul(pid, (void *)0, 16);
+    }
+
+    return devicecount;
+}
+
+static int32_t s_winusbtmc_linux_uniquestring(winusbtmc_device_t *pdev)
+{
+    char    manufacturer[WINUSBTMC_USTR_MAX];
+    char    product[WINUSBTMC_USTR_MAX];
+    char    serial[WINUSBTMC_USTR_MAX];
+
+    /* the string descriptors are cached by the kernel, no usb traffic needed */
+    s_winusbtmc_linux_attr(pdev->usbtmc_minor, "manufacturer", manufacturer, sizeof(manufacturer));
+    s_winusbtmc_linux_attr(pdev->usbtmc_minor, "product", product, sizeof(product));
+    s_winusbtmc_linux_attr(pdev->usbtmc_minor, "serial", serial, sizeof(serial));
+    winusbtmc_uniquestring(pdev->id->usb_uniquestring, manufacturer, product, serial);
+    return 0;
+}
+
+/*
+ * hotplug notification: the kernel (devtmpfs / udev) creates and removes /dev/usbtmcN when
+ * instruments are plugged, which is watched with inotify
+ */
+static bool s_winusbtmc_linux_changed(void)
+{
+    char    buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    ssize_t len, i;
+    bool    changed;
+
+    if (s_winusbtmc_linux_inotify == -2)
+    {
+        s_winusbtmc_linux_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if ( (s_winusbtmc_linux_inotify >= 0) &&
+             (inotify_add_watch(s_winusbtmc_linux_inotify, "/dev", IN_CREATE | IN_DELETE) < 0) )
+        {
+            close(s_winusbtmc_linux_inotify);
+            s_winusbtmc_linux_inotify = -1;
+        }
+        return false; /* first call is done by winusbtmc_init, which updates everything anyway */
+    }
+    if (s_winusbtmc_linux_inotify < 0)
+    {
+        return false;
+    }
+
+    changed = false;
+    while ((len = read(s_winusbtmc_linux_inotify, buf, sizeof(buf))) > 0)
+    {
+        for (i = 0; i < len; i += sizeof(struct inotify_event) + event->len)
+        {
+            event = (const struct inotify_event *)&buf[i];
+            if ( (event->len) && (strncmp(event->name, "usbtmc", 6) == 0) )
+                changed = true;
+        }
+    }
+    return changed;
+}
+
+static int32_t s_winusbtmc_linux_open(winusbtmc_device_t *pdev)
+{
+    char     path[32];
+    uint32_t timeout;
+    uint8_t  enable;
+    struct usbtmc_termchar termchar;
+
+    winusbtmc_quirks_lookup(pdev->usb_vid, pdev->usb_pid, &pdev->quirks, &pdev->max_transfer);
+
+    snprintf(path, sizeof(path), "/dev/usbtmc%d", pdev->usbtmc_minor);
+    pdev->fd = open(path, O_RDWR);
+    if (pdev->fd < 0)
+    {
+        return WINUSBTMC_ERR_CANNOT_OPEN_DEVICE;
+    }
+
+    timeout = WINUSBTMC_TIMEOUT;
+    ioctl(pdev->fd, USBTMC_IOCTL_SET_TIMEOUT, &timeout);
+
+    /* let the kernel abort pending bulk transfers on errors, so the next transfer starts clean */
+    enable = 1;
+    ioctl(pdev->fd, USBTMC_IOCTL_AUTO_ABORT, &enable);
+
+    /* the device may end a read at 0x0a. Only if requested by the quirks, binary blocks (waveforms, screenshots)
+       contain 0x0a bytes and would be split into many short reads. Fails for devices not supporting TermChar */
+    if (pdev->quirks & WINUSBTMC_QUIRK_TERMCHAR)
+    {
+        termchar.term_char         = 0x0a;
+        termchar.term_char_enabled = 1;
+        ioctl(pdev->fd, USBTMC_IOCTL_CONFIG_TERMCHAR, &termchar);
+    }
+
+    return WINUSBTMC_ERR_NONE;
+}
+
+static void s_winusbtmc_linux_close(winusbtmc_device_t *pdev)
+{
+    close(pdev->fd);
+    pdev->fd = -1;
+}
+
+static int32_t s_winusbtmc_linux_write(winusbtmc_device_t *pdev, const char *str, uint32_t len)
+{
+    char     buf[WINUSBTMC_LINUX_WRITEBUF];
+    char    *dat;
+    ssize_t  ret;
+
+    dat = (char *)str;
+    if ( (len == 0) || (str[len-1] != 0x0a) )
+    { /* add terminator 0x0a, every write() is sent as a separate message, so it has to be in the same buffer */
+        dat = (len < sizeof(buf)) ? buf : malloc(len + 1);
+        if (!dat)
+        {
+            return WINUSBTMC_ERR_MALLOC_FAILED;
+        }
+        memcpy(dat, str, len);
+        dat[len++] = 0x0a;
+    }
+
+    ret = write(pdev->fd, dat, len);
+
+    if ( (dat != str) && (dat != buf) )
+        free(dat);
+
+    if (ret != (ssize_t)len)
+    {
+        return WINUSBTMC_ERR_BULKOUT_FAILED;
+    }
+    return WINUSBTMC_ERR_NONE;
+}
+
+static int32_t s_winusbtmc_linux_read(winusbtmc_device_t *pdev, char *dat, uint32_t maxlen, bool *eom)
+{
+    ssize_t ret;
+    uint8_t attr;
+
+    ret = read(pdev->fd, dat, maxlen);
+    if (ret < 0)
+    {
+        return WINUSBTMC_ERR_BULKIN_FAILED;
+    }
+
+    if (eom)
+    {
+        /* bmTransferAttributes of the last received DEV_DEP_MSG_IN, bit 0 is EOM */
+        if (ioctl(pdev->fd, USBTMC_IOCTL_MSG_IN_ATTR, &attr) == 0)
+            *eom = (attr & 0x01) != 0;
+        else
+            *eom = ((uint32_t)ret < maxlen); /* older kernels */
+    }
+
+    return ret;
+}
+
+bool winusbtmc_linux_driver_bound(uint8_t bus, const uint8_t *ports, int nports, uint8_t config, uint8_t interface)
+{
+    char    path[128];
+    char    link[128];
+    int     len, i;
+    ssize_t ret;
+
+    len = snprintf(path, sizeof(path), WINUSBTMC_LINUX_SYSFS_USB "/%d-", bus);
+    for (i = 0; i < nports; i++)
+    {
+        len += snprintf(&path[len], sizeof(path) - len, (i == 0) ? "%d" : ".%d", ports[i]);
+    }
+    snprintf(&path[len], sizeof(path) - len, ":%d.%d/driver", config, interface);
+
+    ret = readlink(path, link, sizeof(link) - 1);
+    if (ret <= 0)
+        return false;
+    link[ret] = '\0';
+
+    return ( (strrchr(link, '/')) && (strcmp(strrchr(link, '/'), "/usbtmc") == 0) );
+}
+
+
+const winusbtmc_transport_t winusbtmc_transport_linux =
+{
+    "linux",
+    s_winusbtmc_linux_deviceindex,
+    s_winusbtmc_linux_uniquestring,
+    s_winusbtmc_linux_changed,
+    s_winusbtmc_linux_open,
+    s_winusbtmc_linux_close,
+    s_winusbtmc_linux_write,
+    s_winusbtmc_linux_read,
+    (void *)0
+};
+
+#endif // __linux__
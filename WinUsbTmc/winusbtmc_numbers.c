@@ -0,0 +1,236 @@
+/*
+ * Parser for ASCII number responses, e.g. DMM readings or ":WAV:DATA?" in ASCII format:
+ * "+1.23456E-03,-2.00000E-01,...\n". The response is parsed in the chunks returned by winusbtmc_recv_data,
+ * a number split between two chunks is kept in the state until the next chunk.
+ *
+ * Numbers whose significant digits fit into 53 bits (all with up to 15 digits) and with a decimal exponent
+ * within +-22 are converted exactly with one multiplication or division (all powers of 10 up to 1e22 are
+ * exact doubles). This covers the usual SCPI formats, other numbers are converted by strtod. The SCPI
+ * markers 9.9E37 (overflow) and 9.91E37 (not a number) become +-INFINITY and NAN, like the words NAN, INF
+ * and NINF. A leading IEEE 488.2 block header ("#800001234") is skipped, a response which ends within it
+ * is an error.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "winusbtmc.h"
+#include "winusbtmc_private.h"
+
+#define WINUSBTMC_NUMBERS_DIGITS_MAX (19)   /* significant digits which fit into the 64 bit mantissa */
+#define WINUSBTMC_NUMBERS_EXACT_MAX  (1ULL << 53) /* largest mantissa which is exact in a double */
+#define WINUSBTMC_NUMBERS_EXP_MAX    (22)   /* largest exact power of 10 */
+
+static const double s_winusbtmc_pow10[WINUSBTMC_NUMBERS_EXP_MAX + 1] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+static bool s_winusbtmc_numbers_separator(char c)
+{
+    return (c == ',') || (c == ';') || (c == '\n') || (c == '\r') || (c == ' ') || (c == '\t');
+}
+
+/*
+ * conversion of anything the fast path does not handle, returns false if it is no number
+ */
+static bool s_winusbtmc_numbers_slow(const char *str, uint32_t len, double *pval)
+{
+    char  buf[WINUSBTMC_NUMBERS_TOKEN_MAX + 1];
+    char *end;
+
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+    *pval = strtod(buf, &end); /* NAN and INF included */
+    if ( (end != buf) && (*end == '\0') )
+        return true;
+    if (strcasecmp(buf, "NINF") == 0)
+    {
+        *pval = -INFINITY;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * convert one number, returns false if it is no number
+ */
+static bool s_winusbtmc_numbers_convert(const char *str, uint32_t len, double *pval)
+{
+    const char *p = str, *end = str + len;
+    uint64_t    mantissa = 0;
+    int32_t     digits = 0, exp10 = 0, e = 0;
+    bool        neg = false, eneg = false, any = false;
+    double      val;
+
+    if ( (p < end) && ((*p == '+') || (*p == '-')) )
+        neg = (*p++ == '-');
+    for (; (p < end) && (*p >= '0') && (*p <= '9'); p++)
+    {
+        any = true;
+        if ( (mantissa) || (*p != '0') )
+        { /* leading zeros are no significant digits */
+            if (++digits <= WINUSBTMC_NUMBERS_DIGITS_MAX)
+                mantissa = mantissa * 10 + (*p - '0');
+        }
+    }
+    if ( (p < end) && (*p == '.') )
+    {
+        for (p++; (p < end) && (*p >= '0') && (*p <= '9'); p++)
+        {
+            any = true;
+            if ( (mantissa) || (*p != '0') )
+            {
+                if (++digits <= WINUSBTMC_NUMBERS_DIGITS_MAX)
+                    mantissa = mantissa * 10 + (*p - '0');
+            }
+            exp10--;
+        }
+    }
+    if ( (any) && (p < end) && ((*p == 'e') || (*p == 'E')) )
+    {
+        p++;
+        if ( (p < end) && ((*p == '+') || (*p == '-')) )
+            eneg = (*p++ == '-');
+        if ( (p >= end) || (*p < '0') || (*p > '9') )
+            any = false;
+        for (; (p < end) && (*p >= '0') && (*p <= '9') && (e < 10000); p++)
+            e = e * 10 + (*p - '0');
+        exp10 += (eneg) ? -e : e;
+    }
+
+    /* digits after the integer part were counted in exp10 even if they were zero */
+    if ( (digits > WINUSBTMC_NUMBERS_DIGITS_MAX) || (mantissa > WINUSBTMC_NUMBERS_EXACT_MAX) )
+        return s_winusbtmc_numbers_slow(str, len, pval);
+    if ( (!any) || (p != end) )
+        return s_winusbtmc_numbers_slow(str, len, pval);
+    if ( (mantissa != 0) && ((exp10 < -WINUSBTMC_NUMBERS_EXP_MAX) || (exp10 > WINUSBTMC_NUMBERS_EXP_MAX)) )
+        return s_winusbtmc_numbers_slow(str, len, pval);
+
+    val = (double)mantissa;
+    if (mantissa != 0)
+        val = (exp10 < 0) ? val / s_winusbtmc_pow10[-exp10] : val * s_winusbtmc_pow10[exp10];
+    *pval = (neg) ? -val : val;
+    return true;
+}
+
+/*
+ * a complete token was found, stores its value
+ */
+static void s_winusbtmc_numbers_token(winusbtmc_numbers_t *pstate, const char *str, uint32_t len, double *dst, int32_t *pcount)
+{
+    double val;
+
+    if ( (len > WINUSBTMC_NUMBERS_TOKEN_MAX) || (!s_winusbtmc_numbers_convert(str, len, &val)) )
+    {
+        pstate->errors++;
+        val = NAN;
+    }
+    else if (fabs(val) == 9.9e37)
+    {
+        val = (val > 0) ? INFINITY : -INFINITY;
+    }
+    else if (val == 9.91e37)
+    {
+        val = NAN;
+    }
+    dst[(*pcount)++] = val;
+}
+
+/*
+ * skip the block header "#<n><n digits>" at the start of the response, returns the count of used bytes
+ */
+static uint32_t s_winusbtmc_numbers_header(winusbtmc_numbers_t *pstate, const char *dat, uint32_t len)
+{
+    uint32_t i = 0;
+
+    if (!pstate->started)
+    {
+        pstate->started = true;
+        if ( (len > 0) && (dat[0] == '#') )
+        {
+            pstate->header = -1;
+            i++;
+        }
+    }
+    if ( (pstate->header < 0) && (i < len) )
+    { /* count of length digits */
+        pstate->header = ((dat[i] >= '0') && (dat[i] <= '9')) ? dat[i] - '0' : 0;
+        i++;
+    }
+    while ( (pstate->header > 0) && (i < len) )
+    {
+        pstate->header--;
+        i++;
+    }
+    return i;
+}
+
+DLL_EXPORT int32_t winusbtmc_parse_numbers(winusbtmc_numbers_t *pstate, const char *dat, uint32_t len, bool eom, double *dst, uint32_t maxcount)
+{
+    const char *p, *end, *start;
+    uint32_t    n;
+    int32_t     count = 0;
+
+    if ( (!pstate) || ((!dat) && (len > 0)) || (!dst) || (len > INT32_MAX - 4) || (maxcount < len / 2 + 2) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    p   = dat + s_winusbtmc_numbers_header(pstate, dat, len);
+    end = dat + len;
+    if ( (pstate->header != 0) && (eom) )
+    { /* the response ended in the header, the next call starts a new response */
+        pstate->started  = false;
+        pstate->tokenlen = 0;
+        pstate->header   = 0;
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    }
+    if (pstate->header != 0)
+        return 0; /* the chunk ended in the header */
+
+    /* complete the token of the previous chunk */
+    if (pstate->tokenlen > 0)
+    {
+        for (start = p; (p < end) && (!s_winusbtmc_numbers_separator(*p)); p++)
+            ;
+        n = p - start;
+        if (pstate->tokenlen + n <= WINUSBTMC_NUMBERS_TOKEN_MAX)
+            memcpy(&pstate->token[pstate->tokenlen], start, n);
+        pstate->tokenlen = (pstate->tokenlen + n <= WINUSBTMC_NUMBERS_TOKEN_MAX) ? pstate->tokenlen + n : WINUSBTMC_NUMBERS_TOKEN_MAX + 1;
+        if ( (p < end) || (eom) )
+        {
+            s_winusbtmc_numbers_token(pstate, pstate->token, pstate->tokenlen, dst, &count);
+            pstate->tokenlen = 0;
+        }
+    }
+
+    /* tokens within the chunk are converted without a copy */
+    while (p < end)
+    {
+        while ( (p < end) && (s_winusbtmc_numbers_separator(*p)) )
+            p++;
+        for (start = p; (p < end) && (!s_winusbtmc_numbers_separator(*p)); p++)
+            ;
+        if (p == start)
+            break;
+        if ( (p < end) || (eom) )
+        {
+            s_winusbtmc_numbers_token(pstate, start, p - start, dst, &count);
+        }
+        else
+        { /* continued in the next chunk */
+            n = p - start;
+            if (n <= WINUSBTMC_NUMBERS_TOKEN_MAX)
+                memcpy(pstate->token, start, n);
+            pstate->tokenlen = (n <= WINUSBTMC_NUMBERS_TOKEN_MAX) ? n : WINUSBTMC_NUMBERS_TOKEN_MAX + 1;
+        }
+    }
+
+    if (eom)
+    { /* the next call starts a new response */
+        pstate->started  = false;
+        pstate->tokenlen = 0;
+        pstate->header   = 0;
+    }
+    return count;
+}
@@ -0,0 +1,302 @@
+#ifndef WINUSBTMC_PRIVATE_H_INCLUDED
+#define WINUSBTMC_PRIVATE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Internal declarations shared between winusbtmc.c, the transports and the usb port layers.
+ * Nothing in here is part of the public API, include winusbtmc.h in your project instead.
+ *
+ * A transport implements enumeration and message exchange for one kind of device access:
+ *   winusbtmc_usb.c    => usbtmc protocol handled in user space on top of the usb port layer
+ *   winusbtmc_linux.c  => Linux kernel usbtmc driver (/dev/usbtmcN), Linux only
+ *   winusbtmc_tcp.c    => LAN instruments, raw socket SCPI ("TCPIP::host::5025")
+ *
+ * The usb port layer is selected at build time:
+ *   default              => winusbtmc_libusb0.c (libusb-win32 0.1 API, libusb.a)
+ *   -DWINUSBTMC_LIBUSB1  => winusbtmc_libusb1.c (libusb-1.0 API, e.g. for Linux builds)
+ *   -DWINUSBTMC_SIMPORT  => winusbtmc_simport.c (simulated usbtmc devices, no usb access)
+ * All files can be part of the project, the unused ones compile to nothing.
+ */
+
+#define WINUSBTMC_USTR_MAX (256) /* maximum length of the unique identifier string */
+#define WINUSBTMC_LOCATION_MAX (64) /* maximum length of the location string */
+#define WINUSBTMC_FINGERPRINT_MAX (32) /* maximum length of the descriptor fingerprint */
+#define WINUSBTMC_FETCH_THREADS (8) /* max. count of devices asked for their descriptor strings at the same time */
+#define WINUSBTMC_CALIBRATE_MIN (4 * 1024)    /* range of transfer sizes probed by winusbtmc_calibrate */
+#define WINUSBTMC_CALIBRATE_MAX (1024 * 1024)
+#define WINUSBTMC_CALIBRATE_ROUNDS (3)        /* queries per probed transfer size */
+#define WINUSBTMC_CALIBRATE_DRAIN (256)       /* max. reads of the rest of a response after a failed probe */
+
+#define WINUSBTMC_CLASS    (0xfe)
+#define WINUSBTMC_SUBCLASS (0x03)
+
+#define WINUSBTMC_DEV_DEP_MSG_OUT (0x01)
+#define WINUSBTMC_DEV_DEP_MSG_IN  (0x02)
+
+#define WINUSBTMC_REQ_INITIATE_CLEAR     (5)  /* usbtmc class requests */
+#define WINUSBTMC_REQ_CHECK_CLEAR_STATUS (6)
+#define WINUSBTMC_REQ_GET_CAPABILITIES   (7)
+#define WINUSBTMC_REQ_VENDOR_INIT        (0xa0) /* not part of usbtmc, sent to Rigol instruments */
+
+#define WINUSBTMC_STATUS_SUCCESS (0x01)
+#define WINUSBTMC_STATUS_PENDING (0x02)
+
+#define WINUSBTMC_TIMEOUT (1000)              /* timeout, unit milliseconds */
+
+
+/* device handles: bits 0..19 are the index in the device table (the device number), bits 20..30 the
+ * generation of the table entry. Handles with generation 0 are plain device numbers, they are not checked */
+#define WINUSBTMC_HANDLE_SLOT_BITS (20)
+#define WINUSBTMC_HANDLE_SLOT_MASK ((1 << WINUSBTMC_HANDLE_SLOT_BITS) - 1)
+#define WINUSBTMC_HANDLE_GEN_MASK  (0x7ff)
+
+
+typedef struct winusbtmc_transport_s winusbtmc_transport_t;
+
+/* identification of a device, only needed by enumeration and lookup, so it is kept apart from the transfer state */
+typedef struct
+{
+    char               usb_uniquestring[WINUSBTMC_USTR_MAX];
+    char               location[WINUSBTMC_LOCATION_MAX]; /* identifies the device within its transport, e.g. usb port path */
+    char               fingerprint[WINUSBTMC_FINGERPRINT_MAX]; /* "vid:pid:bcdDevice:address", empty if the strings must not be cached */
+    bool               strings_valid;      /* usb_uniquestring was fetched from the device or the cache */
+    bool               strings_cached;     /* usb_uniquestring was taken from the enumeration cache */
+} winusbtmc_device_id_t;
+
+typedef struct
+{
+    const winusbtmc_transport_t *transport; /* transport which handles this device */
+    bool               opened;             /* device was opened and initialized by the transport */
+    winusbtmc_device_id_t *id;             /* identification strings */
+
+    void              *dev;                /* usb device structure of the usb port layer */
+    void              *usb_handle;         /* handle to usb device (0 if not opened) */
+    int8_t             usb_config;         /* configuration number */
+    int8_t             usb_interface;      /* interface number */
+    int8_t             usb_alt_setting;    /* alternative setting (-1 if none) */
+    uint16_t           usb_vid;            /* vendor and product id, used to find the quirks of the device */
+    uint16_t           usb_pid;
+
+    uint8_t            usb_ep_bulkin;
+    uint8_t            usb_ep_bulkout;
+    uint8_t            usb_ep_interrupt;
+    uint16_t           usb_ep_bulkin_size; /* wMaxPacketSize of the bulk-in endpoint */
+
+    int                fd;                 /* file descriptor (kernel driver transport) */
+    int32_t            usbtmc_minor;       /* N of /dev/usbtmcN (kernel driver transport) */
+    void              *transport_data;     /* state owned by the transport while opened */
+
+    /* status information for usbtmc protocol handling */
+    uint8_t            winusbtmc_bTag;        /* current bTag number (incremented each transfer) */
+    uint8_t            winusbtmc_status;      /* latest status code from usbtmc device */
+    uint32_t           quirks;                /* WINUSBTMC_QUIRK_* of the device, set when opened */
+    uint32_t           max_transfer;          /* max. TransferSize of one bulk transfer, 0 if not limited */
+    uint32_t           transfer_size;         /* TransferSize of large reads found by winusbtmc_calibrate, 0 if not calibrated */
+    struct winusbtmc_rcache_s *rcache;        /* response cache, 0 if disabled (winusbtmc_rcache.c) */
+    struct winusbtmc_acquire_s *acquire;      /* continuous acquisition, 0 if not running (winusbtmc_acquire.c) */
+    struct winusbtmc_profiler_s *profiler;    /* command profiler, 0 if disabled (winusbtmc_profiler.c) */
+    struct winusbtmc_io_s *io;                /* dedicated I/O thread, 0 if not running (winusbtmc_io.c) */
+    char              *send_buf;              /* winusbtmc_send_buffer of transports without transfer buffer */
+    uint32_t           send_size;
+} winusbtmc_device_t;
+
+typedef winusbtmc_device_t *winusbtmc_device_ptr_t;
+
+typedef struct
+{
+    uint8_t MsgID;
+    uint8_t bTag;
+    uint8_t bTagInverse;
+    uint8_t Rsvd1;
+    uint32_t TransferSize;
+    uint8_t bmTransferAttributes;
+    uint8_t Rsvd2;
+    uint8_t Rsvd3;
+    uint8_t Rsvd4;
+} winusbtmc_bulkout_header_t;
+
+
+
+/**************************************************************************************************
+ * transports
+ **************************************************************************************************/
+
+struct winusbtmc_transport_s
+{
+    const char *name;  /* identifies the transport in the enumeration cache */
+
+    /* walk through all devices of this transport. Returns the count of devices and fills pdeviceinfo
+     * (including transport, location and fingerprint, but not usb_uniquestring) for device number "devicenum"
+     * if it is >= 0 and below the count. pdeviceinfo must be cleared with winusbtmc_device_clear, pdeviceinfo->id
+     * is provided by the caller. This must be cheap, it must not do any usb transfers. */
+    int32_t (*deviceindex)(int32_t devicenum, winusbtmc_device_t *pdeviceinfo);
+
+    /* fill usb_uniquestring of a device returned by deviceindex, returns < 0 if not possible.
+     * Called from worker threads for several devices at the same time.
+     * Optional, 0 for transports whose deviceindex sets usb_uniquestring already */
+    int32_t (*uniquestring)(winusbtmc_device_t *pdev);
+
+    /* returns true if devices were added or removed since the last call (hotplug notification).
+     * Transports without notifications return false, their devices are updated by winusbtmc_init */
+    bool    (*changed)(void);
+
+    /* open the device and do the initialization needed before the first transfer */
+    int32_t (*open)(winusbtmc_device_t *pdev);
+    void    (*close)(winusbtmc_device_t *pdev);
+
+    /* send one complete message, the message is terminated with 0x0a if not already present */
+    int32_t (*write)(winusbtmc_device_t *pdev, const char *dat, uint32_t len);
+
+    /* receive up to maxlen bytes of a response message, *eom is set when the message is complete */
+    int32_t (*read)(winusbtmc_device_t *pdev, char *dat, uint32_t maxlen, bool *eom);
+
+    /* space for a message of up to len bytes within the transfer buffer of the opened device, write sends a
+     * message which was written there without copying it. Returns 0 if the message does not fit.
+     * Optional, 0 for transports without transfer buffer */
+    char   *(*buffer)(winusbtmc_device_t *pdev, uint32_t len);
+};
+
+extern const winusbtmc_transport_t winusbtmc_transport_usb;
+extern const winusbtmc_transport_t winusbtmc_transport_tcp;
+
+/* add a LAN instrument address like "TCPIP::host::5025" to the tcp transport device list.
+ * returns its number within the tcp transport and the normalized address string
+ * (size WINUSBTMC_USTR_MAX), or -1 if pstr is no tcp address */
+int32_t winusbtmc_tcp_register(const char *pstr, char *normalized);
+#ifdef __linux__
+extern const winusbtmc_transport_t winusbtmc_transport_linux;
+
+/* true if the kernel usbtmc driver is bound to the interface, such interfaces are left to
+ * winusbtmc_transport_linux. ports is the port path as returned by libusb_get_port_numbers */
+bool    winusbtmc_linux_driver_bound(uint8_t bus, const uint8_t *ports, int nports, uint8_t config, uint8_t interface);
+#endif
+
+/* enumeration cache (winusbtmc_cache.c), remembers the descriptor strings and calibrated transfer sizes of devices between program runs.
+ * An entry is only used if transport, location and fingerprint of the device are unchanged. */
+void    winusbtmc_cache_load(const char *filename);
+bool    winusbtmc_cache_lookup(winusbtmc_device_t *pdev);
+void    winusbtmc_cache_save(const char *filename, const winusbtmc_device_ptr_t *devices, int32_t count);
+
+/* quirks of a usb device (winusbtmc_quirks.c), WINUSBTMC_QUIRK_DEFAULT for unknown devices */
+void    winusbtmc_quirks_lookup(uint16_t vid, uint16_t pid, uint32_t *flags, uint32_t *max_transfer);
+
+/* response cache (winusbtmc_rcache.c). If pdev->rcache is set, all messages of the device are passed through
+ * winusbtmc_rcache_write and winusbtmc_rcache_read instead of calling the transport directly. */
+int32_t winusbtmc_rcache_enable(winusbtmc_device_t *pdev, bool enable);
+void    winusbtmc_rcache_all(bool enable);
+void    winusbtmc_rcache_opened(winusbtmc_device_t *pdev);
+int32_t winusbtmc_rcache_write(winusbtmc_device_t *pdev, const char *str, uint32_t len);
+int32_t winusbtmc_rcache_read(winusbtmc_device_t *pdev, char *dat, uint32_t maxlen, bool *eom);
+
+/* send a message or receive a part of a response through the response cache and the profiler (winusbtmc.c),
+ * the transfers of the API functions and of the I/O threads */
+int32_t winusbtmc_device_write(winusbtmc_device_t *pdev, const char *dat, uint32_t len);
+int32_t winusbtmc_device_read(winusbtmc_device_t *pdev, char *dat, uint32_t maxlen, bool *eom);
+
+/* command profiler (winusbtmc_profiler.c). If pdev->profiler is set, every message sent is passed to
+ * winusbtmc_profiler_send before and winusbtmc_profiler_sent after the transfer, every part of a response to
+ * winusbtmc_profiler_received. */
+struct winusbtmc_profile_entry_s;       /* winusbtmc_profile_entry_t of winusbtmc.h */
+int32_t winusbtmc_profiler_enable(winusbtmc_device_t *pdev, bool enable);
+void    winusbtmc_profiler_all(bool enable);
+void    winusbtmc_profiler_opened(winusbtmc_device_t *pdev);
+void    winusbtmc_profiler_send(winusbtmc_device_t *pdev, const char *dat, uint32_t len);
+void    winusbtmc_profiler_sent(winusbtmc_device_t *pdev, int32_t ret);
+void    winusbtmc_profiler_received(winusbtmc_device_t *pdev, int32_t ret, bool eom);
+int32_t winusbtmc_profiler_report(winusbtmc_device_t *pdev, struct winusbtmc_profile_entry_s *pentries, uint32_t maxcount);
+
+/* continuous acquisition (winusbtmc_acquire.c). While pdev->acquire is set, only its thread talks to the device. */
+struct winusbtmc_acquire_buffer_s;      /* winusbtmc_acquire_buffer_t of winusbtmc.h */
+int32_t winusbtmc_acquire_begin(winusbtmc_device_t *pdev, const char *query, uint32_t buffers, uint32_t size);
+int32_t winusbtmc_acquire_next(winusbtmc_device_t *pdev, struct winusbtmc_acquire_buffer_s *pbuf, int32_t timeout_ms);
+int32_t winusbtmc_acquire_done(winusbtmc_device_t *pdev);
+int32_t winusbtmc_acquire_end(winusbtmc_device_t *pdev);
+
+/* dedicated I/O threads (winusbtmc_io.c). While pdev->io is set, only its thread talks to the device. */
+struct winusbtmc_io_request_s;          /* winusbtmc_io_request_t of winusbtmc.h */
+int32_t winusbtmc_io_begin(winusbtmc_device_t *pdev, int32_t cpu);
+int32_t winusbtmc_io_queue(winusbtmc_device_t *pdev, struct winusbtmc_io_request_s *preq);
+int32_t winusbtmc_io_result(winusbtmc_device_t *pdev, struct winusbtmc_io_request_s *preq, int32_t timeout_ms);
+int32_t winusbtmc_io_end(winusbtmc_device_t *pdev);
+
+/* wall clock time in seconds since 1970 (winusbtmc.c), the monotonic time is winusbtmc_time_ms of winusbtmc.h */
+double  winusbtmc_time_now(void);
+
+/* waveform kernels (winusbtmc_waveform.c) */
+typedef struct
+{
+    int32_t  min;
+    int32_t  max;
+    int64_t  sum;
+    uint64_t sumsq;                    /* only if squares is true */
+} winusbtmc_envelope_t;
+
+struct winusbtmc_record_s;              /* winusbtmc_record_t of winusbtmc.h */
+typedef void (*winusbtmc_samples_t)(void *ctx, const uint8_t *src, uint32_t count);
+
+/* adds min, max, sum and sum of squares of the codes of count samples to *penv, all fields must be initialized */
+void    winusbtmc_envelope(const uint8_t *src, uint32_t count, int32_t format, bool squares, winusbtmc_envelope_t *penv);
+/* bytes per sample, 0 for an unknown format */
+int32_t winusbtmc_sample_size(int32_t format);
+/* histogram[(code - lowest code of the format) >> shift]++ for count samples */
+void    winusbtmc_histogram(const uint8_t *src, uint32_t count, int32_t format, int32_t shift, uint32_t *histogram);
+/* skips the block header and calls samples for the complete samples of the chunk */
+int32_t winusbtmc_record_add(struct winusbtmc_record_s *prec, int32_t format, const uint8_t *dat, uint32_t len,
+                             winusbtmc_samples_t samples, void *ctx);
+
+/* clear all fields of a device, pdev->id is kept and cleared as well */
+void    winusbtmc_device_clear(winusbtmc_device_t *pdev);
+
+/* build "manufacturer:product:serial" into dst (size WINUSBTMC_USTR_MAX), trims the passed strings */
+void    winusbtmc_uniquestring(char *dst, char *manufacturer, char *product, char *serial);
+
+
+
+/**************************************************************************************************
+ * usb port layer (implemented by winusbtmc_libusb0.c or winusbtmc_libusb1.c)
+ **************************************************************************************************/
+
+/* (re)initialize the usb library and rescan all busses.
+ * usb device structures returned by a previous scan are invalid afterwards. */
+void    winusbtmc_usbport_init(void);
+
+/* release the usb library, called by winusbtmc_deinit after all devices were closed */
+void    winusbtmc_usbport_deinit(void);
+
+/* returns true if usb devices were plugged or unplugged since the last call. The device list used by
+ * winusbtmc_usbport_deviceindex is updated in that case. Returns false if hotplug is not supported */
+bool    winusbtmc_usbport_changed(void);
+
+/*
+ * walk through all present usbtmc interfaces.
+ * returns count of present usbtmc interfaces and fills endpoint / configuration information and the
+ * location and fingerprint of interface number "devicenum" into pdeviceinfo if requested (usb_uniquestring is left empty).
+ */
+int32_t winusbtmc_usbport_deviceindex(int32_t devicenum, winusbtmc_device_t *pdeviceinfo);
+
+/* read the manufacturer, product and serial number string descriptors of a device.
+ * Strings which are not present are returned empty. Returns < 0 if the device can not be opened */
+int32_t winusbtmc_usbport_get_strings(winusbtmc_device_t *pdev, char *manufacturer, char *product, char *serial, int strln);
+
+/* open / close the usb handle of a device (pdev->usb_handle) */
+int32_t winusbtmc_usbport_open(winusbtmc_device_t *pdev);
+void    winusbtmc_usbport_close(winusbtmc_device_t *pdev);
+
+/* claim the usbtmc interface and select its configuration */
+int32_t winusbtmc_usbport_claim(winusbtmc_device_t *pdev);
+
+/* class specific control request to the usbtmc interface (device to host) */
+int32_t winusbtmc_usbport_control_in(winusbtmc_device_t *pdev, uint8_t request, uint16_t value, char *dat, uint16_t len);
+
+/* clear the halt condition of an endpoint, returns < 0 in case of an error */
+int32_t winusbtmc_usbport_clear_halt(winusbtmc_device_t *pdev, uint8_t endpoint);
+
+/* bulk transfers, return the count of transferred bytes or < 0 in case of an error.
+ * winusbtmc_usbport_bulk_read reads one complete bulk-in transfer (terminated by a short packet
+ * or when the TransferSize announced in the usbtmc header is reached) */
+int32_t winusbtmc_usbport_bulk_write(winusbtmc_device_t *pdev, const char *dat, uint32_t len);
+int32_t winusbtmc_usbport_bulk_read(winusbtmc_device_t *pdev, char *dat, uint32_t len);
+
+#endif // WINUSBTMC_PRIVATE_H_INCLUDED
@@ -0,0 +1,326 @@
+/*
+ * Command profiler.
+ * Counters of a whole device tell that the bus is slow, but not which command is. When the profiler of a device
+ * is enabled, every message sent is reduced to its mnemonic (the header without parameters, upper case, numeric
+ * suffixes as "<n>", e.g. ":meas:freq? chan1" => "MEAS:FREQ?", "SOUR2:VOLT 1.5" => "SOUR<n>:VOLT") and the
+ * latency and bytes of the command are added to the entry of the mnemonic:
+ *   queries (the mnemonic contains '?')  from sending the command until its response was received completely
+ *   other commands                       the time to send them
+ * Short and long forms of a keyword (MEAS / MEASURE) stay separate entries, they can not be told apart without
+ * the command tree of the instrument. A query whose response is not read before the next command has no latency.
+ * The latencies are kept in a histogram of logarithmic buckets (16 per octave from 1 us), so p50 and p99 are
+ * exact to a few percent without storing every sample.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "winusbtmc.h"
+#include "winusbtmc_private.h"
+
+#define WINUSBTMC_PROFILER_ENTRIES (255)        /* further mnemonics are counted as "(other)", an entry of its own */
+#define WINUSBTMC_PROFILER_OTHER   "(other)"    /* no mnemonic, they are upper case */
+#define WINUSBTMC_PROFILER_SLOTS   (512)        /* hash table, a power of 2 above twice the entries */
+#define WINUSBTMC_PROFILER_STEPS   (16)         /* histogram buckets per octave */
+#define WINUSBTMC_PROFILER_BUCKETS (32 * WINUSBTMC_PROFILER_STEPS) /* 1 us to 71 minutes */
+
+typedef struct
+{
+    char     mnemonic[WINUSBTMC_PROFILE_MNEMONIC_MAX];
+    uint32_t hash;
+    uint32_t count;
+    uint32_t errors;
+    uint32_t samples;                           /* count of measured latencies */
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    double   total_ms;
+    double   max_ms;
+    uint32_t histogram[WINUSBTMC_PROFILER_BUCKETS]; /* latencies in us, see s_winusbtmc_profiler_bucket */
+} winusbtmc_profiler_entry_t;
+
+struct winusbtmc_profiler_s
+{
+    winusbtmc_profiler_entry_t *slots[WINUSBTMC_PROFILER_SLOTS]; /* open addressing by hash of the mnemonic */
+    uint32_t                    count;
+    winusbtmc_profiler_entry_t *pending;        /* command which is sent or whose response is received now */
+    bool                        query;
+    double                      start;
+};
+
+static bool s_winusbtmc_profiler_all = false;   /* enabled for all devices */
+
+
+/*
+ * normalized mnemonic of a message into dst (size WINUSBTMC_PROFILE_MNEMONIC_MAX), the headers of "a;b" are kept as "A;B".
+ * Returns the length
+ */
+static uint32_t s_winusbtmc_profiler_mnemonic(const char *str, uint32_t len, char *dst)
+{
+    const char *end = str + len;
+    uint32_t    n   = 0;
+    char        c;
+
+    while (str < end)
+    {
+        while ( (str < end) && ((*str == ' ') || (*str == '\t') || (*str == ':')) )
+            str++;
+        for (; (str < end) && (*str != ' ') && (*str != '\t') && (*str != ';') && (*str != '\r') && (*str != '\n'); str++)
+        {
+            c = *str;
+            if ( (c >= '0') && (c <= '9') && (n > 0) && (dst[n-1] >= 'A') && (dst[n-1] <= 'Z') )
+            { /* numeric suffix of a keyword */
+                while ( (str + 1 < end) && (str[1] >= '0') && (str[1] <= '9') )
+                    str++;
+                if (n + 3 < WINUSBTMC_PROFILE_MNEMONIC_MAX)
+                {
+                    memcpy(&dst[n], "<n>", 3);
+                    n += 3;
+                }
+                continue;
+            }
+            if ( (c >= 'a') && (c <= 'z') )
+                c -= 'a' - 'A';
+            if (n + 1 < WINUSBTMC_PROFILE_MNEMONIC_MAX)
+                dst[n++] = c;
+        }
+        while ( (str < end) && (*str != ';') ) /* parameters */
+            str++;
+        if (str < end)
+        {
+            str++;
+            if ( (str < end) && (n + 1 < WINUSBTMC_PROFILE_MNEMONIC_MAX) )
+                dst[n++] = ';';
+        }
+    }
+    dst[n] = '\0';
+    return n;
+}
+
+/*
+ * returns the entry of a mnemonic, it is created if needed. 0 if out of memory
+ */
+static winusbtmc_profiler_entry_t *s_winusbtmc_profiler_entry(struct winusbtmc_profiler_s *pprof, const char *mnemonic, uint32_t len)
+{
+    winusbtmc_profiler_entry_t *pentry;
+    uint32_t                    hash, i, slot;
+
+    hash = 2166136261u; /* FNV-1a */
+    for (i = 0; i < len; i++)
+        hash = (hash ^ (uint8_t)mnemonic[i]) * 16777619u;
+
+    for (slot = hash & (WINUSBTMC_PROFILER_SLOTS - 1); pprof->slots[slot]; slot = (slot + 1) & (WINUSBTMC_PROFILER_SLOTS - 1))
+    {
+        pentry = pprof->slots[slot];
+        if ( (pentry->hash == hash) && (strcmp(pentry->mnemonic, mnemonic) == 0) )
+            return pentry;
+    }
+    if ( (pprof->count >= WINUSBTMC_PROFILER_ENTRIES) && (strcmp(mnemonic, WINUSBTMC_PROFILER_OTHER) != 0) )
+    { /* the table is full, "(other)" is created as entry ENTRIES + 1 the first time */
+        return s_winusbtmc_profiler_entry(pprof, WINUSBTMC_PROFILER_OTHER, sizeof(WINUSBTMC_PROFILER_OTHER) - 1);
+    }
+
+    pentry = calloc(1, sizeof(winusbtmc_profiler_entry_t));
+    if (!pentry)
+        return (void *)0;
+    memcpy(pentry->mnemonic, mnemonic, len + 1);
+    pentry->hash = hash;
+    pprof->slots[slot] = pentry;
+    pprof->count++;
+    return pentry;
+}
+
+/*
+ * histogram bucket of a latency, octave of the us above 1 and the first 4 bits below the leading one
+ */
+static uint32_t s_winusbtmc_profiler_bucket(double ms)
+{
+    double   m;
+    int      e;
+    uint32_t bucket;
+
+    if (ms < 0.001)
+        return 0;
+    m = frexp(ms * 1000.0, &e); /* us = m * 2^e, 0.5 <= m < 1 */
+    bucket = (uint32_t)(e - 1) * WINUSBTMC_PROFILER_STEPS + (uint32_t)((m * 2.0 - 1.0) * WINUSBTMC_PROFILER_STEPS);
+    return (bucket < WINUSBTMC_PROFILER_BUCKETS) ? bucket : WINUSBTMC_PROFILER_BUCKETS - 1;
+}
+
+/*
+ * latency of the p-quantile in ms, the middle of its bucket and not above the largest one
+ */
+static double s_winusbtmc_profiler_quantile(const winusbtmc_profiler_entry_t *pentry, double p)
+{
+    uint64_t rank, sum;
+    uint32_t bucket;
+    double   ms;
+
+    if (pentry->samples == 0)
+        return 0;
+    rank = (uint64_t)ceil(p * pentry->samples);
+    if (rank < 1)
+        rank = 1;
+    sum = 0;
+    for (bucket = 0; bucket < WINUSBTMC_PROFILER_BUCKETS - 1; bucket++)
+    {
+        sum += pentry->histogram[bucket];
+        if (sum >= rank)
+            break;
+    }
+    ms = ldexp(1.0 + (bucket % WINUSBTMC_PROFILER_STEPS + 0.5) / WINUSBTMC_PROFILER_STEPS, bucket / WINUSBTMC_PROFILER_STEPS) / 1000.0;
+    return (ms < pentry->max_ms) ? ms : pentry->max_ms;
+}
+
+static void s_winusbtmc_profiler_sample(winusbtmc_profiler_entry_t *pentry, double ms)
+{
+    pentry->samples++;
+    pentry->total_ms += ms;
+    if (ms > pentry->max_ms)
+        pentry->max_ms = ms;
+    pentry->histogram[s_winusbtmc_profiler_bucket(ms)]++;
+}
+
+static int s_winusbtmc_profiler_compare(const void *a, const void *b)
+{
+    const winusbtmc_profiler_entry_t *pa = *(const winusbtmc_profiler_entry_t * const *)a;
+    const winusbtmc_profiler_entry_t *pb = *(const winusbtmc_profiler_entry_t * const *)b;
+
+    if (pa->total_ms != pb->total_ms)
+        return (pa->total_ms < pb->total_ms) ? 1 : -1;
+    if (pa->count != pb->count)
+        return (pa->count < pb->count) ? 1 : -1;
+    return strcmp(pa->mnemonic, pb->mnemonic);
+}
+
+static void s_winusbtmc_profiler_clear(struct winusbtmc_profiler_s *pprof)
+{
+    uint32_t slot;
+
+    for (slot = 0; slot < WINUSBTMC_PROFILER_SLOTS; slot++)
+    {
+        free(pprof->slots[slot]);
+        pprof->slots[slot] = (void *)0;
+    }
+    pprof->count   = 0;
+    pprof->pending = (void *)0;
+}
+
+int32_t winusbtmc_profiler_enable(winusbtmc_device_t *pdev, bool enable)
+{
+    if ( (enable) && (!pdev->profiler) )
+    {
+        pdev->profiler = calloc(1, sizeof(struct winusbtmc_profiler_s));
+        if (!pdev->profiler)
+            return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+    else if ( (!enable) && (pdev->profiler) )
+    {
+        s_winusbtmc_profiler_clear(pdev->profiler);
+        free(pdev->profiler);
+        pdev->profiler = (void *)0;
+    }
+    return WINUSBTMC_ERR_NONE;
+}
+
+void winusbtmc_profiler_all(bool enable)
+{
+    s_winusbtmc_profiler_all = enable;
+}
+
+void winusbtmc_profiler_opened(winusbtmc_device_t *pdev)
+{
+    if (s_winusbtmc_profiler_all)
+        winusbtmc_profiler_enable(pdev, true);
+}
+
+void winusbtmc_profiler_send(winusbtmc_device_t *pdev, const char *dat, uint32_t len)
+{
+    struct winusbtmc_profiler_s *pprof = pdev->profiler;
+    char                         mnemonic[WINUSBTMC_PROFILE_MNEMONIC_MAX];
+    uint32_t                     n;
+
+    n = s_winusbtmc_profiler_mnemonic(dat, len, mnemonic);
+    pprof->pending = s_winusbtmc_profiler_entry(pprof, mnemonic, n);
+    if (pprof->pending)
+    {
+        pprof->pending->count++;
+        pprof->pending->bytes_sent += len;
+        pprof->query = (memchr(mnemonic, '?', n) != (void *)0);
+        pprof->start = winusbtmc_time_ms();
+    }
+}
+
+void winusbtmc_profiler_sent(winusbtmc_device_t *pdev, int32_t ret)
+{
+    struct winusbtmc_profiler_s *pprof = pdev->profiler;
+
+    if (!pprof->pending)
+        return;
+    if (ret < 0)
+    {
+        pprof->pending->errors++;
+        pprof->pending = (void *)0;
+    }
+    else if (!pprof->query)
+    {
+        s_winusbtmc_profiler_sample(pprof->pending, winusbtmc_time_ms() - pprof->start);
+        pprof->pending = (void *)0;
+    }
+}
+
+void winusbtmc_profiler_received(winusbtmc_device_t *pdev, int32_t ret, bool eom)
+{
+    struct winusbtmc_profiler_s *pprof = pdev->profiler;
+
+    if (!pprof->pending)
+        return;
+    if (ret < 0)
+    {
+        pprof->pending->errors++;
+        pprof->pending = (void *)0;
+        return;
+    }
+    pprof->pending->bytes_received += (uint32_t)ret;
+    if (eom)
+    {
+        s_winusbtmc_profiler_sample(pprof->pending, winusbtmc_time_ms() - pprof->start);
+        pprof->pending = (void *)0;
+    }
+}
+
+int32_t winusbtmc_profiler_report(winusbtmc_device_t *pdev, struct winusbtmc_profile_entry_s *pentries, uint32_t maxcount)
+{
+    struct winusbtmc_profiler_s  *pprof = pdev->profiler;
+    winusbtmc_profiler_entry_t  **psorted;
+    winusbtmc_profiler_entry_t   *pentry;
+    uint32_t                      slot, count, total, i;
+
+    total = (pprof) ? pprof->count : 0;
+    if (total == 0)
+        return 0;
+    psorted = malloc(total * sizeof(winusbtmc_profiler_entry_t *));
+    if (!psorted)
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    count = 0;
+    for (slot = 0; (slot < WINUSBTMC_PROFILER_SLOTS) && (count < total); slot++)
+    {
+        if (pprof->slots[slot])
+            psorted[count++] = pprof->slots[slot];
+    }
+    qsort(psorted, count, sizeof(winusbtmc_profiler_entry_t *), s_winusbtmc_profiler_compare);
+
+    for (i = 0; (i < count) && (i < maxcount); i++)
+    {
+        pentry = psorted[i];
+        memcpy(pentries[i].mnemonic, pentry->mnemonic, sizeof(pentries[i].mnemonic));
+        pentries[i].count          = pentry->count;
+        pentries[i].errors         = pentry->errors;
+        pentries[i].samples        = pentry->samples;
+        pentries[i].bytes_sent     = pentry->bytes_sent;
+        pentries[i].bytes_received = pentry->bytes_received;
+        pentries[i].total_ms       = pentry->total_ms;
+        pentries[i].p50_ms         = s_winusbtmc_profiler_quantile(pentry, 0.50);
+        pentries[i].p99_ms         = s_winusbtmc_profiler_quantile(pentry, 0.99);
+        pentries[i].max_ms         = pentry->max_ms;
+    }
+    free(psorted);
+    return (int32_t)count;
+}
@@ -0,0 +1,99 @@
+/*
+ * Device quirks of usb instruments, keyed by vendor and product id.
+ * Many devices implement only a part of the usbtmc standard, so the usb transport asks this table
+ * which requests are sent when a device is opened and how transfers are done. Devices which are not
+ * listed get WINUSBTMC_QUIRK_DEFAULT, the behaviour of earlier versions of this module.
+ *
+ * The compiled in table can be overridden at runtime with winusbtmc_set_quirks, overrides are
+ * looked up first. An entry for a specific product takes precedence over one for all products
+ * of the vendor (pid WINUSBTMC_QUIRK_ANY_PID).
+ */
+#include <stdlib.h>
+#include "winusbtmc.h"
+#include "winusbtmc_private.h"
+
+typedef struct
+{
+    uint16_t vid;
+    uint16_t pid;                        /* WINUSBTMC_QUIRK_ANY_PID for all products of the vendor */
+    uint32_t flags;                      /* WINUSBTMC_QUIRK_* */
+    uint32_t max_transfer;               /* max. TransferSize of one bulk transfer, 0 if not limited */
+} winusbtmc_quirk_t;
+
+static const winusbtmc_quirk_t s_winusbtmc_quirks[] =
+{
+    /* Rigol DS1000: sends the data of a transfer in several packets with one header */
+    { 0x1ab1, 0x0588, WINUSBTMC_QUIRK_GET_CAPABILITIES | WINUSBTMC_QUIRK_VENDOR_INIT | WINUSBTMC_QUIRK_CLEAR |
+                      WINUSBTMC_QUIRK_SPLIT_TRANSFERS, 0 },
+    /* Rigol DS2000: like DS1000, but INITIATE_CLEAR is not implemented */
+    { 0x1ab1, 0x04b0, WINUSBTMC_QUIRK_GET_CAPABILITIES | WINUSBTMC_QUIRK_VENDOR_INIT |
+                      WINUSBTMC_QUIRK_SPLIT_TRANSFERS, 0 },
+    /* other Rigol instruments */
+    { 0x1ab1, WINUSBTMC_QUIRK_ANY_PID, WINUSBTMC_QUIRK_DEFAULT, 0 },
+    /* Agilent / Keysight, Tektronix and Rohde & Schwarz implement the standard, no vendor request needed.
+       INITIATE_CLEAR is only used to recover from failed transfers, an open needs no control request at all */
+    { 0x0957, WINUSBTMC_QUIRK_ANY_PID, WINUSBTMC_QUIRK_CLEAR, 0 },
+    { 0x2a8d, WINUSBTMC_QUIRK_ANY_PID, WINUSBTMC_QUIRK_CLEAR, 0 },
+    { 0x0699, WINUSBTMC_QUIRK_ANY_PID, WINUSBTMC_QUIRK_CLEAR, 0 },
+    { 0x0aad, WINUSBTMC_QUIRK_ANY_PID, WINUSBTMC_QUIRK_CLEAR, 0 },
+};
+
+static winusbtmc_quirk_t *s_winusbtmc_quirks_override = (void *)0; /* set by winusbtmc_set_quirks */
+static int32_t            s_winusbtmc_quirks_count    = 0;
+
+
+/*
+ * returns the entry for vid and pid (pid may be WINUSBTMC_QUIRK_ANY_PID), 0 if there is none
+ */
+static const winusbtmc_quirk_t *s_winusbtmc_quirks_find(const winusbtmc_quirk_t *table, int32_t count, uint16_t vid, uint16_t pid)
+{
+    int32_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        if ( (table[i].vid == vid) && (table[i].pid == pid) )
+            return &table[i];
+    }
+    return (void *)0;
+}
+
+void winusbtmc_quirks_lookup(uint16_t vid, uint16_t pid, uint32_t *flags, uint32_t *max_transfer)
+{
+    const winusbtmc_quirk_t *pquirk;
+    int                      any;
+
+    pquirk = (void *)0;
+    for (any = 0; (any < 2) && (!pquirk); any++)
+    {
+        pquirk = s_winusbtmc_quirks_find(s_winusbtmc_quirks_override, s_winusbtmc_quirks_count,
+                                         vid, any ? WINUSBTMC_QUIRK_ANY_PID : pid);
+        if (!pquirk)
+        {
+            pquirk = s_winusbtmc_quirks_find(s_winusbtmc_quirks, sizeof(s_winusbtmc_quirks) / sizeof(s_winusbtmc_quirks[0]),
+                                             vid, any ? WINUSBTMC_QUIRK_ANY_PID : pid);
+        }
+    }
+
+    *flags        = (pquirk) ? pquirk->flags : WINUSBTMC_QUIRK_DEFAULT;
+    *max_transfer = (pquirk) ? pquirk->max_transfer : 0;
+}
+
+DLL_EXPORT int32_t winusbtmc_set_quirks(uint16_t vid, uint16_t pid, uint32_t flags, uint32_t max_transfer)
+{
+    winusbtmc_quirk_t *pquirk;
+
+    pquirk = (winusbtmc_quirk_t *)s_winusbtmc_quirks_find(s_winusbtmc_quirks_override, s_winusbtmc_quirks_count, vid, pid);
+    if (!pquirk)
+    {
+        pquirk = realloc(s_winusbtmc_quirks_override, (s_winusbtmc_quirks_count + 1) * sizeof(winusbtmc_quirk_t));
+        if (!pquirk)
+            return WINUSBTMC_ERR_MALLOC_FAILED;
+        s_winusbtmc_quirks_override = pquirk;
+        pquirk      = &s_winusbtmc_quirks_override[s_winusbtmc_quirks_count++];
+        pquirk->vid = vid;
+        pquirk->pid = pid;
+    }
+    pquirk->flags        = flags;
+    pquirk->max_transfer = max_transfer;
+    return WINUSBTMC_ERR_NONE;
+}
@@ -0,0 +1,354 @@
+/*
+ * Response cache.
+ * Queries like "*IDN?" are answered the same way as long as an instrument is connected. When the
+ * response cache of a device is enabled, the response of such a query is recorded the first time and
+ * later queries are answered from the cache without any transfer to the device.
+ *
+ * Which commands are cached is decided by a list of rules, each is a pattern and an action:
+ *   WINUSBTMC_RCACHE_QUERY       the response of a matching query is cached
+ *   WINUSBTMC_RCACHE_INVALIDATE  a matching command drops all cached responses of the device (e.g. "*RST")
+ * Patterns are compared case insensitive with the command (without leading ':' and whitespace), a '*' at
+ * the end of a pattern matches any rest of the command. If several rules match, the last added one is used.
+ * Commands with several parts ("a;b") are never cached, but each part is checked for invalidation.
+ * A failed transfer or removing the device drops the cached responses as well.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "winusbtmc.h"
+#include "winusbtmc_private.h"
+
+#define WINUSBTMC_RCACHE_RESPONSE_MAX (64 * 1024)   /* larger responses are not cached */
+
+typedef struct winusbtmc_rcache_entry_s
+{
+    char                            *query;     /* normalized query */
+    char                            *dat;       /* response including the terminator */
+    uint32_t                         len;
+    bool                             complete;  /* the response was received until eom */
+    struct winusbtmc_rcache_entry_s *next;
+} winusbtmc_rcache_entry_t;
+
+struct winusbtmc_rcache_s
+{
+    winusbtmc_rcache_entry_t *entries;
+    winusbtmc_rcache_entry_t *recording;        /* response which is received now */
+    winusbtmc_rcache_entry_t *replay;           /* response which is read from the cache now */
+    uint32_t                  pos;              /* already read part of replay */
+};
+
+typedef struct
+{
+    char   *pattern;
+    int32_t action;
+} winusbtmc_rcache_rule_t;
+
+static const char * const s_winusbtmc_rcache_queries[] =
+{
+    "*IDN?", "*OPT?", "SYST:OPT?", "SYSTEM:OPTIONS?", (void *)0
+};
+static const char * const s_winusbtmc_rcache_invalidate[] =
+{
+    "*RST", "*RCL*", "SYST:PRES*", "SYSTEM:PRESET*", (void *)0
+};
+
+static winusbtmc_rcache_rule_t *s_winusbtmc_rcache_rules = (void *)0;
+static int32_t                  s_winusbtmc_rcache_count = -1;   /* -1 until the default rules were added */
+static bool                     s_winusbtmc_rcache_all   = false; /* enabled for all devices */
+
+
+/*
+ * skip leading whitespace and ':', returns the length without trailing whitespace and terminator
+ */
+static const char *s_winusbtmc_rcache_trim(const char *cmd, uint32_t len, uint32_t *plen)
+{
+    while ( (len > 0) && ((*cmd == ' ') || (*cmd == '\t') || (*cmd == ':')) )
+    {
+        cmd++;
+        len--;
+    }
+    while ( (len > 0) && ((cmd[len-1] == ' ') || (cmd[len-1] == '\t') || (cmd[len-1] == '\r') || (cmd[len-1] == '\n')) )
+    {
+        len--;
+    }
+    *plen = len;
+    return cmd;
+}
+
+static bool s_winusbtmc_rcache_match(const char *pattern, const char *cmd, uint32_t len)
+{
+    size_t plen = strlen(pattern);
+
+    if ( (plen > 0) && (pattern[plen-1] == '*') && ((plen > 1) || (len > 0)) )
+    {
+        return (len >= plen - 1) && (strncasecmp(pattern, cmd, plen - 1) == 0);
+    }
+    return (len == plen) && (strncasecmp(pattern, cmd, len) == 0);
+}
+
+static int32_t s_winusbtmc_rcache_add(const char *pattern, int32_t action)
+{
+    winusbtmc_rcache_rule_t *prules;
+    char                    *p;
+    uint32_t                 len;
+
+    pattern = s_winusbtmc_rcache_trim(pattern, strlen(pattern), &len);
+    prules = realloc(s_winusbtmc_rcache_rules, (s_winusbtmc_rcache_count + 1) * sizeof(winusbtmc_rcache_rule_t));
+    if (!prules)
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    s_winusbtmc_rcache_rules = prules;
+    p = malloc(len + 1);
+    if (!p)
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    memcpy(p, pattern, len);
+    p[len] = '\0';
+    s_winusbtmc_rcache_rules[s_winusbtmc_rcache_count].pattern = p;
+    s_winusbtmc_rcache_rules[s_winusbtmc_rcache_count].action  = action;
+    s_winusbtmc_rcache_count++;
+    return WINUSBTMC_ERR_NONE;
+}
+
+static void s_winusbtmc_rcache_defaults(void)
+{
+    int i;
+
+    if (s_winusbtmc_rcache_count >= 0)
+        return;
+    s_winusbtmc_rcache_count = 0;
+    for (i = 0; s_winusbtmc_rcache_queries[i]; i++)
+        s_winusbtmc_rcache_add(s_winusbtmc_rcache_queries[i], WINUSBTMC_RCACHE_QUERY);
+    for (i = 0; s_winusbtmc_rcache_invalidate[i]; i++)
+        s_winusbtmc_rcache_add(s_winusbtmc_rcache_invalidate[i], WINUSBTMC_RCACHE_INVALIDATE);
+}
+
+/*
+ * returns the action of the last added rule matching a single command, 0 if none
+ */
+static int32_t s_winusbtmc_rcache_action(const char *cmd, uint32_t len)
+{
+    int32_t i;
+
+    s_winusbtmc_rcache_defaults();
+    cmd = s_winusbtmc_rcache_trim(cmd, len, &len);
+    for (i = s_winusbtmc_rcache_count - 1; i >= 0; i--)
+    {
+        if (s_winusbtmc_rcache_match(s_winusbtmc_rcache_rules[i].pattern, cmd, len))
+            return s_winusbtmc_rcache_rules[i].action;
+    }
+    return 0;
+}
+
+/*
+ * returns the action for a complete message, every part of "a;b" is checked for invalidation
+ */
+static int32_t s_winusbtmc_rcache_classify(const char *str, uint32_t len)
+{
+    const char *part, *end;
+    uint32_t    partlen;
+
+    if (!memchr(str, ';', len))
+        return s_winusbtmc_rcache_action(str, len);
+
+    for (part = str; part < str + len; part += partlen + 1)
+    {
+        end     = memchr(part, ';', str + len - part);
+        partlen = (end) ? (uint32_t)(end - part) : (uint32_t)(str + len - part);
+        if (s_winusbtmc_rcache_action(part, partlen) == WINUSBTMC_RCACHE_INVALIDATE)
+            return WINUSBTMC_RCACHE_INVALIDATE;
+    }
+    return 0;
+}
+
+static void s_winusbtmc_rcache_clear(struct winusbtmc_rcache_s *prc)
+{
+    winusbtmc_rcache_entry_t *pentry;
+
+    while (prc->entries)
+    {
+        pentry       = prc->entries;
+        prc->entries = pentry->next;
+        free(pentry->query);
+        free(pentry->dat);
+        free(pentry);
+    }
+    prc->recording = (void *)0;
+    prc->replay    = (void *)0;
+}
+
+/*
+ * returns the entry of a query, it is created if create is true. 0 if there is none
+ */
+static winusbtmc_rcache_entry_t *s_winusbtmc_rcache_entry(struct winusbtmc_rcache_s *prc, const char *str, uint32_t len, bool create)
+{
+    winusbtmc_rcache_entry_t *pentry;
+    const char               *query;
+
+    query = s_winusbtmc_rcache_trim(str, len, &len);
+    for (pentry = prc->entries; pentry; pentry = pentry->next)
+    {
+        if ( (strlen(pentry->query) == len) && (strncasecmp(pentry->query, query, len) == 0) )
+            return pentry;
+    }
+    if (!create)
+        return (void *)0;
+
+    pentry = calloc(1, sizeof(winusbtmc_rcache_entry_t));
+    if (!pentry)
+        return (void *)0;
+    pentry->query = malloc(len + 1);
+    if (!pentry->query)
+    {
+        free(pentry);
+        return (void *)0;
+    }
+    memcpy(pentry->query, query, len);
+    pentry->query[len] = '\0';
+    pentry->next = prc->entries;
+    prc->entries = pentry;
+    return pentry;
+}
+
+int32_t winusbtmc_rcache_enable(winusbtmc_device_t *pdev, bool enable)
+{
+    if ( (enable) && (!pdev->rcache) )
+    {
+        pdev->rcache = calloc(1, sizeof(struct winusbtmc_rcache_s));
+        if (!pdev->rcache)
+            return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+    else if ( (!enable) && (pdev->rcache) )
+    {
+        s_winusbtmc_rcache_clear(pdev->rcache);
+        free(pdev->rcache);
+        pdev->rcache = (void *)0;
+    }
+    return WINUSBTMC_ERR_NONE;
+}
+
+void winusbtmc_rcache_all(bool enable)
+{
+    s_winusbtmc_rcache_all = enable;
+}
+
+void winusbtmc_rcache_opened(winusbtmc_device_t *pdev)
+{
+    if (s_winusbtmc_rcache_all)
+        winusbtmc_rcache_enable(pdev, true);
+}
+
+int32_t winusbtmc_rcache_write(winusbtmc_device_t *pdev, const char *str, uint32_t len)
+{
+    struct winusbtmc_rcache_s *prc = pdev->rcache;
+    winusbtmc_rcache_entry_t  *pentry;
+    int32_t                    action, ret;
+
+    /* a new command ends the response in progress */
+    prc->recording = (void *)0;
+    prc->replay    = (void *)0;
+
+    action = s_winusbtmc_rcache_classify(str, len);
+    if (action == WINUSBTMC_RCACHE_INVALIDATE)
+    {
+        s_winusbtmc_rcache_clear(prc);
+    }
+    else if (action == WINUSBTMC_RCACHE_QUERY)
+    {
+        pentry = s_winusbtmc_rcache_entry(prc, str, len, false);
+        if ( (pentry) && (pentry->complete) )
+        { /* answered from the cache, nothing is sent */
+            prc->replay = pentry;
+            prc->pos    = 0;
+            return WINUSBTMC_ERR_NONE;
+        }
+    }
+
+    ret = pdev->transport->write(pdev, str, len);
+    if (ret < 0)
+    {
+        s_winusbtmc_rcache_clear(prc);
+        return ret;
+    }
+
+    if (action == WINUSBTMC_RCACHE_QUERY)
+    {
+        prc->recording = s_winusbtmc_rcache_entry(prc, str, len, true);
+        if (prc->recording)
+        {
+            prc->recording->len      = 0;
+            prc->recording->complete = false;
+        }
+    }
+    return ret;
+}
+
+int32_t winusbtmc_rcache_read(winusbtmc_device_t *pdev, char *dat, uint32_t maxlen, bool *eom)
+{
+    struct winusbtmc_rcache_s *prc = pdev->rcache;
+    winusbtmc_rcache_entry_t  *pentry;
+    int32_t                    ret;
+    bool                       end;
+    char                      *p;
+
+    if (prc->replay)
+    {
+        pentry = prc->replay;
+        ret = (pentry->len - prc->pos < maxlen) ? pentry->len - prc->pos : maxlen;
+        memcpy(dat, &pentry->dat[prc->pos], ret);
+        prc->pos += ret;
+        end = (prc->pos >= pentry->len);
+        if (end)
+            prc->replay = (void *)0;
+        if (eom)
+            *eom = end;
+        return ret;
+    }
+
+    end = false;
+    ret = pdev->transport->read(pdev, dat, maxlen, &end);
+    if (eom)
+        *eom = end;
+    if (ret < 0)
+    {
+        s_winusbtmc_rcache_clear(prc);
+        return ret;
+    }
+
+    pentry = prc->recording;
+    if (pentry)
+    {
+        p = (pentry->len + ret <= WINUSBTMC_RCACHE_RESPONSE_MAX) ? realloc(pentry->dat, pentry->len + ret) : (void *)0;
+        if ( (!p) && (pentry->len + ret > 0) )
+        { /* too large, the query is sent to the device every time */
+            prc->recording = (void *)0;
+        }
+        else
+        {
+            pentry->dat = p;
+            memcpy(&pentry->dat[pentry->len], dat, ret);
+            pentry->len += ret;
+            if (end)
+            {
+                pentry->complete = true;
+                prc->recording   = (void *)0;
+            }
+        }
+    }
+    return ret;
+}
+
+DLL_EXPORT int32_t winusbtmc_response_cache_rule(const char *pattern, int32_t action)
+{
+    int32_t i;
+
+    s_winusbtmc_rcache_defaults();
+    if (!pattern)
+    { /* remove all rules, including the default ones */
+        for (i = 0; i < s_winusbtmc_rcache_count; i++)
+            free(s_winusbtmc_rcache_rules[i].pattern);
+        s_winusbtmc_rcache_count = 0;
+        return WINUSBTMC_ERR_NONE;
+    }
+    if ( (action != WINUSBTMC_RCACHE_QUERY) && (action != WINUSBTMC_RCACHE_INVALIDATE) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    return s_winusbtmc_rcache_add(pattern, action);
+}
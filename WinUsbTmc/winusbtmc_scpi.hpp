@@ -0,0 +1,244 @@
+/*
+ * SCPI commands built from templates which are checked at compile time (C++17, header only).
+ *
+ * A template is a command with fields in angle brackets, the name of a field only documents it:
+ *
+ *     static constexpr winusbtmc::scpi_command sour_volt("SOUR<n>:VOLT <value>");
+ *
+ *     for (i = 0; i < points; i++)
+ *         winusbtmc::send<sour_volt>(devnum, 1, start + i * step);
+ *
+ * A broken template (e.g. "SOUR<n:VOLT") does not compile, neither does a call with the wrong count of values.
+ * send formats the values with std::to_chars directly into the transfer buffer of the device
+ * (winusbtmc_send_buffer) and sends the command with winusbtmc_send_data, so there is no temporary string,
+ * no allocation and no strlen. Values can be integers of up to 64 bits (no character types, int8_t / uint8_t
+ * are numbers), floating point numbers (shortest form which reads back to the same value, infinities and NAN as
+ * the SCPI 9.9E37 / 9.91E37), bool (1 / 0), const char * and std::string_view. Other types do not compile.
+ * format writes a command into a buffer of the caller.
+ */
+#ifndef WINUSBTMC_SCPI_HPP
+#define WINUSBTMC_SCPI_HPP
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include "winusbtmc.h"
+
+namespace winusbtmc
+{
+
+constexpr std::size_t scpi_max_fields = 8;
+
+/* called while a constexpr scpi_command is built from a broken template, the name is the compiler error */
+inline void scpi_error_field_without_closing_bracket() {}
+inline void scpi_error_closing_bracket_without_field() {}
+inline void scpi_error_field_name_missing_or_invalid() {}
+inline void scpi_error_too_many_fields() {}
+inline void scpi_error_character_not_allowed() {}
+inline void scpi_error_empty_template() {}
+
+class scpi_command
+{
+public:
+    struct text_t
+    {
+        std::size_t pos = 0;
+        std::size_t len = 0;
+    };
+
+    const char *str;
+    std::size_t fields;                               /* count of values */
+    std::size_t text_len;                             /* bytes without the fields */
+    text_t      text[scpi_max_fields + 1];            /* text before each field and after the last one */
+    bool        valid;                                /* false for a broken template built at run time */
+
+    template <std::size_t N>
+    constexpr scpi_command(const char (&s)[N]) : str(s), fields(0), text_len(0), text{}, valid(true)
+    {
+        std::size_t i = 0, start = 0;
+
+        if (N <= 1)
+            fail(scpi_error_empty_template);
+        for (i = 0; (i < N - 1) && (valid); i++)
+        {
+            if ( (s[i] < 0x20) || (s[i] > 0x7e) ) /* the terminator is added by the library */
+            {
+                fail(scpi_error_character_not_allowed);
+            }
+            else if (s[i] == '>')
+            {
+                fail(scpi_error_closing_bracket_without_field);
+            }
+            else if (s[i] == '<')
+            {
+                if (fields == scpi_max_fields)
+                {
+                    fail(scpi_error_too_many_fields);
+                    break;
+                }
+                text[fields] = text_t{ start, i - start };
+                text_len    += i - start;
+                fields++;
+                for (start = ++i; (i < N - 1) && (is_name(s[i])); i++)
+                    ;
+                if (i == N - 1)
+                    fail(scpi_error_field_without_closing_bracket);
+                else if ( (s[i] != '>') || (i == start) )
+                    fail(scpi_error_field_name_missing_or_invalid);
+                start = i + 1;
+            }
+        }
+        if (valid)
+        {
+            text[fields] = text_t{ start, N - 1 - start };
+            text_len    += N - 1 - start;
+        }
+    }
+
+private:
+    static constexpr bool is_name(char c)
+    {
+        return ( (c >= 'a') && (c <= 'z') ) || ( (c >= 'A') && (c <= 'Z') ) || ( (c >= '0') && (c <= '9') ) || (c == '_');
+    }
+
+    constexpr void fail(void (*error)())
+    {
+        error(); /* not constexpr, so a broken constexpr template is a compile error */
+        valid = false;
+    }
+};
+
+namespace detail
+{
+
+/* character types are no numbers, a char would be sent as its code */
+template <typename T>
+constexpr bool scpi_is_char_v = std::is_same_v<T, char> || std::is_same_v<T, wchar_t> ||
+                                std::is_same_v<T, char16_t> || std::is_same_v<T, char32_t>
+#ifdef __cpp_char8_t
+                                || std::is_same_v<T, char8_t>
+#endif
+                                ;
+
+/* max. bytes of a formatted value */
+template <typename T>
+inline std::size_t scpi_size(const T &value)
+{
+    if constexpr (std::is_same_v<T, bool>)
+        return 1;
+    else if constexpr (std::is_integral_v<T>)
+    {
+        static_assert(!scpi_is_char_v<T>, "characters are no values of SCPI commands, pass a string or an int");
+        static_assert(sizeof(T) <= 8, "integer values of SCPI commands have up to 64 bits");
+        return 20; /* "-9223372036854775808" */
+    }
+    else if constexpr (std::is_floating_point_v<T>)
+        return 32;
+    else if constexpr (std::is_convertible_v<const T &, std::string_view>)
+        return std::string_view(value).size();
+    else
+        static_assert(std::is_integral_v<T>, "values of SCPI commands are numbers, bool or strings");
+}
+
+/* formats a value at p, there are at least scpi_size bytes */
+template <typename T>
+inline char *scpi_put(char *p, char *end, const T &value)
+{
+    if constexpr (std::is_same_v<T, bool>)
+    {
+        *p++ = (value) ? '1' : '0';
+        return p;
+    }
+    else if constexpr (std::is_integral_v<T>)
+    {
+        return std::to_chars(p, end, value).ptr;
+    }
+    else if constexpr (std::is_floating_point_v<T>)
+    {
+        std::string_view special;
+
+        if (std::isnan(value))
+            special = "9.91E37";
+        else if (std::isinf(value))
+            special = (value > 0) ? "9.9E37" : "-9.9E37";
+        if (!special.empty())
+        {
+            std::memcpy(p, special.data(), special.size());
+            return p + special.size();
+        }
+#if defined(__cpp_lib_to_chars) && (__cpp_lib_to_chars >= 201611L)
+        return std::to_chars(p, end, value).ptr;
+#else
+        return p + std::snprintf(p, end - p, "%.17g", (double)value); /* no floating point to_chars */
+#endif
+    }
+    else
+    {
+        std::string_view str(value);
+
+        std::memcpy(p, str.data(), str.size());
+        return p + str.size();
+    }
+}
+
+template <const scpi_command &C>
+inline char *scpi_text(char *p, std::size_t index)
+{
+    std::memcpy(p, C.str + C.text[index].pos, C.text[index].len);
+    return p + C.text[index].len;
+}
+
+template <const scpi_command &C, typename... Args>
+inline std::size_t scpi_format(char *dst, char *end, const Args &... values)
+{
+    char        *p = dst;
+    std::size_t  index = 0;
+
+    (void)end; /* commands without fields */
+    ((p = scpi_text<C>(p, index++), p = scpi_put(p, end, values)), ...);
+    p = scpi_text<C>(p, index);
+    return (std::size_t)(p - dst);
+}
+
+} /* namespace detail */
+
+/* max. length of the command with these values */
+template <const scpi_command &C, typename... Args>
+inline std::size_t max_length(const Args &... values)
+{
+    static_assert(C.fields == sizeof...(Args), "the count of values does not match the fields of the command");
+    return C.text_len + (std::size_t{0} + ... + detail::scpi_size(values));
+}
+
+/* writes the command into dst of size bytes (no terminating 0), returns its length or -1 if dst is too small */
+template <const scpi_command &C, typename... Args>
+inline int32_t format(char *dst, std::size_t size, const Args &... values)
+{
+    if ( (!C.valid) || (max_length<C>(values...) > size) )
+        return -1;
+    return (int32_t)detail::scpi_format<C>(dst, dst + size, values...);
+}
+
+/* formats the command in the transfer buffer of the device and sends it */
+template <const scpi_command &C, typename... Args>
+inline int32_t send(int32_t devnum, const Args &... values)
+{
+    std::size_t len = max_length<C>(values...);
+    char       *buf;
+    int32_t     ret;
+
+    if ( (!C.valid) || (len > INT32_MAX) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    ret = winusbtmc_send_buffer(devnum, (uint32_t)len, &buf);
+    if (ret < 0)
+        return ret;
+    len = detail::scpi_format<C>(buf, buf + len, values...);
+    return winusbtmc_send_data(devnum, buf, (uint32_t)len);
+}
+
+} /* namespace winusbtmc */
+
+#endif /* WINUSBTMC_SCPI_HPP */
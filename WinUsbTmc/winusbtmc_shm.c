@@ -0,0 +1,457 @@
+/*
+ * Shared memory ring.
+ * Hands responses to another process without copying them: the ring of slots is in named shared memory which
+ * both processes map, winusbtmc_recv_shm receives a response directly into a slot and the consumer process
+ * reads it there. A small queue of descriptors (length, sequence number, time) next to the slots says which
+ * slots are filled.
+ *
+ * Like the buffer ring of the continuous acquisition there is a single producer and a single consumer, head
+ * and tail are each written by one side only and passed with atomic accesses, which are lock free between
+ * processes as well. A side which waits for the other one polls, first yielding the cpu and then every
+ * millisecond, so no synchronisation object has to be shared.
+ *
+ * A name belongs to one producer at a time, winusbtmc_shm_create fails while another producer has it. On POSIX the
+ * shared memory outlives a producer which crashed, its name is only taken over if the process in the header is gone.
+ *
+ * Layout of the shared memory:
+ *   header:       "WTMCSHM1", u32 slots, u32 slot size, u32 offset of the first slot, u32 closed, u32 producer pid,
+ *                 padding to 64
+ *                 u32 head, padding to 128, u32 tail, padding to 192 (head and tail in their own cache lines)
+ *   descriptors:  per slot u64 sequence, u32 length, u32 truncated, f64 timestamp
+ *   slots:        page aligned
+ */
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <signal.h>
+    #include <unistd.h>
+    #include <sched.h>
+    #include <time.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+#include "winusbtmc.h"
+#include "winusbtmc_private.h"
+
+#define WINUSBTMC_SHM_MAGIC    "WTMCSHM1"
+#define WINUSBTMC_SHM_PAGE     (4096)        /* alignment of the slots */
+#define WINUSBTMC_SHM_SPINS    (200)         /* yields of a waiting side before it sleeps */
+#define WINUSBTMC_SHM_DRAIN    (65536)       /* bytes per read of the rest of a truncated response */
+#define WINUSBTMC_SHM_NAME     (200)         /* max. length of a name */
+
+/* fields shared by both processes, the store of head or tail publishes everything written before */
+#define WINUSBTMC_SHM_LOAD(field)         __atomic_load_n(&(field), __ATOMIC_SEQ_CST)
+#define WINUSBTMC_SHM_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_SEQ_CST)
+
+typedef struct
+{
+    char     magic[8];
+    uint32_t slots;
+    uint32_t slot_size;
+    uint32_t data_offset;
+    uint32_t closed;                /* set by the producer when it closes the ring */
+    uint32_t pid;                   /* process of the producer (POSIX), to replace the ring after a crash */
+    uint8_t  reserved[36];
+    uint32_t head;                  /* next slot published, 0 .. 2 * slots - 1, written by the producer only */
+    uint8_t  pad_head[60];
+    uint32_t tail;                  /* next slot released, written by the consumer only */
+    uint8_t  pad_tail[60];
+} winusbtmc_shm_header_t;
+
+typedef struct
+{
+    uint64_t sequence;
+    uint32_t len;
+    uint32_t truncated;
+    double   timestamp;
+} winusbtmc_shm_desc_t;
+
+struct winusbtmc_shm_s
+{
+    bool                    producer;
+    char                    name[WINUSBTMC_SHM_NAME + 8];   /* system name of the shared memory */
+    winusbtmc_shm_header_t *hdr;
+    winusbtmc_shm_desc_t   *desc;
+    char                   *data;
+    uint64_t                size;                           /* mapped bytes */
+#ifdef _WIN32
+    HANDLE                  map;
+#else
+    int                     fd;
+#endif
+    uint64_t                sequence;                       /* producer: next sequence number */
+    char                   *drain;                          /* producer: rest of truncated responses */
+    bool                    taken;                          /* consumer: a slot was returned by winusbtmc_shm_get */
+};
+
+
+/* waits a little longer on each call, for a side which polls the other one */
+static void s_winusbtmc_shm_wait(uint32_t *pspins)
+{
+    if (*pspins < WINUSBTMC_SHM_SPINS)
+    {
+        (*pspins)++;
+#ifdef _WIN32
+        SwitchToThread();
+#else
+        sched_yield();
+#endif
+        return;
+    }
+#ifdef _WIN32
+    Sleep(1);
+#else
+    {
+        struct timespec ts = { 0, 1000000 };
+        nanosleep(&ts, (void *)0);
+    }
+#endif
+}
+
+/* false once the time since start is over timeout_ms (0 no wait, -1 infinite) */
+static bool s_winusbtmc_shm_in_time(double start, int32_t timeout_ms)
+{
+    return (timeout_ms < 0) || (winusbtmc_time_ms() - start < timeout_ms);
+}
+
+/* allocates a ring and builds the system name, "/name" for POSIX shared memory and "Local\name" on windows */
+static int32_t s_winusbtmc_shm_alloc(winusbtmc_shm_t **ppshm, const char *name, bool producer)
+{
+    winusbtmc_shm_t *pshm;
+
+    if ( (!ppshm) || (!name) || (!*name) || (strlen(name) > WINUSBTMC_SHM_NAME) || (strpbrk(name, "/\\")) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    *ppshm = (void *)0;
+
+    pshm = calloc(1, sizeof(winusbtmc_shm_t));
+    if (!pshm)
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    pshm->producer = producer;
+#ifdef _WIN32
+    snprintf(pshm->name, sizeof(pshm->name), "Local\\%s", name);
+#else
+    snprintf(pshm->name, sizeof(pshm->name), "/%s", name);
+    pshm->fd = -1;
+#endif
+    *ppshm = pshm;
+    return WINUSBTMC_ERR_NONE;
+}
+
+/* sets the pointers into the mapping, checks the header of a ring opened by a consumer */
+static bool s_winusbtmc_shm_attach(winusbtmc_shm_t *pshm, void *p)
+{
+    winusbtmc_shm_header_t *hdr = p;
+
+    pshm->hdr = hdr;
+    if ( (pshm->size < sizeof(winusbtmc_shm_header_t)) || (memcmp(hdr->magic, WINUSBTMC_SHM_MAGIC, 8) != 0) ||
+         (hdr->slots == 0) || (hdr->data_offset < sizeof(winusbtmc_shm_header_t) +
+                                                  (uint64_t)hdr->slots * sizeof(winusbtmc_shm_desc_t)) ||
+         (pshm->size < hdr->data_offset + (uint64_t)hdr->slots * hdr->slot_size) )
+        return false;
+    pshm->desc = (winusbtmc_shm_desc_t *)((char *)p + sizeof(winusbtmc_shm_header_t));
+    pshm->data = (char *)p + hdr->data_offset;
+    return true;
+}
+
+
+/**************************************************************************************************
+ * producer
+ **************************************************************************************************/
+
+#ifndef _WIN32
+/* true if the shared memory of name was left by a producer which does not run any more */
+static bool s_winusbtmc_shm_stale(const char *name)
+{
+    winusbtmc_shm_header_t *hdr;
+    struct stat             st;
+    int                     fd;
+    bool                    stale;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    stale = false;
+    if ( (fstat(fd, &st) == 0) && (st.st_size >= (off_t)sizeof(winusbtmc_shm_header_t)) )
+    {
+        hdr = mmap((void *)0, sizeof(winusbtmc_shm_header_t), PROT_READ, MAP_SHARED, fd, 0);
+        if (hdr != MAP_FAILED)
+        {
+            /* a ring without magic is still being created */
+            stale = (memcmp(hdr->magic, WINUSBTMC_SHM_MAGIC, 8) == 0) && (hdr->pid != 0) &&
+                    (kill((pid_t)hdr->pid, 0) < 0) && (errno == ESRCH);
+            munmap(hdr, sizeof(winusbtmc_shm_header_t));
+        }
+    }
+    close(fd);
+    return stale;
+}
+#endif
+
+DLL_EXPORT int32_t winusbtmc_shm_create(winusbtmc_shm_t **ppshm, const char *name, uint32_t slots, uint32_t size)
+{
+    winusbtmc_shm_t *pshm;
+    void            *p;
+    uint64_t         data_offset;
+    int32_t          ret;
+
+    if ( (slots == 0) || (slots > INT32_MAX / 2) || (size == 0) || (size > INT32_MAX - WINUSBTMC_SHM_PAGE) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    ret = s_winusbtmc_shm_alloc(ppshm, name, true);
+    if (ret < 0)
+        return ret;
+    pshm = *ppshm;
+
+    /* every slot starts on a page */
+    size        = (size + WINUSBTMC_SHM_PAGE - 1) / WINUSBTMC_SHM_PAGE * WINUSBTMC_SHM_PAGE;
+    data_offset = sizeof(winusbtmc_shm_header_t) + (uint64_t)slots * sizeof(winusbtmc_shm_desc_t);
+    data_offset = (data_offset + WINUSBTMC_SHM_PAGE - 1) / WINUSBTMC_SHM_PAGE * WINUSBTMC_SHM_PAGE;
+    pshm->size  = data_offset + (uint64_t)slots * size;
+    if ( (data_offset > UINT32_MAX) || (pshm->size > (uint64_t)(size_t)-1) )
+    {
+        free(pshm);
+        *ppshm = (void *)0;
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    }
+
+#ifdef _WIN32
+    pshm->map = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(pshm->size >> 32),
+                                   (DWORD)pshm->size, pshm->name);
+    if ( (pshm->map) && (GetLastError() == ERROR_ALREADY_EXISTS) )
+    { /* in use by another producer, or still opened by a consumer of a previous one */
+        CloseHandle(pshm->map);
+        pshm->map = NULL;
+    }
+    p = (pshm->map) ? MapViewOfFile(pshm->map, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)pshm->size) : NULL;
+    if (!p)
+    {
+        if (pshm->map)
+            CloseHandle(pshm->map);
+        free(pshm);
+        *ppshm = (void *)0;
+        return WINUSBTMC_ERR_CANNOT_OPEN_DEVICE;
+    }
+#else
+    pshm->fd = shm_open(pshm->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if ( (pshm->fd < 0) && (errno == EEXIST) && (s_winusbtmc_shm_stale(pshm->name)) )
+    { /* left by a producer which crashed, a running one keeps its ring */
+        shm_unlink(pshm->name);
+        pshm->fd = shm_open(pshm->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    p        = MAP_FAILED;
+    if ( (pshm->fd >= 0) && (ftruncate(pshm->fd, (off_t)pshm->size) == 0) )
+        p = mmap((void *)0, (size_t)pshm->size, PROT_READ | PROT_WRITE, MAP_SHARED, pshm->fd, 0);
+    if (p == MAP_FAILED)
+    {
+        if (pshm->fd >= 0)
+        {
+            close(pshm->fd);
+            shm_unlink(pshm->name);
+        }
+        free(pshm);
+        *ppshm = (void *)0;
+        return WINUSBTMC_ERR_CANNOT_OPEN_DEVICE;
+    }
+#endif
+
+    /* the memory is zeroed, the magic is written last so a consumer never sees a half initialized ring */
+    pshm->hdr              = p;
+    pshm->hdr->slots       = slots;
+    pshm->hdr->slot_size   = size;
+    pshm->hdr->data_offset = (uint32_t)data_offset;
+#ifndef _WIN32
+    pshm->hdr->pid         = (uint32_t)getpid();
+#endif
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    memcpy(pshm->hdr->magic, WINUSBTMC_SHM_MAGIC, 8);
+    s_winusbtmc_shm_attach(pshm, p);
+    return WINUSBTMC_ERR_NONE;
+}
+
+DLL_EXPORT int32_t winusbtmc_recv_shm(int32_t devnum, winusbtmc_shm_t *pshm, int32_t timeout_ms)
+{
+    winusbtmc_shm_desc_t *pdesc;
+    char                 *slot;
+    uint32_t              head, slots, len, spins;
+    double                start;
+    int32_t               ret;
+    bool                  eom, truncated;
+
+    if ( (!pshm) || (!pshm->producer) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    /* a free slot, the ring is full if head is slots ahead of tail */
+    slots = pshm->hdr->slots;
+    head  = pshm->hdr->head;
+    start = winusbtmc_time_ms();
+    spins = 0;
+    while ((head + 2 * slots - WINUSBTMC_SHM_LOAD(pshm->hdr->tail)) % (2 * slots) == slots)
+    {
+        if ( (timeout_ms == 0) || (!s_winusbtmc_shm_in_time(start, timeout_ms)) )
+            return WINUSBTMC_ERR_SHM_FULL;
+        s_winusbtmc_shm_wait(&spins);
+    }
+
+    /* the response goes directly into the slot, the rest of a longer one is dropped */
+    slot      = pshm->data + (uint64_t)(head % slots) * pshm->hdr->slot_size;
+    len       = 0;
+    truncated = false;
+    do
+    {
+        ret = winusbtmc_recv_data(devnum, slot + len, pshm->hdr->slot_size - len, &eom);
+        if (ret < 0)
+            return ret;
+        len += ret;
+    } while ( (!eom) && (len < pshm->hdr->slot_size) );
+    while (!eom)
+    {
+        if (!pshm->drain)
+            pshm->drain = malloc(WINUSBTMC_SHM_DRAIN);
+        if (!pshm->drain)
+            return WINUSBTMC_ERR_MALLOC_FAILED;
+        ret = winusbtmc_recv_data(devnum, pshm->drain, WINUSBTMC_SHM_DRAIN, &eom);
+        if (ret < 0)
+            return ret;
+        truncated = true;
+    }
+
+    pdesc            = &pshm->desc[head % slots];
+    pdesc->sequence  = pshm->sequence++;
+    pdesc->len       = len;
+    pdesc->truncated = truncated;
+    pdesc->timestamp = winusbtmc_time_now();
+    WINUSBTMC_SHM_STORE(pshm->hdr->head, (head + 1) % (2 * slots));
+    return (int32_t)len;
+}
+
+
+/**************************************************************************************************
+ * consumer
+ **************************************************************************************************/
+
+DLL_EXPORT int32_t winusbtmc_shm_open(winusbtmc_shm_t **ppshm, const char *name)
+{
+    winusbtmc_shm_t *pshm;
+    void            *p;
+    int32_t          ret;
+#ifdef _WIN32
+    MEMORY_BASIC_INFORMATION info;
+#else
+    struct stat      st;
+#endif
+
+    ret = s_winusbtmc_shm_alloc(ppshm, name, false);
+    if (ret < 0)
+        return ret;
+    pshm = *ppshm;
+
+#ifdef _WIN32
+    p         = NULL;
+    pshm->map = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, pshm->name);
+    if (pshm->map)
+        p = MapViewOfFile(pshm->map, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if ( (p) && (VirtualQuery(p, &info, sizeof(info)) == sizeof(info)) )
+        pshm->size = info.RegionSize;
+    if ( (!p) || (!s_winusbtmc_shm_attach(pshm, p)) )
+    {
+        if (p)
+            UnmapViewOfFile(p);
+        if (pshm->map)
+            CloseHandle(pshm->map);
+        free(pshm);
+        *ppshm = (void *)0;
+        return WINUSBTMC_ERR_CANNOT_OPEN_DEVICE;
+    }
+#else
+    p        = MAP_FAILED;
+    pshm->fd = shm_open(pshm->name, O_RDWR, 0);
+    if ( (pshm->fd >= 0) && (fstat(pshm->fd, &st) == 0) && (st.st_size > 0) )
+    {
+        pshm->size = (uint64_t)st.st_size;
+        p = mmap((void *)0, (size_t)pshm->size, PROT_READ | PROT_WRITE, MAP_SHARED, pshm->fd, 0);
+    }
+    if ( (p == MAP_FAILED) || (!s_winusbtmc_shm_attach(pshm, p)) )
+    {
+        if (p != MAP_FAILED)
+            munmap(p, (size_t)pshm->size);
+        if (pshm->fd >= 0)
+            close(pshm->fd);
+        free(pshm);
+        *ppshm = (void *)0;
+        return WINUSBTMC_ERR_CANNOT_OPEN_DEVICE;
+    }
+#endif
+    return WINUSBTMC_ERR_NONE;
+}
+
+DLL_EXPORT int32_t winusbtmc_shm_get(winusbtmc_shm_t *pshm, winusbtmc_shm_entry_t *pentry, int32_t timeout_ms)
+{
+    const winusbtmc_shm_desc_t *pdesc;
+    uint32_t                    tail, spins;
+    double                      start;
+
+    if ( (!pshm) || (pshm->producer) || (!pentry) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    /* the slot of the last call until it is released */
+    tail  = pshm->hdr->tail;
+    start = winusbtmc_time_ms();
+    spins = 0;
+    while (WINUSBTMC_SHM_LOAD(pshm->hdr->head) == tail)
+    {
+        if (WINUSBTMC_SHM_LOAD(pshm->hdr->closed))
+        {
+            if (WINUSBTMC_SHM_LOAD(pshm->hdr->head) != tail)
+                break; /* published just before it was closed */
+            return WINUSBTMC_ERR_SHM_CLOSED;
+        }
+        if ( (timeout_ms == 0) || (!s_winusbtmc_shm_in_time(start, timeout_ms)) )
+            return 0;
+        s_winusbtmc_shm_wait(&spins);
+    }
+
+    pdesc              = &pshm->desc[tail % pshm->hdr->slots];
+    pentry->dat        = pshm->data + (uint64_t)(tail % pshm->hdr->slots) * pshm->hdr->slot_size;
+    pentry->len        = (pdesc->len <= pshm->hdr->slot_size) ? pdesc->len : pshm->hdr->slot_size;
+    pentry->truncated  = (pdesc->truncated != 0);
+    pentry->sequence   = pdesc->sequence;
+    pentry->timestamp  = pdesc->timestamp;
+    pshm->taken        = true;
+    return 1;
+}
+
+DLL_EXPORT int32_t winusbtmc_shm_release(winusbtmc_shm_t *pshm)
+{
+    if ( (!pshm) || (pshm->producer) || (!pshm->taken) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    pshm->taken = false;
+    WINUSBTMC_SHM_STORE(pshm->hdr->tail, (pshm->hdr->tail + 1) % (2 * pshm->hdr->slots));
+    return WINUSBTMC_ERR_NONE;
+}
+
+DLL_EXPORT int32_t winusbtmc_shm_close(winusbtmc_shm_t *pshm)
+{
+    if (!pshm)
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    if (pshm->producer)
+        WINUSBTMC_SHM_STORE(pshm->hdr->closed, 1);
+#ifdef _WIN32
+    UnmapViewOfFile(pshm->hdr);
+    CloseHandle(pshm->map);
+#else
+    munmap(pshm->hdr, (size_t)pshm->size);
+    close(pshm->fd);
+    if (pshm->producer)
+        shm_unlink(pshm->name);
+#endif
+    free(pshm->drain);
+    free(pshm);
+    return WINUSBTMC_ERR_NONE;
+}
@@ -0,0 +1,285 @@
+/*
+ * usb port layer simulating usbtmc instruments, used when WINUSBTMC_SIMPORT is defined.
+ * No usb hardware or library is needed, the simulated devices parse the usbtmc bulk-out headers and
+ * answer with usbtmc bulk-in headers, so everything above the port layer runs like with a real device.
+ * Intended for benchmarks and testing of the host side.
+ *
+ * Environment variables:
+ *   WINUSBTMC_SIM_DEVICES   count of simulated devices (default 1)
+ *   WINUSBTMC_SIM_LATENCY   delay of every bulk transfer in microseconds (default 0)
+ *
+ * Commands understood by the simulated devices:
+ *   *IDN?          => "WinUsbTmc,Simulator,SIM<n>,1.0"
+ *   DATA? <n>      => IEEE 488.2 definite length block with n bytes of data
+ *   other queries  => "+1.00000E+00"
+ *   everything else is accepted without response
+ */
+#ifdef WINUSBTMC_SIMPORT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <unistd.h>
+#endif
+#include "winusbtmc_private.h"
+
+#define WINUSBTMC_SIMPORT_CMD_MAX  (4096)     /* max. length of a command message */
+
+typedef struct
+{
+    int32_t  index;                      /* number of the simulated device */
+    char     cmd[WINUSBTMC_SIMPORT_CMD_MAX];
+    uint32_t cmdlen;                     /* received part of the current command message */
+    char    *resp;                       /* pending response message */
+    uint32_t resplen;
+    uint32_t respsize;                   /* allocated size of resp */
+    uint32_t resppos;                    /* already sent part of resp */
+    uint32_t requested;                  /* TransferSize of the last REQUEST_DEV_DEP_MSG_IN */
+    uint8_t  bTag;                       /* bTag of the last REQUEST_DEV_DEP_MSG_IN */
+} winusbtmc_simport_t;
+
+static int32_t  s_winusbtmc_simport_devices = 1;
+static uint32_t s_winusbtmc_simport_latency = 0;
+
+
+static void s_winusbtmc_simport_delay(void)
+{
+    if (s_winusbtmc_simport_latency == 0)
+        return;
+#ifdef _WIN32
+    Sleep((s_winusbtmc_simport_latency + 999) / 1000);
+#else
+    usleep(s_winusbtmc_simport_latency);
+#endif
+}
+
+void winusbtmc_usbport_init(void)
+{
+    if (getenv("WINUSBTMC_SIM_DEVICES"))
+    {
+        s_winusbtmc_simport_devices = atoi(getenv("WINUSBTMC_SIM_DEVICES"));
+        if (s_winusbtmc_simport_devices < 0)
+            s_winusbtmc_simport_devices = 0;
+    }
+    if (getenv("WINUSBTMC_SIM_LATENCY"))
+    {
+        s_winusbtmc_simport_latency = atoi(getenv("WINUSBTMC_SIM_LATENCY"));
+    }
+}
+
+void winusbtmc_usbport_deinit(void)
+{
+}
+
+bool winusbtmc_usbport_changed(void)
+{
+    return false;
+}
+
+int32_t winusbtmc_usbport_deviceindex(int32_t devicenum, winusbtmc_device_t *pdeviceinfo)
+{
+    if ( (devicenum >= 0) && (devicenum < s_winusbtmc_simport_devices) && (pdeviceinfo) )
+    {
+        winusbtmc_device_clear(pdeviceinfo);
+        pdeviceinfo->dev              = (void *)(intptr_t)(devicenum + 1);
+        pdeviceinfo->usb_config       = 1;
+        pdeviceinfo->usb_interface    = 0;
+        pdeviceinfo->usb_ep_bulkin    = 0x82;
+        pdeviceinfo->usb_ep_bulkin_size = 512;
+        pdeviceinfo->usb_ep_bulkout   = 0x01;
+        pdeviceinfo->usb_ep_interrupt = 0x83;
+        snprintf(pdeviceinfo->id->location, WINUSBTMC_LOCATION_MAX, "sim-%d", devicenum);
+    }
+    return s_winusbtmc_simport_devices;
+}
+
+int32_t winusbtmc_usbport_get_strings(winusbtmc_device_t *pdev, char *manufacturer, char *product, char *serial, int strln)
+{
+    s_winusbtmc_simport_delay();
+    snprintf(manufacturer, strln, "WinUsbTmc");
+    snprintf(product, strln, "Simulator");
+    snprintf(serial, strln, "SIM%04d", (int)(intptr_t)pdev->dev - 1);
+    return 0;
+}
+
+int32_t winusbtmc_usbport_open(winusbtmc_device_t *pdev)
+{
+    winusbtmc_simport_t *psim;
+
+    psim = calloc(1, sizeof(winusbtmc_simport_t));
+    if (!psim)
+        return -1;
+    psim->index = (int32_t)(intptr_t)pdev->dev - 1;
+    pdev->usb_handle = psim;
+    return 0;
+}
+
+void winusbtmc_usbport_close(winusbtmc_device_t *pdev)
+{
+    winusbtmc_simport_t *psim = pdev->usb_handle;
+
+    if (psim)
+    {
+        free(psim->resp);
+        free(psim);
+    }
+    pdev->usb_handle = (void *)0;
+}
+
+int32_t winusbtmc_usbport_claim(winusbtmc_device_t *pdev)
+{
+    return 0;
+}
+
+int32_t winusbtmc_usbport_control_in(winusbtmc_device_t *pdev, uint8_t request, uint16_t value, char *dat, uint16_t len)
+{
+    winusbtmc_simport_t *psim = pdev->usb_handle;
+
+    if ( (request == WINUSBTMC_REQ_INITIATE_CLEAR) && (psim) )
+    { /* discard the command and response in progress */
+        psim->cmdlen    = 0;
+        psim->resplen   = 0;
+        psim->resppos   = 0;
+        psim->requested = 0;
+    }
+    memset(dat, 0, len);
+    if (len > 0)
+        dat[0] = 0x01; /* USBTMC_STATUS_SUCCESS */
+    return len;
+}
+
+int32_t winusbtmc_usbport_clear_halt(winusbtmc_device_t *pdev, uint8_t endpoint)
+{
+    return 0;
+}
+
+/*
+ * make room for a response of len bytes, returns false if out of memory
+ */
+static bool s_winusbtmc_simport_alloc(winusbtmc_simport_t *psim, uint32_t len)
+{
+    char *p;
+
+    if (len > psim->respsize)
+    {
+        p = realloc(psim->resp, len);
+        if (!p)
+            return false;
+        psim->resp     = p;
+        psim->respsize = len;
+    }
+    psim->resplen = 0;
+    psim->resppos = 0;
+    return true;
+}
+
+/*
+ * a complete command message was received
+ */
+static void s_winusbtmc_simport_execute(winusbtmc_simport_t *psim)
+{
+    char    *cmd = psim->cmd;
+    uint32_t n, i;
+    int      digits;
+
+    cmd[psim->cmdlen] = '\0';
+    cmd[strcspn(cmd, "\r\n")] = '\0';
+    psim->cmdlen = 0;
+
+    if (!strchr(cmd, '?'))
+        return; /* command without response */
+
+    if (strcasecmp(cmd, "*IDN?") == 0)
+    {
+        if (s_winusbtmc_simport_alloc(psim, 64))
+            psim->resplen = snprintf(psim->resp, 64, "WinUsbTmc,Simulator,SIM%04d,1.0\n", psim->index);
+    }
+    else if (strncasecmp(cmd, "DATA?", 5) == 0)
+    {
+        n = strtoul(&cmd[5], (void *)0, 10);
+        if (s_winusbtmc_simport_alloc(psim, n + 16))
+        {
+            digits = snprintf(psim->resp, 16, "%u", n);
+            psim->resplen = snprintf(psim->resp, 16, "#%d%u", digits, n);
+            for (i = 0; i < n; i++)
+                psim->resp[psim->resplen++] = (char)i;
+            psim->resp[psim->resplen++] = '\n';
+        }
+    }
+    else
+    {
+        if (s_winusbtmc_simport_alloc(psim, 16))
+            psim->resplen = snprintf(psim->resp, 16, "+1.00000E+00\n");
+    }
+}
+
+int32_t winusbtmc_usbport_bulk_write(winusbtmc_device_t *pdev, const char *dat, uint32_t len)
+{
+    winusbtmc_simport_t        *psim = pdev->usb_handle;
+    winusbtmc_bulkout_header_t *phdr = (winusbtmc_bulkout_header_t *)dat;
+    uint32_t                    n;
+
+    s_winusbtmc_simport_delay();
+    if ( (!psim) || (len < sizeof(winusbtmc_bulkout_header_t)) || (phdr->bTag != (uint8_t)~phdr->bTagInverse) )
+        return -1;
+
+    switch (phdr->MsgID)
+    {
+        case WINUSBTMC_DEV_DEP_MSG_OUT:
+            n = phdr->TransferSize;
+            if (n > len - sizeof(winusbtmc_bulkout_header_t))
+                return -1;
+            if (n > WINUSBTMC_SIMPORT_CMD_MAX - 1 - psim->cmdlen)
+                n = WINUSBTMC_SIMPORT_CMD_MAX - 1 - psim->cmdlen; /* too long, truncated like a real device would */
+            memcpy(&psim->cmd[psim->cmdlen], &dat[sizeof(winusbtmc_bulkout_header_t)], n);
+            psim->cmdlen += n;
+            if (phdr->bmTransferAttributes & 0x01)
+                s_winusbtmc_simport_execute(psim);
+            break;
+        case WINUSBTMC_DEV_DEP_MSG_IN: /* REQUEST_DEV_DEP_MSG_IN */
+            psim->requested = phdr->TransferSize;
+            psim->bTag      = phdr->bTag;
+            break;
+        default:
+            return -1;
+    }
+    return len;
+}
+
+int32_t winusbtmc_usbport_bulk_read(winusbtmc_device_t *pdev, char *dat, uint32_t len)
+{
+    winusbtmc_simport_t        *psim = pdev->usb_handle;
+    winusbtmc_bulkout_header_t *phdr = (winusbtmc_bulkout_header_t *)dat;
+    uint32_t                    n;
+
+    s_winusbtmc_simport_delay();
+    if ( (!psim) || (len < sizeof(winusbtmc_bulkout_header_t)) || (psim->requested == 0) || (psim->resplen == 0) )
+        return -1; /* nothing to send, a real device would time out */
+
+    n = psim->resplen - psim->resppos;
+    if (n > psim->requested)
+        n = psim->requested;
+    if (n > len - sizeof(winusbtmc_bulkout_header_t))
+        n = len - sizeof(winusbtmc_bulkout_header_t);
+
+    memset(phdr, 0, sizeof(winusbtmc_bulkout_header_t));
+    phdr->MsgID        = WINUSBTMC_DEV_DEP_MSG_IN;
+    phdr->bTag         = psim->bTag;
+    phdr->bTagInverse  = ~psim->bTag;
+    phdr->TransferSize = n;
+    memcpy(&dat[sizeof(winusbtmc_bulkout_header_t)], &psim->resp[psim->resppos], n);
+    psim->resppos += n;
+    psim->requested = 0;
+    if (psim->resppos >= psim->resplen)
+    {
+        phdr->bmTransferAttributes = 0x01; /* EOM */
+        psim->resplen = 0;
+        psim->resppos = 0;
+    }
+    return sizeof(winusbtmc_bulkout_header_t) + n;
+}
+
+#endif // WINUSBTMC_SIMPORT
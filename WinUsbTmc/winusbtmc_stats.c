@@ -0,0 +1,318 @@
+/*
+ * Statistics of a waveform record: count, mean, rms, min, max, peak to peak and an optional histogram of the
+ * ADC codes. Like the decimation the record is processed in the chunks as they are received, so it never has
+ * to be kept in memory.
+ *
+ * The envelope kernels of winusbtmc_waveform.c (SSE2/AVX2) sum the codes and their squares as integers, so
+ * the sums are exact for records of up to 2^32 samples and do not depend on the chunking. Scale and offset are
+ * applied once to the final moments instead of to every sample.
+ *
+ * winusbtmc_recv_stats overlaps the processing with the usb transfers: a chunk is processed by a worker
+ * thread (one per call, it gets the chunks one after the other) while the calling thread already receives the
+ * next one into a second buffer. Only the last chunk
+ * is processed after the end of message, so the results are ready one chunk after the last transfer.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <pthread.h>
+#endif
+#include "winusbtmc.h"
+#include "winusbtmc_private.h"
+
+#define WINUSBTMC_STATS_CHUNK (1024 * 1024)    /* bytes per buffer of winusbtmc_recv_stats */
+
+/* worker thread of winusbtmc_recv_stats, it is started once per call and gets one chunk after the other */
+typedef struct
+{
+    winusbtmc_stats_t *pstats;
+    const char        *dat;
+    uint32_t           len;
+    int32_t            ret;
+    bool               started;            /* false: no thread, the chunks are processed inline */
+    bool               busy;               /* a chunk was handed over and is not processed yet */
+    bool               stop;
+#ifdef _WIN32
+    HANDLE             thread;
+    HANDLE             ready;              /* chunk or stop for the worker */
+    HANDLE             done;               /* chunk processed */
+#else
+    pthread_t          thread;
+    pthread_mutex_t    mutex;
+    pthread_cond_t     cond;
+#endif
+} winusbtmc_stats_job_t;
+
+
+/* complete samples of the record, called by winusbtmc_record_add */
+static void s_winusbtmc_stats_samples(void *ctx, const uint8_t *src, uint32_t count)
+{
+    winusbtmc_stats_t   *ps = ctx;
+    winusbtmc_envelope_t env;
+
+    env.min   = ps->code_min;
+    env.max   = ps->code_max;
+    env.sum   = ps->sum;
+    env.sumsq = ps->sumsq;
+    winusbtmc_envelope(src, count, ps->format, true, &env);
+    ps->code_min = env.min;
+    ps->code_max = env.max;
+    ps->sum      = env.sum;
+    ps->sumsq    = env.sumsq;
+
+    if (ps->histogram)
+        winusbtmc_histogram(src, count, ps->format, ps->shift, ps->histogram);
+}
+
+DLL_EXPORT int32_t winusbtmc_stats_init(winusbtmc_stats_t *ps, int32_t format, double scale, double offset,
+                                        uint32_t *histogram, uint32_t bins)
+{
+    int32_t bits, shift;
+
+    if ( (!ps) || (winusbtmc_sample_size(format) == 0) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    bits  = winusbtmc_sample_size(format) * 8;
+    shift = bits;
+    if (histogram)
+    {
+        for (shift = bits; (shift > 0) && ((1U << (bits - shift)) < bins); shift--)
+            ;
+        if ( (bins == 0) || ((1U << (bits - shift)) != bins) )
+            return WINUSBTMC_ERR_INVALID_PARAMETER;
+        memset(histogram, 0, bins * sizeof(uint32_t));
+    }
+
+    memset(ps, 0, sizeof(winusbtmc_stats_t));
+    ps->record.unbounded = true;
+    ps->format           = format;
+    ps->scale            = scale;
+    ps->offset           = offset;
+    ps->histogram        = histogram;
+    ps->bins             = (histogram) ? bins : 0;
+    ps->shift            = shift;
+    ps->code_min         = INT32_MAX;
+    ps->code_max         = INT32_MIN;
+    return WINUSBTMC_ERR_NONE;
+}
+
+DLL_EXPORT int32_t winusbtmc_stats_add(winusbtmc_stats_t *ps, const void *dat, uint32_t len)
+{
+    if ( (!ps) || ((!dat) && (len > 0)) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    return winusbtmc_record_add(&ps->record, ps->format, dat, len, s_winusbtmc_stats_samples, ps);
+}
+
+DLL_EXPORT int32_t winusbtmc_stats_finish(winusbtmc_stats_t *ps)
+{
+    double n, mean, meansq, lo, hi;
+
+    if (!ps)
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    ps->count = ps->record.pos;
+    if (ps->count == 0)
+    {
+        ps->mean = ps->rms = ps->min = ps->max = ps->peak_to_peak = 0;
+        return WINUSBTMC_ERR_NONE;
+    }
+
+    /* moments of the codes, converted to volts: E[v] = s*E[c] + o, E[v^2] = s^2*E[c^2] + 2*s*o*E[c] + o^2 */
+    n      = (double)ps->count;
+    mean   = (double)ps->sum / n;
+    meansq = (double)ps->sumsq / n;
+    ps->mean = ps->scale * mean + ps->offset;
+    meansq   = ps->scale * ps->scale * meansq + 2.0 * ps->scale * ps->offset * mean + ps->offset * ps->offset;
+    ps->rms  = (meansq > 0) ? sqrt(meansq) : 0;
+
+    lo = ps->code_min * ps->scale + ps->offset;
+    hi = ps->code_max * ps->scale + ps->offset;
+    ps->min          = (ps->scale < 0) ? hi : lo;
+    ps->max          = (ps->scale < 0) ? lo : hi;
+    ps->peak_to_peak = ps->max - ps->min;
+    return WINUSBTMC_ERR_NONE;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI s_winusbtmc_stats_worker(LPVOID arg)
+{
+    winusbtmc_stats_job_t *pjob = arg;
+
+    for (;;)
+    {
+        WaitForSingleObject(pjob->ready, INFINITE);
+        if (pjob->stop)
+            return 0;
+        pjob->ret = winusbtmc_stats_add(pjob->pstats, pjob->dat, pjob->len);
+        SetEvent(pjob->done);
+    }
+}
+#else
+static void *s_winusbtmc_stats_worker(void *arg)
+{
+    winusbtmc_stats_job_t *pjob = arg;
+
+    pthread_mutex_lock(&pjob->mutex);
+    for (;;)
+    {
+        while ( (!pjob->busy) && (!pjob->stop) )
+            pthread_cond_wait(&pjob->cond, &pjob->mutex);
+        if (!pjob->busy)
+            break;
+        pthread_mutex_unlock(&pjob->mutex);
+        pjob->ret = winusbtmc_stats_add(pjob->pstats, pjob->dat, pjob->len);
+        pthread_mutex_lock(&pjob->mutex);
+        pjob->busy = false;
+        pthread_cond_signal(&pjob->cond);
+    }
+    pthread_mutex_unlock(&pjob->mutex);
+    return NULL;
+}
+#endif
+
+/* start the worker, the chunks are processed inline if that is not possible */
+static void s_winusbtmc_stats_start(winusbtmc_stats_job_t *pjob)
+{
+    pjob->ret     = WINUSBTMC_ERR_NONE;
+    pjob->busy    = false;
+    pjob->stop    = false;
+#ifdef _WIN32
+    pjob->started = false;
+    pjob->ready   = CreateEvent(NULL, FALSE, FALSE, NULL);
+    pjob->done    = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if ( (pjob->ready) && (pjob->done) )
+    {
+        pjob->thread  = CreateThread(NULL, 0, s_winusbtmc_stats_worker, pjob, 0, NULL);
+        pjob->started = (pjob->thread != NULL);
+    }
+#else
+    pthread_mutex_init(&pjob->mutex, NULL);
+    pthread_cond_init(&pjob->cond, NULL);
+    pjob->started = (pthread_create(&pjob->thread, NULL, s_winusbtmc_stats_worker, pjob) == 0);
+#endif
+}
+
+/* wait until the chunk handed over last is processed, pjob->ret is valid afterwards */
+static void s_winusbtmc_stats_wait(winusbtmc_stats_job_t *pjob)
+{
+    if (!pjob->started)
+        return;
+#ifdef _WIN32
+    if (pjob->busy)
+        WaitForSingleObject(pjob->done, INFINITE);
+    pjob->busy = false;
+#else
+    pthread_mutex_lock(&pjob->mutex);
+    while (pjob->busy)
+        pthread_cond_wait(&pjob->cond, &pjob->mutex);
+    pthread_mutex_unlock(&pjob->mutex);
+#endif
+}
+
+/* hand a chunk to the worker, the previous one must be processed (s_winusbtmc_stats_wait) */
+static void s_winusbtmc_stats_post(winusbtmc_stats_job_t *pjob, const char *dat, uint32_t len)
+{
+    pjob->dat = dat;
+    pjob->len = len;
+    if (!pjob->started)
+    {
+        pjob->ret = winusbtmc_stats_add(pjob->pstats, dat, len);
+        return;
+    }
+#ifdef _WIN32
+    pjob->busy = true;
+    SetEvent(pjob->ready);
+#else
+    pthread_mutex_lock(&pjob->mutex);
+    pjob->busy = true;
+    pthread_cond_signal(&pjob->cond);
+    pthread_mutex_unlock(&pjob->mutex);
+#endif
+}
+
+/* wait for the last chunk and end the worker */
+static void s_winusbtmc_stats_stop(winusbtmc_stats_job_t *pjob)
+{
+    s_winusbtmc_stats_wait(pjob);
+#ifdef _WIN32
+    if (pjob->started)
+    {
+        pjob->stop = true;
+        SetEvent(pjob->ready);
+        WaitForSingleObject(pjob->thread, INFINITE);
+        CloseHandle(pjob->thread);
+    }
+    if (pjob->ready)
+        CloseHandle(pjob->ready);
+    if (pjob->done)
+        CloseHandle(pjob->done);
+#else
+    if (pjob->started)
+    {
+        pthread_mutex_lock(&pjob->mutex);
+        pjob->stop = true;
+        pthread_cond_signal(&pjob->cond);
+        pthread_mutex_unlock(&pjob->mutex);
+        pthread_join(pjob->thread, NULL);
+    }
+    pthread_cond_destroy(&pjob->cond);
+    pthread_mutex_destroy(&pjob->mutex);
+#endif
+}
+
+DLL_EXPORT int32_t winusbtmc_recv_stats(int32_t devnum, winusbtmc_stats_t *ps)
+{
+    winusbtmc_stats_job_t job;
+    char                 *buf[2];
+    int32_t               ret, total, cur;
+    bool                  eom = false;
+
+    if (!ps)
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    buf[0] = malloc(WINUSBTMC_STATS_CHUNK);
+    buf[1] = malloc(WINUSBTMC_STATS_CHUNK);
+    if ( (!buf[0]) || (!buf[1]) )
+    {
+        free(buf[0]);
+        free(buf[1]);
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+
+    job.pstats = ps;
+    s_winusbtmc_stats_start(&job);
+    cur   = 0;
+    total = 0;
+    ret   = winusbtmc_recv_data(devnum, buf[cur], WINUSBTMC_STATS_CHUNK, &eom);
+    while ( (ret >= 0) && (!eom) )
+    {
+        /* the chunk is processed while the next one is received into the other buffer */
+        s_winusbtmc_stats_wait(&job);
+        if (job.ret < 0)
+            break;
+        total += ret;
+        s_winusbtmc_stats_post(&job, buf[cur], ret);
+
+        cur ^= 1;
+        ret  = winusbtmc_recv_data(devnum, buf[cur], WINUSBTMC_STATS_CHUNK, &eom);
+    }
+    s_winusbtmc_stats_stop(&job);
+
+    if ( (ret >= 0) && (job.ret >= 0) )
+    { /* the last chunk */
+        total  += ret;
+        job.ret = winusbtmc_stats_add(ps, buf[cur], ret);
+        if (job.ret >= 0)
+            job.ret = winusbtmc_stats_finish(ps);
+    }
+
+    free(buf[0]);
+    free(buf[1]);
+    if (ret < 0)
+        return ret;
+    return (job.ret < 0) ? job.ret : total;
+}
@@ -0,0 +1,529 @@
+/*
+ * Capture store.
+ * An append only log of responses for random access by analysis tools. The responses are appended unchanged to
+ * the data file, the index file has a record of fixed size per capture, so capture n is at a known position
+ * of the index and its response is found with a single lookup. Readers map both files into memory and return
+ * pointers into the mapping, a capture is never copied or parsed.
+ *
+ * File layout, all numbers little endian:
+ *   data file:    "WTMCDAT1", responses
+ *   index file:   "WTMCIDX2", u32 record size, u32 0
+ *                 per capture u64 offset in the data file, u32 length, u32 tag, f64 timestamp
+ *
+ * The writer appends the response before its index record, so a reader never sees a record of a response
+ * which is not in the data file yet. A record which is only partly written (the size of the index file is no
+ * multiple of the record size) is ignored by readers and removed when the store is opened for writing again.
+ * Responses of captures which were not completed remain in the data file without a record.
+ */
+#define _FILE_OFFSET_BITS 64
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+#include "winusbtmc.h"
+#include "winusbtmc_private.h"
+
+#define WINUSBTMC_STORE_DATA_MAGIC   "WTMCDAT1"
+#define WINUSBTMC_STORE_INDEX_MAGIC  "WTMCIDX2"
+#define WINUSBTMC_STORE_HEADER       (16)          /* bytes before the first index record */
+#define WINUSBTMC_STORE_RECORD       (24)          /* bytes of an index record */
+#define WINUSBTMC_STORE_CHUNK        (1024 * 1024) /* bytes per read of winusbtmc_recv_store */
+
+#ifdef _WIN32
+    typedef HANDLE winusbtmc_store_file_t;
+    #define WINUSBTMC_STORE_NO_FILE  INVALID_HANDLE_VALUE
+#else
+    typedef int winusbtmc_store_file_t;
+    #define WINUSBTMC_STORE_NO_FILE  (-1)
+#endif
+
+/* index record, the byte order of the host (all supported hosts are little endian) */
+typedef struct
+{
+    uint64_t offset;
+    uint32_t len;
+    uint32_t tag;
+    double   timestamp;
+} winusbtmc_store_record_t;
+
+/* read only mapping of a file */
+typedef struct
+{
+    const uint8_t *p;
+    uint64_t       size;
+#ifdef _WIN32
+    HANDLE         map;
+#endif
+} winusbtmc_store_map_t;
+
+struct winusbtmc_store_s
+{
+    bool                   write;
+    winusbtmc_store_file_t dat_file;
+    winusbtmc_store_file_t idx_file;
+    uint64_t               dat_size;     /* writer: end of the data file */
+    winusbtmc_store_map_t  dat;          /* reader: mapped files */
+    winusbtmc_store_map_t  idx;
+    uint32_t               count;        /* captures */
+    char                  *buf;          /* chunks of winusbtmc_recv_store */
+    int32_t                error;        /* first write error, the store is not written anymore */
+};
+
+
+/**************************************************************************************************
+ * files
+ **************************************************************************************************/
+
+static winusbtmc_store_file_t s_winusbtmc_store_open_file(const char *filename, bool write)
+{
+#ifdef _WIN32
+    /* readers share the files with the writer */
+    return CreateFileA(filename, write ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, write ? OPEN_ALWAYS : OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL, NULL);
+#else
+    return open(filename, write ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+#endif
+}
+
+static void s_winusbtmc_store_close_file(winusbtmc_store_file_t file)
+{
+    if (file == WINUSBTMC_STORE_NO_FILE)
+        return;
+#ifdef _WIN32
+    CloseHandle(file);
+#else
+    close(file);
+#endif
+}
+
+static bool s_winusbtmc_store_size(winusbtmc_store_file_t file, uint64_t *psize)
+{
+#ifdef _WIN32
+    LARGE_INTEGER size;
+
+    if (!GetFileSizeEx(file, &size))
+        return false;
+    *psize = (uint64_t)size.QuadPart;
+#else
+    struct stat st;
+
+    if (fstat(file, &st) != 0)
+        return false;
+    *psize = (uint64_t)st.st_size;
+#endif
+    return true;
+}
+
+/* cuts the file at pos and moves the file position to its end */
+static bool s_winusbtmc_store_truncate(winusbtmc_store_file_t file, uint64_t pos)
+{
+#ifdef _WIN32
+    LARGE_INTEGER li;
+
+    li.QuadPart = (LONGLONG)pos;
+    return (SetFilePointerEx(file, li, NULL, FILE_BEGIN)) && (SetEndOfFile(file));
+#else
+    return (ftruncate(file, (off_t)pos) == 0) && (lseek(file, (off_t)pos, SEEK_SET) == (off_t)pos);
+#endif
+}
+
+static bool s_winusbtmc_store_seek_end(winusbtmc_store_file_t file)
+{
+#ifdef _WIN32
+    LARGE_INTEGER li;
+
+    li.QuadPart = 0;
+    return SetFilePointerEx(file, li, NULL, FILE_END);
+#else
+    return lseek(file, 0, SEEK_END) >= 0;
+#endif
+}
+
+static bool s_winusbtmc_store_write_file(winusbtmc_store_file_t file, const void *dat, uint32_t len)
+{
+    const char *p = dat;
+#ifdef _WIN32
+    DWORD       n;
+
+    while (len > 0)
+    {
+        if ( (!WriteFile(file, p, len, &n, NULL)) || (n == 0) )
+            return false;
+        p   += n;
+        len -= n;
+    }
+#else
+    ssize_t     n;
+
+    while (len > 0)
+    {
+        n = write(file, p, len);
+        if (n <= 0)
+            return false;
+        p   += n;
+        len -= (uint32_t)n;
+    }
+#endif
+    return true;
+}
+
+static bool s_winusbtmc_store_read_file(winusbtmc_store_file_t file, void *dat, uint32_t len)
+{
+#ifdef _WIN32
+    DWORD n;
+
+    return (ReadFile(file, dat, len, &n, NULL)) && (n == len);
+#else
+    return read(file, dat, len) == (ssize_t)len;
+#endif
+}
+
+/* maps the first size bytes of the file, replaces an existing mapping */
+static bool s_winusbtmc_store_map(winusbtmc_store_file_t file, winusbtmc_store_map_t *pmap, uint64_t size)
+{
+    void *p;
+
+    if (size == pmap->size)
+        return true;
+    if (size > (uint64_t)(size_t)-1)
+        return false; /* larger than the address space of a 32 bit process */
+
+#ifdef _WIN32
+    if (pmap->p)
+    {
+        UnmapViewOfFile((void *)pmap->p);
+        CloseHandle(pmap->map);
+    }
+    pmap->p    = (void *)0;
+    pmap->size = 0;
+    pmap->map  = CreateFileMappingA(file, NULL, PAGE_READONLY, (DWORD)(size >> 32), (DWORD)size, NULL);
+    if (!pmap->map)
+        return false;
+    p = MapViewOfFile(pmap->map, FILE_MAP_READ, 0, 0, (SIZE_T)size);
+    if (!p)
+    {
+        CloseHandle(pmap->map);
+        return false;
+    }
+#else
+    if (pmap->p)
+        munmap((void *)pmap->p, (size_t)pmap->size);
+    pmap->p    = (void *)0;
+    pmap->size = 0;
+    p = mmap((void *)0, (size_t)size, PROT_READ, MAP_SHARED, file, 0);
+    if (p == MAP_FAILED)
+        return false;
+#endif
+    pmap->p    = p;
+    pmap->size = size;
+    return true;
+}
+
+static void s_winusbtmc_store_unmap(winusbtmc_store_map_t *pmap)
+{
+    if (!pmap->p)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile((void *)pmap->p);
+    CloseHandle(pmap->map);
+#else
+    munmap((void *)pmap->p, (size_t)pmap->size);
+#endif
+    pmap->p    = (void *)0;
+    pmap->size = 0;
+}
+
+/* allocates a store and opens both files */
+static int32_t s_winusbtmc_store_alloc(winusbtmc_store_t **ppstore, const char *filename, bool write)
+{
+    winusbtmc_store_t *pstore;
+    char              *idxname;
+
+    if ( (!ppstore) || (!filename) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    *ppstore = (void *)0;
+
+    pstore  = calloc(1, sizeof(winusbtmc_store_t));
+    idxname = malloc(strlen(filename) + 5);
+    if ( (!pstore) || (!idxname) )
+    {
+        free(pstore);
+        free(idxname);
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+    sprintf(idxname, "%s.idx", filename);
+
+    pstore->write    = write;
+    pstore->dat_file = s_winusbtmc_store_open_file(filename, write);
+    pstore->idx_file = s_winusbtmc_store_open_file(idxname, write);
+    free(idxname);
+    if ( (pstore->dat_file == WINUSBTMC_STORE_NO_FILE) || (pstore->idx_file == WINUSBTMC_STORE_NO_FILE) )
+    {
+        s_winusbtmc_store_close_file(pstore->dat_file);
+        s_winusbtmc_store_close_file(pstore->idx_file);
+        free(pstore);
+        return WINUSBTMC_ERR_FILE;
+    }
+    *ppstore = pstore;
+    return WINUSBTMC_ERR_NONE;
+}
+
+
+/**************************************************************************************************
+ * writer
+ **************************************************************************************************/
+
+/* checks the headers of an existing store, writes them for a new one */
+static int32_t s_winusbtmc_store_prepare(winusbtmc_store_t *pstore)
+{
+    uint8_t  hdr[WINUSBTMC_STORE_HEADER];
+    uint64_t dat_size, idx_size;
+
+    if ( (!s_winusbtmc_store_size(pstore->dat_file, &dat_size)) ||
+         (!s_winusbtmc_store_size(pstore->idx_file, &idx_size)) )
+        return WINUSBTMC_ERR_FILE;
+
+    if ( (dat_size == 0) && (idx_size == 0) )
+    {
+        memset(hdr, 0, sizeof(hdr));
+        memcpy(hdr, WINUSBTMC_STORE_INDEX_MAGIC, 8);
+        hdr[8] = WINUSBTMC_STORE_RECORD;
+        if ( (!s_winusbtmc_store_write_file(pstore->dat_file, WINUSBTMC_STORE_DATA_MAGIC, 8)) ||
+             (!s_winusbtmc_store_write_file(pstore->idx_file, hdr, sizeof(hdr))) )
+            return WINUSBTMC_ERR_FILE;
+        pstore->dat_size = 8;
+        return WINUSBTMC_ERR_NONE;
+    }
+
+    if ( (dat_size < 8) || (idx_size < WINUSBTMC_STORE_HEADER) ||
+         (!s_winusbtmc_store_read_file(pstore->dat_file, hdr, 8)) ||
+         (memcmp(hdr, WINUSBTMC_STORE_DATA_MAGIC, 8) != 0) ||
+         (!s_winusbtmc_store_read_file(pstore->idx_file, hdr, sizeof(hdr))) ||
+         (memcmp(hdr, WINUSBTMC_STORE_INDEX_MAGIC, 8) != 0) || (hdr[8] != WINUSBTMC_STORE_RECORD) )
+        return WINUSBTMC_ERR_FILE; /* no capture store */
+
+    /* a record which was only partly written is removed, its response stays unused in the data file */
+    pstore->count = (uint32_t)((idx_size - WINUSBTMC_STORE_HEADER) / WINUSBTMC_STORE_RECORD);
+    if (idx_size != WINUSBTMC_STORE_HEADER + (uint64_t)pstore->count * WINUSBTMC_STORE_RECORD)
+    {
+        if (!s_winusbtmc_store_truncate(pstore->idx_file, WINUSBTMC_STORE_HEADER +
+                                        (uint64_t)pstore->count * WINUSBTMC_STORE_RECORD))
+            return WINUSBTMC_ERR_FILE;
+    }
+    else if (!s_winusbtmc_store_seek_end(pstore->idx_file))
+        return WINUSBTMC_ERR_FILE;
+    if (!s_winusbtmc_store_seek_end(pstore->dat_file))
+        return WINUSBTMC_ERR_FILE;
+    pstore->dat_size = dat_size;
+    return WINUSBTMC_ERR_NONE;
+}
+
+/* appends a part of a response to the data file */
+static void s_winusbtmc_store_append(winusbtmc_store_t *pstore, const void *dat, uint32_t len)
+{
+    if (pstore->error < 0)
+        return;
+    if (!s_winusbtmc_store_write_file(pstore->dat_file, dat, len))
+        pstore->error = WINUSBTMC_ERR_FILE;
+    pstore->dat_size += len;
+}
+
+/* completes a capture with its index record, after the response is in the data file */
+static void s_winusbtmc_store_commit(winusbtmc_store_t *pstore, uint64_t offset, uint32_t len, uint32_t tag,
+                                     double timestamp)
+{
+    winusbtmc_store_record_t rec;
+
+    if (pstore->error < 0)
+        return;
+    rec.offset    = offset;
+    rec.len       = len;
+    rec.tag       = tag;
+    rec.timestamp = (timestamp != 0) ? timestamp : winusbtmc_time_now();
+    if (!s_winusbtmc_store_write_file(pstore->idx_file, &rec, sizeof(rec)))
+        pstore->error = WINUSBTMC_ERR_FILE;
+    else
+        pstore->count++;
+}
+
+DLL_EXPORT int32_t winusbtmc_store_create(winusbtmc_store_t **ppstore, const char *filename)
+{
+    int32_t ret;
+
+    ret = s_winusbtmc_store_alloc(ppstore, filename, true);
+    if (ret < 0)
+        return ret;
+
+    ret = s_winusbtmc_store_prepare(*ppstore);
+    if (ret < 0)
+    {
+        winusbtmc_store_close(*ppstore);
+        *ppstore = (void *)0;
+    }
+    return ret;
+}
+
+DLL_EXPORT int32_t winusbtmc_store_add(winusbtmc_store_t *pstore, uint32_t tag, double timestamp,
+                                       const void *dat, uint32_t len)
+{
+    uint64_t offset;
+
+    if ( (!pstore) || (!pstore->write) || ((!dat) && (len > 0)) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    offset = pstore->dat_size;
+    s_winusbtmc_store_append(pstore, dat, len);
+    s_winusbtmc_store_commit(pstore, offset, len, tag, timestamp);
+    return pstore->error;
+}
+
+DLL_EXPORT int32_t winusbtmc_recv_store(int32_t devnum, winusbtmc_store_t *pstore, uint32_t tag)
+{
+    uint64_t offset;
+    uint32_t total;
+    double   timestamp;
+    int32_t  ret;
+    bool     eom;
+
+    if ( (!pstore) || (!pstore->write) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    if (pstore->error < 0)
+        return pstore->error;
+    if (!pstore->buf)
+    {
+        pstore->buf = malloc(WINUSBTMC_STORE_CHUNK);
+        if (!pstore->buf)
+            return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+
+    /* the chunks go to the data file as they arrive, the record follows the end of message.
+       After a write error the rest of the response is still received. */
+    timestamp = winusbtmc_time_now();
+    offset    = pstore->dat_size;
+    total     = 0;
+    do
+    {
+        ret = winusbtmc_recv_data(devnum, pstore->buf, WINUSBTMC_STORE_CHUNK, &eom);
+        if (ret < 0)
+            return ret;
+        s_winusbtmc_store_append(pstore, pstore->buf, ret);
+        total += ret;
+    } while (!eom);
+
+    s_winusbtmc_store_commit(pstore, offset, total, tag, timestamp);
+    return (pstore->error < 0) ? pstore->error : (int32_t)total;
+}
+
+
+/**************************************************************************************************
+ * reader
+ **************************************************************************************************/
+
+DLL_EXPORT int32_t winusbtmc_store_open(winusbtmc_store_t **ppstore, const char *filename)
+{
+    int32_t ret;
+
+    ret = s_winusbtmc_store_alloc(ppstore, filename, false);
+    if (ret < 0)
+        return ret;
+
+    ret = winusbtmc_store_refresh(*ppstore);
+    if ( (ret >= 0) && ( (memcmp((*ppstore)->dat.p, WINUSBTMC_STORE_DATA_MAGIC, 8) != 0) ||
+                         (memcmp((*ppstore)->idx.p, WINUSBTMC_STORE_INDEX_MAGIC, 8) != 0) ||
+                         ((*ppstore)->idx.p[8] != WINUSBTMC_STORE_RECORD) ) )
+        ret = WINUSBTMC_ERR_FILE;
+    if (ret < 0)
+    {
+        winusbtmc_store_close(*ppstore);
+        *ppstore = (void *)0;
+        return ret;
+    }
+    return WINUSBTMC_ERR_NONE;
+}
+
+DLL_EXPORT int32_t winusbtmc_store_count(winusbtmc_store_t *pstore)
+{
+    if (!pstore)
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    return pstore->count;
+}
+
+DLL_EXPORT int32_t winusbtmc_store_refresh(winusbtmc_store_t *pstore)
+{
+    winusbtmc_store_record_t rec;
+    uint64_t                 dat_size, idx_size;
+    uint32_t                 count;
+
+    if ( (!pstore) || (pstore->write) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    /* the index is read before the data file, so the responses of all records are in the mapping */
+    if (!s_winusbtmc_store_size(pstore->idx_file, &idx_size))
+        return WINUSBTMC_ERR_FILE;
+    if (idx_size < WINUSBTMC_STORE_HEADER)
+        return WINUSBTMC_ERR_FILE;
+    count = (uint32_t)((idx_size - WINUSBTMC_STORE_HEADER) / WINUSBTMC_STORE_RECORD);
+    if ( (count == pstore->count) && (pstore->idx.p) )
+        return pstore->count;
+
+    idx_size = WINUSBTMC_STORE_HEADER + (uint64_t)count * WINUSBTMC_STORE_RECORD;
+    if ( (!s_winusbtmc_store_size(pstore->dat_file, &dat_size)) || (dat_size < 8) ||
+         (!s_winusbtmc_store_map(pstore->idx_file, &pstore->idx, idx_size)) ||
+         (!s_winusbtmc_store_map(pstore->dat_file, &pstore->dat, dat_size)) )
+    {
+        s_winusbtmc_store_unmap(&pstore->idx);
+        s_winusbtmc_store_unmap(&pstore->dat);
+        pstore->count = 0;
+        return WINUSBTMC_ERR_FILE;
+    }
+
+    /* the new records are checked once, winusbtmc_store_get can trust them */
+    for ( ; pstore->count < count; pstore->count++)
+    {
+        memcpy(&rec, pstore->idx.p + WINUSBTMC_STORE_HEADER + (uint64_t)pstore->count * WINUSBTMC_STORE_RECORD,
+               sizeof(rec));
+        if ( (rec.offset < 8) || (rec.offset > dat_size) || (rec.len > dat_size - rec.offset) )
+            break;
+    }
+    return pstore->count;
+}
+
+DLL_EXPORT int32_t winusbtmc_store_get(winusbtmc_store_t *pstore, uint32_t index, winusbtmc_store_entry_t *pentry)
+{
+    winusbtmc_store_record_t rec;
+
+    if ( (!pstore) || (pstore->write) || (index >= pstore->count) || (!pentry) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    memcpy(&rec, pstore->idx.p + WINUSBTMC_STORE_HEADER + (uint64_t)index * WINUSBTMC_STORE_RECORD, sizeof(rec));
+    pentry->dat       = (const char *)pstore->dat.p + rec.offset;
+    pentry->len       = rec.len;
+    pentry->tag       = rec.tag;
+    pentry->timestamp = rec.timestamp;
+    return WINUSBTMC_ERR_NONE;
+}
+
+DLL_EXPORT int32_t winusbtmc_store_close(winusbtmc_store_t *pstore)
+{
+    int32_t ret;
+
+    if (!pstore)
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    ret = pstore->error;
+    s_winusbtmc_store_unmap(&pstore->idx);
+    s_winusbtmc_store_unmap(&pstore->dat);
+    s_winusbtmc_store_close_file(pstore->dat_file);
+    s_winusbtmc_store_close_file(pstore->idx_file);
+    free(pstore->buf);
+    free(pstore);
+    return ret;
+}
@@ -0,0 +1,442 @@
+/*
+ * Transport for LAN instruments using the raw socket SCPI protocol (usually TCP port 5025).
+ *
+ * LAN instruments can not be enumerated, they are added to the device list the first time they
+ * are addressed by a string like "TCPIP::192.168.1.10::5025" (the VISA forms "TCPIP0::host::port::SOCKET"
+ * and "TCPIP::host" with the default port 5025 are accepted as well). IPv6 addresses are written in brackets,
+ * e.g. "TCPIP::[fe80::1%eth0]::5025".
+ *
+ * A message is sent with a single send() call with Nagle disabled, so a command leaves the host
+ * immediately as one segment. Responses are received through a read-ahead buffer; the end of a
+ * response is the 0x0a terminator outside of IEEE 488.2 definite length blocks (#<n><len><data>).
+ * Sending a message discards the unread rest of a previous response, as far as it arrived already.
+ * Parts the instrument sends later are taken for the next response, so callers read whole responses.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    typedef SOCKET winusbtmc_socket_t;
+    #define WINUSBTMC_TCP_INVALID  INVALID_SOCKET
+    #define WINUSBTMC_TCP_CLOSE(s) closesocket(s)
+#else
+    #include <unistd.h>
+    #include <netdb.h>
+    #include <sys/socket.h>
+    #include <sys/time.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    typedef int winusbtmc_socket_t;
+    #define WINUSBTMC_TCP_INVALID  (-1)
+    #define WINUSBTMC_TCP_CLOSE(s) close(s)
+#endif
+#include "winusbtmc.h"
+#include "winusbtmc_private.h"
+
+#define WINUSBTMC_TCP_DEFAULTPORT  "5025"
+#define WINUSBTMC_TCP_READAHEAD    (64 * 1024)   /* size of the receive buffer */
+#define WINUSBTMC_TCP_WRITEBUF     (256)         /* messages up to this size are terminated on the stack */
+
+typedef struct
+{
+    winusbtmc_socket_t sock;
+    char              *buf;                /* read-ahead buffer */
+    uint32_t           head;               /* next unread byte in buf */
+    uint32_t           tail;               /* end of valid data in buf */
+
+    /* response terminator scanner, keeps its state across reads */
+    uint32_t           block_remaining;    /* bytes left of a definite length block */
+    uint32_t           block_length;       /* length field of a block header while it is parsed */
+    uint8_t            block_digits;       /* length digits of a block header still to parse, 0 if none */
+    bool               block_hash;         /* last byte was '#' */
+    bool               quoted;             /* inside a "..." string */
+    bool               failed;             /* recv failed after a part of the response was returned */
+} winusbtmc_tcp_t;
+
+typedef char winusbtmc_tcp_address_t[WINUSBTMC_USTR_MAX];
+
+static winusbtmc_tcp_address_t *s_winusbtmc_tcp_address = (void *)0; /* "TCPIP::host::port", grows when needed */
+static int32_t s_winusbtmc_tcp_count = 0;
+static int32_t s_winusbtmc_tcp_alloc = 0;
+static bool    s_winusbtmc_tcp_added = false;   /* an address was registered since the last update */
+
+
+/*
+ * split "TCPIP[n]::host[::port][::SOCKET]" into host and port, returns false for other strings.
+ * An IPv6 host is in brackets ("[fe80::1]"), host is returned without them
+ */
+static bool s_winusbtmc_tcp_parse(const char *address, char *host, int hostln, char *port, int portln)
+{
+    const char *p, *end;
+
+    if (strncasecmp(address, "TCPIP", 5) != 0)
+        return false;
+    p = &address[5];
+    while (isdigit((unsigned char)*p))
+        p++;
+    if (strncmp(p, "::", 2) != 0)
+        return false;
+    p += 2;
+
+    if (*p == '[')
+    {
+        end = strchr(++p, ']');
+        if ( (!end) || ( (end[1] != '\0') && (strncmp(&end[1], "::", 2) != 0) ) )
+            return false;
+    }
+    else
+    {
+        end = strstr(p, "::");
+        if (!end)
+            end = p + strlen(p);
+    }
+    if ( (end == p) || (end - p >= hostln) )
+        return false;
+    memcpy(host, p, end - p);
+    host[end - p] = '\0';
+    if (*end == ']')
+        end++;
+
+    snprintf(port, portln, "%s", WINUSBTMC_TCP_DEFAULTPORT);
+    if (*end)
+    {
+        p = end + 2;
+        if (isdigit((unsigned char)*p))
+        {
+            end = strstr(p, "::");
+            if (!end)
+                end = p + strlen(p);
+            if (end - p >= portln)
+                return false;
+            memcpy(port, p, end - p);
+            port[end - p] = '\0';
+        }
+    }
+    return true;
+}
+
+int32_t winusbtmc_tcp_register(const char *address, char *normalized)
+{
+    char    host[WINUSBTMC_USTR_MAX - 32];
+    char    port[16];
+    int32_t i;
+    winusbtmc_tcp_address_t *paddress;
+
+    if (!s_winusbtmc_tcp_parse(address, host, sizeof(host), port, sizeof(port)))
+        return -1;
+
+    snprintf(normalized, WINUSBTMC_USTR_MAX, strchr(host, ':') ? "TCPIP::[%s]::%s" : "TCPIP::%s::%s", host, port);
+
+    for (i = 0; i < s_winusbtmc_tcp_count; i++)
+    {
+        if (strcasecmp(s_winusbtmc_tcp_address[i], normalized) == 0)
+            return i;
+    }
+    if (s_winusbtmc_tcp_count >= s_winusbtmc_tcp_alloc)
+    {
+        paddress = realloc(s_winusbtmc_tcp_address, (s_winusbtmc_tcp_alloc + 16) * sizeof(winusbtmc_tcp_address_t));
+        if (!paddress)
+            return -1;
+        s_winusbtmc_tcp_address = paddress;
+        s_winusbtmc_tcp_alloc  += 16;
+    }
+
+    strcpy(s_winusbtmc_tcp_address[s_winusbtmc_tcp_count], normalized);
+    s_winusbtmc_tcp_added = true;
+    return s_winusbtmc_tcp_count++;
+}
+
+static int32_t s_winusbtmc_tcp_deviceindex(int32_t devicenum, winusbtmc_device_t *pdeviceinfo)
+{
+    if ( (devicenum >= 0) && (devicenum < s_winusbtmc_tcp_count) && (pdeviceinfo) )
+    {
+        winusbtmc_device_clear(pdeviceinfo);
+        pdeviceinfo->transport = &winusbtmc_transport_tcp;
+        snprintf(pdeviceinfo->id->location, WINUSBTMC_LOCATION_MAX, "%s", s_winusbtmc_tcp_address[devicenum]);
+        strcpy(pdeviceinfo->id->usb_uniquestring, s_winusbtmc_tcp_address[devicenum]);
+    }
+    return s_winusbtmc_tcp_count;
+}
+
+static bool s_winusbtmc_tcp_changed(void)
+{
+    bool changed = s_winusbtmc_tcp_added;
+
+    s_winusbtmc_tcp_added = false;
+    return changed;
+}
+
+static int32_t s_winusbtmc_tcp_open(winusbtmc_device_t *pdev)
+{
+    char             host[WINUSBTMC_USTR_MAX];
+    char             port[16];
+    struct addrinfo  hints, *res, *ai;
+    winusbtmc_tcp_t *ptcp;
+    int              nodelay;
+#ifdef _WIN32
+    static bool      wsa_started = false;
+    WSADATA          wsadata;
+    DWORD            timeout;
+
+    if (!wsa_started)
+    {
+        if (WSAStartup(MAKEWORD(2, 2), &wsadata) != 0)
+            return WINUSBTMC_ERR_CANNOT_OPEN_DEVICE;
+        wsa_started = true;
+    }
+    timeout = WINUSBTMC_TIMEOUT;
+#else
+    struct timeval   timeout;
+
+    timeout.tv_sec  = WINUSBTMC_TIMEOUT / 1000;
+    timeout.tv_usec = (WINUSBTMC_TIMEOUT % 1000) * 1000;
+#endif
+
+    if (!s_winusbtmc_tcp_parse(pdev->id->usb_uniquestring, host, sizeof(host), port, sizeof(port)))
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    ptcp = calloc(1, sizeof(winusbtmc_tcp_t));
+    if (!ptcp)
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    ptcp->buf = malloc(WINUSBTMC_TCP_READAHEAD);
+    if (!ptcp->buf)
+    {
+        free(ptcp);
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+    {
+        free(ptcp->buf);
+        free(ptcp);
+        return WINUSBTMC_ERR_DEVICE_NOT_PRESENT;
+    }
+
+    ptcp->sock = WINUSBTMC_TCP_INVALID;
+    for (ai = res; ai; ai = ai->ai_next)
+    {
+        ptcp->sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (ptcp->sock == WINUSBTMC_TCP_INVALID)
+            continue;
+        if (connect(ptcp->sock, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        WINUSBTMC_TCP_CLOSE(ptcp->sock);
+        ptcp->sock = WINUSBTMC_TCP_INVALID;
+    }
+    freeaddrinfo(res);
+
+    if (ptcp->sock == WINUSBTMC_TCP_INVALID)
+    {
+        free(ptcp->buf);
+        free(ptcp);
+        return WINUSBTMC_ERR_CANNOT_OPEN_DEVICE;
+    }
+
+    /* send each command immediately instead of waiting for the ack of the previous segment */
+    nodelay = 1;
+    setsockopt(ptcp->sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay, sizeof(nodelay));
+    setsockopt(ptcp->sock, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+    setsockopt(ptcp->sock, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout, sizeof(timeout));
+
+    pdev->transport_data = ptcp;
+    return WINUSBTMC_ERR_NONE;
+}
+
+static void s_winusbtmc_tcp_close(winusbtmc_device_t *pdev)
+{
+    winusbtmc_tcp_t *ptcp = pdev->transport_data;
+
+    WINUSBTMC_TCP_CLOSE(ptcp->sock);
+    free(ptcp->buf);
+    free(ptcp);
+    pdev->transport_data = (void *)0;
+}
+
+/* receive and drop everything which arrived on the socket, without waiting for more */
+static void s_winusbtmc_tcp_drain(winusbtmc_tcp_t *ptcp)
+{
+#ifdef _WIN32
+    u_long available;
+
+    while ( (ioctlsocket(ptcp->sock, FIONREAD, &available) == 0) && (available > 0) )
+    {
+        if (recv(ptcp->sock, ptcp->buf, WINUSBTMC_TCP_READAHEAD, 0) <= 0)
+            break;
+    }
+#else
+    while (recv(ptcp->sock, ptcp->buf, WINUSBTMC_TCP_READAHEAD, MSG_DONTWAIT) > 0)
+        ;
+#endif
+}
+
+static int32_t s_winusbtmc_tcp_write(winusbtmc_device_t *pdev, const char *str, uint32_t len)
+{
+    winusbtmc_tcp_t *ptcp = pdev->transport_data;
+    char             buf[WINUSBTMC_TCP_WRITEBUF];
+    char            *dat;
+    uint32_t         sent;
+    int              ret;
+
+    dat = (char *)str;
+    if ( (len == 0) || (str[len-1] != 0x0a) )
+    { /* add terminator 0x0a in the same buffer, so the message leaves in one segment */
+        dat = (len < sizeof(buf)) ? buf : malloc(len + 1);
+        if (!dat)
+        {
+            return WINUSBTMC_ERR_MALLOC_FAILED;
+        }
+        memcpy(dat, str, len);
+        dat[len++] = 0x0a;
+    }
+
+    /* a new command discards unread data of a previous response, in the read-ahead buffer and in the socket */
+    s_winusbtmc_tcp_drain(ptcp);
+    ptcp->head = ptcp->tail = 0;
+    ptcp->block_remaining = 0;
+    ptcp->block_digits    = 0;
+    ptcp->block_hash      = false;
+    ptcp->quoted          = false;
+    ptcp->failed          = false;
+
+    ret  = 0;
+    sent = 0;
+    while (sent < len)
+    {
+        ret = send(ptcp->sock, &dat[sent], len - sent, 0);
+        if (ret <= 0)
+            break;
+        sent += ret;
+    }
+
+    if ( (dat != str) && (dat != buf) )
+        free(dat);
+
+    if (sent < len)
+    {
+        return WINUSBTMC_ERR_BULKOUT_FAILED;
+    }
+    return WINUSBTMC_ERR_NONE;
+}
+
+/*
+ * copy bytes from the read-ahead buffer to dat until the response terminator is found.
+ * returns true if the terminator was copied
+ */
+static bool s_winusbtmc_tcp_scan(winusbtmc_tcp_t *ptcp, char *dat, uint32_t maxlen, uint32_t *len)
+{
+    char c;
+
+    while ( (ptcp->head < ptcp->tail) && (*len < maxlen) )
+    {
+        if (ptcp->block_remaining)
+        { /* binary block data is copied without looking at it */
+            uint32_t n = ptcp->tail - ptcp->head;
+            if (n > ptcp->block_remaining)
+                n = ptcp->block_remaining;
+            if (n > maxlen - *len)
+                n = maxlen - *len;
+            memcpy(&dat[*len], &ptcp->buf[ptcp->head], n);
+            ptcp->head += n;
+            *len += n;
+            ptcp->block_remaining -= n;
+            continue;
+        }
+
+        c = ptcp->buf[ptcp->head++];
+        dat[(*len)++] = c;
+
+        if (ptcp->block_digits)
+        { /* length field of a definite length block header */
+            if (isdigit((unsigned char)c))
+                ptcp->block_length = ptcp->block_length * 10 + (c - '0');
+            if (--ptcp->block_digits == 0)
+                ptcp->block_remaining = ptcp->block_length;
+            continue;
+        }
+        if (ptcp->block_hash)
+        {
+            ptcp->block_hash = false;
+            if ( (c >= '1') && (c <= '9') )
+            {
+                ptcp->block_digits = c - '0';
+                ptcp->block_length = 0;
+                continue;
+            }
+        }
+
+        if (c == '"')
+            ptcp->quoted = !ptcp->quoted;
+        else if ( (c == '#') && (!ptcp->quoted) )
+            ptcp->block_hash = true;
+        else if ( (c == 0x0a) && (!ptcp->quoted) )
+            return true;
+    }
+    return false;
+}
+
+static int32_t s_winusbtmc_tcp_read(winusbtmc_device_t *pdev, char *dat, uint32_t maxlen, bool *eom)
+{
+    winusbtmc_tcp_t *ptcp = pdev->transport_data;
+    uint32_t         len;
+    bool             complete;
+    int              ret;
+
+    if (ptcp->failed)
+    {
+        ptcp->failed = false;
+        return WINUSBTMC_ERR_BULKIN_FAILED;
+    }
+
+    len      = 0;
+    complete = false;
+    while ( (!complete) && (len < maxlen) )
+    {
+        if (ptcp->head >= ptcp->tail)
+        {
+            ret = recv(ptcp->sock, ptcp->buf, WINUSBTMC_TCP_READAHEAD, 0);
+            if ( (ret <= 0) && (len == 0) )
+            {
+                return WINUSBTMC_ERR_BULKIN_FAILED;
+            }
+            if (ret <= 0)
+            { /* the received part is returned, the error with the next call */
+                ptcp->failed = true;
+                break;
+            }
+            ptcp->head = 0;
+            ptcp->tail = ret;
+        }
+        complete = s_winusbtmc_tcp_scan(ptcp, dat, maxlen, &len);
+    }
+
+    if (complete)
+    { /* the next response starts in a clean scanner state */
+        ptcp->block_hash = false;
+        ptcp->quoted     = false;
+    }
+    if (eom)
+    {
+        *eom = complete;
+    }
+    return len;
+}
+
+
+const winusbtmc_transport_t winusbtmc_transport_tcp =
+{
+    "tcp",
+    s_winusbtmc_tcp_deviceindex,
+    (void *)0,                             /* the address is the device string, it is set by deviceindex */
+    s_winusbtmc_tcp_changed,
+    s_winusbtmc_tcp_open,
+    s_winusbtmc_tcp_close,
+    s_winusbtmc_tcp_write,
+    s_winusbtmc_tcp_read,
+    (void *)0
+};
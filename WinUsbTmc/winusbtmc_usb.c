@@ -0,0 +1,346 @@
+/*
+ * usbtmc transport on top of the usb port layer (libusb).
+ * This transport builds and parses the usbtmc bulk headers in user space.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "winusbtmc.h"
+#include "winusbtmc_private.h"
+
+/* state of an opened device (transport_data) */
+typedef struct
+{
+    char     *buf;                       /* transfer buffer, kept between transfers */
+    uint32_t  size;
+} winusbtmc_usb_t;
+
+
+/*
+ * walk through all usbtmc interfaces of the usb port layer.
+ * returns count of present usbtmc devices and returns some device information if requested
+ */
+static int32_t s_winusbtmc_usb_deviceindex(int32_t devicenum, winusbtmc_device_t *pdeviceinfo)
+{
+    int32_t  devicecount;
+
+    devicecount = winusbtmc_usbport_deviceindex(devicenum, pdeviceinfo);
+
+    if ( (devicenum >= 0) && (devicenum < devicecount) && (pdeviceinfo) )
+    {
+        pdeviceinfo->transport = &winusbtmc_transport_usb;
+    }
+
+    return devicecount;
+}
+
+/*
+ * retrieve USB string descriptors
+ */
+static int32_t s_winusbtmc_usb_uniquestring(winusbtmc_device_t *pdev)
+{
+    char     manufacturer[WINUSBTMC_USTR_MAX];
+    char     product[WINUSBTMC_USTR_MAX];
+    char     serial[WINUSBTMC_USTR_MAX];
+
+    if (winusbtmc_usbport_get_strings(pdev, manufacturer, product, serial, WINUSBTMC_USTR_MAX - 1) < 0)
+        return -1; /* device can not be opened */
+
+    winusbtmc_uniquestring(pdev->id->usb_uniquestring, manufacturer, product, serial);
+    return 0;
+}
+
+
+/*
+ * returns the transfer buffer of an opened device with at least len bytes, 0 if out of memory
+ */
+static char *s_winusbtmc_usb_buffer(winusbtmc_device_t *pdev, uint32_t len)
+{
+    winusbtmc_usb_t *pusb = pdev->transport_data;
+    char            *p;
+
+    if (len > pusb->size)
+    {
+        p = realloc(pusb->buf, len);
+        if (!p)
+            return (void *)0;
+        pusb->buf  = p;
+        pusb->size = len;
+    }
+    return pusb->buf;
+}
+
+/*
+ * INITIATE_CLEAR and CHECK_CLEAR_STATUS, discards the messages in progress in both directions.
+ * Only used for devices with WINUSBTMC_QUIRK_CLEAR after failed transfers and with WINUSBTMC_QUIRK_CLEAR_ON_OPEN when
+ * opened, some devices do not implement these requests although they are mandatory according to the usbtmc standard
+ * (e.g. Rigol DS2000).
+ */
+static int32_t s_winusbtmc_usb_clear(winusbtmc_device_t *pdev)
+{
+    char  dat[64];
+    int   i;
+
+    if ( (winusbtmc_usbport_control_in(pdev, WINUSBTMC_REQ_INITIATE_CLEAR, 0, dat, 1) < 1) ||
+         (dat[0] != WINUSBTMC_STATUS_SUCCESS) )
+    {
+        return -1;
+    }
+
+    for (i = 0; i < 100; i++)
+    {
+        if (winusbtmc_usbport_control_in(pdev, WINUSBTMC_REQ_CHECK_CLEAR_STATUS, 0, dat, 2) < 2)
+            return -1;
+        if (dat[0] != WINUSBTMC_STATUS_PENDING)
+            break;
+        if (dat[1] & 0x01)
+        { /* bmClear.D0: the device waits until its bulk-in fifo was read */
+            winusbtmc_usbport_bulk_read(pdev, dat, sizeof(dat));
+        }
+    }
+    if (dat[0] != WINUSBTMC_STATUS_SUCCESS)
+        return -1;
+
+    return winusbtmc_usbport_clear_halt(pdev, pdev->usb_ep_bulkout);
+}
+
+static void s_winusbtmc_usb_close(winusbtmc_device_t *pdev)
+{
+    winusbtmc_usb_t *pusb = pdev->transport_data;
+
+    if (pdev->usb_handle)
+        winusbtmc_usbport_close(pdev);
+    if (pusb)
+    {
+        free(pusb->buf);
+        free(pusb);
+    }
+    pdev->transport_data = (void *)0;
+}
+
+/*
+ * Open the usb device and do initialization when device is opened the first time within this module.
+ * The requests sent depend on the quirks of the device (winusbtmc_quirks.c).
+ */
+static int32_t s_winusbtmc_usb_open(winusbtmc_device_t *pdev)
+{
+    char  dat[0x18];
+
+    winusbtmc_quirks_lookup(pdev->usb_vid, pdev->usb_pid, &pdev->quirks, &pdev->max_transfer);
+
+    pdev->transport_data = calloc(1, sizeof(winusbtmc_usb_t));
+    if (!pdev->transport_data)
+    {
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+
+    if (winusbtmc_usbport_open(pdev) < 0)
+    {
+        s_winusbtmc_usb_close(pdev);
+        return WINUSBTMC_ERR_CANNOT_OPEN_DEVICE;
+    }
+
+    if (winusbtmc_usbport_claim(pdev) < 0)
+    {
+        s_winusbtmc_usb_close(pdev);
+        return WINUSBTMC_ERR_FIRST_INIT_FAILED;
+    }
+
+    if (pdev->quirks & WINUSBTMC_QUIRK_GET_CAPABILITIES)
+    {
+        winusbtmc_usbport_control_in(pdev, WINUSBTMC_REQ_GET_CAPABILITIES, 0, dat, 0x18);
+    }
+
+    if (pdev->quirks & WINUSBTMC_QUIRK_VENDOR_INIT)
+    {
+        winusbtmc_usbport_control_in(pdev, WINUSBTMC_REQ_VENDOR_INIT, 1, dat, 0x1);
+    }
+
+    if (pdev->quirks & WINUSBTMC_QUIRK_CLEAR_ON_OPEN)
+    { /* discard what a previous program left in the device */
+        if (s_winusbtmc_usb_clear(pdev) < 0)
+        {
+            s_winusbtmc_usb_close(pdev);
+            return WINUSBTMC_ERR_FIRST_INIT_FAILED;
+        }
+    }
+
+    return WINUSBTMC_ERR_NONE;
+}
+
+/*
+ * send a message. It is split into several transfers if the device limits the transfer size,
+ * only the last one has EOM set.
+ */
+static int32_t s_winusbtmc_usb_write(winusbtmc_device_t *pdev, const char *str, uint32_t len)
+{
+    char     *dat;
+    int       ret;
+    uint32_t  total, chunk, pos, n, i;
+
+    /* add terminator 0x0a if not present */
+    total = ((len > 0) && (str[len-1] == 0x0a)) ? len : len + 1;
+    chunk = ((pdev->max_transfer) && (pdev->max_transfer < total)) ? pdev->max_transfer : total;
+
+    dat = s_winusbtmc_usb_buffer(pdev, chunk + sizeof(winusbtmc_bulkout_header_t) + 4);
+
+    if (!dat)
+    {
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+
+    pos = 0;
+    do
+    {
+        n = (total - pos < chunk) ? total - pos : chunk;
+
+        ((winusbtmc_bulkout_header_t*)dat)->MsgID = WINUSBTMC_DEV_DEP_MSG_OUT;
+        ((winusbtmc_bulkout_header_t*)dat)->bTag  = pdev->winusbtmc_bTag++;
+        ((winusbtmc_bulkout_header_t*)dat)->bTagInverse = ((winusbtmc_bulkout_header_t*)dat)->bTag ^ 0xff;
+        ((winusbtmc_bulkout_header_t*)dat)->Rsvd1 = 0;
+        ((winusbtmc_bulkout_header_t*)dat)->TransferSize = n;
+        ((winusbtmc_bulkout_header_t*)dat)->bmTransferAttributes = (pos + n == total) ? 0x01 : 0x00; // EOM on the last transfer
+        ((winusbtmc_bulkout_header_t*)dat)->Rsvd2 = 0;
+        ((winusbtmc_bulkout_header_t*)dat)->Rsvd3 = 0;
+        ((winusbtmc_bulkout_header_t*)dat)->Rsvd4 = 0;
+
+        i = (pos + n > len) ? len - pos : n;
+        if (&str[pos] != &dat[sizeof(winusbtmc_bulkout_header_t)]) /* not written in place (s_winusbtmc_usb_send_buffer) */
+            memcpy(&dat[sizeof(winusbtmc_bulkout_header_t)], &str[pos], i);
+        if (i < n)
+        {
+            dat[sizeof(winusbtmc_bulkout_header_t) + i] = 0x0a;
+        }
+        i = n + sizeof(winusbtmc_bulkout_header_t);
+
+        /* 32 Bit zero padding */
+        while ((i & 0x03) != 0)
+        {
+            dat[i++] = 0x00;
+        }
+
+        ret = winusbtmc_usbport_bulk_write(pdev, dat, i);
+        pos += n;
+    } while ( (ret >= 0) && (pos < total) );
+
+    if (ret < 0)
+    {
+        if (pdev->quirks & WINUSBTMC_QUIRK_CLEAR)
+            s_winusbtmc_usb_clear(pdev); /* the next message starts in a clean state */
+        return WINUSBTMC_ERR_BULKOUT_FAILED;
+    }
+
+    return WINUSBTMC_ERR_NONE;
+}
+
+/*
+ * space for a message behind the bulk-out header of the transfer buffer, s_winusbtmc_usb_write sends it in place.
+ * Only for messages of one transfer, the headers of further transfers would overwrite the message.
+ */
+static char *s_winusbtmc_usb_send_buffer(winusbtmc_device_t *pdev, uint32_t len)
+{
+    char *dat;
+
+    if ( (pdev->max_transfer) && (len + 1 > pdev->max_transfer) )
+    {
+        return (void *)0;
+    }
+    dat = s_winusbtmc_usb_buffer(pdev, len + 1 + sizeof(winusbtmc_bulkout_header_t) + 4);
+    return (dat) ? &dat[sizeof(winusbtmc_bulkout_header_t)] : (void *)0;
+}
+
+/*
+ * eom gets true, if the complete message was received
+ * maxlen = max. amount of data to receive
+ * returns the count of received bytes
+ */
+static int32_t s_winusbtmc_usb_read(winusbtmc_device_t *pdev, char *str, uint32_t maxlen, bool *eom)
+{
+    char *dat;
+    winusbtmc_bulkout_header_t hdr;
+    int ret;
+    uint32_t reclen, received;
+
+    /* large reads are split into transfers of the calibrated size, the caller reads until eom */
+    if ( (pdev->transfer_size) && (maxlen > pdev->transfer_size) )
+    {
+        maxlen = pdev->transfer_size;
+    }
+    if ( (pdev->max_transfer) && (maxlen > pdev->max_transfer) )
+    {
+        maxlen = pdev->max_transfer;
+    }
+
+    dat = s_winusbtmc_usb_buffer(pdev, maxlen + sizeof(winusbtmc_bulkout_header_t) + 4);
+    if (!dat)
+    {
+        return WINUSBTMC_ERR_MALLOC_FAILED;
+    }
+
+    hdr.MsgID        = WINUSBTMC_DEV_DEP_MSG_IN;
+    hdr.bTag         = pdev->winusbtmc_bTag++;
+    hdr.bTagInverse  = hdr.bTag ^ 0xff;
+    hdr.Rsvd1        = 0;
+    hdr.TransferSize = maxlen;
+    hdr.bmTransferAttributes = 0x00;
+    hdr.Rsvd2        = 0;
+    hdr.Rsvd3        = 0;
+    hdr.Rsvd4        = 0;
+    ret = winusbtmc_usbport_bulk_write(pdev, (char *)&hdr, sizeof(hdr));
+
+    if (ret < 0)
+    {
+        return WINUSBTMC_ERR_BULKOUT_FAILED;
+    }
+    ret = winusbtmc_usbport_bulk_read(pdev, dat, maxlen + sizeof(winusbtmc_bulkout_header_t) + 4);
+
+    if (ret < (int)sizeof(winusbtmc_bulkout_header_t))
+    {
+        if (pdev->quirks & WINUSBTMC_QUIRK_CLEAR)
+            s_winusbtmc_usb_clear(pdev);
+        return WINUSBTMC_ERR_BULKIN_FAILED;
+    }
+
+    reclen   = ((winusbtmc_bulkout_header_t*)dat)->TransferSize;
+    received = ret - sizeof(winusbtmc_bulkout_header_t);
+    if (reclen > maxlen)
+    {
+        reclen = maxlen;
+    }
+
+    /* devices with split transfers send the rest of the data without header in further packets */
+    while ( (received < reclen) && (pdev->quirks & WINUSBTMC_QUIRK_SPLIT_TRANSFERS) )
+    {
+        ret = winusbtmc_usbport_bulk_read(pdev, &dat[sizeof(winusbtmc_bulkout_header_t) + received], maxlen + 4 - received);
+        if (ret <= 0)
+            break;
+        received += ret;
+    }
+    if (received < reclen)
+    {
+        reclen = received;
+    }
+
+    memcpy(str, &dat[sizeof(winusbtmc_bulkout_header_t)], reclen);
+
+    if (eom)
+    {
+        *eom = ( ((winusbtmc_bulkout_header_t*)dat)->bmTransferAttributes == 0x01 );
+    }
+
+    return reclen;
+}
+
+
+const winusbtmc_transport_t winusbtmc_transport_usb =
+{
+    "usb",
+    s_winusbtmc_usb_deviceindex,
+    s_winusbtmc_usb_uniquestring,
+    winusbtmc_usbport_changed,
+    s_winusbtmc_usb_open,
+    s_winusbtmc_usb_close,
+    s_winusbtmc_usb_write,
+    s_winusbtmc_usb_read,
+    s_winusbtmc_usb_send_buffer
+};
@@ -0,0 +1,798 @@
+/*
+ * Conversion of waveform samples (ADC codes as read with e.g. ":WAV:DATA?") to float or double.
+ * value = code * scale + offset, for the usual preamble scale = y-increment and
+ * offset = y-origin - y-reference * y-increment.
+ *
+ * On x86 the conversion uses SSE2 or AVX2, selected at runtime by the cpu features, other cpus use the
+ * scalar loop. The kernels keep no state, so the data can be converted in chunks as it is received. A chunk
+ * of 16 bit samples must contain complete samples, an odd last byte belongs to the next chunk.
+ *
+ * The decimation reduces a record to a given count of points for display, each point is the min, max and
+ * mean of the samples of its interval. It works on the received chunks as well (odd bytes included), so
+ * only the output points are kept in memory instead of the complete record. The statistics of
+ * winusbtmc_stats.c use the same kernels with the sums of squares.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "winusbtmc.h"
+#include "winusbtmc_private.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define WINUSBTMC_WAVEFORM_X86
+    #include <immintrin.h>
+    #define WINUSBTMC_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+#define WINUSBTMC_INLINE static inline __attribute__((always_inline))
+
+static int32_t s_winusbtmc_simd_level = -1;   /* WINUSBTMC_SIMD_*, -1 until detected */
+
+
+/**************************************************************************************************
+ * scalar
+ **************************************************************************************************/
+
+/* code of sample i */
+WINUSBTMC_INLINE int32_t s_winusbtmc_sample(const uint8_t *src, uint32_t i, int32_t format)
+{
+    switch (format)
+    {
+        case WINUSBTMC_SAMPLE_INT8:      return (int8_t)src[i];
+        case WINUSBTMC_SAMPLE_UINT8:     return src[i];
+        case WINUSBTMC_SAMPLE_INT16_LE:  return (int16_t)(src[2*i] | (src[2*i+1] << 8));
+        case WINUSBTMC_SAMPLE_INT16_BE:  return (int16_t)(src[2*i+1] | (src[2*i] << 8));
+        case WINUSBTMC_SAMPLE_UINT16_LE: return (uint16_t)(src[2*i] | (src[2*i+1] << 8));
+        default:                         return (uint16_t)(src[2*i+1] | (src[2*i] << 8));
+    }
+}
+
+/* samples start .. count-1, format is a constant at every call, so the switch is resolved outside of the loop */
+WINUSBTMC_INLINE void s_winusbtmc_tail_float(float *dst, const uint8_t *src, uint32_t start, uint32_t count, int32_t format, float scale, float offset)
+{
+    uint32_t i;
+
+    for (i = start; i < count; i++)
+        dst[i] = (float)s_winusbtmc_sample(src, i, format) * scale + offset;
+}
+
+WINUSBTMC_INLINE void s_winusbtmc_tail_double(double *dst, const uint8_t *src, uint32_t start, uint32_t count, int32_t format, double scale, double offset)
+{
+    uint32_t i;
+
+    for (i = start; i < count; i++)
+        dst[i] = (double)s_winusbtmc_sample(src, i, format) * scale + offset;
+}
+
+WINUSBTMC_INLINE void s_winusbtmc_scalar_float(float *dst, const uint8_t *src, uint32_t count, int32_t format, float scale, float offset)
+{
+    s_winusbtmc_tail_float(dst, src, 0, count, format, scale, offset);
+}
+
+WINUSBTMC_INLINE void s_winusbtmc_scalar_double(double *dst, const uint8_t *src, uint32_t count, int32_t format, double scale, double offset)
+{
+    s_winusbtmc_tail_double(dst, src, 0, count, format, scale, offset);
+}
+
+/* calls kernel with format as constant, used by one function per instruction set */
+#define WINUSBTMC_WAVEFORM_DISPATCH(kernel) \
+    switch (format) \
+    { \
+        case WINUSBTMC_SAMPLE_INT8:      kernel(dst, src, count, WINUSBTMC_SAMPLE_INT8, scale, offset); break; \
+        case WINUSBTMC_SAMPLE_UINT8:     kernel(dst, src, count, WINUSBTMC_SAMPLE_UINT8, scale, offset); break; \
+        case WINUSBTMC_SAMPLE_INT16_LE:  kernel(dst, src, count, WINUSBTMC_SAMPLE_INT16_LE, scale, offset); break; \
+        case WINUSBTMC_SAMPLE_INT16_BE:  kernel(dst, src, count, WINUSBTMC_SAMPLE_INT16_BE, scale, offset); break; \
+        case WINUSBTMC_SAMPLE_UINT16_LE: kernel(dst, src, count, WINUSBTMC_SAMPLE_UINT16_LE, scale, offset); break; \
+        case WINUSBTMC_SAMPLE_UINT16_BE: kernel(dst, src, count, WINUSBTMC_SAMPLE_UINT16_BE, scale, offset); break; \
+    }
+
+static void s_winusbtmc_convert_float_scalar(float *dst, const uint8_t *src, uint32_t count, int32_t format, float scale, float offset)
+{
+    WINUSBTMC_WAVEFORM_DISPATCH(s_winusbtmc_scalar_float)
+}
+
+static void s_winusbtmc_convert_double_scalar(double *dst, const uint8_t *src, uint32_t count, int32_t format, double scale, double offset)
+{
+    WINUSBTMC_WAVEFORM_DISPATCH(s_winusbtmc_scalar_double)
+}
+
+/* samples start .. count-1 are added to *penv, the squares only if squares is true */
+WINUSBTMC_INLINE void s_winusbtmc_tail_envelope(const uint8_t *src, uint32_t start, uint32_t count, int32_t format, bool squares, winusbtmc_envelope_t *penv)
+{
+    uint32_t i;
+    int32_t  code;
+
+    for (i = start; i < count; i++)
+    {
+        code = s_winusbtmc_sample(src, i, format);
+        if (code < penv->min)
+            penv->min = code;
+        if (code > penv->max)
+            penv->max = code;
+        penv->sum += code;
+        if (squares)
+            penv->sumsq += (uint64_t)((int64_t)code * code);
+    }
+}
+
+WINUSBTMC_INLINE void s_winusbtmc_scalar_envelope(const uint8_t *src, uint32_t count, int32_t format, bool squares, winusbtmc_envelope_t *penv)
+{
+    s_winusbtmc_tail_envelope(src, 0, count, format, squares, penv);
+}
+
+#define WINUSBTMC_ENVELOPE_FORMAT(kernel, squares) \
+    switch (format) \
+    { \
+        case WINUSBTMC_SAMPLE_INT8:      kernel(src, count, WINUSBTMC_SAMPLE_INT8, squares, penv); break; \
+        case WINUSBTMC_SAMPLE_UINT8:     kernel(src, count, WINUSBTMC_SAMPLE_UINT8, squares, penv); break; \
+        case WINUSBTMC_SAMPLE_INT16_LE:  kernel(src, count, WINUSBTMC_SAMPLE_INT16_LE, squares, penv); break; \
+        case WINUSBTMC_SAMPLE_INT16_BE:  kernel(src, count, WINUSBTMC_SAMPLE_INT16_BE, squares, penv); break; \
+        case WINUSBTMC_SAMPLE_UINT16_LE: kernel(src, count, WINUSBTMC_SAMPLE_UINT16_LE, squares, penv); break; \
+        case WINUSBTMC_SAMPLE_UINT16_BE: kernel(src, count, WINUSBTMC_SAMPLE_UINT16_BE, squares, penv); break; \
+    }
+
+/* calls kernel with format and squares as constants */
+#define WINUSBTMC_ENVELOPE_DISPATCH(kernel) \
+    if (squares) \
+    { \
+        WINUSBTMC_ENVELOPE_FORMAT(kernel, true) \
+    } \
+    else \
+    { \
+        WINUSBTMC_ENVELOPE_FORMAT(kernel, false) \
+    }
+
+static void s_winusbtmc_envelope_scalar(const uint8_t *src, uint32_t count, int32_t format, bool squares, winusbtmc_envelope_t *penv)
+{
+    WINUSBTMC_ENVELOPE_DISPATCH(s_winusbtmc_scalar_envelope)
+}
+
+
+
+#ifdef WINUSBTMC_WAVEFORM_X86
+/**************************************************************************************************
+ * SSE2, 8 samples per step
+ **************************************************************************************************/
+
+/* codes of 8 samples as two vectors of 4 int32 */
+WINUSBTMC_INLINE WINUSBTMC_TARGET("sse2") void s_winusbtmc_sse2_load(const uint8_t *p, int32_t format, __m128i *plo, __m128i *phi)
+{
+    __m128i v;
+
+    if ( (format == WINUSBTMC_SAMPLE_INT8) || (format == WINUSBTMC_SAMPLE_UINT8) )
+    {
+        v = _mm_loadl_epi64((const __m128i *)p);
+        if (format == WINUSBTMC_SAMPLE_INT8)
+            v = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+        else
+            v = _mm_unpacklo_epi8(v, _mm_setzero_si128());
+    }
+    else
+    {
+        v = _mm_loadu_si128((const __m128i *)p);
+        if ( (format == WINUSBTMC_SAMPLE_INT16_BE) || (format == WINUSBTMC_SAMPLE_UINT16_BE) )
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    }
+
+    /* 8 x 16 bit to 2 x 4 x 32 bit */
+    if ( (format == WINUSBTMC_SAMPLE_UINT8) || (format == WINUSBTMC_SAMPLE_UINT16_LE) || (format == WINUSBTMC_SAMPLE_UINT16_BE) )
+    {
+        *plo = _mm_unpacklo_epi16(v, _mm_setzero_si128());
+        *phi = _mm_unpackhi_epi16(v, _mm_setzero_si128());
+    }
+    else
+    {
+        *plo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        *phi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    }
+}
+
+WINUSBTMC_INLINE WINUSBTMC_TARGET("sse2") void s_winusbtmc_sse2_float(float *dst, const uint8_t *src, uint32_t count, int32_t format, float scale, float offset)
+{
+    __m128  vscale = _mm_set1_ps(scale);
+    __m128  voffset = _mm_set1_ps(offset);
+    __m128i lo, hi;
+    uint32_t i, size;
+
+    size = ( (format == WINUSBTMC_SAMPLE_INT8) || (format == WINUSBTMC_SAMPLE_UINT8) ) ? 1 : 2;
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        s_winusbtmc_sse2_load(&src[i * size], format, &lo, &hi);
+        _mm_storeu_ps(&dst[i],     _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), vscale), voffset));
+        _mm_storeu_ps(&dst[i + 4], _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi), vscale), voffset));
+    }
+    s_winusbtmc_tail_float(dst, src, i, count, format, scale, offset);
+}
+
+WINUSBTMC_INLINE WINUSBTMC_TARGET("sse2") void s_winusbtmc_sse2_double(double *dst, const uint8_t *src, uint32_t count, int32_t format, double scale, double offset)
+{
+    __m128d vscale = _mm_set1_pd(scale);
+    __m128d voffset = _mm_set1_pd(offset);
+    __m128i lo, hi;
+    uint32_t i, size;
+
+    size = ( (format == WINUSBTMC_SAMPLE_INT8) || (format == WINUSBTMC_SAMPLE_UINT8) ) ? 1 : 2;
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        s_winusbtmc_sse2_load(&src[i * size], format, &lo, &hi);
+        _mm_storeu_pd(&dst[i],     _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(lo), vscale), voffset));
+        _mm_storeu_pd(&dst[i + 2], _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(lo, 0x0e)), vscale), voffset));
+        _mm_storeu_pd(&dst[i + 4], _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(hi), vscale), voffset));
+        _mm_storeu_pd(&dst[i + 6], _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(hi, 0x0e)), vscale), voffset));
+    }
+    s_winusbtmc_tail_double(dst, src, i, count, format, scale, offset);
+}
+
+
+
+/*
+ * The envelope works on 16 bit lanes. Unsigned 16 bit codes are biased by -32768 to fit, min and max of
+ * signed 16 bit lanes are available in SSE2. The sums of two lanes (_mm_madd_epi16) are added to 32 bit
+ * sums, which are moved to the 64 bit sum before they can overflow. Two squares of 8 bit codes fit into
+ * 32 bit sums the same way, two squares of 16 bit codes (up to 2^31, unsigned) go to 64 bit sums at once.
+ * The bias is removed from the sums at the end: sum (b + 32768)^2 = sum b^2 + 65536 sum b + n 2^30.
+ */
+#define WINUSBTMC_ENVELOPE_BLOCK (16384)   /* steps until the 32 bit sums are moved */
+
+WINUSBTMC_INLINE bool s_winusbtmc_envelope_biased(int32_t format)
+{
+    return (format == WINUSBTMC_SAMPLE_UINT16_LE) || (format == WINUSBTMC_SAMPLE_UINT16_BE);
+}
+
+/* codes of 8 samples as int16 */
+WINUSBTMC_INLINE WINUSBTMC_TARGET("sse2") __m128i s_winusbtmc_sse2_load16(const uint8_t *p, int32_t format)
+{
+    __m128i v;
+
+    if ( (format == WINUSBTMC_SAMPLE_INT8) || (format == WINUSBTMC_SAMPLE_UINT8) )
+    {
+        v = _mm_loadl_epi64((const __m128i *)p);
+        if (format == WINUSBTMC_SAMPLE_INT8)
+            return _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+        return _mm_unpacklo_epi8(v, _mm_setzero_si128());
+    }
+    v = _mm_loadu_si128((const __m128i *)p);
+    if ( (format == WINUSBTMC_SAMPLE_INT16_BE) || (format == WINUSBTMC_SAMPLE_UINT16_BE) )
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    if (s_winusbtmc_envelope_biased(format))
+        v = _mm_xor_si128(v, _mm_set1_epi16((short)0x8000));
+    return v;
+}
+
+/* adds the lanes and the sums of n samples to *penv, bias is removed */
+static void s_winusbtmc_envelope_lanes(const int16_t *vmin, const int16_t *vmax, int32_t lanes, int64_t sum, uint64_t sumsq, uint32_t n,
+                                       int32_t format, winusbtmc_envelope_t *penv)
+{
+    int32_t bias, i;
+
+    bias = (s_winusbtmc_envelope_biased(format)) ? 32768 : 0;
+    for (i = 0; i < lanes; i++)
+    {
+        if (vmin[i] + bias < penv->min)
+            penv->min = vmin[i] + bias;
+        if (vmax[i] + bias > penv->max)
+            penv->max = vmax[i] + bias;
+    }
+    if (bias)
+    { /* modulo 2^64, the result is exact */
+        sumsq += (uint64_t)sum * 65536 + ((uint64_t)n << 30);
+        sum   += (int64_t)32768 * n;
+    }
+    penv->sum   += sum;
+    penv->sumsq += sumsq;
+}
+
+WINUSBTMC_INLINE WINUSBTMC_TARGET("sse2") void s_winusbtmc_sse2_envelope(const uint8_t *src, uint32_t count, int32_t format, bool squares, winusbtmc_envelope_t *penv)
+{
+    __m128i  vmin = _mm_set1_epi16(32767);
+    __m128i  vmax = _mm_set1_epi16(-32768);
+    __m128i  ones = _mm_set1_epi16(1);
+    __m128i  zero = _mm_setzero_si128();
+    __m128i  vsq64 = _mm_setzero_si128();
+    __m128i  vsum, vsq, v, sq;
+    int16_t  lmin[8], lmax[8];
+    int32_t  lsum[4];
+    uint32_t lsq[4];
+    uint64_t lsq64[2], sumsq = 0;
+    int64_t  sum = 0;
+    uint32_t i, block, size;
+
+    size = ( (format == WINUSBTMC_SAMPLE_INT8) || (format == WINUSBTMC_SAMPLE_UINT8) ) ? 1 : 2;
+    for (i = 0; i + 8 <= count; )
+    {
+        vsum  = _mm_setzero_si128();
+        vsq   = _mm_setzero_si128();
+        block = (count - i) / 8;
+        if (block > WINUSBTMC_ENVELOPE_BLOCK)
+            block = WINUSBTMC_ENVELOPE_BLOCK;
+        for (; block > 0; block--, i += 8)
+        {
+            v    = s_winusbtmc_sse2_load16(&src[i * size], format);
+            vmin = _mm_min_epi16(vmin, v);
+            vmax = _mm_max_epi16(vmax, v);
+            vsum = _mm_add_epi32(vsum, _mm_madd_epi16(v, ones));
+            if ( (squares) && (size == 1) )
+            {
+                vsq = _mm_add_epi32(vsq, _mm_madd_epi16(v, v));
+            }
+            else if (squares)
+            {
+                sq    = _mm_madd_epi16(v, v);
+                vsq64 = _mm_add_epi64(vsq64, _mm_add_epi64(_mm_unpacklo_epi32(sq, zero), _mm_unpackhi_epi32(sq, zero)));
+            }
+        }
+        _mm_storeu_si128((__m128i *)lsum, vsum);
+        sum += (int64_t)lsum[0] + lsum[1] + lsum[2] + lsum[3];
+        if ( (squares) && (size == 1) )
+        {
+            _mm_storeu_si128((__m128i *)lsq, vsq);
+            sumsq += (uint64_t)lsq[0] + lsq[1] + lsq[2] + lsq[3];
+        }
+    }
+    if (i > 0)
+    {
+        _mm_storeu_si128((__m128i *)lmin, vmin);
+        _mm_storeu_si128((__m128i *)lmax, vmax);
+        _mm_storeu_si128((__m128i *)lsq64, vsq64);
+        s_winusbtmc_envelope_lanes(lmin, lmax, 8, sum, sumsq + lsq64[0] + lsq64[1], i, format, penv);
+    }
+    s_winusbtmc_tail_envelope(src, i, count, format, squares, penv);
+}
+
+
+
+/**************************************************************************************************
+ * AVX2, 8 samples per step
+ **************************************************************************************************/
+
+/* codes of 8 samples as int32 */
+WINUSBTMC_INLINE WINUSBTMC_TARGET("avx2") __m256i s_winusbtmc_avx2_load(const uint8_t *p, int32_t format)
+{
+    const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    __m128i       v;
+
+    switch (format)
+    {
+        case WINUSBTMC_SAMPLE_INT8:      return _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)p));
+        case WINUSBTMC_SAMPLE_UINT8:     return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p));
+        case WINUSBTMC_SAMPLE_INT16_LE:  return _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)p));
+        case WINUSBTMC_SAMPLE_UINT16_LE: return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p));
+        default:
+            v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), swap);
+            if (format == WINUSBTMC_SAMPLE_INT16_BE)
+                return _mm256_cvtepi16_epi32(v);
+            return _mm256_cvtepu16_epi32(v);
+    }
+}
+
+WINUSBTMC_INLINE WINUSBTMC_TARGET("avx2") void s_winusbtmc_avx2_float(float *dst, const uint8_t *src, uint32_t count, int32_t format, float scale, float offset)
+{
+    __m256   vscale = _mm256_set1_ps(scale);
+    __m256   voffset = _mm256_set1_ps(offset);
+    uint32_t i, size;
+
+    size = ( (format == WINUSBTMC_SAMPLE_INT8) || (format == WINUSBTMC_SAMPLE_UINT8) ) ? 1 : 2;
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        _mm256_storeu_ps(&dst[i], _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(s_winusbtmc_avx2_load(&src[i * size], format)), vscale), voffset));
+    }
+    s_winusbtmc_tail_float(dst, src, i, count, format, scale, offset);
+}
+
+WINUSBTMC_INLINE WINUSBTMC_TARGET("avx2") void s_winusbtmc_avx2_double(double *dst, const uint8_t *src, uint32_t count, int32_t format, double scale, double offset)
+{
+    __m256d  vscale = _mm256_set1_pd(scale);
+    __m256d  voffset = _mm256_set1_pd(offset);
+    __m256i  v;
+    uint32_t i, size;
+
+    size = ( (format == WINUSBTMC_SAMPLE_INT8) || (format == WINUSBTMC_SAMPLE_UINT8) ) ? 1 : 2;
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        v = s_winusbtmc_avx2_load(&src[i * size], format);
+        _mm256_storeu_pd(&dst[i],     _mm256_add_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(v)), vscale), voffset));
+        _mm256_storeu_pd(&dst[i + 4], _mm256_add_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1)), vscale), voffset));
+    }
+    s_winusbtmc_tail_double(dst, src, i, count, format, scale, offset);
+}
+
+/* codes of 16 samples as int16, 16 bit codes like s_winusbtmc_sse2_load16 */
+WINUSBTMC_INLINE WINUSBTMC_TARGET("avx2") __m256i s_winusbtmc_avx2_load16(const uint8_t *p, int32_t format)
+{
+    const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    __m256i       v;
+
+    if (format == WINUSBTMC_SAMPLE_INT8)
+        return _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)p));
+    if (format == WINUSBTMC_SAMPLE_UINT8)
+        return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p));
+    v = _mm256_loadu_si256((const __m256i *)p);
+    if ( (format == WINUSBTMC_SAMPLE_INT16_BE) || (format == WINUSBTMC_SAMPLE_UINT16_BE) )
+        v = _mm256_shuffle_epi8(v, swap);
+    if (s_winusbtmc_envelope_biased(format))
+        v = _mm256_xor_si256(v, _mm256_set1_epi16((short)0x8000));
+    return v;
+}
+
+WINUSBTMC_INLINE WINUSBTMC_TARGET("avx2") void s_winusbtmc_avx2_envelope(const uint8_t *src, uint32_t count, int32_t format, bool squares, winusbtmc_envelope_t *penv)
+{
+    __m256i  vmin = _mm256_set1_epi16(32767);
+    __m256i  vmax = _mm256_set1_epi16(-32768);
+    __m256i  ones = _mm256_set1_epi16(1);
+    __m256i  zero = _mm256_setzero_si256();
+    __m256i  vsq64 = _mm256_setzero_si256();
+    __m256i  vsum, vsq, v, sq;
+    int16_t  lmin[16], lmax[16];
+    int32_t  lsum[8];
+    uint32_t lsq[8];
+    uint64_t lsq64[4], sumsq = 0;
+    int64_t  sum = 0;
+    uint32_t i, block, size;
+
+    size = ( (format == WINUSBTMC_SAMPLE_INT8) || (format == WINUSBTMC_SAMPLE_UINT8) ) ? 1 : 2;
+    for (i = 0; i + 16 <= count; )
+    {
+        vsum  = _mm256_setzero_si256();
+        vsq   = _mm256_setzero_si256();
+        block = (count - i) / 16;
+        if (block > WINUSBTMC_ENVELOPE_BLOCK)
+            block = WINUSBTMC_ENVELOPE_BLOCK;
+        for (; block > 0; block--, i += 16)
+        {
+            v    = s_winusbtmc_avx2_load16(&src[i * size], format);
+            vmin = _mm256_min_epi16(vmin, v);
+            vmax = _mm256_max_epi16(vmax, v);
+            vsum = _mm256_add_epi32(vsum, _mm256_madd_epi16(v, ones));
+            if ( (squares) && (size == 1) )
+            {
+                vsq = _mm256_add_epi32(vsq, _mm256_madd_epi16(v, v));
+            }
+            else if (squares)
+            {
+                sq    = _mm256_madd_epi16(v, v);
+                vsq64 = _mm256_add_epi64(vsq64, _mm256_add_epi64(_mm256_unpacklo_epi32(sq, zero), _mm256_unpackhi_epi32(sq, zero)));
+            }
+        }
+        _mm256_storeu_si256((__m256i *)lsum, vsum);
+        sum += (int64_t)lsum[0] + lsum[1] + lsum[2] + lsum[3] + lsum[4] + lsum[5] + lsum[6] + lsum[7];
+        if ( (squares) && (size == 1) )
+        {
+            _mm256_storeu_si256((__m256i *)lsq, vsq);
+            sumsq += (uint64_t)lsq[0] + lsq[1] + lsq[2] + lsq[3] + lsq[4] + lsq[5] + lsq[6] + lsq[7];
+        }
+    }
+    if (i > 0)
+    {
+        _mm256_storeu_si256((__m256i *)lmin, vmin);
+        _mm256_storeu_si256((__m256i *)lmax, vmax);
+        _mm256_storeu_si256((__m256i *)lsq64, vsq64);
+        s_winusbtmc_envelope_lanes(lmin, lmax, 16, sum, sumsq + lsq64[0] + lsq64[1] + lsq64[2] + lsq64[3], i, format, penv);
+    }
+    s_winusbtmc_tail_envelope(src, i, count, format, squares, penv);
+}
+
+
+
+/**************************************************************************************************
+ * one function per instruction set
+ **************************************************************************************************/
+
+static WINUSBTMC_TARGET("sse2") void s_winusbtmc_convert_float_sse2(float *dst, const uint8_t *src, uint32_t count, int32_t format, float scale, float offset)
+{
+    WINUSBTMC_WAVEFORM_DISPATCH(s_winusbtmc_sse2_float)
+}
+
+static WINUSBTMC_TARGET("sse2") void s_winusbtmc_convert_double_sse2(double *dst, const uint8_t *src, uint32_t count, int32_t format, double scale, double offset)
+{
+    WINUSBTMC_WAVEFORM_DISPATCH(s_winusbtmc_sse2_double)
+}
+
+static WINUSBTMC_TARGET("avx2") void s_winusbtmc_convert_float_avx2(float *dst, const uint8_t *src, uint32_t count, int32_t format, float scale, float offset)
+{
+    WINUSBTMC_WAVEFORM_DISPATCH(s_winusbtmc_avx2_float)
+}
+
+static WINUSBTMC_TARGET("avx2") void s_winusbtmc_convert_double_avx2(double *dst, const uint8_t *src, uint32_t count, int32_t format, double scale, double offset)
+{
+    WINUSBTMC_WAVEFORM_DISPATCH(s_winusbtmc_avx2_double)
+}
+
+static WINUSBTMC_TARGET("sse2") void s_winusbtmc_envelope_sse2(const uint8_t *src, uint32_t count, int32_t format, bool squares, winusbtmc_envelope_t *penv)
+{
+    WINUSBTMC_ENVELOPE_DISPATCH(s_winusbtmc_sse2_envelope)
+}
+
+static WINUSBTMC_TARGET("avx2") void s_winusbtmc_envelope_avx2(const uint8_t *src, uint32_t count, int32_t format, bool squares, winusbtmc_envelope_t *penv)
+{
+    WINUSBTMC_ENVELOPE_DISPATCH(s_winusbtmc_avx2_envelope)
+}
+#endif // WINUSBTMC_WAVEFORM_X86
+
+
+
+/**************************************************************************************************
+ * public functions
+ **************************************************************************************************/
+
+/* best instruction set of this cpu */
+static int32_t s_winusbtmc_simd_detect(void)
+{
+#ifdef WINUSBTMC_WAVEFORM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return WINUSBTMC_SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return WINUSBTMC_SIMD_SSE2;
+#endif
+    return WINUSBTMC_SIMD_NONE;
+}
+
+static bool s_winusbtmc_sample_format(int32_t format)
+{
+    return (format >= WINUSBTMC_SAMPLE_INT8) && (format <= WINUSBTMC_SAMPLE_UINT16_BE);
+}
+
+DLL_EXPORT int32_t winusbtmc_convert_float(float *dst, const void *src, uint32_t count, int32_t format, float scale, float offset)
+{
+    if ( (!dst) || (!src) || (!s_winusbtmc_sample_format(format)) || (count > INT32_MAX) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    if (s_winusbtmc_simd_level < 0)
+        s_winusbtmc_simd_level = s_winusbtmc_simd_detect();
+
+#ifdef WINUSBTMC_WAVEFORM_X86
+    if (s_winusbtmc_simd_level == WINUSBTMC_SIMD_AVX2)
+        s_winusbtmc_convert_float_avx2(dst, src, count, format, scale, offset);
+    else if (s_winusbtmc_simd_level == WINUSBTMC_SIMD_SSE2)
+        s_winusbtmc_convert_float_sse2(dst, src, count, format, scale, offset);
+    else
+#endif
+        s_winusbtmc_convert_float_scalar(dst, src, count, format, scale, offset);
+    return count;
+}
+
+DLL_EXPORT int32_t winusbtmc_convert_double(double *dst, const void *src, uint32_t count, int32_t format, double scale, double offset)
+{
+    if ( (!dst) || (!src) || (!s_winusbtmc_sample_format(format)) || (count > INT32_MAX) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    if (s_winusbtmc_simd_level < 0)
+        s_winusbtmc_simd_level = s_winusbtmc_simd_detect();
+
+#ifdef WINUSBTMC_WAVEFORM_X86
+    if (s_winusbtmc_simd_level == WINUSBTMC_SIMD_AVX2)
+        s_winusbtmc_convert_double_avx2(dst, src, count, format, scale, offset);
+    else if (s_winusbtmc_simd_level == WINUSBTMC_SIMD_SSE2)
+        s_winusbtmc_convert_double_sse2(dst, src, count, format, scale, offset);
+    else
+#endif
+        s_winusbtmc_convert_double_scalar(dst, src, count, format, scale, offset);
+    return count;
+}
+
+DLL_EXPORT int32_t winusbtmc_convert_simd(int32_t level)
+{
+    int32_t best = s_winusbtmc_simd_detect();
+
+    s_winusbtmc_simd_level = ( (level >= 0) && (level < best) ) ? level : best;
+    return s_winusbtmc_simd_level;
+}
+
+void winusbtmc_envelope(const uint8_t *src, uint32_t count, int32_t format, bool squares, winusbtmc_envelope_t *penv)
+{
+    if (s_winusbtmc_simd_level < 0)
+        s_winusbtmc_simd_level = s_winusbtmc_simd_detect();
+
+#ifdef WINUSBTMC_WAVEFORM_X86
+    if (s_winusbtmc_simd_level == WINUSBTMC_SIMD_AVX2)
+        s_winusbtmc_envelope_avx2(src, count, format, squares, penv);
+    else if (s_winusbtmc_simd_level == WINUSBTMC_SIMD_SSE2)
+        s_winusbtmc_envelope_sse2(src, count, format, squares, penv);
+    else
+#endif
+        s_winusbtmc_envelope_scalar(src, count, format, squares, penv);
+}
+
+int32_t winusbtmc_sample_size(int32_t format)
+{
+    if (!s_winusbtmc_sample_format(format))
+        return 0;
+    return ( (format == WINUSBTMC_SAMPLE_INT8) || (format == WINUSBTMC_SAMPLE_UINT8) ) ? 1 : 2;
+}
+
+/* scattered increments do not vectorize, the format is resolved outside of the loop like for the tails */
+WINUSBTMC_INLINE void s_winusbtmc_histogram_format(const uint8_t *src, uint32_t count, int32_t format, int32_t lowest,
+                                                   int32_t shift, uint32_t *histogram)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; i++)
+        histogram[(uint32_t)(s_winusbtmc_sample(src, i, format) - lowest) >> shift]++;
+}
+
+void winusbtmc_histogram(const uint8_t *src, uint32_t count, int32_t format, int32_t shift, uint32_t *histogram)
+{
+    switch (format)
+    {
+        case WINUSBTMC_SAMPLE_INT8:      s_winusbtmc_histogram_format(src, count, WINUSBTMC_SAMPLE_INT8, INT8_MIN, shift, histogram); break;
+        case WINUSBTMC_SAMPLE_UINT8:     s_winusbtmc_histogram_format(src, count, WINUSBTMC_SAMPLE_UINT8, 0, shift, histogram); break;
+        case WINUSBTMC_SAMPLE_INT16_LE:  s_winusbtmc_histogram_format(src, count, WINUSBTMC_SAMPLE_INT16_LE, INT16_MIN, shift, histogram); break;
+        case WINUSBTMC_SAMPLE_INT16_BE:  s_winusbtmc_histogram_format(src, count, WINUSBTMC_SAMPLE_INT16_BE, INT16_MIN, shift, histogram); break;
+        case WINUSBTMC_SAMPLE_UINT16_LE: s_winusbtmc_histogram_format(src, count, WINUSBTMC_SAMPLE_UINT16_LE, 0, shift, histogram); break;
+        case WINUSBTMC_SAMPLE_UINT16_BE: s_winusbtmc_histogram_format(src, count, WINUSBTMC_SAMPLE_UINT16_BE, 0, shift, histogram); break;
+    }
+}
+
+/*
+ * the block header "#<n><n digits>" at the start of the record, returns the count of used bytes
+ */
+static uint32_t s_winusbtmc_record_header(winusbtmc_record_t *prec, const uint8_t *dat, uint32_t len)
+{
+    uint32_t i = 0;
+
+    if (!prec->started)
+    {
+        prec->started = true;
+        if ( (len > 0) && (dat[0] == '#') )
+        {
+            prec->header = -1;
+            i++;
+        }
+    }
+    if ( (prec->header < 0) && (i < len) )
+    {
+        prec->header = ((dat[i] >= '1') && (dat[i] <= '9')) ? dat[i] - '0' : 0;
+        i++;
+    }
+    for (; (prec->header > 0) && (i < len); i++)
+    {
+        prec->length = prec->length * 10 + (dat[i] - '0');
+        prec->header--;
+    }
+    return i;
+}
+
+int32_t winusbtmc_record_add(winusbtmc_record_t *prec, int32_t format, const uint8_t *dat, uint32_t len,
+                             winusbtmc_samples_t samples, void *ctx)
+{
+    uint8_t  sample[2];
+    uint32_t used, size;
+
+    used = s_winusbtmc_record_header(prec, dat, len);
+    dat += used;
+    len -= used;
+    if (prec->header != 0)
+        return WINUSBTMC_ERR_NONE; /* the chunk ended in the header */
+
+    size = winusbtmc_sample_size(format);
+    if (prec->total == 0)
+    { /* the record length is taken from the block header */
+        prec->total = (prec->length) ? prec->length / size : (prec->unbounded) ? UINT64_MAX : 0;
+        if (prec->total == 0)
+            return WINUSBTMC_ERR_INVALID_PARAMETER;
+    }
+
+    /* the trailing terminator and anything after the record is ignored */
+    if ( (prec->total != UINT64_MAX) && (len > (prec->total - prec->pos) * size - prec->partial_len) )
+        len = (uint32_t)((prec->total - prec->pos) * size - prec->partial_len);
+    if ( (prec->partial_len > 0) && (len > 0) )
+    { /* 16 bit sample split between two chunks */
+        sample[0] = prec->partial;
+        sample[1] = *dat++;
+        len--;
+        prec->partial_len = 0;
+        prec->pos++;
+        samples(ctx, sample, 1);
+    }
+    if (len >= size)
+    {
+        prec->pos += len / size;
+        samples(ctx, dat, len / size);
+    }
+    if (len % size)
+    {
+        prec->partial     = dat[len - 1];
+        prec->partial_len = 1;
+    }
+    return WINUSBTMC_ERR_NONE;
+}
+
+/* first sample of point, the points divide the record evenly */
+static uint64_t s_winusbtmc_decimate_start(const winusbtmc_decimate_t *pd, uint32_t point)
+{
+    return pd->record.total * point / pd->width;
+}
+
+/* the samples of the current point are complete */
+static void s_winusbtmc_decimate_point(winusbtmc_decimate_t *pd)
+{
+    float   lo, hi;
+    int64_t n;
+
+    n  = pd->pos - s_winusbtmc_decimate_start(pd, pd->points);
+    lo = (float)pd->cur_min * pd->scale + pd->offset;
+    hi = (float)pd->cur_max * pd->scale + pd->offset;
+    if (pd->min)
+        pd->min[pd->points] = (pd->scale < 0) ? hi : lo;
+    if (pd->max)
+        pd->max[pd->points] = (pd->scale < 0) ? lo : hi;
+    if (pd->mean)
+        pd->mean[pd->points] = (float)((double)pd->cur_sum / (double)n * pd->scale + pd->offset);
+
+    pd->points++;
+    pd->cur_min = INT32_MAX;
+    pd->cur_max = INT32_MIN;
+    pd->cur_sum = 0;
+}
+
+/* complete samples of the record, called by winusbtmc_record_add */
+static void s_winusbtmc_decimate_samples(void *ctx, const uint8_t *src, uint32_t count)
+{
+    winusbtmc_decimate_t *pd = ctx;
+    winusbtmc_envelope_t  env;
+    uint64_t              end;
+    uint32_t              n, size;
+
+    if (pd->record.total < pd->width)
+        pd->width = (uint32_t)pd->record.total;
+
+    size = winusbtmc_sample_size(pd->format);
+    while ( (count > 0) && (pd->points < pd->width) )
+    {
+        end = s_winusbtmc_decimate_start(pd, pd->points + 1);
+        n   = (end - pd->pos < count) ? (uint32_t)(end - pd->pos) : count;
+
+        env.min = pd->cur_min;
+        env.max = pd->cur_max;
+        env.sum = pd->cur_sum;
+        env.sumsq = 0;          /* not needed, but the biased formats add to it even without squares */
+        winusbtmc_envelope(src, n, pd->format, false, &env);
+        pd->cur_min = env.min;
+        pd->cur_max = env.max;
+        pd->cur_sum = env.sum;
+
+        pd->pos += n;
+        src     += n * size;
+        count   -= n;
+        if (pd->pos == end)
+            s_winusbtmc_decimate_point(pd);
+    }
+}
+
+DLL_EXPORT int32_t winusbtmc_decimate_init(winusbtmc_decimate_t *pd, int32_t format, uint64_t total, uint32_t width,
+                                           float scale, float offset, float *min, float *max, float *mean)
+{
+    if ( (!pd) || (!s_winusbtmc_sample_format(format)) || (width == 0) || (width > INT32_MAX) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    memset(pd, 0, sizeof(winusbtmc_decimate_t));
+    pd->format       = format;
+    pd->record.total = total;
+    pd->width        = (total) && (total < width) ? (uint32_t)total : width;
+    pd->scale        = scale;
+    pd->offset       = offset;
+    pd->min          = min;
+    pd->max          = max;
+    pd->mean         = mean;
+    pd->cur_min      = INT32_MAX;
+    pd->cur_max      = INT32_MIN;
+    return pd->width;
+}
+
+DLL_EXPORT int32_t winusbtmc_decimate(winusbtmc_decimate_t *pd, const void *dat, uint32_t len)
+{
+    int32_t ret;
+
+    if ( (!pd) || ((!dat) && (len > 0)) )
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+
+    ret = winusbtmc_record_add(&pd->record, pd->format, dat, len, s_winusbtmc_decimate_samples, pd);
+    return (ret < 0) ? ret : (int32_t)pd->points;
+}
+
+DLL_EXPORT int32_t winusbtmc_decimate_finish(winusbtmc_decimate_t *pd)
+{
+    if (!pd)
+        return WINUSBTMC_ERR_INVALID_PARAMETER;
+    if ( (pd->points < pd->width) && (pd->pos > s_winusbtmc_decimate_start(pd, pd->points)) )
+        s_winusbtmc_decimate_point(pd); /* the record ended early */
+    return pd->points;
+}
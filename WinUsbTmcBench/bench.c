@@ -0,0 +1,884 @@
+/*
+ * benchmark of the winusbtmc host side against simulated usbtmc devices (winusbtmc_simport.c).
+ * Measures enumeration, lookup and message transfers across transfer sizes, device counts and
+ * thread counts. The simulated devices answer immediately, so the results are the overhead of
+ * winusbtmc itself. The waveform conversion, decimation and statistics are measured for every instruction
+ * set of the cpu, operations are samples there. Parsing ASCII numbers is compared with strtod, operations are numbers.
+ * The continuous acquisition counts the responses taken by the consumer, the dropped ones are in the last column.
+ * The waveform archive writes and reads a file in the working directory, operations are samples and size is
+ * the stored bytes of a capture of 16M samples. The capture store appends responses of a given size and looks up
+ * random captures of the store, operations are captures and the size of store_get is the count of captures in the
+ * store. The shared memory ring is read by a second thread through its name like by another process, operations are
+ * responses taken by it. recv_string+profile is the same query with the command profiler enabled. io_shared_device
+ * is a single device shared by all threads through its I/O thread (winusbtmc_io_submit / winusbtmc_io_wait).
+ * The scpi cases format a sweep command with the templates of winusbtmc_scpi.hpp (bench_scpi.cpp) and with snprintf.
+ *
+ * usage: WinUsbTmcBench [time per case in ms, default 200]
+ *
+ * Output is CSV on stdout, one line per case:
+ *   case,size,devices,threads,operations,ns_per_op,ops_per_s,mb_per_s,dropped
+ * dropped is only filled by the cases which can drop responses.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <time.h>
+    #include <pthread.h>
+#endif
+#include "../WinUsbTmc/winusbtmc.h"
+
+#define BENCH_MAX_THREADS  (8)
+#define BENCH_BUFFER       (1024 * 1024 + 64)
+
+static double s_case_ms = 200;
+static volatile char s_sink;       /* bytes read only to touch them */
+
+/* SCPI command templates (bench_scpi.cpp), return the count of commands and the time in *pms */
+long bench_scpi_format(double case_ms, double *pms);
+long bench_scpi_snprintf(double case_ms, double *pms);
+long bench_scpi_send(int32_t devnum, bool template_send, double case_ms, double *pms);
+
+/* monotonic time in milliseconds */
+static double time_ms(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart * 1000.0 / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#endif
+}
+
+static void set_sim_devices(int count)
+{
+    char str[64];
+
+    snprintf(str, sizeof(str), "WINUSBTMC_SIM_DEVICES=%d", count);
+#ifdef _WIN32
+    _putenv(str);
+#else
+    putenv(strdup(str));
+#endif
+}
+
+static void report_dropped(const char *name, long size, int devices, int threads, long ops, double ms, double bytes,
+                           long long dropped)
+{
+    printf("%s,%ld,%d,%d,%ld,%.1f,%.1f,%.3f,", name, size, devices, threads, ops,
+           ms * 1000000.0 / ops, ops * 1000.0 / ms, bytes / 1000.0 / ms);
+    if (dropped >= 0)
+        printf("%lld", dropped);
+    printf("\n");
+    fflush(stdout);
+}
+
+static void report(const char *name, long size, int devices, int threads, long ops, double ms, double bytes)
+{
+    report_dropped(name, size, devices, threads, ops, ms, bytes, -1);
+}
+
+/* one query including the complete response, returns the response length or < 0 */
+static long query(int32_t devnum, const char *cmd, char *buf)
+{
+    int32_t ret;
+    long    len;
+    bool    eom;
+
+    ret = winusbtmc_send_string(devnum, cmd);
+    len = 0;
+    while (ret >= 0)
+    {
+        ret = winusbtmc_recv_data(devnum, buf, BENCH_BUFFER, &eom);
+        if (ret >= 0)
+            len += ret;
+        if (eom)
+            break;
+    }
+    return (ret < 0) ? ret : len;
+}
+
+/* the same query done by the I/O thread of the device */
+static long io_query(int32_t devnum, const char *cmd, char *buf)
+{
+    winusbtmc_io_request_t req;
+    int32_t                ret;
+
+    memset(&req, 0, sizeof(req));
+    req.command  = cmd;
+    req.response = buf;
+    req.maxlen   = BENCH_BUFFER;
+    ret = winusbtmc_io_submit(devnum, &req);
+    if (ret >= 0)
+        ret = winusbtmc_io_wait(devnum, &req, -1);
+    return ret;
+}
+
+
+
+/**************************************************************************************************
+ * enumeration and lookup
+ **************************************************************************************************/
+
+static void bench_enumeration(int devices)
+{
+    char   str[256];
+    long   ops;
+    double start, ms;
+    int    i;
+
+    set_sim_devices(devices);
+
+    /* count only, no descriptor strings needed */
+    ops   = 0;
+    start = time_ms();
+    do
+    {
+        winusbtmc_deinit();
+        winusbtmc_init();
+        if (winusbtmc_get_device_count() != devices)
+        {
+            fprintf(stderr, "enumeration found wrong device count\n");
+            exit(1);
+        }
+        ops++;
+    } while ((ms = time_ms() - start) < s_case_ms);
+    report("enumerate_count", 0, devices, 1, ops, ms, 0);
+
+    /* list with all device strings */
+    ops   = 0;
+    start = time_ms();
+    do
+    {
+        winusbtmc_deinit();
+        for (i = 0; i < winusbtmc_get_device_count(); i++)
+            winusbtmc_get_device_string(i, str, sizeof(str));
+        ops++;
+    } while ((ms = time_ms() - start) < s_case_ms);
+    report("enumerate_strings", 0, devices, 1, ops, ms, 0);
+
+    /* lookup of the last device in an initialized table */
+    snprintf(str, sizeof(str), "WinUsbTmc:Simulator:SIM%04d", devices - 1);
+    ops   = 0;
+    start = time_ms();
+    do
+    {
+        if (WINUSBTMC_DEVNUM(winusbtmc_find_devnum_by_string(str)) != devices - 1)
+        {
+            fprintf(stderr, "lookup found wrong device\n");
+            exit(1);
+        }
+        ops++;
+    } while ((ms = time_ms() - start) < s_case_ms);
+    report("find_devnum_by_string", 0, devices, 1, ops, ms, 0);
+
+    winusbtmc_deinit();
+}
+
+
+
+/**************************************************************************************************
+ * transfers of a single device
+ **************************************************************************************************/
+
+static void bench_send_string(long size, char *buf)
+{
+    char  *cmd;
+    long   ops;
+    double start, ms;
+
+    cmd = malloc(size + 1);
+    memset(cmd, 'A', size);
+    cmd[size] = '\0';
+
+    ops   = 0;
+    start = time_ms();
+    do
+    {
+        if (winusbtmc_send_string(0, cmd) < 0)
+        {
+            fprintf(stderr, "send_string failed\n");
+            exit(1);
+        }
+        ops++;
+    } while ((ms = time_ms() - start) < s_case_ms);
+    report("send_string", size, 1, 1, ops, ms, (double)ops * size);
+    free(cmd);
+}
+
+/* "SOUR<n>:VOLT <value>" with changing values, formatted only and sent */
+static void bench_scpi(void)
+{
+    long   ops;
+    double ms;
+
+    ops = bench_scpi_format(s_case_ms, &ms);
+    report("scpi_format", 0, 0, 1, ops, ms, 0);
+    ops = bench_scpi_snprintf(s_case_ms, &ms);
+    report("scpi_snprintf", 0, 0, 1, ops, ms, 0);
+    ops = bench_scpi_send(0, true, s_case_ms, &ms);
+    if (ops > 0)
+        report("scpi_send", 0, 1, 1, ops, ms, 0);
+    ops = bench_scpi_send(0, false, s_case_ms, &ms);
+    if (ops > 0)
+        report("scpi_snprintf_send_string", 0, 1, 1, ops, ms, 0);
+}
+
+static void bench_recv_data(long size, char *buf)
+{
+    char   cmd[32];
+    long   ops, len;
+    double start, ms, bytes;
+
+    snprintf(cmd, sizeof(cmd), "DATA? %ld", size);
+    ops   = 0;
+    bytes = 0;
+    start = time_ms();
+    do
+    {
+        len = query(0, cmd, buf);
+        if (len < size)
+        {
+            fprintf(stderr, "recv_data failed\n");
+            exit(1);
+        }
+        bytes += len;
+        ops++;
+    } while ((ms = time_ms() - start) < s_case_ms);
+    report("recv_data", size, 1, 1, ops, ms, bytes);
+}
+
+static void bench_recv_string(bool profile, char *buf)
+{
+    long    ops;
+    int32_t ret;
+    bool    eom;
+    double  start, ms, bytes;
+
+    winusbtmc_profile(0, profile);
+    ops   = 0;
+    bytes = 0;
+    start = time_ms();
+    do
+    {
+        ret = winusbtmc_send_string(0, "*IDN?");
+        if (ret >= 0)
+            ret = winusbtmc_recv_string(0, buf, 256, &eom);
+        if (ret < 0)
+        {
+            fprintf(stderr, "recv_string failed\n");
+            exit(1);
+        }
+        bytes += ret;
+        ops++;
+    } while ((ms = time_ms() - start) < s_case_ms);
+    winusbtmc_profile(0, false);
+    report((profile) ? "recv_string+profile" : "recv_string", 0, 1, 1, ops, ms, bytes);
+}
+
+
+
+/**************************************************************************************************
+ * parallel transfers, one thread per device or many threads sharing one I/O thread
+ **************************************************************************************************/
+
+typedef struct
+{
+    int32_t devnum;
+    long    size;
+    long    ops;
+    double  bytes;
+    bool    io;                 /* through the I/O thread of the device */
+    bool    failed;
+} bench_thread_t;
+
+static volatile bool s_stop;
+
+#ifdef _WIN32
+static DWORD WINAPI bench_thread(LPVOID arg)
+#else
+static void *bench_thread(void *arg)
+#endif
+{
+    bench_thread_t *pt = arg;
+    char            cmd[32];
+    char           *buf;
+    long            len;
+
+    buf = malloc(BENCH_BUFFER);
+    snprintf(cmd, sizeof(cmd), "DATA? %ld", pt->size);
+    while ( (!s_stop) && (buf) )
+    {
+        len = (pt->io) ? io_query(pt->devnum, cmd, buf) : query(pt->devnum, cmd, buf);
+        if (len < 0)
+        {
+            pt->failed = true;
+            break;
+        }
+        pt->bytes += len;
+        pt->ops++;
+    }
+    free(buf);
+    return 0;
+}
+
+/*
+ * one device per thread, or with io all threads share device 0 through its I/O thread
+ */
+static void bench_threads(int threads, long size, bool io, char *buf)
+{
+    bench_thread_t t[BENCH_MAX_THREADS];
+#ifdef _WIN32
+    HANDLE         handle[BENCH_MAX_THREADS];
+#else
+    pthread_t      handle[BENCH_MAX_THREADS];
+#endif
+    double         start, ms, bytes;
+    long           ops;
+    int            i;
+
+    set_sim_devices((io) ? 1 : threads);
+    winusbtmc_deinit();
+    winusbtmc_init();
+    for (i = 0; i < ((io) ? 1 : threads); i++)
+    { /* open all devices before the threads start, the device table is not thread safe */
+        query(i, "*IDN?", buf);
+    }
+    if ( (io) && (winusbtmc_io_start(0, -1) < 0) )
+    {
+        fprintf(stderr, "io_start failed\n");
+        exit(1);
+    }
+
+    memset(t, 0, sizeof(t));
+    s_stop = false;
+    start  = time_ms();
+    for (i = 0; i < threads; i++)
+    {
+        t[i].devnum = (io) ? 0 : i;
+        t[i].size   = size;
+        t[i].io     = io;
+#ifdef _WIN32
+        handle[i] = CreateThread(NULL, 0, bench_thread, &t[i], 0, NULL);
+#else
+        pthread_create(&handle[i], NULL, bench_thread, &t[i]);
+#endif
+    }
+    while (time_ms() - start < s_case_ms)
+    {
+#ifdef _WIN32
+        Sleep(1);
+#else
+        struct timespec ts = { 0, 1000000 };
+        nanosleep(&ts, NULL);
+#endif
+    }
+    s_stop = true;
+
+    ops   = 0;
+    bytes = 0;
+    for (i = 0; i < threads; i++)
+    {
+#ifdef _WIN32
+        WaitForSingleObject(handle[i], INFINITE);
+        CloseHandle(handle[i]);
+#else
+        pthread_join(handle[i], NULL);
+#endif
+        if (t[i].failed)
+        {
+            fprintf(stderr, "transfer of thread %d failed\n", i);
+            exit(1);
+        }
+        ops   += t[i].ops;
+        bytes += t[i].bytes;
+    }
+    ms = time_ms() - start;
+    if (io)
+        winusbtmc_io_stop(0);
+    report((io) ? "io_shared_device" : "parallel_recv_data", size, (io) ? 1 : threads, threads, ops, ms, bytes);
+    winusbtmc_deinit();
+}
+
+
+
+/**************************************************************************************************
+ * waveform conversion, one operation is one sample
+ **************************************************************************************************/
+
+#define BENCH_SAMPLES  (1024 * 1024)
+
+static void bench_convert(int32_t level, int32_t format, const char *name, bool dbl, char *buf)
+{
+    static const char * const isa[] = { "scalar", "sse2", "avx2" };
+    char    str[64];
+    void   *dst;
+    long    ops;
+    double  start, ms;
+    int32_t size;
+
+    if (winusbtmc_convert_simd(level) != level)
+        return; /* not supported by this cpu */
+
+    dst = malloc(BENCH_SAMPLES * (dbl ? sizeof(double) : sizeof(float)));
+    if (!dst)
+        return;
+    size = ( (format == WINUSBTMC_SAMPLE_INT8) || (format == WINUSBTMC_SAMPLE_UINT8) ) ? 1 : 2;
+
+    ops   = 0;
+    start = time_ms();
+    do
+    {
+        if (dbl)
+            winusbtmc_convert_double(dst, buf, BENCH_SAMPLES / size, format, 0.04, -5.0);
+        else
+            winusbtmc_convert_float(dst, buf, BENCH_SAMPLES / size, format, 0.04f, -5.0f);
+        ops += BENCH_SAMPLES / size;
+    } while ((ms = time_ms() - start) < s_case_ms);
+    snprintf(str, sizeof(str), "convert_%s_%s_%s", dbl ? "double" : "float", name, isa[level]);
+    report(str, BENCH_SAMPLES / size, 0, 1, ops, ms, (double)ops * size);
+    free(dst);
+}
+
+
+
+/* a record of 24M samples in chunks of BENCH_SAMPLES bytes to 1000 points */
+static void bench_decimate(int32_t level, int32_t format, const char *name, char *buf)
+{
+    static const char * const isa[] = { "scalar", "sse2", "avx2" };
+    winusbtmc_decimate_t state;
+    float                min[1000], max[1000], mean[1000];
+    char                 str[64];
+    long                 ops, total;
+    double               start, ms;
+    int32_t              size, i;
+
+    if (winusbtmc_convert_simd(level) != level)
+        return;
+    size  = ( (format == WINUSBTMC_SAMPLE_INT8) || (format == WINUSBTMC_SAMPLE_UINT8) ) ? 1 : 2;
+    total = 24L * 1024 * 1024;
+
+    ops   = 0;
+    start = time_ms();
+    do
+    {
+        winusbtmc_decimate_init(&state, format, total, 1000, 0.04f, -5.0f, min, max, mean);
+        for (i = 0; i < total * size / BENCH_SAMPLES; i++)
+            winusbtmc_decimate(&state, buf, BENCH_SAMPLES);
+        ops += total;
+    } while ((ms = time_ms() - start) < s_case_ms);
+    snprintf(str, sizeof(str), "decimate_%s_%s", name, isa[level]);
+    report(str, total, 0, 1, ops, ms, (double)ops * size);
+}
+
+
+static void bench_stats(int32_t level, int32_t format, const char *name, uint32_t bins, char *buf)
+{
+    static const char * const isa[] = { "scalar", "sse2", "avx2" };
+    static uint32_t      histogram[65536];
+    winusbtmc_stats_t    state;
+    char                 str[64];
+    long                 ops, total;
+    double               start, ms;
+    int32_t              size, i;
+
+    if (winusbtmc_convert_simd(level) != level)
+        return;
+    size  = ( (format == WINUSBTMC_SAMPLE_INT8) || (format == WINUSBTMC_SAMPLE_UINT8) ) ? 1 : 2;
+    total = 24L * 1024 * 1024;
+
+    ops   = 0;
+    start = time_ms();
+    do
+    {
+        winusbtmc_stats_init(&state, format, 0.04, -5.0, (bins) ? histogram : 0, bins);
+        for (i = 0; i < total * size / BENCH_SAMPLES; i++)
+            winusbtmc_stats_add(&state, buf, BENCH_SAMPLES);
+        winusbtmc_stats_finish(&state);
+        ops += total;
+    } while ((ms = time_ms() - start) < s_case_ms);
+    snprintf(str, sizeof(str), "stats_%s%s_%s", name, (bins) ? "_hist" : "", isa[level]);
+    report(str, total, 0, 1, ops, ms, (double)ops * size);
+}
+
+/* continuous acquisition, one operation is one response taken by the consumer */
+static void bench_acquire(long size)
+{
+    winusbtmc_acquire_buffer_t buf;
+    char                       cmd[32];
+    long                       ops;
+    double                     start, ms;
+
+    snprintf(cmd, sizeof(cmd), "DATA? %ld", size);
+    if (winusbtmc_acquire_start(0, cmd, 8, size + 16) < 0)
+        return;
+    ops   = 0;
+    start = time_ms();
+    do
+    {
+        if (winusbtmc_acquire_get(0, &buf, -1) < 0)
+        {
+            winusbtmc_acquire_stop(0);
+            return;
+        }
+        winusbtmc_acquire_release(0);
+        ops++;
+    } while ((ms = time_ms() - start) < s_case_ms);
+    winusbtmc_acquire_stop(0);
+    report_dropped("acquire", size, 1, 2, ops, ms, (double)ops * size, (long long)buf.overruns);
+}
+
+/* waveform archive, one capture of 16M samples in chunks of BENCH_SAMPLES bytes, written and read back */
+static void bench_archive(int32_t format, const char *name, char *buf)
+{
+    static const char        file[] = "WinUsbTmcBench.wtmc";
+    winusbtmc_archive_t     *parc;
+    winusbtmc_archive_info_t info;
+    char                     str[64];
+    void                    *dst;
+    long                     ops, total;
+    double                   start, ms;
+    int32_t                  size, i;
+
+    size  = ( (format == WINUSBTMC_SAMPLE_INT8) || (format == WINUSBTMC_SAMPLE_UINT8) ) ? 1 : 2;
+    total = 16L * 1024 * 1024;
+    dst   = malloc(total * size);
+    if (!dst)
+        return;
+
+    ops   = 0;
+    start = time_ms();
+    do
+    {
+        if (winusbtmc_archive_create(&parc, file) < 0)
+            break;
+        winusbtmc_archive_begin(parc, format, 0, 0, 0);
+        for (i = 0; i < total * size / BENCH_SAMPLES; i++)
+            winusbtmc_archive_add(parc, buf, BENCH_SAMPLES);
+        winusbtmc_archive_end(parc);
+        winusbtmc_archive_close(parc);
+        ops += total;
+    } while ((ms = time_ms() - start) < s_case_ms);
+
+    info.stored = 0;
+    if ( (ops > 0) && (winusbtmc_archive_open(&parc, file) == WINUSBTMC_ERR_NONE) )
+    {
+        winusbtmc_archive_info(parc, 0, &info);
+        winusbtmc_archive_close(parc);
+        snprintf(str, sizeof(str), "archive_write_%s", name);
+        report(str, (long)info.stored, 0, 1, ops, ms, (double)ops * size);
+
+        ops   = 0;
+        start = time_ms();
+        do
+        {
+            if (winusbtmc_archive_open(&parc, file) < 0)
+                break;
+            winusbtmc_archive_read(parc, 0, 0, 0, dst, total);
+            winusbtmc_archive_close(parc);
+            ops += total;
+        } while ((ms = time_ms() - start) < s_case_ms);
+        snprintf(str, sizeof(str), "archive_read_%s", name);
+        report(str, (long)info.stored, 0, 1, ops, ms, (double)ops * size);
+    }
+    remove(file);
+    free(dst);
+}
+
+/* capture store, responses of size bytes appended, then random captures of the mapped store */
+static void bench_store(long size, char *buf)
+{
+    static const char       file[] = "WinUsbTmcBench.st";
+    winusbtmc_store_t      *pstore;
+    winusbtmc_store_entry_t entry;
+    long                    ops;
+    double                  start, ms;
+    int32_t                 count;
+    uint32_t                seed;
+
+    remove(file);
+    remove("WinUsbTmcBench.st.idx");
+    if (winusbtmc_store_create(&pstore, file) < 0)
+        return;
+    ops   = 0;
+    start = time_ms();
+    do
+    {
+        if (winusbtmc_store_add(pstore, 0, 0, buf, size) < 0)
+        {
+            winusbtmc_store_close(pstore);
+            return;
+        }
+        ops++;
+    } while ((ms = time_ms() - start) < s_case_ms);
+    winusbtmc_store_close(pstore);
+    report("store_add", size, 0, 1, ops, ms, (double)ops * size);
+
+    /* the time is read once per 1024 lookups, a byte of each response is read (no copy, no mb/s) */
+    if (winusbtmc_store_open(&pstore, file) == WINUSBTMC_ERR_NONE)
+    {
+        count = winusbtmc_store_count(pstore);
+        ops   = 0;
+        seed  = 1;
+        start = time_ms();
+        while ( (count > 0) && ( ((ops & 1023) != 0) || ((ms = time_ms() - start) < s_case_ms) ) )
+        {
+            seed = seed * 1103515245 + 12345;
+            winusbtmc_store_get(pstore, (seed >> 8) % count, &entry);
+            s_sink = entry.dat[entry.len / 2];
+            ops++;
+        }
+        winusbtmc_store_close(pstore);
+        if (count > 0)
+            report("store_get", count, 0, 1, ops, ms, 0);
+    }
+    remove(file);
+    remove("WinUsbTmcBench.st.idx");
+}
+
+/* consumer of the shared memory ring, touches the first byte of every response */
+#ifdef _WIN32
+static DWORD WINAPI bench_shm_consumer(LPVOID arg)
+#else
+static void *bench_shm_consumer(void *arg)
+#endif
+{
+    winusbtmc_shm_t      *pshm;
+    winusbtmc_shm_entry_t entry;
+    long                 *pops = arg;
+
+    if (winusbtmc_shm_open(&pshm, "WinUsbTmcBench") < 0)
+        return 0;
+    while (winusbtmc_shm_get(pshm, &entry, -1) == 1)
+    {
+        s_sink = entry.dat[0];
+        winusbtmc_shm_release(pshm);
+        (*pops)++;
+    }
+    winusbtmc_shm_close(pshm);
+    return 0;
+}
+
+/* responses received into a shared memory ring of 8 slots and taken by a consumer thread */
+static void bench_shm(long size)
+{
+    winusbtmc_shm_t *pshm;
+    char             cmd[32];
+    long             ops;
+    double           start, ms;
+#ifdef _WIN32
+    HANDLE           thread;
+#else
+    pthread_t        thread;
+#endif
+
+    if (winusbtmc_shm_create(&pshm, "WinUsbTmcBench", 8, size + 16) < 0)
+        return;
+    ops = 0;
+#ifdef _WIN32
+    thread = CreateThread(NULL, 0, bench_shm_consumer, &ops, 0, NULL);
+#else
+    pthread_create(&thread, NULL, bench_shm_consumer, &ops);
+#endif
+
+    snprintf(cmd, sizeof(cmd), "DATA? %ld", size);
+    start = time_ms();
+    do
+    {
+        if ( (winusbtmc_send_string(0, cmd) < 0) || (winusbtmc_recv_shm(0, pshm, -1) < 0) )
+            break;
+    } while (time_ms() - start < s_case_ms);
+    winusbtmc_shm_close(pshm); /* the consumer takes the rest and ends */
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+    ms = time_ms() - start;
+    report("shm", size, 1, 2, ops, ms, (double)ops * size);
+}
+
+/* statistics of a received record, processed after each chunk (serial) or overlapped with the next transfer */
+static void bench_recv_stats(long size, bool overlapped, char *buf)
+{
+    winusbtmc_stats_t state;
+    char              cmd[32];
+    long              ops;
+    double            start, ms;
+    int32_t           ret;
+    bool              eom;
+
+    snprintf(cmd, sizeof(cmd), "DATA? %ld", size);
+    ops   = 0;
+    start = time_ms();
+    do
+    {
+        winusbtmc_stats_init(&state, WINUSBTMC_SAMPLE_UINT8, 0.04, -5.0, 0, 0);
+        winusbtmc_send_string(0, cmd);
+        if (overlapped)
+        {
+            winusbtmc_recv_stats(0, &state);
+        }
+        else
+        {
+            do
+            {
+                ret = winusbtmc_recv_data(0, buf, BENCH_BUFFER, &eom);
+                if (ret >= 0)
+                    winusbtmc_stats_add(&state, buf, ret);
+            } while ( (ret >= 0) && (!eom) );
+            winusbtmc_stats_finish(&state);
+        }
+        ops++;
+    } while ((ms = time_ms() - start) < s_case_ms);
+    report((overlapped) ? "recv_stats" : "recv_stats_serial", size, 1, 1, ops, ms, (double)ops * size);
+}
+
+
+/**************************************************************************************************
+ * ASCII numbers, one operation is one number
+ **************************************************************************************************/
+
+#define BENCH_NUMBERS  (65536)
+#define BENCH_CHUNK    (16384)
+
+static void bench_parse(const char *format, const char *name)
+{
+    winusbtmc_numbers_t state;
+    char                str[64];
+    char               *text, *p, *end;
+    double             *dst;
+    long                ops, len, pos, n;
+    double              start, ms;
+    int                 i;
+
+    text = malloc(BENCH_NUMBERS * 32);
+    dst  = malloc((BENCH_CHUNK / 2 + 2) * sizeof(double));
+    if ( (!text) || (!dst) )
+        exit(1);
+    len = 0;
+    for (i = 0; i < BENCH_NUMBERS; i++)
+        len += sprintf(&text[len], format, (i - BENCH_NUMBERS / 2) * 1.2345e-5, (i + 1 < BENCH_NUMBERS) ? "," : "\n");
+
+    /* in chunks like they are received */
+    ops   = 0;
+    start = time_ms();
+    do
+    {
+        memset(&state, 0, sizeof(state));
+        for (pos = 0; pos < len; pos += BENCH_CHUNK)
+        {
+            n = (len - pos < BENCH_CHUNK) ? len - pos : BENCH_CHUNK;
+            ops += winusbtmc_parse_numbers(&state, &text[pos], n, pos + n == len, dst, BENCH_CHUNK / 2 + 2);
+        }
+    } while ((ms = time_ms() - start) < s_case_ms);
+    snprintf(str, sizeof(str), "parse_numbers_%s", name);
+    report(str, len, 0, 1, ops, ms, (double)len * ops / BENCH_NUMBERS);
+
+    /* one strtod per number on the complete response */
+    ops   = 0;
+    start = time_ms();
+    do
+    {
+        for (p = text, n = 0; *p; p = (*end) ? end + 1 : end)
+            dst[n++ % (BENCH_CHUNK / 2)] = strtod(p, &end);
+        ops += n;
+    } while ((ms = time_ms() - start) < s_case_ms);
+    snprintf(str, sizeof(str), "parse_strtod_%s", name);
+    report(str, len, 0, 1, ops, ms, (double)len * ops / BENCH_NUMBERS);
+
+    free(dst);
+    free(text);
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    static const int  devices[] = { 1, 8, 32, 128 };
+    static const long sizes[]   = { 16, 1024, 65536, 1024 * 1024 };
+    static const int  threads[] = { 1, 2, 4, 8 };
+    char             *buf;
+    unsigned int      i;
+
+    if (argc > 1)
+        s_case_ms = atof(argv[1]);
+
+    buf = malloc(BENCH_BUFFER);
+    if (!buf)
+        return 1;
+
+#ifdef _WIN32
+    _putenv("WINUSBTMC_SIM_LATENCY=0");
+#else
+    putenv("WINUSBTMC_SIM_LATENCY=0");
+#endif
+
+    printf("case,size,devices,threads,operations,ns_per_op,ops_per_s,mb_per_s,dropped\n");
+
+    for (i = 0; i < sizeof(devices) / sizeof(devices[0]); i++)
+        bench_enumeration(devices[i]);
+
+    set_sim_devices(1);
+    winusbtmc_init();
+    query(0, "*IDN?", buf); /* open the device */
+    bench_recv_string(false, buf);
+    bench_recv_string(true, buf);
+    for (i = 0; i < 3; i++)
+        bench_send_string(sizes[i], buf);
+    bench_scpi();
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        bench_recv_data(sizes[i], buf);
+    bench_recv_stats(16L * 1024 * 1024, false, buf);
+    bench_recv_stats(16L * 1024 * 1024, true, buf);
+    bench_acquire(16);
+    bench_acquire(65536);
+    bench_shm(65536);
+    bench_shm(1024 * 1024);
+    winusbtmc_deinit();
+
+    for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i++)
+    {
+        bench_threads(threads[i], 16, false, buf);
+        bench_threads(threads[i], 65536, false, buf);
+        bench_threads(threads[i], 16, true, buf);
+    }
+
+    for (i = 0; i < BENCH_SAMPLES; i++)
+        buf[i] = (char)(i * 7);
+    for (i = WINUSBTMC_SIMD_NONE; i <= WINUSBTMC_SIMD_AVX2; i++)
+    {
+        bench_convert(i, WINUSBTMC_SAMPLE_INT8, "int8", false, buf);
+        bench_convert(i, WINUSBTMC_SAMPLE_UINT8, "uint8", false, buf);
+        bench_convert(i, WINUSBTMC_SAMPLE_INT16_LE, "int16le", false, buf);
+        bench_convert(i, WINUSBTMC_SAMPLE_INT16_BE, "int16be", false, buf);
+        bench_convert(i, WINUSBTMC_SAMPLE_UINT8, "uint8", true, buf);
+        bench_convert(i, WINUSBTMC_SAMPLE_INT16_LE, "int16le", true, buf);
+        bench_decimate(i, WINUSBTMC_SAMPLE_UINT8, "uint8", buf);
+        bench_decimate(i, WINUSBTMC_SAMPLE_INT16_BE, "int16be", buf);
+        bench_stats(i, WINUSBTMC_SAMPLE_INT8, "int8", 0, buf);
+        bench_stats(i, WINUSBTMC_SAMPLE_INT16_LE, "int16le", 0, buf);
+        bench_stats(i, WINUSBTMC_SAMPLE_INT16_LE, "int16le", 256, buf);
+    }
+    winusbtmc_convert_simd(-1);
+    bench_archive(WINUSBTMC_SAMPLE_UINT8, "uint8", buf);
+    bench_archive(WINUSBTMC_SAMPLE_INT16_BE, "int16be", buf);
+    bench_store(1024, buf);
+    bench_store(65536, buf);
+
+    bench_parse("%+.5E%s", "e5");
+    bench_parse("%+.9E%s", "e9");
+    bench_parse("%.17g%s", "g17");
+
+    free(buf);
+    return 0;
+}
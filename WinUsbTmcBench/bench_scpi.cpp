@@ -0,0 +1,72 @@
+/*
+ * benchmark of the SCPI command templates (winusbtmc_scpi.hpp), called by bench.c.
+ * A sweep command "SOUR<n>:VOLT <value>" is formatted with winusbtmc::format and, for comparison, with snprintf,
+ * then sent to a simulated device with winusbtmc::send and with snprintf + winusbtmc_send_string.
+ * Every function runs for case_ms, stores the elapsed time in *pms and returns the count of commands.
+ */
+#include <chrono>
+#include <cstdio>
+#include "../WinUsbTmc/winusbtmc_scpi.hpp"
+
+static constexpr winusbtmc::scpi_command sour_volt("SOUR<n>:VOLT <value>");
+
+static volatile char s_scpi_sink;  /* bytes read only to touch them */
+
+/* milliseconds since start */
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+extern "C" long bench_scpi_format(double case_ms, double *pms)
+{
+    char buf[64];
+    long ops = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    do
+    {
+        s_scpi_sink = buf[winusbtmc::format<sour_volt>(buf, sizeof(buf), (int)(ops & 3) + 1, 0.001 * ops) - 1];
+        ops++;
+    } while ( ((ops & 1023) != 0) || ((*pms = elapsed_ms(start)) < case_ms) );
+    return ops;
+}
+
+extern "C" long bench_scpi_snprintf(double case_ms, double *pms)
+{
+    char buf[64];
+    long ops = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    do
+    {
+        s_scpi_sink = buf[std::snprintf(buf, sizeof(buf), "SOUR%d:VOLT %.17g", (int)(ops & 3) + 1, 0.001 * ops) - 1];
+        ops++;
+    } while ( ((ops & 1023) != 0) || ((*pms = elapsed_ms(start)) < case_ms) );
+    return ops;
+}
+
+extern "C" long bench_scpi_send(int32_t devnum, bool template_send, double case_ms, double *pms)
+{
+    char    buf[64];
+    int32_t ret;
+    long    ops = 0;
+    auto    start = std::chrono::steady_clock::now();
+
+    do
+    {
+        if (template_send)
+        {
+            ret = winusbtmc::send<sour_volt>(devnum, (int)(ops & 3) + 1, 0.001 * ops);
+        }
+        else
+        {
+            std::snprintf(buf, sizeof(buf), "SOUR%d:VOLT %.17g", (int)(ops & 3) + 1, 0.001 * ops);
+            ret = winusbtmc_send_string(devnum, buf);
+        }
+        if (ret < 0)
+            return ret;
+        ops++;
+    } while ((*pms = elapsed_ms(start)) < case_ms);
+    return ops;
+}
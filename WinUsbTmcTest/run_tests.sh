@@ -0,0 +1,58 @@
+#!/bin/sh
+# Builds and runs the tests of WinUsbTmcTest.cbp with gcc on Linux, e.g. for a CI job.
+# Needs the libusb-1.0 headers (libusb-1.0-0-dev), not the library.
+# usage: run_tests.sh [build directory, default ./build]
+cd "$(dirname "$0")" || exit 1
+out=${1:-build}
+mkdir -p "$out" || exit 1
+
+lib=$(ls ../WinUsbTmc/winusbtmc*.c)
+cflags="-O2 -Wall -std=gnu99"
+cxxflags="-O2 -Wall -std=gnu++17"
+libs="-lpthread -lrt -lm"
+failed=0
+
+run()
+{
+    name=$1
+    shift
+    if "$@"; then
+        echo "ok      $name"
+    else
+        echo "FAILED  $name"
+        failed=1
+    fi
+}
+
+# succeeds if the command fails, for code which must not compile
+fails()
+{
+    ! "$@" 2>/dev/null
+}
+
+# the library compiled as C into $out/obj_<name> with -D<define>, for the C++ tests
+build_objects()
+{
+    mkdir -p "$out/obj_$1" || return 1
+    for f in $lib; do
+        gcc $cflags -D$2 -c -o "$out/obj_$1/$(basename "$f" .c).o" "$f" || return 1
+    done
+}
+
+run build_libusb1 gcc $cflags -DWINUSBTMC_LIBUSB1 -o "$out/test_libusb1" $lib test_libusb1.c $libs
+run test_libusb1 "$out/test_libusb1"
+
+run build_tcp gcc $cflags -DWINUSBTMC_SIMPORT -o "$out/test_tcp" $lib test_tcp.c $libs
+run test_tcp "$out/test_tcp"
+
+run build_profiler gcc $cflags -DWINUSBTMC_SIMPORT -o "$out/test_profiler" $lib test_profiler.c $libs
+run test_profiler "$out/test_profiler"
+
+run build_objects_simport build_objects simport WINUSBTMC_SIMPORT
+run build_scpi g++ $cxxflags -DWINUSBTMC_SIMPORT -o "$out/test_scpi" test_scpi.cpp "$out"/obj_simport/*.o $libs
+run test_scpi "$out/test_scpi"
+for n in 1 2 3 4 5 6 7; do
+    run scpi_negative_$n fails g++ $cxxflags -fsyntax-only -DSCPI_NEGATIVE=$n test_scpi.cpp
+done
+
+exit $failed
@@ -0,0 +1,545 @@
+/*
+ * test of the libusb-1.0 usb port (winusbtmc_libusb1.c) without usb hardware.
+ * The library is built with -DWINUSBTMC_LIBUSB1 and linked against the libusb-1.0 functions below instead of
+ * -lusb-1.0. They pass the transfers to the simulated usbtmc devices of winusbtmc_simport.c, so enumeration,
+ * descriptor strings, the synchronous transfers of small reads and the queued bulk-in transfers of large reads
+ * run through the unchanged port layer. Asynchronous transfers complete in submission order in
+ * libusb_handle_events_timeout_completed, like on a real endpoint.
+ *
+ * usage: test_libusb1, returns 0 if all checks passed
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+/* the declaration differs between libusb versions (enum or int parameters), the definition below fits both */
+#define libusb_hotplug_register_callback libusb_hotplug_register_callback_declared
+#include <libusb-1.0/libusb.h>
+#undef libusb_hotplug_register_callback
+
+/* the simulated devices, with their port functions renamed so they do not collide with winusbtmc_libusb1.c */
+#define WINUSBTMC_SIMPORT
+#define winusbtmc_usbport_init          sim_init
+#define winusbtmc_usbport_deinit        sim_deinit
+#define winusbtmc_usbport_changed       sim_changed
+#define winusbtmc_usbport_deviceindex   sim_deviceindex
+#define winusbtmc_usbport_get_strings   sim_get_strings
+#define winusbtmc_usbport_open          sim_open
+#define winusbtmc_usbport_close         sim_close
+#define winusbtmc_usbport_claim         sim_claim
+#define winusbtmc_usbport_control_in    sim_control_in
+#define winusbtmc_usbport_clear_halt    sim_clear_halt
+#define winusbtmc_usbport_bulk_write    sim_bulk_write
+#define winusbtmc_usbport_bulk_read     sim_bulk_read
+#include "../WinUsbTmc/winusbtmc_simport.c"
+
+#include "../WinUsbTmc/winusbtmc.h"
+
+#define TEST_DEVICES  (2)
+#define TEST_QUEUED   (4)                 /* WINUSBTMC_LIBUSB1_QUEUED */
+#define TEST_BUFFER   (1024 * 1024 + 64)
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); s_failed++; } } while (0)
+
+static int s_failed = 0;
+
+
+
+/**************************************************************************************************
+ * libusb-1.0 on top of the simulated devices
+ **************************************************************************************************/
+
+struct libusb_context
+{
+    int dummy;
+};
+
+struct libusb_device
+{
+    int index;
+};
+
+struct libusb_device_handle
+{
+    winusbtmc_device_t      sim;         /* the simulated device as seen by winusbtmc_simport.c */
+    winusbtmc_device_id_t   simid;
+    int                     config;      /* active configuration */
+    bool                    claimed;
+    char                   *staged;      /* bulk-in transfer of the device which is not read yet */
+    uint32_t                stagedsize;
+    uint32_t                stagedlen;
+    uint32_t                stagedpos;
+    uint32_t                requested;   /* TransferSize of the last REQUEST_DEV_DEP_MSG_IN */
+};
+
+static struct libusb_context   s_ctx;
+static struct libusb_device    s_devices[TEST_DEVICES];
+static pthread_mutex_t         s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t         s_events = PTHREAD_MUTEX_INITIALIZER; /* libusb_lock_events */
+
+static struct libusb_transfer *s_queue[64];     /* submitted asynchronous transfers in order */
+static bool                    s_cancelled[64];
+static int                     s_queued     = 0;
+static int                     s_max_queued = 0; /* max. count of transfers submitted at the same time */
+static int                     s_async      = 0; /* count of completed asynchronous transfers */
+static int                     s_set_config = 0; /* count of libusb_set_configuration calls */
+static int                     s_contexts   = 0; /* count of contexts not released by libusb_exit */
+
+static const struct libusb_endpoint_descriptor s_endpoints[3] =
+{
+    { 7, 5, 0x01, LIBUSB_TRANSFER_TYPE_BULK,      512, 0 },
+    { 7, 5, 0x82, LIBUSB_TRANSFER_TYPE_BULK,      512, 0 },
+    { 7, 5, 0x83, LIBUSB_TRANSFER_TYPE_INTERRUPT,   8, 1 },
+};
+static const struct libusb_interface_descriptor s_ifdesc =
+{
+    .bLength = 9, .bDescriptorType = 4, .bInterfaceNumber = 0, .bAlternateSetting = 0, .bNumEndpoints = 3,
+    .bInterfaceClass = 0xfe, .bInterfaceSubClass = 0x03, .bInterfaceProtocol = 0x01, .endpoint = s_endpoints
+};
+static const struct libusb_interface s_interface = { .altsetting = &s_ifdesc, .num_altsetting = 1 };
+
+
+int LIBUSB_CALL libusb_init(libusb_context **ctx)
+{
+    int i;
+
+    for (i = 0; i < TEST_DEVICES; i++)
+        s_devices[i].index = i;
+    sim_init();
+    *ctx = &s_ctx;
+    s_contexts++;
+    return LIBUSB_SUCCESS;
+}
+
+void LIBUSB_CALL libusb_exit(libusb_context *ctx)
+{
+    s_contexts--;
+}
+
+int LIBUSB_CALL libusb_has_capability(uint32_t capability)
+{
+    return 0; /* no hotplug, winusbtmc_usbport_changed reports no changes */
+}
+
+int LIBUSB_CALL libusb_hotplug_register_callback(libusb_context *ctx, int events, int flags, int vendor_id, int product_id,
+                                                 int dev_class, libusb_hotplug_callback_fn cb_fn, void *user_data,
+                                                 libusb_hotplug_callback_handle *callback_handle)
+{
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+void LIBUSB_CALL libusb_hotplug_deregister_callback(libusb_context *ctx, libusb_hotplug_callback_handle callback_handle)
+{
+}
+
+ssize_t LIBUSB_CALL libusb_get_device_list(libusb_context *ctx, libusb_device ***list)
+{
+    libusb_device **plist;
+    int             i;
+
+    plist = calloc(TEST_DEVICES + 1, sizeof(libusb_device *));
+    if (!plist)
+        return LIBUSB_ERROR_NO_MEM;
+    for (i = 0; i < TEST_DEVICES; i++)
+        plist[i] = &s_devices[i];
+    *list = plist;
+    return TEST_DEVICES;
+}
+
+void LIBUSB_CALL libusb_free_device_list(libusb_device **list, int unref_devices)
+{
+    free(list);
+}
+
+int LIBUSB_CALL libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc)
+{
+    memset(desc, 0, sizeof(*desc));
+    desc->bLength            = 18;
+    desc->bDescriptorType    = 1;
+    desc->bcdUSB             = 0x0200;
+    desc->idVendor           = 0x1234; /* no quirk table entry */
+    desc->idProduct          = 0x5678;
+    desc->bcdDevice          = 0x0100;
+    desc->iManufacturer      = 1;
+    desc->iProduct           = 2;
+    desc->iSerialNumber      = 3;
+    desc->bNumConfigurations = 1;
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_get_config_descriptor(libusb_device *dev, uint8_t config_index, struct libusb_config_descriptor **config)
+{
+    struct libusb_config_descriptor *pconfig;
+
+    pconfig = calloc(1, sizeof(*pconfig));
+    if (!pconfig)
+        return LIBUSB_ERROR_NO_MEM;
+    pconfig->bLength             = 9;
+    pconfig->bDescriptorType     = 2;
+    pconfig->bNumInterfaces      = 1;
+    pconfig->bConfigurationValue = 1;
+    pconfig->interface           = &s_interface;
+    *config = pconfig;
+    return LIBUSB_SUCCESS;
+}
+
+void LIBUSB_CALL libusb_free_config_descriptor(struct libusb_config_descriptor *config)
+{
+    free(config);
+}
+
+uint8_t LIBUSB_CALL libusb_get_bus_number(libusb_device *dev)
+{
+    return 250; /* not a bus of the machine, so no kernel driver is found in sysfs */
+}
+
+uint8_t LIBUSB_CALL libusb_get_device_address(libusb_device *dev)
+{
+    return (uint8_t)(dev->index + 2);
+}
+
+int LIBUSB_CALL libusb_get_port_numbers(libusb_device *dev, uint8_t *port_numbers, int port_numbers_len)
+{
+    port_numbers[0] = (uint8_t)(dev->index + 1);
+    return 1;
+}
+
+int LIBUSB_CALL libusb_open(libusb_device *dev, libusb_device_handle **dev_handle)
+{
+    libusb_device_handle *phandle;
+
+    phandle = calloc(1, sizeof(*phandle));
+    if (!phandle)
+        return LIBUSB_ERROR_NO_MEM;
+    phandle->sim.id  = &phandle->simid;
+    phandle->sim.dev = (void *)(intptr_t)(dev->index + 1);
+    phandle->config  = 1;
+    if (sim_open(&phandle->sim) < 0)
+    {
+        free(phandle);
+        return LIBUSB_ERROR_IO;
+    }
+    *dev_handle = phandle;
+    return LIBUSB_SUCCESS;
+}
+
+void LIBUSB_CALL libusb_close(libusb_device_handle *dev_handle)
+{
+    sim_close(&dev_handle->sim);
+    free(dev_handle->staged);
+    free(dev_handle);
+}
+
+int LIBUSB_CALL libusb_get_string_descriptor_ascii(libusb_device_handle *dev_handle, uint8_t desc_index, unsigned char *data, int length)
+{
+    char strings[3][64];
+
+    sim_get_strings(&dev_handle->sim, strings[0], strings[1], strings[2], sizeof(strings[0]));
+    if ( (desc_index < 1) || (desc_index > 3) )
+        return LIBUSB_ERROR_IO;
+    snprintf((char *)data, length, "%s", strings[desc_index - 1]);
+    return (int)strlen((char *)data);
+}
+
+int LIBUSB_CALL libusb_set_auto_detach_kernel_driver(libusb_device_handle *dev_handle, int enable)
+{
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_get_configuration(libusb_device_handle *dev_handle, int *config)
+{
+    *config = dev_handle->config;
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_set_configuration(libusb_device_handle *dev_handle, int configuration)
+{
+    s_set_config++;
+    if (dev_handle->claimed)
+        return LIBUSB_ERROR_IO; /* LIBUSB_ERROR_BUSY of real devices */
+    dev_handle->config = configuration;
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_claim_interface(libusb_device_handle *dev_handle, int interface_number)
+{
+    dev_handle->claimed = true;
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_release_interface(libusb_device_handle *dev_handle, int interface_number)
+{
+    dev_handle->claimed = false;
+    return LIBUSB_SUCCESS;
+}
+
+int LIBUSB_CALL libusb_control_transfer(libusb_device_handle *dev_handle, uint8_t request_type, uint8_t bRequest,
+                                        uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout)
+{
+    if (request_type & LIBUSB_ENDPOINT_IN)
+    {
+        dev_handle->stagedlen = 0; /* INITIATE_CLEAR discards the bulk-in transfer in progress */
+        return sim_control_in(&dev_handle->sim, bRequest, wValue, (char *)data, wLength);
+    }
+    return LIBUSB_ERROR_IO;
+}
+
+int LIBUSB_CALL libusb_clear_halt(libusb_device_handle *dev_handle, unsigned char endpoint)
+{
+    return sim_clear_halt(&dev_handle->sim, endpoint);
+}
+
+/*
+ * next part of the bulk-in transfer of the device, up to length bytes. Returns -1 if the device has nothing
+ * to send (a real device would NAK until the timeout). A part shorter than length ends with a short packet.
+ */
+static int s_bulk_in(libusb_device_handle *dev_handle, unsigned char *data, int length)
+{
+    int ret, n;
+
+    if (dev_handle->stagedpos >= dev_handle->stagedlen)
+    {
+        if (dev_handle->stagedsize < dev_handle->requested + 16)
+        {
+            free(dev_handle->staged);
+            dev_handle->stagedsize = dev_handle->requested + 16;
+            dev_handle->staged     = malloc(dev_handle->stagedsize);
+            if (!dev_handle->staged)
+                dev_handle->stagedsize = 0;
+        }
+        ret = sim_bulk_read(&dev_handle->sim, dev_handle->staged, dev_handle->stagedsize);
+        if (ret < 0)
+            return -1;
+        dev_handle->stagedlen = ret;
+        dev_handle->stagedpos = 0;
+    }
+    n = dev_handle->stagedlen - dev_handle->stagedpos;
+    if (n > length)
+        n = length;
+    memcpy(data, &dev_handle->staged[dev_handle->stagedpos], n);
+    dev_handle->stagedpos += n;
+    return n;
+}
+
+int LIBUSB_CALL libusb_bulk_transfer(libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *data,
+                                     int length, int *actual_length, unsigned int timeout)
+{
+    int ret;
+
+    if (endpoint & LIBUSB_ENDPOINT_IN)
+    {
+        ret = s_bulk_in(dev_handle, data, length);
+        if (ret < 0)
+            return LIBUSB_ERROR_TIMEOUT;
+    }
+    else
+    {
+        if ( (length >= (int)sizeof(winusbtmc_bulkout_header_t)) && (data[0] == WINUSBTMC_DEV_DEP_MSG_IN) )
+            dev_handle->requested = ((winusbtmc_bulkout_header_t *)data)->TransferSize;
+        ret = sim_bulk_write(&dev_handle->sim, (const char *)data, length);
+        if (ret < 0)
+            return LIBUSB_ERROR_IO;
+    }
+    *actual_length = ret;
+    return LIBUSB_SUCCESS;
+}
+
+struct libusb_transfer * LIBUSB_CALL libusb_alloc_transfer(int iso_packets)
+{
+    return calloc(1, sizeof(struct libusb_transfer));
+}
+
+void LIBUSB_CALL libusb_free_transfer(struct libusb_transfer *transfer)
+{
+    free(transfer);
+}
+
+int LIBUSB_CALL libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+    int ret = LIBUSB_ERROR_IO;
+
+    pthread_mutex_lock(&s_mutex);
+    if (s_queued < (int)(sizeof(s_queue) / sizeof(s_queue[0])))
+    {
+        s_cancelled[s_queued] = false;
+        s_queue[s_queued++]   = transfer;
+        if (s_queued > s_max_queued)
+            s_max_queued = s_queued;
+        ret = LIBUSB_SUCCESS;
+    }
+    pthread_mutex_unlock(&s_mutex);
+    return ret;
+}
+
+int LIBUSB_CALL libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+    int i, ret = LIBUSB_ERROR_NOT_FOUND;
+
+    pthread_mutex_lock(&s_mutex);
+    for (i = 0; i < s_queued; i++)
+    {
+        if (s_queue[i] == transfer)
+        {
+            s_cancelled[i] = true;
+            ret = LIBUSB_SUCCESS;
+        }
+    }
+    pthread_mutex_unlock(&s_mutex);
+    return ret;
+}
+
+void LIBUSB_CALL libusb_lock_events(libusb_context *ctx)
+{
+    pthread_mutex_lock(&s_events);
+}
+
+void LIBUSB_CALL libusb_unlock_events(libusb_context *ctx)
+{
+    pthread_mutex_unlock(&s_events);
+}
+
+/*
+ * completes the submitted transfers in order, until one finds no data (it stays submitted until it is cancelled)
+ * or completed is set. The callbacks run with the event lock like in libusb.
+ */
+int LIBUSB_CALL libusb_handle_events_timeout_completed(libusb_context *ctx, struct timeval *tv, int *completed)
+{
+    struct libusb_transfer *xfer;
+    bool                    cancelled;
+    int                     ret;
+
+    pthread_mutex_lock(&s_events);
+    while ( (!completed) || (!*completed) )
+    {
+        pthread_mutex_lock(&s_mutex);
+        if (s_queued == 0)
+        {
+            pthread_mutex_unlock(&s_mutex);
+            break;
+        }
+        xfer      = s_queue[0];
+        cancelled = s_cancelled[0];
+        ret       = (cancelled) ? 0 : s_bulk_in(xfer->dev_handle, xfer->buffer, xfer->length);
+        if (ret >= 0)
+        {
+            s_queued--;
+            memmove(&s_queue[0], &s_queue[1], s_queued * sizeof(s_queue[0]));
+            memmove(&s_cancelled[0], &s_cancelled[1], s_queued * sizeof(s_cancelled[0]));
+        }
+        pthread_mutex_unlock(&s_mutex);
+        if (ret < 0)
+            break;
+
+        xfer->status        = (cancelled) ? LIBUSB_TRANSFER_CANCELLED : LIBUSB_TRANSFER_COMPLETED;
+        xfer->actual_length = ret;
+        s_async++;
+        xfer->callback(xfer); /* may submit the next transfer */
+    }
+    pthread_mutex_unlock(&s_events);
+    return LIBUSB_SUCCESS;
+}
+
+
+
+/**************************************************************************************************
+ * tests
+ **************************************************************************************************/
+
+/* one query, the response is read with the given buffer size until eom. Returns the response length or < 0 */
+static long query(int32_t devnum, const char *cmd, char *buf, uint32_t maxlen, uint32_t bufsize)
+{
+    int32_t ret;
+    long    len;
+    bool    eom = false;
+
+    ret = winusbtmc_send_string(devnum, cmd);
+    len = 0;
+    while ( (ret >= 0) && (!eom) && (len + maxlen <= bufsize) )
+    {
+        ret = winusbtmc_recv_data(devnum, &buf[len], maxlen, &eom);
+        if (ret >= 0)
+            len += ret;
+    }
+    return (ret < 0) ? ret : len;
+}
+
+/* the "DATA? n" response of the simulator: "#<digits><n>", n bytes of 0, 1, 2, ... and "\n" */
+static bool check_block(const char *buf, long len, uint32_t n)
+{
+    char     hdr[16];
+    int      hdrlen, digits;
+    uint32_t i;
+
+    digits = snprintf(hdr, sizeof(hdr), "%u", n);
+    hdrlen = snprintf(hdr, sizeof(hdr), "#%d%u", digits, n);
+    if ( (len != (long)(hdrlen + n + 1)) || (memcmp(buf, hdr, hdrlen) != 0) || (buf[len - 1] != '\n') )
+        return false;
+    for (i = 0; i < n; i++)
+    {
+        if ((uint8_t)buf[hdrlen + i] != (uint8_t)i)
+            return false;
+    }
+    return true;
+}
+
+int main(void)
+{
+    static char buf[TEST_BUFFER];
+    char        str[256];
+    int32_t     devnum;
+    long        len;
+
+    winusbtmc_init();
+
+    /* enumeration and descriptor strings */
+    CHECK(winusbtmc_get_device_count() >= TEST_DEVICES);
+    winusbtmc_get_device_string(0, str, sizeof(str));
+    CHECK(strcmp(str, "WinUsbTmc:Simulator:SIM0000") == 0);
+    winusbtmc_get_device_string(1, str, sizeof(str));
+    CHECK(strcmp(str, "WinUsbTmc:Simulator:SIM0001") == 0);
+    devnum = winusbtmc_find_devnum_by_string("WinUsbTmc:Simulator:SIM0001");
+    CHECK(devnum >= 0);
+
+    /* small response, synchronous transfers. The configuration is active already, so it is not set again */
+    len = query(devnum, "*IDN?", buf, 1024, TEST_BUFFER);
+    CHECK( (len == 32) && (memcmp(buf, "WinUsbTmc,Simulator,SIM0001,1.0\n", 32) == 0) );
+    CHECK(s_set_config == 0);
+    CHECK(s_async == 0);
+
+    /* large response, queued bulk-in transfers of 64 KB */
+    len = query(devnum, "DATA? 1000000", buf, TEST_BUFFER, TEST_BUFFER);
+    CHECK(check_block(buf, len, 1000000));
+    CHECK(s_max_queued == TEST_QUEUED);
+    CHECK(s_async >= 1000000 / (64 * 1024));
+    CHECK(s_queued == 0);
+
+    /* response longer than one read, the rest is read with further usbtmc transfers */
+    len = query(devnum, "DATA? 300000", buf, 100000, TEST_BUFFER);
+    CHECK(check_block(buf, len, 300000));
+    CHECK(s_queued == 0);
+
+    /* response which ends exactly at the end of a queued transfer */
+    len = query(devnum, "DATA? 131051", buf, TEST_BUFFER, TEST_BUFFER);
+    CHECK(check_block(buf, len, 131051));
+    CHECK(s_queued == 0);
+
+    /* a small response still works after the streamed ones */
+    len = query(0, "*IDN?", buf, TEST_BUFFER, TEST_BUFFER);
+    CHECK( (len == 32) && (memcmp(buf, "WinUsbTmc,Simulator,SIM0000,1.0\n", 32) == 0) );
+
+    /* deinit releases the libusb context, the next init creates a new one */
+    winusbtmc_deinit();
+    CHECK(s_contexts == 0);
+    winusbtmc_init();
+    CHECK(s_contexts == 1);
+    len = query(0, "*IDN?", buf, TEST_BUFFER, TEST_BUFFER);
+    CHECK( (len == 32) && (memcmp(buf, "WinUsbTmc,Simulator,SIM0000,1.0\n", 32) == 0) );
+    winusbtmc_deinit();
+    CHECK(s_contexts == 0);
+
+    printf("%s\n", (s_failed) ? "FAILED" : "ok");
+    return (s_failed) ? 1 : 0;
+}
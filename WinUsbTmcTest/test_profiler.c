@@ -0,0 +1,74 @@
+/*
+ * test of the command profiler (winusbtmc_profiler.c) against a simulated device (winusbtmc_simport.c).
+ * More distinct mnemonics are sent than the profiler keeps entries for, the rest must be counted as "(other)".
+ *
+ * usage: test_profiler, returns 0 if all checks passed
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../WinUsbTmc/winusbtmc.h"
+
+#define TEST_MNEMONICS (300)                /* distinct commands sent, the profiler keeps 255 */
+#define TEST_ENTRIES   (255)
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); s_failed++; } } while (0)
+
+static int s_failed = 0;
+
+/* command with a distinct mnemonic for every i, letters only (digits would become <n>) */
+static void command(int i, char *str, size_t size)
+{
+    snprintf(str, size, "TEST:%c%c%c 1", 'A' + i / 676, 'A' + i / 26 % 26, 'A' + i % 26);
+}
+
+int main(void)
+{
+    static winusbtmc_profile_entry_t entries[TEST_MNEMONICS];
+    char    str[64];
+    int32_t devnum, count, i, other, first;
+
+    winusbtmc_init();
+
+    devnum = winusbtmc_find_devnum_by_string("WinUsbTmc:Simulator:SIM0000");
+    CHECK(devnum >= 0);
+    if (devnum < 0)
+        return 1;
+    CHECK(winusbtmc_profile(devnum, true) == WINUSBTMC_ERR_NONE);
+
+    for (i = 0; i < TEST_MNEMONICS; i++)
+    {
+        command(i, str, sizeof(str));
+        CHECK(winusbtmc_send_string(devnum, str) >= 0);
+    }
+    /* a known mnemonic still gets its own entry when the table is full */
+    command(0, str, sizeof(str));
+    CHECK(winusbtmc_send_string(devnum, str) >= 0);
+    command(TEST_MNEMONICS - 1, str, sizeof(str));
+    CHECK(winusbtmc_send_string(devnum, str) >= 0);
+
+    count = winusbtmc_profile_report(devnum, entries, TEST_MNEMONICS);
+    CHECK(count == TEST_ENTRIES + 1);
+    other = -1;
+    first = -1;
+    command(0, str, sizeof(str));
+    *strchr(str, ' ') = '\0';
+    for (i = 0; (i < count) && (i < TEST_MNEMONICS); i++)
+    {
+        if (strcmp(entries[i].mnemonic, "(other)") == 0)
+            other = i;
+        if (strcmp(entries[i].mnemonic, str) == 0)
+            first = i;
+    }
+    CHECK(other >= 0);
+    if (other >= 0)
+        CHECK(entries[other].count == TEST_MNEMONICS - TEST_ENTRIES + 1);
+    CHECK( (first >= 0) && (entries[first].count == 2) );
+
+    winusbtmc_deinit();
+
+    printf("%s\n", (s_failed) ? "FAILED" : "ok");
+    return (s_failed) ? 1 : 0;
+}
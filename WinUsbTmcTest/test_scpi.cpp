@@ -0,0 +1,128 @@
+/*
+ * test of the SCPI command templates (winusbtmc_scpi.hpp) against the simulated devices (winusbtmc_simport.c).
+ * The formatting of every value type is checked with format, send is checked with a query of the simulator whose
+ * response length depends on the formatted value.
+ *
+ * Built with -DSCPI_NEGATIVE=<n> the file must not compile, run_tests.sh builds every case of the list below and
+ * checks that the compiler rejects it:
+ *   1  field without closing bracket       5  char value
+ *   2  closing bracket without field       6  integer of more than 64 bits
+ *   3  too few values                      7  pointer which is no string
+ *   4  too many values
+ *
+ * usage: test_scpi, returns 0 if all checks passed
+ */
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+#include <string_view>
+#include "../WinUsbTmc/winusbtmc_scpi.hpp"
+
+#define CHECK(cond) do { if (!(cond)) { std::printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); s_failed++; } } while (0)
+
+static int s_failed = 0;
+
+static constexpr winusbtmc::scpi_command idn("*IDN?");
+static constexpr winusbtmc::scpi_command sour_volt("SOUR<n>:VOLT <value>");
+static constexpr winusbtmc::scpi_command data("DATA? <n>");
+static constexpr winusbtmc::scpi_command disp("DISP:TEXT \"<text>\",<on>");
+
+static_assert(idn.fields == 0 && idn.text_len == 5);
+static_assert(sour_volt.fields == 2 && sour_volt.text_len == 10);
+
+#if SCPI_NEGATIVE == 1
+static constexpr winusbtmc::scpi_command broken("SOUR1:VOLT <value");
+#elif SCPI_NEGATIVE == 2
+static constexpr winusbtmc::scpi_command broken("SOUR1:VOLT> 1");
+#endif
+
+/* the command with values as a string, "" if format failed */
+template <const winusbtmc::scpi_command &C, typename... Args>
+static std::string_view formatted(char *buf, std::size_t size, const Args &... values)
+{
+    int32_t len = winusbtmc::format<C>(buf, size, values...);
+
+    return (len < 0) ? std::string_view() : std::string_view(buf, len);
+}
+
+static void test_format(void)
+{
+    char buf[128];
+
+    CHECK(formatted<idn>(buf, sizeof(buf)) == "*IDN?");
+    CHECK(formatted<sour_volt>(buf, sizeof(buf), 1, 2.5) == "SOUR1:VOLT 2.5");
+    CHECK(formatted<sour_volt>(buf, sizeof(buf), 2, 0.1) == "SOUR2:VOLT 0.1");
+    CHECK(formatted<sour_volt>(buf, sizeof(buf), -3, -1e-9) == "SOUR-3:VOLT -1e-09");
+    CHECK(formatted<sour_volt>(buf, sizeof(buf), 1, HUGE_VAL) == "SOUR1:VOLT 9.9E37");
+    CHECK(formatted<sour_volt>(buf, sizeof(buf), 1, -HUGE_VAL) == "SOUR1:VOLT -9.9E37");
+    CHECK(formatted<sour_volt>(buf, sizeof(buf), 1, NAN) == "SOUR1:VOLT 9.91E37");
+    CHECK(formatted<sour_volt>(buf, sizeof(buf), 1, 1.5f) == "SOUR1:VOLT 1.5");
+
+    /* every integer type up to 64 bits, int8_t / uint8_t are numbers */
+    CHECK(formatted<data>(buf, sizeof(buf), (int8_t)-128) == "DATA? -128");
+    CHECK(formatted<data>(buf, sizeof(buf), (uint8_t)255) == "DATA? 255");
+    CHECK(formatted<data>(buf, sizeof(buf), (uint16_t)65535) == "DATA? 65535");
+    CHECK(formatted<data>(buf, sizeof(buf), INT64_MIN) == "DATA? -9223372036854775808");
+    CHECK(formatted<data>(buf, sizeof(buf), UINT64_MAX) == "DATA? 18446744073709551615");
+
+    CHECK(formatted<disp>(buf, sizeof(buf), "Hello", true) == "DISP:TEXT \"Hello\",1");
+    CHECK(formatted<disp>(buf, sizeof(buf), std::string_view("abc", 2), false) == "DISP:TEXT \"ab\",0");
+
+    /* the buffer must hold the max. length, not only the result */
+    CHECK(winusbtmc::max_length<data>(INT64_MIN) == 26);
+    CHECK(winusbtmc::format<data>(buf, 25, 1) < 0);
+    CHECK(winusbtmc::format<data>(buf, 26, 1) == 7);
+
+#if SCPI_NEGATIVE == 3
+    winusbtmc::format<sour_volt>(buf, sizeof(buf), 1);
+#elif SCPI_NEGATIVE == 4
+    winusbtmc::format<sour_volt>(buf, sizeof(buf), 1, 2.5, 3);
+#elif SCPI_NEGATIVE == 5
+    winusbtmc::format<data>(buf, sizeof(buf), 'A');
+#elif SCPI_NEGATIVE == 6
+    winusbtmc::format<data>(buf, sizeof(buf), (__int128)1 << 100);
+#elif SCPI_NEGATIVE == 7
+    winusbtmc::format<data>(buf, sizeof(buf), &s_failed);
+#endif
+}
+
+/* send formats into the transfer buffer, the simulator answers "DATA? n" with a block of n bytes */
+static void test_send(void)
+{
+    static char buf[1024 * 1024 + 64];
+    int32_t     devnum, ret;
+    long        len;
+    bool        eom;
+
+    devnum = winusbtmc_find_devnum_by_string("WinUsbTmc:Simulator:SIM0000");
+    CHECK(devnum >= 0);
+    if (devnum < 0)
+        return;
+
+    CHECK(winusbtmc::send<sour_volt>(devnum, 1, 2.5) >= 0);
+    CHECK(winusbtmc::send<data>(devnum, 123456u) >= 0);
+    len = 0;
+    eom = false;
+    ret = 0;
+    while ( (ret >= 0) && (!eom) )
+    {
+        ret = winusbtmc_recv_data(devnum, buf, sizeof(buf), &eom);
+        if (ret > 0)
+            len += ret;
+    }
+    CHECK( (ret >= 0) && (len == 8 + 123456 + 1) ); /* "#6123456" data 0x0a */
+}
+
+int main(void)
+{
+    winusbtmc_init();
+
+    test_format();
+    test_send();
+
+    winusbtmc_deinit();
+
+    std::printf("%s\n", (s_failed) ? "FAILED" : "ok");
+    return (s_failed) ? 1 : 0;
+}
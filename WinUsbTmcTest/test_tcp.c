@@ -0,0 +1,294 @@
+/*
+ * test of the raw socket SCPI transport (winusbtmc_tcp.c) against a stand-in instrument on the loopback interface.
+ * The stand-in listens on an ephemeral port of 127.0.0.1 (and ::1 if IPv6 is available) and sends its responses in
+ * small pieces with pauses in between, so they arrive in several recv calls: block headers split after '#' and
+ * inside the length, block data with 0x0a bytes and quotes in it, and a response cut off by closing the connection.
+ *
+ * Queries of the stand-in:
+ *   *IDN?          => "WinUsbTmc,Loopback,0,1.0"
+ *   DATA? <n>      => IEEE 488.2 definite length block with n bytes of data (i * 7 & 0xff)
+ *   STR?           => "\"a\nb\",1" (a quoted 0x0a is no terminator)
+ *   CUT?           => "+1.0" and the connection is closed without terminator
+ *
+ * usage: test_tcp, returns 0 if all checks passed
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../WinUsbTmc/winusbtmc.h"
+
+#define TEST_BUFFER   (1024 * 1024)
+#define TEST_PAUSE_US (20000)               /* between the pieces of a response */
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); s_failed++; } } while (0)
+
+static int s_failed = 0;
+
+
+
+/**************************************************************************************************
+ * stand-in instrument
+ **************************************************************************************************/
+
+/* sends a piece of a response and waits, so the next piece arrives in another recv of the client */
+static void send_piece(int sock, const char *dat, size_t len)
+{
+    ssize_t ret;
+
+    while (len > 0)
+    {
+        ret = send(sock, dat, len, MSG_NOSIGNAL);
+        if (ret <= 0)
+            return;
+        dat += ret;
+        len -= ret;
+    }
+    usleep(TEST_PAUSE_US);
+}
+
+static void answer(int sock, const char *cmd)
+{
+    static char dat[TEST_BUFFER];
+    char        hdr[16];
+    uint32_t    n, i;
+    int         hdrlen;
+
+    if (strcmp(cmd, "*IDN?") == 0)
+    {
+        send_piece(sock, "WinUsbTmc,Loop", 14);
+        send_piece(sock, "back,0,1.0\n", 11);
+    }
+    else if (strncmp(cmd, "DATA? ", 6) == 0)
+    {
+        n = strtoul(&cmd[6], (void *)0, 10);
+        if (n > TEST_BUFFER)
+            n = TEST_BUFFER;
+        hdrlen = snprintf(hdr, sizeof(hdr), "%u", n);
+        hdrlen = snprintf(hdr, sizeof(hdr), "#%d%u", hdrlen, n);
+        for (i = 0; i < n; i++)
+            dat[i] = (char)(i * 7);      /* contains 0x0a, '"' and '#' */
+        send_piece(sock, hdr, 1);        /* "#" */
+        send_piece(sock, &hdr[1], 2);    /* digit count and the first digit of the length */
+        send_piece(sock, &hdr[3], hdrlen - 3);
+        for (i = 0; i < n; i += 30000)
+            send_piece(sock, &dat[i], (n - i < 30000) ? n - i : 30000);
+        send_piece(sock, "\n", 1);
+    }
+    else if (strcmp(cmd, "STR?") == 0)
+    {
+        send_piece(sock, "\"a\n", 3);
+        send_piece(sock, "b\",1\n", 5);
+    }
+    else if (strcmp(cmd, "CUT?") == 0)
+    {
+        send_piece(sock, "+1.0", 4);
+        shutdown(sock, SHUT_RDWR);
+    }
+}
+
+/* serves the connections of a listening socket one after the other, runs until the test ends */
+static void *responder(void *arg)
+{
+    int     listener = (int)(intptr_t)arg;
+    int     sock, nodelay;
+    char    cmd[256];
+    size_t  len;
+    ssize_t ret;
+
+    for (;;)
+    {
+        sock = accept(listener, (void *)0, (void *)0);
+        if (sock < 0)
+            return (void *)0;
+        nodelay = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        len = 0;
+        while ((ret = recv(sock, &cmd[len], sizeof(cmd) - 1 - len, 0)) > 0)
+        {
+            len += ret;
+            cmd[len] = '\0';
+            while (strchr(cmd, '\n'))
+            {
+                *strchr(cmd, '\n') = '\0';
+                answer(sock, cmd);
+                len -= strlen(cmd) + 1;
+                memmove(cmd, &cmd[strlen(cmd) + 1], len + 1);
+            }
+            if (len == sizeof(cmd) - 1)
+                len = 0;
+        }
+        close(sock);
+    }
+}
+
+/* starts a stand-in on the loopback address of family, returns its port or 0 if not possible */
+static int start_responder(int family)
+{
+    struct sockaddr_storage addr;
+    socklen_t               addrlen;
+    pthread_t               thread;
+    int                     listener;
+
+    memset(&addr, 0, sizeof(addr));
+    if (family == AF_INET6)
+    {
+        ((struct sockaddr_in6 *)&addr)->sin6_family = AF_INET6;
+        ((struct sockaddr_in6 *)&addr)->sin6_addr   = in6addr_loopback;
+        addrlen = sizeof(struct sockaddr_in6);
+    }
+    else
+    {
+        ((struct sockaddr_in *)&addr)->sin_family      = AF_INET;
+        ((struct sockaddr_in *)&addr)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addrlen = sizeof(struct sockaddr_in);
+    }
+
+    listener = socket(family, SOCK_STREAM, 0);
+    if (listener < 0)
+        return 0;
+    if ( (bind(listener, (struct sockaddr *)&addr, addrlen) < 0) || (listen(listener, 4) < 0) ||
+         (getsockname(listener, (struct sockaddr *)&addr, &addrlen) < 0) ||
+         (pthread_create(&thread, (void *)0, responder, (void *)(intptr_t)listener) != 0) )
+    {
+        close(listener);
+        return 0;
+    }
+    pthread_detach(thread);
+    return ntohs((family == AF_INET6) ? ((struct sockaddr_in6 *)&addr)->sin6_port : ((struct sockaddr_in *)&addr)->sin_port);
+}
+
+
+
+/**************************************************************************************************
+ * tests
+ **************************************************************************************************/
+
+/* one query, the response is read in parts of up to maxlen bytes until eom. Returns the response length or < 0 */
+static long query(int32_t devnum, const char *cmd, char *buf, uint32_t maxlen, int *reads)
+{
+    int32_t ret;
+    long    len;
+    bool    eom = false;
+
+    *reads = 0;
+    ret = winusbtmc_send_string(devnum, cmd);
+    len = 0;
+    while ( (ret >= 0) && (!eom) && (len + maxlen <= TEST_BUFFER + 64) )
+    {
+        ret = winusbtmc_recv_data(devnum, &buf[len], maxlen, &eom);
+        if (ret >= 0)
+            len += ret;
+        (*reads)++;
+    }
+    return (ret < 0) ? ret : len;
+}
+
+static bool check_block(const char *buf, long len, uint32_t n)
+{
+    char     hdr[16];
+    int      hdrlen;
+    uint32_t i;
+
+    hdrlen = snprintf(hdr, sizeof(hdr), "%u", n);
+    hdrlen = snprintf(hdr, sizeof(hdr), "#%d%u", hdrlen, n);
+    if ( (len != (long)(hdrlen + n + 1)) || (memcmp(buf, hdr, hdrlen) != 0) || (buf[len - 1] != '\n') )
+        return false;
+    for (i = 0; i < n; i++)
+    {
+        if (buf[hdrlen + i] != (char)(i * 7))
+            return false;
+    }
+    return true;
+}
+
+/* all queries against the stand-in at address */
+static void test_address(const char *address)
+{
+    static char buf[TEST_BUFFER + 64];
+    char        str[256];
+    int32_t     devnum, ret;
+    long        len;
+    int         reads;
+    bool        eom;
+
+    devnum = winusbtmc_find_devnum_by_string(address);
+    CHECK(devnum >= 0);
+    if (devnum < 0)
+        return;
+    winusbtmc_get_device_string(devnum, str, sizeof(str));
+    CHECK(strcmp(str, address) == 0);
+
+    /* response split between two recv calls */
+    len = query(devnum, "*IDN?", buf, 1024, &reads);
+    CHECK( (len == 25) && (memcmp(buf, "WinUsbTmc,Loopback,0,1.0\n", 25) == 0) );
+    CHECK(reads == 1);
+
+    /* block with split header, 0x0a in the data and data split across many recv calls, read at once */
+    len = query(devnum, "DATA? 100000", buf, TEST_BUFFER + 64, &reads);
+    CHECK(check_block(buf, len, 100000));
+    CHECK(reads == 1);
+
+    /* the same block read in small parts */
+    len = query(devnum, "DATA? 100000", buf, 1000, &reads);
+    CHECK(check_block(buf, len, 100000));
+    CHECK(reads > 100);
+
+    /* a response which was not read is discarded by the next command, once it arrived completely */
+    CHECK(winusbtmc_send_string(devnum, "*IDN?") >= 0);
+    usleep(5 * TEST_PAUSE_US);
+    len = query(devnum, "STR?", buf, 1024, &reads);
+    CHECK( (len == 8) && (memcmp(buf, "\"a\nb\",1\n", 8) == 0) );
+
+    /* quoted 0x0a */
+    len = query(devnum, "STR?", buf, 1024, &reads);
+    CHECK( (len == 8) && (memcmp(buf, "\"a\nb\",1\n", 8) == 0) );
+
+    /* the part received before the connection was closed is returned, the error with the next read */
+    ret = winusbtmc_send_string(devnum, "CUT?");
+    CHECK(ret >= 0);
+    eom = true;
+    ret = winusbtmc_recv_data(devnum, buf, 1024, &eom);
+    CHECK( (ret == 4) && (memcmp(buf, "+1.0", 4) == 0) && (!eom) );
+    ret = winusbtmc_recv_data(devnum, buf, 1024, &eom);
+    CHECK(ret == WINUSBTMC_ERR_BULKIN_FAILED);
+}
+
+int main(void)
+{
+    char address[64];
+    int  port;
+
+    winusbtmc_init();
+
+    port = start_responder(AF_INET);
+    CHECK(port > 0);
+    snprintf(address, sizeof(address), "TCPIP::127.0.0.1::%d", port);
+    test_address(address);
+
+    port = start_responder(AF_INET6);
+    if (port > 0)
+    {
+        snprintf(address, sizeof(address), "TCPIP::[::1]::%d", port);
+        test_address(address);
+    }
+    else
+    {
+        printf("no IPv6 loopback, skipped\n");
+    }
+
+    /* unterminated brackets are no tcp address */
+    CHECK(winusbtmc_find_devnum_by_string("TCPIP::[::1::5025") < 0);
+
+    winusbtmc_deinit();
+
+    printf("%s\n", (s_failed) ? "FAILED" : "ok");
+    return (s_failed) ? 1 : 0;
+}